@@ -0,0 +1,123 @@
+/*------------------------------------------------------------------------------
+ *! \file   adaptive.c
+ *! \brief  Adaptive read intervals, pins are read more often while their
+ *          readings are changing and less often while they are stable.
+ *
+ *  Each valid reading is compared with the one before, and the larger of the
+ *  temperature and humidity changes, measured in bands, is smoothed over the
+ *  recent reads. While that is above one band per read the interval is
+ *  halved, down to the shortest allowed, and while it is under half a band
+ *  the interval grows by half, up to the longest. The interval so settles
+ *  where each read sees about a band of change: a stable room is left alone
+ *  and a changing one is followed closely, for the fewest reads, and the
+ *  least sensor self-heating, overall.
+ *------------------------------------------------------------------------------
+ *                   Kris Dunning ippie52@gmail.com 2016.
+ *------------------------------------------------------------------------------
+ */
+
+#include <string.h>
+
+#include "adaptive.h"
+
+/*******************************************************************************
+ *  \brief  Gets the size of the change between two values.
+ *  \return The absolute difference.
+ */
+static float change
+(
+    const float from,   /*!< - The previous value   */
+    const float to      /*!< - The new value        */
+)
+{
+    return (to > from) ? to - from : from - to;
+}
+
+/*******************************************************************************
+ *  \brief  Sets up a pin's adaptive interval, starting at the shortest so a
+ *          new pin is followed closely until it is known to be stable. The
+ *          last valid reading in the pin's statistics is used as the first to
+ *          compare with if it is recent enough. The interval is fixed if the
+ *          longest is not above the shortest.
+ */
+void adaptive_init
+(
+    AdaptiveState *state,       /*!<OUT - The state to set up               */
+    const int min_interval,     /*!<IN  - The shortest interval, seconds    */
+    const int max_interval,     /*!<IN  - The longest interval, seconds     */
+    const float temperature,    /*!<IN  - The temperature band, *C          */
+    const float humidity,       /*!<IN  - The humidity band, %              */
+    const PinStats *stats       /*!<IN  - The pin's history                 */
+)
+{
+    memset(state, 0, sizeof(*state));
+    state->min_interval = min_interval;
+    state->max_interval = max_interval;
+    state->temperature_band = temperature;
+    state->humidity_band = humidity;
+    state->enabled = (max_interval > min_interval) && temperature > 0.0f &&
+        humidity > 0.0f;
+    state->interval = min_interval;
+    state->last = (SensorValues)INVALID_VALUES;
+
+    if (0 != stats->last_time && RESULT_OK == stats->last.result &&
+        time(NULL) - stats->last_time <= (time_t)max_interval)
+    {
+        state->last = stats->last;
+        state->last_time = stats->last_time;
+    }
+}
+
+/*******************************************************************************
+ *  \brief  Takes a reading into account and works out when to read next.
+ *          Failed reads do not change the interval.
+ *  \return The interval until the next read, seconds.
+ */
+int adaptive_update
+(
+    AdaptiveState *state,       /*!<INOUT - The pin's adaptive state    */
+    const SensorReport *report  /*!<IN    - The reading just made       */
+)
+{
+    const SensorValues *values = &report->values;
+    float moved;
+
+    if (!state->enabled || RESULT_OK != values->result)
+    {
+        return state->interval;
+    }
+    if (RESULT_OK != state->last.result)
+    {
+        state->last = *values;
+        state->last_time = report->timestamp.tv_sec;
+        return state->interval;
+    }
+
+    moved = change(state->last.temperature, values->temperature) /
+        state->temperature_band;
+    if (change(state->last.humidity, values->humidity) / state->humidity_band > moved)
+    {
+        moved = change(state->last.humidity, values->humidity) / state->humidity_band;
+    }
+    state->activity = 0.5f * state->activity + 0.5f * moved;
+    state->last = *values;
+    state->last_time = report->timestamp.tv_sec;
+
+    if (state->activity > 1.0f)
+    {
+        state->interval /= 2;
+        if (state->interval < state->min_interval)
+        {
+            state->interval = state->min_interval;
+        }
+    }
+    else if (state->activity < 0.5f)
+    {
+        state->interval += (state->interval > 1) ? state->interval / 2 : 1;
+        if (state->interval > state->max_interval)
+        {
+            state->interval = state->max_interval;
+        }
+    }
+    return state->interval;
+}
@@ -0,0 +1,38 @@
+/*------------------------------------------------------------------------------
+ *! \file   adaptive.h
+ *! \brief  Adaptive read intervals, pins are read more often while their
+ *          readings are changing and less often while they are stable.
+ *------------------------------------------------------------------------------
+ *                   Kris Dunning ippie52@gmail.com 2016.
+ *------------------------------------------------------------------------------
+ */
+#pragma once
+
+#include <time.h>
+
+#include "output.h"
+#include "stats.h"
+
+#define DEFAULT_ADAPT_TEMPERATURE   0.2f
+#define DEFAULT_ADAPT_HUMIDITY      1.0f
+
+/******************************************************************************/
+/** A pin's read interval and the recent changes it is based on
+ */
+typedef struct AdaptiveStates
+{
+    int min_interval;               /*!< The shortest interval, seconds         */
+    int max_interval;               /*!< The longest interval, seconds          */
+    float temperature_band;         /*!< Change per read counted as moving, *C  */
+    float humidity_band;            /*!< Change per read counted as moving, %   */
+    int enabled;                    /*!< Zero to keep the shortest interval     */
+    int interval;                   /*!< The interval until the next read       */
+    float activity;                 /*!< Smoothed change per read, in bands     */
+    SensorValues last;              /*!< The last valid values                  */
+    time_t last_time;               /*!< When last was read, zero if never      */
+} AdaptiveState;
+
+void adaptive_init(AdaptiveState *state, const int min_interval,
+    const int max_interval, const float temperature, const float humidity,
+    const PinStats *stats);
+int adaptive_update(AdaptiveState *state, const SensorReport *report);
@@ -0,0 +1,1055 @@
+/*------------------------------------------------------------------------------
+ *! \file   aggregator.c
+ *! \brief  kdht-aggregator, collects the reading streams from many kdht nodes.
+ *
+ *  Each connection carries one node's readings in time order (see stream.c).
+ *  The connections are merged by timestamp with a k-way heap: a reading is
+ *  released once every connection has something queued, or once it is older
+ *  than the maximum delay. Retransmitted readings are dropped, and the rest
+ *  are passed to shard threads, chosen by sensor, which keep the rollups and
+ *  percentile sketches.
+ *------------------------------------------------------------------------------
+ *                   Kris Dunning ippie52@gmail.com 2016.
+ *------------------------------------------------------------------------------
+ */
+
+#include <sys/socket.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <getopt.h>
+#include <errno.h>
+#include <float.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "output.h"
+#include "stream.h"
+#include "config.h"
+
+#define MAX_LISTENERS           4
+#define MAX_CONNECTIONS         512
+#define MAX_SHARDS              16
+#define MAX_NODE_LENGTH         32U
+#define LINE_BUFFER_LENGTH      4096U
+#define CONNECTION_QUEUE_LENGTH 1024U
+#define SHARD_QUEUE_LENGTH      8192U
+#define SENSOR_TABLE_LENGTH     8192U
+
+#define DEFAULT_MAX_DELAY_MS    2000L
+#define DEFAULT_INTERVAL        10
+
+/* Sketch bins, in tenths: -40.0 to 80.0 *C and 0.0 to 100.0 % */
+#define TEMPERATURE_MIN_TENTHS  (-400)
+#define TEMPERATURE_BINS        1201
+#define HUMIDITY_BINS           1001
+
+/******************************************************************************/
+/** A single reading from a node
+ */
+typedef struct Readings
+{
+    char node[MAX_NODE_LENGTH];     /*!< The node the reading came from     */
+    int pin;                        /*!< The sensor pin on that node        */
+    long long timestamp;            /*!< When it was read, in ms            */
+    SensorReadingResults result;    /*!< The read result                    */
+    int attempts;                   /*!< The attempts made                  */
+    long latency_us;                /*!< The read latency                   */
+    float humidity;                 /*!< Humidity, valid when result is OK  */
+    float temperature;              /*!< Temperature, valid when OK         */
+    unsigned int hash;              /*!< Hash of node and pin               */
+} Reading;
+
+/******************************************************************************/
+/** A node connection and the readings waiting to be merged
+ */
+typedef struct Connections
+{
+    int fd;                                 /*!< The socket                 */
+    char buffer[LINE_BUFFER_LENGTH];        /*!< Partial line received      */
+    size_t used;                            /*!< Bytes in the buffer        */
+    Reading queue[CONNECTION_QUEUE_LENGTH]; /*!< Readings waiting           */
+    unsigned int head;                      /*!< Next to write              */
+    unsigned int tail;                      /*!< Next to merge              */
+    int closing;                            /*!< Set once the peer is gone  */
+} Connection;
+
+/******************************************************************************/
+/** A percentile sketch over fixed 0.1 wide bins
+ */
+typedef struct Sketches
+{
+    unsigned int *bins;     /*!< The bin counts                     */
+    int count;              /*!< The number of bins                 */
+    int offset;             /*!< The value, in tenths, of bin 0     */
+} Sketch;
+
+/******************************************************************************/
+/** Everything known about one sensor, owned by a single shard
+ */
+typedef struct SensorRollups
+{
+    char node[MAX_NODE_LENGTH];         /*!< The node name                  */
+    int pin;                            /*!< The sensor pin                 */
+    unsigned long results[RESULT_COUNT];/*!< Readings by result             */
+    unsigned long attempts;             /*!< All attempts made              */
+    double temperature_sum;             /*!< Sum of valid temperatures      */
+    double humidity_sum;                /*!< Sum of valid humidities        */
+    float temperature_min;              /*!< Lowest valid temperature       */
+    float temperature_max;              /*!< Highest valid temperature      */
+    float humidity_min;                 /*!< Lowest valid humidity          */
+    float humidity_max;                 /*!< Highest valid humidity         */
+    Reading last;                       /*!< The last valid reading         */
+    unsigned int temperature_bins[TEMPERATURE_BINS]; /*!< Temperature sketch */
+    unsigned int humidity_bins[HUMIDITY_BINS];       /*!< Humidity sketch    */
+} SensorRollup;
+
+/******************************************************************************/
+/** A shard thread, its queue and the sensors it owns
+ */
+typedef struct Shards
+{
+    pthread_t thread;                       /*!< The shard thread           */
+    pthread_mutex_t lock;                   /*!< Guards everything below    */
+    pthread_cond_t ready;                   /*!< Signalled on new readings  */
+    pthread_cond_t space;                   /*!< Signalled on free space    */
+    Reading queue[SHARD_QUEUE_LENGTH];      /*!< Readings to apply          */
+    unsigned int head;                      /*!< Next to write              */
+    unsigned int tail;                      /*!< Next to apply              */
+    int stopping;                           /*!< Set to stop the thread     */
+    SensorRollup *sensors[SENSOR_TABLE_LENGTH]; /*!< Open addressed table   */
+    unsigned int sensor_count;              /*!< Sensors owned              */
+} Shard;
+
+/******************************************************************************/
+/** Last timestamp seen per sensor, used to drop retransmits
+ */
+typedef struct SeenEntries
+{
+    char node[MAX_NODE_LENGTH];     /*!< The node name, empty if unused     */
+    int pin;                        /*!< The sensor pin                     */
+    long long timestamp;            /*!< The newest timestamp seen          */
+} SeenEntry;
+
+static volatile sig_atomic_t running = 1;
+static Connection *connections[MAX_CONNECTIONS];
+static int connection_count = 0;
+static int heap[MAX_CONNECTIONS];
+static int heap_size = 0;
+static Shard *shards = NULL;
+static int shard_count = 1;
+static SeenEntry seen[SENSOR_TABLE_LENGTH * 4];
+static unsigned long merged_count = 0;
+static unsigned long duplicate_count = 0;
+static unsigned long invalid_count = 0;
+static int print_merged = 0;
+
+/*******************************************************************************
+ *  \brief  Stops the main loop on SIGINT or SIGTERM.
+ */
+static void handle_signal
+(
+    int signal_number   /*!< - The signal received  */
+)
+{
+    (void)signal_number;
+    running = 0;
+}
+
+/*******************************************************************************
+ *  \brief  Gets the wall clock time in milliseconds.
+ *  \return The time in milliseconds since the epoch.
+ */
+static long long now_ms(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (long long)now.tv_sec * 1000LL + now.tv_nsec / 1000000L;
+}
+
+/*******************************************************************************
+ *  \brief  Hashes a node name and pin (FNV-1a).
+ *  \return The hash.
+ */
+static unsigned int hash_sensor
+(
+    const char *node,   /*!< - The node name    */
+    const int pin       /*!< - The sensor pin   */
+)
+{
+    unsigned int hash = 2166136261U;
+    while (*node)
+    {
+        hash = (hash ^ (unsigned char)*node++) * 16777619U;
+    }
+    return (hash ^ (unsigned int)pin) * 16777619U;
+}
+
+/*******************************************************************************
+ *  \brief  Parses a stream line, see stream.c for the layout.
+ *  \return Zero if the line is not valid, otherwise 1.
+ */
+static int parse_line
+(
+    char *line,         /*!<IN  - The line, modified in place   */
+    Reading *reading    /*!<OUT - The reading parsed            */
+)
+{
+    char *fields[8];
+    int count = 0;
+    int result;
+    char *field = line;
+
+    while (count < 8)
+    {
+        char *comma = strchr(field, ',');
+        fields[count++] = field;
+        if (NULL == comma)
+        {
+            break;
+        }
+        *comma = '\0';
+        field = comma + 1;
+    }
+    if (8 != count || 0 == fields[0][0] || strlen(fields[0]) >= MAX_NODE_LENGTH)
+    {
+        return 0;
+    }
+
+    memset(reading, 0, sizeof(*reading));
+    snprintf(reading->node, sizeof(reading->node), "%s", fields[0]);
+    reading->timestamp = atoll(fields[1]);
+    reading->pin = atoi(fields[2]);
+    reading->result = RESULT_INVALID;
+    for (result = RESULT_OK; result < RESULT_COUNT; ++result)
+    {
+        if (0 == strcmp(fields[3], get_result_name((SensorReadingResults)result)))
+        {
+            reading->result = (SensorReadingResults)result;
+        }
+    }
+    reading->attempts = atoi(fields[4]);
+    reading->latency_us = atol(fields[5]);
+    if (RESULT_OK == reading->result)
+    {
+        if (0 == fields[6][0] || 0 == fields[7][0])
+        {
+            return 0;
+        }
+        reading->humidity = strtof(fields[6], NULL);
+        reading->temperature = strtof(fields[7], NULL);
+    }
+    reading->hash = hash_sensor(reading->node, reading->pin);
+    return 1;
+}
+
+/*******************************************************************************
+ *  \brief  Gets the timestamp of the next reading a connection would merge.
+ *  \return The timestamp in milliseconds.
+ */
+static long long front_timestamp
+(
+    const int index     /*!< - The connection index */
+)
+{
+    const Connection *connection = connections[index];
+    return connection->queue[connection->tail % CONNECTION_QUEUE_LENGTH].timestamp;
+}
+
+/*******************************************************************************
+ *  \brief  Restores the heap order upwards from a position.
+ */
+static void heap_up
+(
+    int position    /*!< - The heap position to sift    */
+)
+{
+    while (position > 0)
+    {
+        int parent = (position - 1) / 2;
+        int swap;
+        if (front_timestamp(heap[parent]) <= front_timestamp(heap[position]))
+        {
+            break;
+        }
+        swap = heap[parent];
+        heap[parent] = heap[position];
+        heap[position] = swap;
+        position = parent;
+    }
+}
+
+/*******************************************************************************
+ *  \brief  Restores the heap order downwards from a position.
+ */
+static void heap_down
+(
+    int position    /*!< - The heap position to sift    */
+)
+{
+    for (;;)
+    {
+        int smallest = position;
+        int left = 2 * position + 1;
+        int right = left + 1;
+        int swap;
+        if (left < heap_size &&
+            front_timestamp(heap[left]) < front_timestamp(heap[smallest]))
+        {
+            smallest = left;
+        }
+        if (right < heap_size &&
+            front_timestamp(heap[right]) < front_timestamp(heap[smallest]))
+        {
+            smallest = right;
+        }
+        if (smallest == position)
+        {
+            break;
+        }
+        swap = heap[smallest];
+        heap[smallest] = heap[position];
+        heap[position] = swap;
+        position = smallest;
+    }
+}
+
+/*******************************************************************************
+ *  \brief  Checks whether the reading is newer than anything seen for its
+ *          sensor, remembering it if so.
+ *  \return Zero for a retransmit (or an out of order reading), otherwise 1.
+ */
+static int first_sighting
+(
+    const Reading *reading  /*!< - The reading to check */
+)
+{
+    const unsigned int length = sizeof(seen) / sizeof(seen[0]);
+    unsigned int slot = reading->hash % length;
+    unsigned int probes;
+    for (probes = 0; probes < length; ++probes, slot = (slot + 1) % length)
+    {
+        SeenEntry *entry = &seen[slot];
+        if (0 == entry->node[0])
+        {
+            memcpy(entry->node, reading->node, sizeof(entry->node));
+            entry->pin = reading->pin;
+            entry->timestamp = reading->timestamp;
+            return 1;
+        }
+        if (entry->pin == reading->pin && 0 == strcmp(entry->node, reading->node))
+        {
+            if (reading->timestamp <= entry->timestamp)
+            {
+                return 0;
+            }
+            entry->timestamp = reading->timestamp;
+            return 1;
+        }
+    }
+    /* Table full, better to let a duplicate through than lose a reading */
+    return 1;
+}
+
+/*******************************************************************************
+ *  \brief  Passes a merged reading to the shard owning its sensor, waiting if
+ *          that shard is behind.
+ */
+static void dispatch
+(
+    const Reading *reading  /*!< - The reading to pass on   */
+)
+{
+    Shard *shard = &shards[reading->hash % (unsigned int)shard_count];
+    pthread_mutex_lock(&shard->lock);
+    while (shard->head - shard->tail >= SHARD_QUEUE_LENGTH)
+    {
+        pthread_cond_wait(&shard->space, &shard->lock);
+    }
+    shard->queue[shard->head % SHARD_QUEUE_LENGTH] = *reading;
+    ++shard->head;
+    pthread_cond_signal(&shard->ready);
+    pthread_mutex_unlock(&shard->lock);
+}
+
+/*******************************************************************************
+ *  \brief  Releases the oldest reading queued, the front of the heap top.
+ *          The heap must not be empty.
+ */
+static void release_front(void)
+{
+    Connection *connection = connections[heap[0]];
+    const Reading *reading = &connection->queue[connection->tail % CONNECTION_QUEUE_LENGTH];
+
+    if (first_sighting(reading))
+    {
+        ++merged_count;
+        if (print_merged)
+        {
+            printf("%s,%lld,%d,%s,%d,%ld,", reading->node, reading->timestamp,
+                reading->pin, get_result_name(reading->result),
+                reading->attempts, reading->latency_us);
+            if (RESULT_OK == reading->result)
+            {
+                printf("%.1f,%.1f\n", reading->humidity, reading->temperature);
+            }
+            else
+            {
+                printf(",\n");
+            }
+        }
+        dispatch(reading);
+    }
+    else
+    {
+        ++duplicate_count;
+    }
+
+    ++connection->tail;
+    if (connection->head == connection->tail)
+    {
+        heap[0] = heap[--heap_size];
+    }
+    heap_down(0);
+}
+
+/*******************************************************************************
+ *  \brief  Releases merged readings in timestamp order.
+ */
+static void release_readings
+(
+    const long long max_delay_ms,   /*!< - How long to wait for slow nodes  */
+    const int flush_all             /*!< - Release everything queued        */
+)
+{
+    const long long cutoff = now_ms() - max_delay_ms;
+    while (heap_size > 0)
+    {
+        const Connection *connection = connections[heap[0]];
+
+        /* Wait while a connection with nothing queued could still send older */
+        if (!flush_all && heap_size < connection_count &&
+            front_timestamp(heap[0]) > cutoff &&
+            connection->head - connection->tail < CONNECTION_QUEUE_LENGTH)
+        {
+            break;
+        }
+        release_front();
+    }
+}
+
+/*******************************************************************************
+ *  \brief  Adds a sketch observation, clamped to the sketch range.
+ */
+static void sketch_add
+(
+    unsigned int *bins,     /*!< - The sketch bins              */
+    const int count,        /*!< - The number of bins           */
+    const int offset,       /*!< - The value of bin 0, tenths   */
+    const float value       /*!< - The value observed           */
+)
+{
+    int bin = (int)(value * 10.0f + (value < 0 ? -0.5f : 0.5f)) - offset;
+    if (bin < 0)
+    {
+        bin = 0;
+    }
+    if (bin >= count)
+    {
+        bin = count - 1;
+    }
+    ++bins[bin];
+}
+
+/*******************************************************************************
+ *  \brief  Finds a shard's rollup for a sensor, creating it if required. The
+ *          shard lock must be held.
+ *  \return The rollup, NULL if the table is full.
+ */
+static SensorRollup *find_rollup
+(
+    Shard *shard,               /*!< - The shard owning the sensor  */
+    const Reading *reading      /*!< - A reading from the sensor    */
+)
+{
+    unsigned int slot = (reading->hash / (unsigned int)shard_count) % SENSOR_TABLE_LENGTH;
+    unsigned int probes;
+    for (probes = 0; probes < SENSOR_TABLE_LENGTH; ++probes)
+    {
+        SensorRollup *rollup = shard->sensors[slot];
+        if (NULL == rollup)
+        {
+            rollup = calloc(1, sizeof(*rollup));
+            if (NULL == rollup)
+            {
+                return NULL;
+            }
+            memcpy(rollup->node, reading->node, sizeof(rollup->node));
+            rollup->pin = reading->pin;
+            rollup->temperature_min = FLT_MAX;
+            rollup->humidity_min = FLT_MAX;
+            rollup->temperature_max = -FLT_MAX;
+            rollup->humidity_max = -FLT_MAX;
+            shard->sensors[slot] = rollup;
+            ++shard->sensor_count;
+            return rollup;
+        }
+        if (rollup->pin == reading->pin && 0 == strcmp(rollup->node, reading->node))
+        {
+            return rollup;
+        }
+        slot = (slot + 1) % SENSOR_TABLE_LENGTH;
+    }
+    return NULL;
+}
+
+/*******************************************************************************
+ *  \brief  Applies a reading to its sensor's rollup. The shard lock must be
+ *          held.
+ */
+static void apply_reading
+(
+    Shard *shard,               /*!< - The shard owning the sensor  */
+    const Reading *reading      /*!< - The reading to apply         */
+)
+{
+    SensorRollup *rollup = find_rollup(shard, reading);
+    if (NULL == rollup)
+    {
+        return;
+    }
+    ++rollup->results[reading->result];
+    rollup->attempts += (unsigned long)reading->attempts;
+    if (RESULT_OK != reading->result)
+    {
+        return;
+    }
+    rollup->temperature_sum += reading->temperature;
+    rollup->humidity_sum += reading->humidity;
+    if (reading->temperature < rollup->temperature_min)
+    {
+        rollup->temperature_min = reading->temperature;
+    }
+    if (reading->temperature > rollup->temperature_max)
+    {
+        rollup->temperature_max = reading->temperature;
+    }
+    if (reading->humidity < rollup->humidity_min)
+    {
+        rollup->humidity_min = reading->humidity;
+    }
+    if (reading->humidity > rollup->humidity_max)
+    {
+        rollup->humidity_max = reading->humidity;
+    }
+    sketch_add(rollup->temperature_bins, TEMPERATURE_BINS, TEMPERATURE_MIN_TENTHS,
+        reading->temperature);
+    sketch_add(rollup->humidity_bins, HUMIDITY_BINS, 0, reading->humidity);
+    rollup->last = *reading;
+}
+
+/*******************************************************************************
+ *  \brief  The shard thread, applying readings until stopped.
+ *  \return Always NULL.
+ */
+static void *shard_worker
+(
+    void *arg   /*!< - The Shard to run */
+)
+{
+    Shard *shard = (Shard *)arg;
+    pthread_mutex_lock(&shard->lock);
+    for (;;)
+    {
+        while (shard->head == shard->tail && !shard->stopping)
+        {
+            pthread_cond_wait(&shard->ready, &shard->lock);
+        }
+        if (shard->head == shard->tail)
+        {
+            break;
+        }
+        while (shard->head != shard->tail)
+        {
+            apply_reading(shard, &shard->queue[shard->tail % SHARD_QUEUE_LENGTH]);
+            ++shard->tail;
+        }
+        pthread_cond_broadcast(&shard->space);
+    }
+    pthread_mutex_unlock(&shard->lock);
+    return NULL;
+}
+
+/*******************************************************************************
+ *  \brief  Finds a percentile from a sketch.
+ *  \return The percentile value.
+ */
+static double sketch_percentile
+(
+    const unsigned int *bins,   /*!< - The sketch bins              */
+    const int count,            /*!< - The number of bins           */
+    const int offset,           /*!< - The value of bin 0, tenths   */
+    const unsigned long total,  /*!< - The number of observations   */
+    const double percentile     /*!< - The percentile, 0 to 1       */
+)
+{
+    unsigned long rank = (unsigned long)(percentile * (double)total);
+    unsigned long seen_so_far = 0;
+    int bin;
+    for (bin = 0; bin < count; ++bin)
+    {
+        seen_so_far += bins[bin];
+        if (seen_so_far > rank)
+        {
+            break;
+        }
+    }
+    if (bin == count)
+    {
+        bin = count - 1;
+    }
+    return (double)(bin + offset) / 10.0;
+}
+
+/*******************************************************************************
+ *  \brief  Prints the rollup of a set of sensors as a JSON line.
+ */
+static void print_rollup
+(
+    const char *scope,                  /*!< - "fleet" or "sensor"          */
+    const SensorRollup *rollup,         /*!< - The (merged) rollup          */
+    const unsigned long sensors         /*!< - Sensors in the rollup        */
+)
+{
+    const unsigned long valid = rollup->results[RESULT_OK];
+    unsigned long reads = 0;
+    int result;
+    for (result = 0; result < RESULT_COUNT; ++result)
+    {
+        reads += rollup->results[result];
+    }
+
+    printf("{\"ts\":%lld,\"scope\":\"%s\"", now_ms(), scope);
+    if (0 == strcmp(scope, "sensor"))
+    {
+        printf(",\"node\":\"%s\",\"pin\":%d", rollup->node, rollup->pin);
+    }
+    else
+    {
+        printf(",\"sensors\":%lu,\"merged\":%lu,\"duplicates\":%lu,\"invalid\":%lu",
+            sensors, merged_count, duplicate_count, invalid_count);
+    }
+    printf(",\"readings\":%lu,\"valid\":%lu,\"attempts\":%lu", reads, valid,
+        rollup->attempts);
+    if (valid > 0)
+    {
+        printf(",\"temperature\":{\"min\":%.1f,\"mean\":%.2f,\"max\":%.1f,"
+            "\"p50\":%.1f,\"p90\":%.1f,\"p99\":%.1f}",
+            rollup->temperature_min, rollup->temperature_sum / (double)valid,
+            rollup->temperature_max,
+            sketch_percentile(rollup->temperature_bins, TEMPERATURE_BINS,
+                TEMPERATURE_MIN_TENTHS, valid, 0.5),
+            sketch_percentile(rollup->temperature_bins, TEMPERATURE_BINS,
+                TEMPERATURE_MIN_TENTHS, valid, 0.9),
+            sketch_percentile(rollup->temperature_bins, TEMPERATURE_BINS,
+                TEMPERATURE_MIN_TENTHS, valid, 0.99));
+        printf(",\"humidity\":{\"min\":%.1f,\"mean\":%.2f,\"max\":%.1f,"
+            "\"p50\":%.1f,\"p90\":%.1f,\"p99\":%.1f}",
+            rollup->humidity_min, rollup->humidity_sum / (double)valid,
+            rollup->humidity_max,
+            sketch_percentile(rollup->humidity_bins, HUMIDITY_BINS, 0, valid, 0.5),
+            sketch_percentile(rollup->humidity_bins, HUMIDITY_BINS, 0, valid, 0.9),
+            sketch_percentile(rollup->humidity_bins, HUMIDITY_BINS, 0, valid, 0.99));
+    }
+    printf("}\n");
+}
+
+/*******************************************************************************
+ *  \brief  Prints the fleet rollup, merged across every shard, and optionally
+ *          the rollup of each sensor.
+ */
+static void print_report_lines
+(
+    const int per_sensor    /*!< - Non zero to print every sensor too   */
+)
+{
+    static SensorRollup fleet;
+    unsigned long sensors = 0;
+    int i;
+    unsigned int slot;
+    int bin;
+
+    memset(&fleet, 0, sizeof(fleet));
+    fleet.temperature_min = FLT_MAX;
+    fleet.humidity_min = FLT_MAX;
+    fleet.temperature_max = -FLT_MAX;
+    fleet.humidity_max = -FLT_MAX;
+
+    for (i = 0; i < shard_count; ++i)
+    {
+        Shard *shard = &shards[i];
+        pthread_mutex_lock(&shard->lock);
+        sensors += shard->sensor_count;
+        for (slot = 0; slot < SENSOR_TABLE_LENGTH; ++slot)
+        {
+            const SensorRollup *rollup = shard->sensors[slot];
+            int result;
+            if (NULL == rollup)
+            {
+                continue;
+            }
+            if (per_sensor)
+            {
+                print_rollup("sensor", rollup, 1);
+            }
+            for (result = 0; result < RESULT_COUNT; ++result)
+            {
+                fleet.results[result] += rollup->results[result];
+            }
+            fleet.attempts += rollup->attempts;
+            fleet.temperature_sum += rollup->temperature_sum;
+            fleet.humidity_sum += rollup->humidity_sum;
+            if (rollup->results[RESULT_OK] > 0)
+            {
+                if (rollup->temperature_min < fleet.temperature_min)
+                {
+                    fleet.temperature_min = rollup->temperature_min;
+                }
+                if (rollup->temperature_max > fleet.temperature_max)
+                {
+                    fleet.temperature_max = rollup->temperature_max;
+                }
+                if (rollup->humidity_min < fleet.humidity_min)
+                {
+                    fleet.humidity_min = rollup->humidity_min;
+                }
+                if (rollup->humidity_max > fleet.humidity_max)
+                {
+                    fleet.humidity_max = rollup->humidity_max;
+                }
+            }
+            for (bin = 0; bin < TEMPERATURE_BINS; ++bin)
+            {
+                fleet.temperature_bins[bin] += rollup->temperature_bins[bin];
+            }
+            for (bin = 0; bin < HUMIDITY_BINS; ++bin)
+            {
+                fleet.humidity_bins[bin] += rollup->humidity_bins[bin];
+            }
+        }
+        pthread_mutex_unlock(&shard->lock);
+    }
+    print_rollup("fleet", &fleet, sensors);
+    fflush(stdout);
+}
+
+/*******************************************************************************
+ *  \brief  Reads what a connection has sent, queueing each complete line.
+ *  \return Zero once the connection has closed, otherwise 1.
+ */
+static int receive_lines
+(
+    const int index     /*!< - The connection index */
+)
+{
+    Connection *connection = connections[index];
+    char *start;
+    char *end;
+    ssize_t received = recv(connection->fd, connection->buffer + connection->used,
+        sizeof(connection->buffer) - connection->used - 1, 0);
+
+    if (received <= 0)
+    {
+        return (received < 0 && (EINTR == errno || EAGAIN == errno));
+    }
+    connection->used += (size_t)received;
+    connection->buffer[connection->used] = '\0';
+
+    start = connection->buffer;
+    while (NULL != (end = strchr(start, '\n')))
+    {
+        Reading reading;
+        *end = '\0';
+        if (parse_line(start, &reading))
+        {
+            const int was_empty = (connection->head == connection->tail);
+            if (connection->head - connection->tail >= CONNECTION_QUEUE_LENGTH)
+            {
+                /* Too far ahead of the others, let the merge catch up */
+                release_readings(0, 0);
+            }
+            while (connection->head - connection->tail >= CONNECTION_QUEUE_LENGTH)
+            {
+                /*
+                 * Still full, a node's clock may be ahead of ours. Release the
+                 * oldest readings regardless, this connection's included, as
+                 * the heap still refers to the tail a write would overwrite.
+                 */
+                release_front();
+            }
+            connection->queue[connection->head % CONNECTION_QUEUE_LENGTH] = reading;
+            ++connection->head;
+            if (was_empty)
+            {
+                heap[heap_size] = index;
+                heap_up(heap_size++);
+            }
+        }
+        else
+        {
+            ++invalid_count;
+        }
+        start = end + 1;
+    }
+    connection->used -= (size_t)(start - connection->buffer);
+    memmove(connection->buffer, start, connection->used);
+    if (connection->used == sizeof(connection->buffer) - 1)
+    {
+        /* A line longer than the buffer can't be valid */
+        connection->used = 0;
+        ++invalid_count;
+    }
+    return 1;
+}
+
+/*******************************************************************************
+ *  \brief  Removes closed connections whose readings have all been merged.
+ *          Heap entries refer to connection indices, so the heap is rebuilt.
+ */
+static void remove_closed(void)
+{
+    int i;
+    int kept = 0;
+    for (i = 0; i < connection_count; ++i)
+    {
+        Connection *connection = connections[i];
+        if (connection->closing && connection->head == connection->tail)
+        {
+            close(connection->fd);
+            free(connection);
+        }
+        else
+        {
+            connections[kept++] = connection;
+        }
+    }
+    if (kept == connection_count)
+    {
+        return;
+    }
+    connection_count = kept;
+    heap_size = 0;
+    for (i = 0; i < connection_count; ++i)
+    {
+        if (connections[i]->head != connections[i]->tail)
+        {
+            heap[heap_size] = i;
+            heap_up(heap_size++);
+        }
+    }
+}
+
+/*******************************************************************************
+ *  \brief  Prints the usage information.
+ */
+static void print_usage
+(
+    const char *name    /*!< - The application name */
+)
+{
+    fprintf(stderr, "kdht-aggregator version %s\n\n", VERSION);
+    fprintf(stderr, "Usage: %s --listen <address> [options]\n\n", name);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "\t--listen <address>    Accept streams on [host]:port or unix:<path>, may be repeated\n");
+    fprintf(stderr, "\t--shards <count>      Shard threads (default the number of CPUs, at most %d)\n", MAX_SHARDS);
+    fprintf(stderr, "\t--max-delay <ms>      Longest to wait for a slow node when merging (default %ld)\n", DEFAULT_MAX_DELAY_MS);
+    fprintf(stderr, "\t--interval <seconds>  How often to print the rollups (default %d)\n", DEFAULT_INTERVAL);
+    fprintf(stderr, "\t--per-sensor          Print every sensor's rollup, not just the fleet\n");
+    fprintf(stderr, "\t--merged              Print the merged readings as they are released\n");
+}
+
+/*******************************************************************************
+ *  \brief  Main function.
+ *  \return EXIT_SUCCESS, or EXIT_FAILURE if the arguments are not valid.
+ */
+int main
+(
+    int argc,       /*!< - The number of arguments              */
+    char *argv[]    /*!< - The collection of argument strings   */
+)
+{
+    static const struct option long_options[] =
+    {
+        { "listen",     required_argument,  NULL, 'l' },
+        { "shards",     required_argument,  NULL, 's' },
+        { "max-delay",  required_argument,  NULL, 'd' },
+        { "interval",   required_argument,  NULL, 'i' },
+        { "per-sensor", no_argument,        NULL, 'p' },
+        { "merged",     no_argument,        NULL, 'm' },
+        { "help",       no_argument,        NULL, 'h' },
+        { NULL,         0,                  NULL, 0   }
+    };
+    static struct pollfd fds[MAX_LISTENERS + MAX_CONNECTIONS];
+    int listeners[MAX_LISTENERS];
+    int listener_count = 0;
+    long long max_delay_ms = DEFAULT_MAX_DELAY_MS;
+    int interval = DEFAULT_INTERVAL;
+    int per_sensor = 0;
+    long long next_report;
+    struct sigaction action;
+    int opt;
+    int i;
+
+    shard_count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    while ((opt = getopt_long(argc, argv, "l:s:d:i:pmh", long_options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+            case 'l':
+                if (listener_count >= MAX_LISTENERS)
+                {
+                    fprintf(stderr, "Too many listen addresses, at most %d\n", MAX_LISTENERS);
+                    exit(EXIT_FAILURE);
+                }
+                listeners[listener_count] = stream_listen(optarg);
+                if (listeners[listener_count] < 0)
+                {
+                    fprintf(stderr, "Could not listen on %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                ++listener_count;
+                break;
+
+            case 's':
+                shard_count = atoi(optarg);
+                break;
+
+            case 'd':
+                max_delay_ms = atoll(optarg);
+                break;
+
+            case 'i':
+                interval = atoi(optarg);
+                break;
+
+            case 'p':
+                per_sensor = 1;
+                break;
+
+            case 'm':
+                print_merged = 1;
+                break;
+
+            case 'h':
+                print_usage(argv[0]);
+                exit(EXIT_SUCCESS);
+
+            default:
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+    if (0 == listener_count || interval < 1 || max_delay_ms < 0)
+    {
+        print_usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (shard_count < 1)
+    {
+        shard_count = 1;
+    }
+    if (shard_count > MAX_SHARDS)
+    {
+        shard_count = MAX_SHARDS;
+    }
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handle_signal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    shards = calloc((size_t)shard_count, sizeof(Shard));
+    if (NULL == shards)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < shard_count; ++i)
+    {
+        pthread_mutex_init(&shards[i].lock, NULL);
+        pthread_cond_init(&shards[i].ready, NULL);
+        pthread_cond_init(&shards[i].space, NULL);
+        pthread_create(&shards[i].thread, NULL, shard_worker, &shards[i]);
+    }
+    fprintf(stderr, "Aggregating with %d shards\n", shard_count);
+
+    next_report = now_ms() + interval * 1000LL;
+    while (running)
+    {
+        int count = 0;
+        for (i = 0; i < listener_count; ++i)
+        {
+            fds[count].fd = listeners[i];
+            fds[count++].events = POLLIN;
+        }
+        for (i = 0; i < connection_count; ++i)
+        {
+            fds[count].fd = connections[i]->closing ? -1 : connections[i]->fd;
+            fds[count++].events = POLLIN;
+        }
+
+        if (poll(fds, (nfds_t)count, 100) > 0)
+        {
+            for (i = 0; i < listener_count; ++i)
+            {
+                if ((fds[i].revents & POLLIN) && connection_count < MAX_CONNECTIONS)
+                {
+                    int fd = accept(listeners[i], NULL, NULL);
+                    Connection *connection = (fd >= 0) ? calloc(1, sizeof(*connection)) : NULL;
+                    if (NULL != connection)
+                    {
+                        connection->fd = fd;
+                        connections[connection_count++] = connection;
+                    }
+                    else if (fd >= 0)
+                    {
+                        close(fd);
+                    }
+                }
+            }
+            for (i = listener_count; i < count; ++i)
+            {
+                const int index = i - listener_count;
+                if ((fds[i].revents & (POLLIN | POLLHUP | POLLERR)) && !receive_lines(index))
+                {
+                    connections[index]->closing = 1;
+                }
+            }
+        }
+
+        release_readings(max_delay_ms, 0);
+        remove_closed();
+
+        if (now_ms() >= next_report)
+        {
+            next_report += interval * 1000LL;
+            print_report_lines(per_sensor);
+        }
+    }
+
+    release_readings(0, 1);
+    for (i = 0; i < shard_count; ++i)
+    {
+        pthread_mutex_lock(&shards[i].lock);
+        shards[i].stopping = 1;
+        pthread_cond_signal(&shards[i].ready);
+        pthread_mutex_unlock(&shards[i].lock);
+        pthread_join(shards[i].thread, NULL);
+    }
+    print_report_lines(per_sensor);
+    return EXIT_SUCCESS;
+}
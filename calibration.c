@@ -0,0 +1,364 @@
+/*------------------------------------------------------------------------------
+ *! \file   calibration.c
+ *! \brief  Calibration of the capture loop's speed on each GPIO backend,
+ *          which the bit threshold and the timeout are counted in, cached
+ *          per host.
+ *
+ *  The capture times each level by counting turns of a loop of one
+ *  digitalRead() and delayMicroseconds(1). The original threshold of 16
+ *  turns between a 0 (26-28us high) and a 1 (70us high), and the timeout of
+ *  255, hold for a loop of about 3us, which is not what every board, kernel
+ *  and governor gives. The loop is timed here against CLOCK_MONOTONIC_RAW,
+ *  turn by turn, and the threshold is set at 48us and the timeout at 765us
+ *  in turns of the loop measured. Each backend is timed, as each has a loop
+ *  of its own, along with the time and CPU time of a read alone, which
+ *  limit how finely any loop can sample. A measurement is kept in
+ *  /var/tmp/kdht-calibration keyed by the board, the kernel release and the
+ *  backend, so it is only made again when one changes, or with --calibrate.
+ *------------------------------------------------------------------------------
+ *                   Kris Dunning ippie52@gmail.com 2016.
+ *------------------------------------------------------------------------------
+ */
+
+#include <wiringPi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/utsname.h>
+
+#include "calibration.h"
+
+#define DEFAULT_PERIOD_US       3.0f    /* The loop the original counts assume */
+#define BIT_THRESHOLD_US        48.0f   /* Between a 0 and a 1's high time   */
+#define TIMEOUT_US              765.0f  /* A level longer than this is lost  */
+#define MIN_PERIOD_US           0.5f    /* Faster than this is not a real loop */
+#define MAX_PERIOD_US           24.0f   /* Slower cannot tell a 0 from a 1   */
+#define CALIBRATION_TURNS       2000    /* Loop turns timed                  */
+#define JITTER_WEIGHT           2.0f    /* Jitter's cost against the period  */
+#define MAX_CALIBRATION_LINE    256U
+
+/*******************************************************************************
+ *  \brief  Sets the thresholds from the loop period.
+ */
+static void scale_thresholds
+(
+    Calibration *calibration    /*!<INOUT - The calibration */
+)
+{
+    const float timeout = TIMEOUT_US / calibration->period_us;
+    calibration->bit_threshold = (int)(BIT_THRESHOLD_US / calibration->period_us + 0.5f);
+    if (calibration->bit_threshold < 2)
+    {
+        calibration->bit_threshold = 2;
+    }
+    calibration->timeout = (timeout < 255.0f) ? (int)timeout : 255;
+}
+
+/*******************************************************************************
+ *  \brief  Reads the first line of a file, without its newline.
+ *  \return Zero if the file could not be read, otherwise 1.
+ */
+static int read_first_line
+(
+    const char *filename,   /*!<IN  - The file to read          */
+    const char *prefix,     /*!<IN  - The line's start, or NULL */
+    char *buffer,           /*!<OUT - The line                  */
+    const size_t size       /*!<IN  - The size of the buffer    */
+)
+{
+    char line[MAX_CALIBRATION_LINE];
+    FILE *fp = fopen(filename, "r");
+    int found = 0;
+
+    if (NULL == fp)
+    {
+        return 0;
+    }
+    while (!found && NULL != fgets(line, sizeof(line), fp))
+    {
+        if (NULL == prefix || 0 == strncmp(line, prefix, strlen(prefix)))
+        {
+            const char *start = (NULL == prefix) ? line : strchr(line, ':');
+            start = (NULL == start) ? line : start + (NULL != prefix);
+            start += strspn(start, " \t");
+            snprintf(buffer, size, "%s", start);
+            buffer[strcspn(buffer, "\r\n")] = '\0';
+            found = ('\0' != buffer[0]);
+        }
+    }
+    fclose(fp);
+    return found;
+}
+
+/*******************************************************************************
+ *  \brief  Checks whether a cache line is of a calibration's host and backend.
+ *  \return The offset of the measurement in the line, zero if not.
+ */
+static size_t cache_line_matches
+(
+    const Calibration *calibration, /*!< - The calibration  */
+    const char *line                /*!< - The cache line   */
+)
+{
+    const char *name = get_gpio_backend_name(calibration->backend);
+    const size_t length = strlen(calibration->key);
+
+    if (0 != strncmp(line, calibration->key, length) || '\t' != line[length] ||
+        0 != strncmp(line + length + 1, name, strlen(name)) ||
+        ' ' != line[length + 1 + strlen(name)])
+    {
+        return 0;
+    }
+    return length + strlen(name) + 2;
+}
+
+/*******************************************************************************
+ *  \brief  Gets the time between two points, in microseconds.
+ *  \return The time from start to end.
+ */
+static double elapsed
+(
+    const struct timespec *start,   /*!< - The start    */
+    const struct timespec *end      /*!< - The end      */
+)
+{
+    return (double)(end->tv_sec - start->tv_sec) * 1e6 +
+        (double)(end->tv_nsec - start->tv_nsec) / 1e3;
+}
+
+/*******************************************************************************
+ *  \brief  Sets the default calibration of a backend, the original
+ *          thresholds, keyed by this host's board and kernel release.
+ */
+void calibration_init
+(
+    Calibration *calibration,   /*!<OUT - The calibration   */
+    const GpioBackend backend   /*!<IN  - The backend       */
+)
+{
+    char board[MAX_CALIBRATION_KEY_LENGTH];
+    struct utsname host;
+    char *c;
+
+    memset(calibration, 0, sizeof(*calibration));
+    calibration->backend = backend;
+    calibration->period_us = DEFAULT_PERIOD_US;
+    scale_thresholds(calibration);
+
+    if (!read_first_line("/proc/device-tree/model", NULL, board, sizeof(board)) &&
+        !read_first_line("/proc/cpuinfo", "Hardware", board, sizeof(board)) &&
+        !read_first_line("/proc/cpuinfo", "model name", board, sizeof(board)))
+    {
+        snprintf(board, sizeof(board), "unknown");
+    }
+    if (0 != uname(&host))
+    {
+        snprintf(host.release, sizeof(host.release), "unknown");
+    }
+    snprintf(calibration->key, sizeof(calibration->key), "%.80s;%.40s", board,
+        host.release);
+    /* The key is one field of a line */
+    for (c = calibration->key; '\0' != *c; ++c)
+    {
+        if ('\t' == *c || '\n' == *c)
+        {
+            *c = ' ';
+        }
+    }
+}
+
+/*******************************************************************************
+ *  \brief  Loads this host's calibration of the backend from the cache.
+ *  \return Zero if there is none, otherwise 1.
+ */
+int calibration_load
+(
+    Calibration *calibration    /*!<INOUT - The calibration, keyed  */
+)
+{
+    char line[MAX_CALIBRATION_LINE];
+    FILE *fp = fopen(CALIBRATION_FILE, "r");
+    int found = 0;
+
+    if (NULL == fp)
+    {
+        return 0;
+    }
+    while (!found && NULL != fgets(line, sizeof(line), fp))
+    {
+        const size_t offset = cache_line_matches(calibration, line);
+        float period;
+        float jitter;
+        float read;
+        float cpu;
+        if (0 != offset &&
+            4 == sscanf(line + offset, "%f %f %f %f", &period, &jitter, &read, &cpu) &&
+            period >= MIN_PERIOD_US && period <= MAX_PERIOD_US)
+        {
+            calibration->period_us = period;
+            calibration->jitter_us = jitter;
+            calibration->read_us = read;
+            calibration->cpu_us = cpu;
+            calibration->measured = 1;
+            scale_thresholds(calibration);
+            found = 1;
+        }
+    }
+    fclose(fp);
+    return found;
+}
+
+/*******************************************************************************
+ *  \brief  Saves this host's calibration of the backend to the cache,
+ *          keeping the others.
+ *  \return Zero if saving fails, otherwise 1.
+ */
+int calibration_save
+(
+    const Calibration *calibration  /*!<IN - The calibration to save    */
+)
+{
+    char line[MAX_CALIBRATION_LINE];
+    FILE *in = fopen(CALIBRATION_FILE, "r");
+    FILE *out = fopen(CALIBRATION_FILE ".tmp", "w");
+
+    if (NULL == out)
+    {
+        fprintf(stderr, "Failed to open file %s in mode \"w\".\n", CALIBRATION_FILE ".tmp");
+        if (NULL != in)
+        {
+            fclose(in);
+        }
+        return 0;
+    }
+    while (NULL != in && NULL != fgets(line, sizeof(line), in))
+    {
+        if (0 == cache_line_matches(calibration, line))
+        {
+            fputs(line, out);
+        }
+    }
+    if (NULL != in)
+    {
+        fclose(in);
+    }
+    fprintf(out, "%s\t%s %.4f %.4f %.4f %.4f\n", calibration->key,
+        get_gpio_backend_name(calibration->backend), calibration->period_us,
+        calibration->jitter_us, calibration->read_us, calibration->cpu_us);
+    if (0 != fclose(out) || 0 != rename(CALIBRATION_FILE ".tmp", CALIBRATION_FILE))
+    {
+        fprintf(stderr, "Failed to replace %s\n", CALIBRATION_FILE);
+        return 0;
+    }
+    return 1;
+}
+
+/*******************************************************************************
+ *  \brief  Times the capture loop on a backend's line, an input, at real time
+ *          priority as the readers run, and a read alone for its time and
+ *          CPU time.
+ *  \return Zero if the time measured is not plausible and the calibration
+ *          is left as it was, otherwise 1.
+ */
+int calibration_measure
+(
+    Calibration *calibration,   /*!<INOUT - The calibration of the backend  */
+    const GpioLine *line        /*!<IN    - The line to read, idle          */
+)
+{
+    struct sched_param param;
+    struct sched_param previous;
+    const int policy = sched_getscheduler(0);
+    struct timespec last;
+    struct timespec now;
+    struct timespec cpu_start;
+    struct timespec cpu_end;
+    double sum = 0.0;
+    double squares = 0.0;
+    volatile int level = 0;
+    double mean;
+    double reads;
+    int i;
+
+    sched_getparam(0, &previous);
+    param.sched_priority = sched_get_priority_max(SCHED_FIFO);
+    sched_setscheduler(0, SCHED_FIFO, &param);
+
+    gpio_input(line);
+    clock_gettime(CLOCK_MONOTONIC_RAW, &last);
+    for (i = 0; i < CALIBRATION_TURNS; ++i)
+    {
+        double turn;
+        /* The same work as a turn of the capture loop */
+        level += gpio_read(line);
+        delayMicroseconds(1);
+        clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+        turn = elapsed(&last, &now);
+        sum += turn;
+        squares += turn * turn;
+        last = now;
+    }
+
+    /* Reads alone, as fast as the backend goes */
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_start);
+    clock_gettime(CLOCK_MONOTONIC_RAW, &last);
+    for (i = 0; i < CALIBRATION_TURNS; ++i)
+    {
+        level += gpio_read(line);
+    }
+    clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+    reads = elapsed(&last, &now) / CALIBRATION_TURNS;
+
+    sched_setscheduler(0, policy, &previous);
+
+    mean = sum / CALIBRATION_TURNS;
+    if (mean < MIN_PERIOD_US || mean > MAX_PERIOD_US)
+    {
+        fprintf(stderr, "Capture loop on %s measured at %.3fus, keeping %.2fus\n",
+            get_gpio_backend_name(calibration->backend), mean, calibration->period_us);
+        return 0;
+    }
+    calibration->period_us = (float)mean;
+    calibration->jitter_us = (float)sqrt(fmax(squares / CALIBRATION_TURNS - mean * mean, 0.0));
+    calibration->read_us = (float)reads;
+    calibration->cpu_us = (float)(elapsed(&cpu_start, &cpu_end) / CALIBRATION_TURNS);
+    calibration->measured = 1;
+    scale_thresholds(calibration);
+    return 1;
+}
+
+/*******************************************************************************
+ *  \brief  Scores a backend's calibration for the capture: a shorter loop
+ *          times the bits more finely, and jitter blurs them.
+ *  \return The score, lower is better.
+ */
+float calibration_score
+(
+    const Calibration *calibration  /*!<IN - The calibration    */
+)
+{
+    return calibration->period_us + JITTER_WEIGHT * calibration->jitter_us;
+}
+
+/*******************************************************************************
+ *  \brief  Prints the calibration, i.e. "wiringpi: capture loop 2.91us,
+ *          jitter 0.35us, read 0.08us (0.08us CPU): bit threshold 16,
+ *          timeout 255 (<board>;<kernel>)".
+ */
+void print_calibration
+(
+    FILE *fp,                           /*!<IN - The stream to print to */
+    const Calibration *calibration      /*!<IN - The calibration        */
+)
+{
+    fprintf(fp, "%s: capture loop %.2fus, jitter %.2fus, read %.2fus (%.2fus CPU)%s: "
+        "bit threshold %d, timeout %d (%s)\n",
+        get_gpio_backend_name(calibration->backend), calibration->period_us,
+        calibration->jitter_us, calibration->read_us, calibration->cpu_us,
+        calibration->measured ? "" : " (default)", calibration->bit_threshold,
+        calibration->timeout, calibration->key);
+}
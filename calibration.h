@@ -0,0 +1,41 @@
+/*------------------------------------------------------------------------------
+ *! \file   calibration.h
+ *! \brief  Calibration of the capture loop's speed on each GPIO backend,
+ *          which the bit threshold and the timeout are counted in, cached
+ *          per host.
+ *------------------------------------------------------------------------------
+ *                   Kris Dunning ippie52@gmail.com 2016.
+ *------------------------------------------------------------------------------
+ */
+#pragma once
+
+#include <stdio.h>
+
+#include "gpio.h"
+
+#define CALIBRATION_FILE            "/var/tmp/kdht-calibration"
+#define MAX_CALIBRATION_KEY_LENGTH  128U
+
+/******************************************************************************/
+/** The capture loop's measured speed on a backend and the thresholds scaled
+ *  from it
+ */
+typedef struct Calibrations
+{
+    char key[MAX_CALIBRATION_KEY_LENGTH];   /*!< The board and kernel       */
+    GpioBackend backend;    /*!< The backend measured                       */
+    float period_us;        /*!< Time per loop iteration                    */
+    float jitter_us;        /*!< Standard deviation of the iteration time   */
+    float read_us;          /*!< Time per read alone, the sampling limit    */
+    float cpu_us;           /*!< CPU time per read alone                    */
+    int measured;           /*!< Non zero if measured, not the default      */
+    int bit_threshold;      /*!< Loop counts above this are a 1 bit         */
+    int timeout;            /*!< Loop counts at which a level has timed out */
+} Calibration;
+
+void calibration_init(Calibration *calibration, const GpioBackend backend);
+int calibration_load(Calibration *calibration);
+int calibration_save(const Calibration *calibration);
+int calibration_measure(Calibration *calibration, const GpioLine *line);
+float calibration_score(const Calibration *calibration);
+void print_calibration(FILE *fp, const Calibration *calibration);
@@ -10,50 +10,90 @@
  * -----------------------------------------------------------------------------
  */
 
+#define _GNU_SOURCE
+
 #include <wiringPi.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <math.h>
 #include <sys/types.h>
 #include <string.h>
 #include <unistd.h>
 #include <sched.h>
+#include <getopt.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
 
 #include "locking.h"
+#include "sensor.h"
+#include "output.h"
+#include "mqtt.h"
+#include "statsd.h"
+#include "stats.h"
+#include "sink.h"
+#include "stream.h"
+#include "publish.h"
+#include "adaptive.h"
+#include "rules.h"
+#include "shm.h"
+#include "settings.h"
+#include "schedule.h"
+#include "readers.h"
+#include "fusion.h"
+#include "filter.h"
+#include "frame.h"
+#include "kalman.h"
+#include "scan.h"
+#include "iio.h"
+#include "i2c.h"
+#include "gpio.h"
+#include "calibration.h"
 #include "config.h"
 
 #define MAX_PATH_LENGTH     100U
 #define MAX_READING_LENGTH  20U
+#define DETECT_MARGIN       0.25f   /* Weakest bit margin to detect a model */
+
+#define DEFAULT_MQTT_TOPIC      "kdht/readings"
+#define DEFAULT_MQTT_SPOOL      "/var/tmp/kdht.mqtt.spool"
+#define MQTT_KEEPALIVE_MARGIN   60U
+#define DEFAULT_STATSD_PREFIX   "kdht"
 
 static const float MAX_HUMIDITY = 99.9f;
 static const int DEFAULT_PIN = 7;
-static const int MAX_TIMINGS = 85;
+static const int MIN_WATCH_INTERVAL = 2;
 
-/******************************************************************************/
-/**The result enumeration of the sensor readings
+#define MAX_PLUGINS         4
+
+/* The capture loop's speed on each backend, the bit threshold and timeout
+ * counted in its turns
  */
-typedef enum Results
-{
-    RESULT_OK,          /*!< Valid values appear to have been found   */
-    RESULT_BAD_DATA,    /*!< Bad data                                 */
-    RESULT_ALL_ZERO,    /*!< All values are zero - suspicious         */
-    RESULT_INCONSISTENT,/*!< Data inconsistent from last reading      */
-    RESULT_INVALID      /*!< Data appears to be invalid               */
-} SensorReadingResults;
+static Calibration calibrations[GPIO_BACKEND_COUNT];
+
+/* Non zero once the backends have been measured in this run */
+static int backends_measured = 0;
 
 /******************************************************************************/
-/** Sensor value struct, storing temperature, humidity and the processing result
+/** Per pin state, kept for the lifetime of the process
  */
-typedef struct Values
+typedef struct PinStates
 {
-    SensorReadingResults result;    /*!< The sensor reading results         */
-    float humidity;                 /*!< The humidity reading (in %)        */
-    float temperature;              /*!< The temperature reading (in *C)    */
-
-} SensorValues;
-
-#define INVALID_VALUES  { RESULT_INVALID, 0.0f, 0.0f }
-#define C_TO_F(c)       (((float)c * 1.8f) + 32.0f)
+    int pin;                    /*!< The sensor pin                         */
+    int lockfd;                 /*!< The lock file held for the pin         */
+    SensorValues last_read;     /*!< The last values read from the sensor   */
+    PinStats stats;             /*!< The read statistics for the pin        */
+    PublishState publish;       /*!< The last reading passed to the outputs */
+    AdaptiveState adaptive;     /*!< The pin's read interval                */
+    ReadingFilter filter;       /*!< The median filter of valid readings    */
+    IioSensor iio;              /*!< The kernel driver's device, if used    */
+    GpioLine line;              /*!< The pin, opened for its backend        */
+    PinRules rules;             /*!< The alert rules for the pin            */
+    SharedSlot *slot;           /*!< Shared memory for local consumers      */
+    unsigned int sink_mask;     /*!< The sinks the readings go to           */
+} PinState;
 
 /*******************************************************************************
  *  \brief  Evaluates the sensor values to sanity check the results found.
@@ -80,33 +120,49 @@ static int evaluate
     return RESULT_OK;
 }
 
+/*******************************************************************************
+ *  \brief  Gets the wall clock time.
+ *  \return The time in seconds.
+ */
+static double wall_time(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
 /*******************************************************************************
  *  \brief  Evaluates the sensor values to sanity check the results found
- *          against previous read and stored values.
+ *          against previous read and stored values. Once the pin's filters
+ *          have a history the values are checked against their prediction,
+ *          otherwise against the stored values.
  *  \return SensorReadingResults value to indicate the legitimacy of the results
  *          obtained.
  */
 static int evaluate_last
 (
+    const PinTracker *tracker,      /*!<IN - The pin's filters, on raw values        */
     const SensorValues last_stored, /*!<IN - The last SensorValues stored on file   */
     SensorValues *values,           /*!<IN/OUT - The SensorValues to evaluate       */
     SensorValues *last_read         /*!<OUT - The last read values for comparison   */
 )
 {
+    const int predicted = tracker_ready(tracker);
     values->result = evaluate(values);
-    if (RESULT_OK == values->result && RESULT_OK == last_stored.result)
+    if (RESULT_OK == values->result && (predicted || RESULT_OK == last_stored.result))
     {
         /* First, let's check whether its similar enough */
-        if (abs(last_stored.temperature - values->temperature) > 5.0f ||
-            abs(last_stored.humidity - values->humidity) > 5.0f)
+        if (predicted ? !tracker_gate(tracker, values, wall_time()) :
+            (fabsf(last_stored.temperature - values->temperature) > 5.0f ||
+            fabsf(last_stored.humidity - values->humidity) > 5.0f))
         {
             /* Now, let's check to see whether we have a previous reading,
              * and if so, whether the temperature or humidity has genuinely changed
              * this much
              */
             if (RESULT_INCONSISTENT == last_read->result &&
-                abs(last_read->temperature - values->temperature) < 5.0f &&
-                abs(last_read->humidity - values->humidity) < 5.0f)
+                fabsf(last_read->temperature - values->temperature) < 5.0f &&
+                fabsf(last_read->humidity - values->humidity) < 5.0f)
             {
                 fprintf(stderr, "Last two read values appear to match, ignoring saved inconsistency\n");
                 /* We can assume the value(s) have actually changed this much */
@@ -142,7 +198,7 @@ static uint8_t sizecvt
 
     if (read > 255 || read < 0)
     {
-        printf("Invalid data from wiringPi library\n");
+        fprintf(stderr, "Invalid data from wiringPi library\n");
         exit(EXIT_FAILURE);
     }
     return (uint8_t)read;
@@ -247,17 +303,34 @@ static int set_last_values
 }
 
 /*******************************************************************************
- *  \brief  Sets the thread priority to the maximum available in the hope that
- *          it will prevent data loss when bit-bashing the DHT sensor.
+ *  \brief  Gets the microseconds elapsed between two monotonic times.
+ *  \return The elapsed time in microseconds.
  */
-static void set_priority()
+static long elapsed_us
+(
+    const struct timespec *start,   /*!< - The start time   */
+    const struct timespec *end      /*!< - The end time     */
+)
 {
-    struct sched_param params;
-    params.sched_priority  = sched_get_priority_max(SCHED_FIFO);
-    /* PID set to zero implies this thread, FIFO is the best chance at having a
-     * "real-time" priority, and the maximum priority is identified.
-     */
-    sched_setscheduler(0, SCHED_FIFO, &params);
+    return (long)(end->tv_sec - start->tv_sec) * 1000000L +
+        (end->tv_nsec - start->tv_nsec) / 1000L;
+}
+
+/*******************************************************************************
+ *  \brief  Gets how clearly a data bit's high time fell on one side of the
+ *          threshold between a 0 and a 1.
+ *  \return The distance from the threshold as a fraction of it, up to 1.
+ */
+static float bit_margin
+(
+    const uint8_t counter,  /*!< - The loop count of the bit's high level */
+    const int threshold     /*!< - The loop count between a 0 and a 1     */
+)
+{
+    const float margin = (counter > threshold) ?
+        (float)(counter - threshold) / threshold :
+        (float)(threshold - counter) / threshold;
+    return (margin < 1.0f) ? margin : 1.0f;
 }
 
 /*******************************************************************************
@@ -266,47 +339,68 @@ static void set_priority()
  */
 static SensorReadingResults read_dht22_data
 (
-    const int sensor_pin,           /*!< - The sensor pin to read   */
+    const GpioLine *line,           /*!< - The sensor pin to read   */
+    SensorModel *model,             /*!<INOUT - The pin's model, MODEL_AUTO if not known */
+    const int detect,               /*!< - Non zero to detect the model from the frame */
+    CaptureBuffer *buffer,          /*!<INOUT - The reader's capture buffer */
     SensorValues *values,           /*!<OUT - The values to set     */
-    const SensorValues last_stored  /*!< - The last stored values   */
+    const PinTracker *tracker,      /*!<IN - The pin's filters      */
+    const SensorValues last_stored, /*!< - The last stored values   */
+    SensorValues *last_read,        /*!<INOUT - The last read values for this pin */
+    SensorReport *report            /*!<INOUT - The phase timings and bit margins */
 )
 {
+    const Calibration *calibration = &calibrations[line->backend];
+    struct timespec handshake;
+    struct timespec capture;
+    struct timespec end;
     uint8_t laststate = HIGH;
     uint8_t counter = 0;
     uint8_t j = 0, i;
-    int data_sum = 0;
-    static int dht22_data[5] = { 0, 0, 0, 0, 0 };
-    static SensorValues last_read = INVALID_VALUES;
-
-    memset(dht22_data, 0, sizeof(dht22_data));
-    /* Pull pin down for 18 milliseconds */
-    pinMode(sensor_pin, OUTPUT);
-    digitalWrite(sensor_pin, HIGH);
+    int *dht22_data = buffer->data;
+    float weakest = 1.0f;
+    PerfSample sample;
+    float margin;
+
+    if (GPIO_AUTO == line->backend)
+    {
+        /* The pin could not be opened, see select_backend() */
+        values->result = RESULT_INVALID;
+        return values->result;
+    }
+    memset(buffer->timings, 0, sizeof(buffer->timings));
+    memset(buffer->data, 0, sizeof(buffer->data));
+    clock_gettime(CLOCK_MONOTONIC, &handshake);
+    perf_start(&buffer->perf);
+    /* Pull pin down for 18 milliseconds, less for a known DHT22 */
+    gpio_output(line, HIGH);
     delayMicroseconds(10000);
-    digitalWrite(sensor_pin, LOW);
-    delayMicroseconds(18000);
+    gpio_output(line, LOW);
+    delayMicroseconds(frame_start_us(*model));
     /* Then pull it up for 40 microseconds */
-    digitalWrite(sensor_pin, HIGH);
+    gpio_output(line, HIGH);
     delayMicroseconds(40);
     /* Prepare to read the pin */
-    pinMode(sensor_pin, INPUT);
+    gpio_input(line);
+    clock_gettime(CLOCK_MONOTONIC, &capture);
 
     /* Detect change and read data */
-    for (i = 0; i < MAX_TIMINGS; ++i)
+    for (i = 0; i < MAX_CAPTURE_TIMINGS; ++i)
     {
         counter = 0;
-        while (sizecvt(digitalRead(sensor_pin)) == laststate)
+        while (sizecvt(gpio_read(line)) == laststate)
         {
             ++counter;
             delayMicroseconds(1);
-            if (0xFF == counter)
+            if (calibration->timeout == counter)
             {
                 break;
             }
         }
-        laststate = sizecvt(digitalRead(sensor_pin));
+        laststate = sizecvt(gpio_read(line));
+        buffer->timings[i] = counter;
 
-        if (0xFF == counter)
+        if (calibration->timeout == counter)
         {
             break;
         }
@@ -316,107 +410,204 @@ static SensorReadingResults read_dht22_data
         {
             /* Shove each bit into the storage bytes */
             dht22_data[j/8] <<= 1;
-            if (counter > 16)
+            if (counter > calibration->bit_threshold)
             {
                 dht22_data[j/8] |= 1;
             }
             j++;
+            margin = bit_margin(counter, calibration->bit_threshold);
+            if (margin < weakest)
+            {
+                weakest = margin;
+            }
+            report->margin_sum += margin;
+            ++report->margin_bits;
         }
     }
 
+    perf_stop(&buffer->perf, &sample);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    report->phase_us[PHASE_HANDSHAKE] += elapsed_us(&handshake, &capture);
+    report->phase_us[PHASE_CAPTURE] += elapsed_us(&capture, &end);
+    if (calibration->timeout == counter && j < 40)
+    {
+        /* The sensor stopped sending before all the bits were in */
+        ++report->timeouts;
+    }
+
     /* Check we read 40 bits (8bit x 5 ) + verify checksum in the last byte */
-    data_sum = (dht22_data[0] + dht22_data[1] + dht22_data[2] + dht22_data[3]);
-    if ((j >= 40) && (dht22_data[4] == (uint8_t)(data_sum & 0xFF)))
+    if ((j >= FRAME_BITS) && frame_checksum_ok(dht22_data))
     {
-        values->humidity = (float)dht22_data[0] * 256 + (float)dht22_data[1];
-        values->humidity /= 10;
-        values->temperature = (float)(dht22_data[2] & 0x7F)* 256 + (float)dht22_data[3];
-        values->temperature /= 10.0;
-        if ((dht22_data[2] & 0x80) != 0)
+        /* Only a frame with every bit clearly timed is trusted to detect the
+         * model, a bit read the wrong way can still pass the checksum
+         */
+        if (detect && weakest >= DETECT_MARGIN)
         {
-          values->temperature *= -1.0;
+            const SensorModel found = frame_classify(dht22_data);
+            if (MODEL_AUTO != found && found != *model)
+            {
+                fprintf(stderr, "Detected a %s on GPIO %d\n", get_model_name(found),
+                    line->pin);
+                *model = found;
+            }
         }
-        values->result = evaluate_last(last_stored, values, &last_read);
+        frame_decode(dht22_data, *model, values);
+        values->result = evaluate_last(tracker, last_stored, values, last_read);
     }
     else
     {
         fprintf(stderr, "Data not good, skip\n");
         values->result = RESULT_BAD_DATA;
     }
+
+    /* The events are kept by the attempt's result, and traced for failures */
+    report->perf_mask |= sample.mask;
+    for (i = 0; i < PERF_EVENT_COUNT; ++i)
+    {
+        report->perf[values->result][i] += sample.counts[i];
+    }
+    if (RESULT_OK != values->result && 0 != sample.mask)
+    {
+        fprintf(stderr, "Attempt %d on GPIO %d was %s: ", report->attempts, line->pin,
+            get_result_name(values->result));
+        print_perf_sample(stderr, &sample);
+        fprintf(stderr, "\n");
+    }
     return values->result;
 }
 
 /*******************************************************************************
- *  \brief  Main function.
- *  \return Result of the sensor evaluation.
+ *  \brief  Reads the sensor through the kernel's IIO driver, which does the
+ *          start signal and edge timing itself. The whole read counts as the
+ *          capture phase, and there are no bit margins to report.
+ *  \return The SensorReadingResults value.
  */
-int main
+static SensorReadingResults read_iio_data
 (
-    int argc,       /*!< - The number of arguments              */
-    char *argv[]    /*!< - The collection of argument strings   */
+    IioSensor *sensor,              /*!<INOUT - The pin's IIO device */
+    SensorValues *values,           /*!<OUT - The values to set     */
+    const PinTracker *tracker,      /*!<IN - The pin's filters      */
+    const SensorValues last_stored, /*!< - The last stored values   */
+    SensorValues *last_read,        /*!<INOUT - The last read values for this pin */
+    SensorReport *report            /*!<INOUT - The phase timings   */
 )
 {
-    int lockfd;
-    int dht_pin = DEFAULT_PIN;
-    int zero_count = 0;
-    int tries = 100;
-    char buffer[MAX_PATH_LENGTH];
-    SensorValues values = INVALID_VALUES;
-    SensorValues last_stored;
+    struct timespec capture;
+    struct timespec end;
+    int timed_out;
 
-    if (argc < 2)
+    clock_gettime(CLOCK_MONOTONIC, &capture);
+    iio_read(sensor, values, &timed_out);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    report->phase_us[PHASE_CAPTURE] += elapsed_us(&capture, &end);
+    if (timed_out)
     {
-        fprintf(stderr, "kdht version %s\n\n", VERSION);
-        fprintf(stderr, "Usage: %s <pin> [<tries>]\n\n", argv[0]);
-        fprintf(stderr, "Description:\n\tPin is the wiringPi pin number (default 7 (GPIO 4)).\n");
-        fprintf(stderr, "\tTries is the number of times to try to obtain a read (default %d) [Optional]\n", tries);
-    }
-    else
-    {
-        dht_pin = atoi(argv[1]);
-        printf("Reading DHT21/22 sensor on GPIO %d\n", dht_pin);
+        ++report->timeouts;
     }
 
-    if (argc >= 3)
+    if (RESULT_OK == values->result)
     {
-        tries = atoi(argv[2]);
+        values->result = evaluate_last(tracker, last_stored, values, last_read);
     }
-    printf("%d attempts will be made.\n", tries);
-
-    if (tries < 1)
+    else
     {
-        fprintf(stderr, "Invalid tries supplied\n");
-        exit(EXIT_FAILURE);
+        fprintf(stderr, "Data not good, skip\n");
     }
+    return values->result;
+}
+
+/*******************************************************************************
+ *  \brief  Reads an AM2320/AM2315 on an I2C bus, from the bus's last sweep
+ *          if it is fresh. The whole read counts as the capture phase.
+ *  \return The SensorReadingResults value.
+ */
+static SensorReadingResults read_i2c_data
+(
+    I2cTable *i2c,                  /*!<INOUT - The I2C buses       */
+    const int index,                /*!< - The pin's index in the settings */
+    SensorValues *values,           /*!<OUT - The values to set     */
+    const PinTracker *tracker,      /*!<IN - The pin's filters      */
+    const SensorValues last_stored, /*!< - The last stored values   */
+    SensorValues *last_read,        /*!<INOUT - The last read values for this pin */
+    SensorReport *report            /*!<INOUT - The phase timings   */
+)
+{
+    struct timespec capture;
+    struct timespec end;
 
-    get_lockfile_name(dht_pin, buffer, MAX_PATH_LENGTH);
-    lockfd = open_lockfile(buffer);
+    clock_gettime(CLOCK_MONOTONIC, &capture);
+    i2c_read(i2c, index, values);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    report->phase_us[PHASE_CAPTURE] += elapsed_us(&capture, &end);
 
-    if (wiringPiSetup() == -1)
+    if (RESULT_OK == values->result)
     {
-        fprintf(stderr, "Problem setting up wiringPi\n");
-        exit(EXIT_FAILURE);
+        values->result = evaluate_last(tracker, last_stored, values, last_read);
     }
-
-    if (setuid(getuid()) < 0)
+    else
     {
-        perror("Dropping privileges failed\n");
-        exit(EXIT_FAILURE);
+        fprintf(stderr, "Data not good, skip\n");
     }
+    return values->result;
+}
+
+/*******************************************************************************
+ *  \brief  Reads the sensor on the given pin, retrying up to the configured
+ *          number of times, and stores the result for the next read. The
+ *          calibration offsets are applied after the raw result is stored.
+ *          A pin in a group whose other members have fresh readings is
+ *          checked against those instead of being read again.
+ */
+static void read_sensor
+(
+    PinState *state,            /*!<INOUT - The pin to read                 */
+    const PinConfig *config,    /*!<IN    - The pin's settings              */
+    FusionTable *fusion,        /*!<INOUT - The sensor groups               */
+    I2cTable *i2c,              /*!<INOUT - The I2C buses                   */
+    const int index,            /*!<IN    - The pin's index in the settings */
+    CaptureBuffer *buffer,      /*!<INOUT - The reader's capture buffer     */
+    SensorReport *report        /*!<OUT   - The outcome of the read         */
+)
+{
+    const int grouped = fusion_is_grouped(fusion, index);
+    int zero_count = 0;
+    int remaining = config->tries;
+    struct timespec start;
+    struct timespec wait;
+    struct timespec end;
+    SensorValues values = INVALID_VALUES;
+    SensorValues last_stored = get_last_values(state->pin);
+    const int detect = MODEL_AUTO == config->model;
+    SensorModel model = detect ? state->stats.model : config->model;
+    double now;
 
-    last_stored = get_last_values(dht_pin);
     if (RESULT_OK != last_stored.result)
     {
         fprintf(stderr, "Stored results were not OK, ignoring them.\n");
     }
 
-    /* Set the thread priority to give a better chance of not losing data due to
-     * thread interruptions
-     */
-    set_priority();
-    while (tries--)
+    memset(report, 0, sizeof(*report));
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (remaining--)
     {
-        if (read_dht22_data(dht_pin, &values, last_stored) == RESULT_ALL_ZERO)
+        ++report->attempts;
+        if (i2c_is_used(i2c, index))
+        {
+            read_i2c_data(i2c, index, &values, &state->stats.tracker, last_stored,
+                &state->last_read, report);
+        }
+        else if ('\0' != state->iio.path[0])
+        {
+            read_iio_data(&state->iio, &values, &state->stats.tracker, last_stored,
+                &state->last_read, report);
+        }
+        else
+        {
+            read_dht22_data(&state->line, &model, detect, buffer, &values,
+                &state->stats.tracker, last_stored, &state->last_read, report);
+        }
+        ++report->outcomes[values.result];
+        if (RESULT_ALL_ZERO == values.result)
         {
             fprintf(stderr, "Reading was zero, checking again\n");
             ++zero_count;
@@ -425,7 +616,7 @@ int main
                 values.result = RESULT_OK;
                 break;
             }
-            ++tries;
+            ++remaining;
         }
 
         if (RESULT_OK == values.result)
@@ -433,27 +624,1702 @@ int main
             break;
         }
 
+        if (grouped && RESULT_INCONSISTENT == values.result)
+        {
+            SensorValues calibrated = values;
+            FusionCheck check;
+            calibrated.temperature += config->temperature_offset;
+            calibrated.humidity += config->humidity_offset;
+            check = fusion_check(fusion, index, &calibrated);
+            if (FUSION_AGREES == check)
+            {
+                fprintf(stderr, "Group %s agrees with the change, accepting it\n",
+                    config->group);
+                values.result = RESULT_OK;
+                break;
+            }
+            if (FUSION_DISAGREES == check)
+            {
+                fprintf(stderr, "Group %s disagrees, not reading again\n",
+                    config->group);
+                break;
+            }
+        }
+        else if (grouped && RESULT_BAD_DATA == values.result &&
+            FUSION_AGREES == fusion_check(fusion, index, NULL))
+        {
+            fprintf(stderr, "Group %s has fresh readings, not reading again\n",
+                config->group);
+            break;
+        }
+
         if (RESULT_OK != values.result)
         {
             /* Wait to refresh */
-            delay(200);
+            clock_gettime(CLOCK_MONOTONIC, &wait);
+            delay(config->retry_delay_ms);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            report->phase_us[PHASE_RETRY_WAIT] += elapsed_us(&wait, &end);
         }
     }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    clock_gettime(CLOCK_REALTIME, &report->timestamp);
 
+    report->pin = state->pin;
+    report->latency_us = elapsed_us(&start, &end);
+    report->phase_us[PHASE_TOTAL] = report->latency_us;
+
+    set_last_values(state->pin, values);
+    if (detect)
+    {
+        state->stats.model = model;
+    }
+    now = wall_time();
+    tracker_update(&state->stats.tracker, &values, now);
+    tracker_estimate(&state->stats.tracker, now, &report->smoothed);
+    tracker_estimate(&state->stats.tracker, now + KALMAN_FORECAST, &report->forecast);
     if (RESULT_OK == values.result)
     {
-        printf("Humidity = %.2f %% Temperature = %.2f *C (%.2f *F)\n",
-            values.humidity, values.temperature, C_TO_F(values.temperature));
+        values.temperature += config->temperature_offset;
+        values.humidity += config->humidity_offset;
+    }
+    report->smoothed.temperature += config->temperature_offset;
+    report->smoothed.humidity += config->humidity_offset;
+    report->forecast.temperature += config->temperature_offset;
+    report->forecast.humidity += config->humidity_offset;
+    reading_filter_apply(&state->filter, &values);
+    report->values = values;
+    fusion_update(fusion, index, report);
+
+    stats_update(&state->stats, report);
+    stats_save(&state->stats);
+}
+
+/******************************************************************************/
+/** What the readers need to make a read
+ */
+typedef struct ReadContexts
+{
+    PinState *pins;             /*!< The pin states                         */
+    const Settings *settings;   /*!< The pin settings                       */
+    FusionTable *fusion;        /*!< The sensor groups                      */
+    I2cTable *i2c;              /*!< The I2C buses                          */
+} ReadContext;
+
+/*******************************************************************************
+ *  \brief  Makes a scheduled read, on a reader thread. The pin is read by
+ *          this reader alone until the read is collected.
+ */
+static void read_job
+(
+    ReadJob *job,           /*!<INOUT - The read to make                */
+    CaptureBuffer *buffer,  /*!<INOUT - The reader's capture buffer     */
+    void *arg               /*!<IN    - The ReadContext                 */
+)
+{
+    const ReadContext *context = (const ReadContext *)arg;
+    const int index = job->entry.index;
+    read_sensor(&context->pins[index], &context->settings->pins[index],
+        context->fusion, context->i2c, index, buffer, &job->report);
+}
+
+/******************************************************************************/
+/** The standard output sink settings
+ */
+typedef struct OutputSinks
+{
+    FILE *fp;               /*!< The stream to print to     */
+    OutputFormat format;    /*!< The format to print in     */
+} OutputSink;
+
+/*******************************************************************************
+ *  \brief  Sink callback, prints the report or alert.
+ */
+static void output_sink_write
+(
+    void *context,              /*!<IN - The OutputSink         */
+    const SinkEvent *event      /*!<IN - The report to print    */
+)
+{
+    const OutputSink *sink = (const OutputSink *)context;
+    if (SINK_EVENT_ALERT == event->type)
+    {
+        print_alert(sink->fp, sink->format, &event->alert);
     }
     else
     {
-        fprintf(stderr, "Values could not be obtained.\n");
+        print_report(sink->fp, sink->format, &event->report);
     }
+}
+
+/*******************************************************************************
+ *  \brief  Sink callback, flushes the stream at the end of each cycle.
+ */
+static void output_sink_flush
+(
+    void *context   /*!<IN - The OutputSink */
+)
+{
+    fflush(((const OutputSink *)context)->fp);
+}
 
-    set_last_values(dht_pin, values);
+static const SinkOps output_sink =
+{
+    SINK_API_VERSION, "stdout", NULL, output_sink_write, output_sink_flush, NULL
+};
 
-    delay(100);
-    close_lockfile(lockfd);
+/*******************************************************************************
+ *  \brief  Sink callback, writes the Prometheus textfile for the pin.
+ */
+static void prometheus_sink_write
+(
+    void *context,              /*!<IN - The textfile directory */
+    const SinkEvent *event      /*!<IN - The report to export   */
+)
+{
+    if (SINK_EVENT_REPORT == event->type)
+    {
+        stats_write_prometheus((const char *)context, &event->stats);
+    }
+}
+
+/*******************************************************************************
+ *  \brief  Sink callback, writes the sink queue metrics once per cycle.
+ */
+static void prometheus_sink_flush
+(
+    void *context   /*!<IN - The textfile directory */
+)
+{
+    sink_write_prometheus((const char *)context);
+}
+
+static const SinkOps prometheus_sink =
+{
+    SINK_API_VERSION, "prometheus", NULL, prometheus_sink_write,
+    prometheus_sink_flush, NULL
+};
+
+/******************************************************************************/
+/** The settings taken from the command line and the configuration file
+ */
+typedef struct Options
+{
+    OutputFormat format;                    /*!< The stdout format              */
+    PinConfig defaults;                     /*!< Settings of pins not configured */
+    const char *deadbands[MAX_PINS + 1];    /*!< --deadband options given       */
+    int deadband_count;                     /*!< The number of deadbands        */
+    long heartbeat;                         /*!< On change heartbeat, seconds   */
+    const char *config_path;                /*!< The configuration file         */
+    const char *mqtt_server;                /*!< MQTT broker, NULL if none      */
+    const char *mqtt_topic;                 /*!< MQTT topic                     */
+    const char *mqtt_spool;                 /*!< MQTT spool file                */
+    const char *statsd_server;              /*!< StatsD server, NULL if none    */
+    const char *statsd_prefix;              /*!< StatsD metric prefix           */
+    const char *prom_directory;             /*!< Textfile directory, or NULL    */
+    const char *stream_address;             /*!< Aggregator, NULL if none       */
+    const char *node;                       /*!< Node name for the aggregator   */
+    const char *plugins[MAX_PLUGINS];       /*!< Sink plugins to load           */
+    SinkPolicy plugin_policies[MAX_PLUGINS]; /*!< Policy of each plugin         */
+    int plugin_count;                       /*!< The number of plugins          */
+    SinkPolicy policy;                      /*!< Policy for following plugins   */
+    RuleSet rules;                          /*!< Alert rules                    */
+    int readers;                            /*!< Reader threads, 0 for each core */
+    int health;                             /*!< Non zero to report health only */
+    int scan;                               /*!< Non zero to look for sensors only */
+    int calibrate;                          /*!< Non zero to calibrate only     */
+    int max_age;                            /*!< Age of a reading to answer with */
+} Options;
+
+static const struct option long_options[] =
+{
+    { "format",     required_argument,  NULL, 'f' },
+    { "watch",      required_argument,  NULL, 'w' },
+    { "config",     required_argument,  NULL, 'c' },
+    { "tries",      required_argument,  NULL, 'T' },
+    { "retry-delay", required_argument, NULL, 'R' },
+    { "model",      required_argument,  NULL, 'M' },
+    { "offset",     required_argument,  NULL, 'O' },
+    { "max-interval", required_argument, NULL, 'X' },
+    { "adapt-band", required_argument,  NULL, 'A' },
+    { "filter",     required_argument,  NULL, 'F' },
+    { "gpio",       required_argument,  NULL, 'G' },
+    { "iio",        required_argument,  NULL, 'I' },
+    { "i2c",        required_argument,  NULL, 'B' },
+    { "readers",    required_argument,  NULL, 'N' },
+    { "mqtt",       required_argument,  NULL, 'm' },
+    { "mqtt-topic", required_argument,  NULL, 't' },
+    { "mqtt-spool", required_argument,  NULL, 's' },
+    { "statsd",     required_argument,  NULL, 'S' },
+    { "statsd-prefix", required_argument, NULL, 'P' },
+    { "prom-textfile", required_argument, NULL, 'p' },
+    { "stream",     required_argument,  NULL, 'a' },
+    { "node",       required_argument,  NULL, 'n' },
+    { "deadband",   required_argument,  NULL, 'D' },
+    { "heartbeat",  required_argument,  NULL, 'H' },
+    { "rules",      required_argument,  NULL, 'r' },
+    { "sink",       required_argument,  NULL, 'k' },
+    { "sink-policy", required_argument, NULL, 'K' },
+    { "health",     no_argument,        NULL, 'E' },
+    { "scan",       no_argument,        NULL, 'Z' },
+    { "calibrate",  no_argument,        NULL, 'L' },
+    { "max-age",    required_argument,  NULL, 'Y' },
+    { "help",       no_argument,        NULL, 'h' },
+    { NULL,         0,                  NULL, 0   }
+};
+
+static volatile sig_atomic_t running = 1;
+static volatile sig_atomic_t reload_requested = 0;
+
+/*******************************************************************************
+ *  \brief  Records SIGHUP as a reload, and SIGINT or SIGTERM as a stop. Both
+ *          are blocked while reading, so are only seen between reads.
+ */
+static void handle_signal
+(
+    int signal_number   /*!< - The signal received  */
+)
+{
+    if (SIGHUP == signal_number)
+    {
+        reload_requested = 1;
+    }
+    else
+    {
+        running = 0;
+    }
+}
+
+/*******************************************************************************
+ *  \brief  Prints the usage information.
+ */
+static void print_usage
+(
+    const char *name    /*!< - The application name         */
+)
+{
+    fprintf(stderr, "kdht version %s\n\n", VERSION);
+    fprintf(stderr, "Usage: %s [options] <pin>[,<pin>...] [<tries>]\n", name);
+    fprintf(stderr, "       %s --config <file> [options]\n\n", name);
+    fprintf(stderr, "Description:\n\tPin is the wiringPi pin number (default 7 (GPIO 4)).\n");
+    fprintf(stderr, "\tTries is the number of times to try to obtain a read (default %d) [Optional]\n", DEFAULT_TRIES);
+    fprintf(stderr, "\nOptions:\n");
+    fprintf(stderr, "\t--config <file>       Read the options and the pins from the file, SIGHUP reloads the pins\n");
+    fprintf(stderr, "\t--format <fmt>        Output written to stdout: human, json, csv or influx (default human)\n");
+    fprintf(stderr, "\t--watch <seconds>     Keep reading every interval (minimum %ds)\n", MIN_WATCH_INTERVAL);
+    fprintf(stderr, "\t--tries <count>       The number of times to try to obtain a read (default %d)\n", DEFAULT_TRIES);
+    fprintf(stderr, "\t--retry-delay <ms>    The wait between tries (default %d)\n", DEFAULT_RETRY_DELAY);
+    fprintf(stderr, "\t--model <model>       The sensor model: auto, dht11, dht22, am2302 or dht21 (default auto)\n");
+    fprintf(stderr, "\t--offset <temp>[:<humidity>] Calibration added to every valid reading\n");
+    fprintf(stderr, "\t--max-interval <seconds> Read less often, up to this, while readings are stable\n");
+    fprintf(stderr, "\t--adapt-band <temp>[:<humidity>] Change per read that brings reads closer (default %.1f:%.1f)\n",
+        DEFAULT_ADAPT_TEMPERATURE, DEFAULT_ADAPT_HUMIDITY);
+    fprintf(stderr, "\t--gpio <backend>      How the pins are read: auto, wiringpi or chardev (default auto)\n");
+    fprintf(stderr, "\t--iio <directory>     Read through the kernel's dht11 driver, i.e. /sys/bus/iio/devices/iio:device0\n");
+    fprintf(stderr, "\t--i2c <bus>[:<address>] Read an AM2320/AM2315 on the I2C bus, i.e. 1 or /dev/i2c-1\n");
+    fprintf(stderr, "\t--filter <readings>   Report the median of this many valid readings, 2 to %d\n",
+        MAX_FILTER_WINDOW);
+    fprintf(stderr, "\t--readers <count>     Read on this many threads, one per core if 0 (default 1)\n");
+    fprintf(stderr, "\t--mqtt <host[:port]>  Publish each cycle's readings to an MQTT broker\n");
+    fprintf(stderr, "\t--mqtt-topic <topic>  The topic to publish to (default %s)\n", DEFAULT_MQTT_TOPIC);
+    fprintf(stderr, "\t--mqtt-spool <file>   Where undelivered messages are kept (default %s)\n", DEFAULT_MQTT_SPOOL);
+    fprintf(stderr, "\t--statsd <host[:port]> Send metrics to a StatsD server over UDP\n");
+    fprintf(stderr, "\t--statsd-prefix <name> The metric name prefix (default %s)\n", DEFAULT_STATSD_PREFIX);
+    fprintf(stderr, "\t--prom-textfile <dir> Write kdht_<pin>.prom for the node-exporter textfile collector\n");
+    fprintf(stderr, "\t--stream <address>   Stream readings to kdht-aggregator, host:port or unix:<path>\n");
+    fprintf(stderr, "\t--node <name>         This node's name in the stream (default the host name)\n");
+    fprintf(stderr, "\t--deadband [pin=]<band> Only publish changes above <temp>[:<humidity>], may be repeated\n");
+    fprintf(stderr, "\t--heartbeat <seconds> With --deadband, publish at least this often (default %d)\n", DEFAULT_HEARTBEAT);
+    fprintf(stderr, "\t--rules <file>        Raise alerts from the rules in the file\n");
+    fprintf(stderr, "\t--sink <file.so[:args]> Load a sink plugin, may be repeated\n");
+    fprintf(stderr, "\t--sink-policy <policy> When a following plugin's queue is full: drop or block (default drop)\n");
+    fprintf(stderr, "\t--health              Report the health of the pins, every pin read before if none given\n");
+    fprintf(stderr, "\t--scan                Look for sensors on the pins, every free header pin if none given\n");
+    fprintf(stderr, "\t--max-age <seconds>   Answer a single read with a reading this recent, if every pin has one\n");
+    fprintf(stderr, "\t--calibrate           Time the capture loop of each backend on the first pin again and cache it\n");
+}
+
+/*******************************************************************************
+ *  \brief  Applies an option from the command line or the configuration file.
+ *  \return Zero if the option is not valid, otherwise 1.
+ */
+static int apply_option
+(
+    Options *options,   /*!<INOUT - The options to update           */
+    const int opt,      /*!<IN    - The option, as in long_options  */
+    const char *arg     /*!<IN    - The option argument, kept       */
+)
+{
+    switch (opt)
+    {
+        case 'f':
+            if (!parse_output_format(arg, &options->format))
+            {
+                fprintf(stderr, "Invalid format supplied: %s\n", arg);
+                return 0;
+            }
+            break;
+
+        case 'w':
+            options->defaults.interval = atoi(arg);
+            if (options->defaults.interval < MIN_WATCH_INTERVAL)
+            {
+                fprintf(stderr, "Invalid watch interval, the minimum is %ds\n",
+                    MIN_WATCH_INTERVAL);
+                return 0;
+            }
+            break;
+
+        case 'c':
+            options->config_path = arg;
+            break;
+
+        case 'T':
+            options->defaults.tries = atoi(arg);
+            if (options->defaults.tries < 1)
+            {
+                fprintf(stderr, "Invalid tries supplied\n");
+                return 0;
+            }
+            break;
+
+        case 'R':
+            options->defaults.retry_delay_ms = atoi(arg);
+            if (options->defaults.retry_delay_ms < 0)
+            {
+                fprintf(stderr, "Invalid retry delay supplied: %s\n", arg);
+                return 0;
+            }
+            break;
+
+        case 'M':
+            if (!parse_model(arg, &options->defaults.model))
+            {
+                fprintf(stderr, "Unsupported sensor model: %s\n", arg);
+                return 0;
+            }
+            break;
+
+        case 'G':
+            if (!parse_gpio_backend(arg, &options->defaults.gpio))
+            {
+                fprintf(stderr, "Unsupported GPIO backend: %s\n", arg);
+                return 0;
+            }
+            break;
+
+        case 'O':
+            if (!parse_value_pair(arg, &options->defaults.temperature_offset,
+                    &options->defaults.humidity_offset))
+            {
+                fprintf(stderr, "Invalid offset supplied: %s\n", arg);
+                return 0;
+            }
+            break;
+
+        case 'X':
+            options->defaults.max_interval = atoi(arg);
+            if (options->defaults.max_interval < MIN_WATCH_INTERVAL)
+            {
+                fprintf(stderr, "Invalid max interval supplied: %s\n", arg);
+                return 0;
+            }
+            break;
+
+        case 'A':
+            if (!parse_value_pair(arg, &options->defaults.adapt_temperature,
+                    &options->defaults.adapt_humidity) ||
+                options->defaults.adapt_temperature <= 0.0f ||
+                options->defaults.adapt_humidity <= 0.0f)
+            {
+                fprintf(stderr, "Invalid adapt band supplied: %s\n", arg);
+                return 0;
+            }
+            break;
+
+        case 'F':
+            options->defaults.filter_window = atoi(arg);
+            if (options->defaults.filter_window < 0 || 1 == options->defaults.filter_window ||
+                options->defaults.filter_window > MAX_FILTER_WINDOW)
+            {
+                fprintf(stderr, "Invalid filter supplied: %s\n", arg);
+                return 0;
+            }
+            break;
+
+        case 'I':
+            if (strlen(arg) >= sizeof(options->defaults.iio))
+            {
+                fprintf(stderr, "Invalid IIO device supplied: %s\n", arg);
+                return 0;
+            }
+            snprintf(options->defaults.iio, sizeof(options->defaults.iio), "%s", arg);
+            break;
+
+        case 'B':
+            if (!parse_i2c_device(arg, &options->defaults))
+            {
+                fprintf(stderr, "Invalid I2C sensor supplied: %s\n", arg);
+                return 0;
+            }
+            break;
+
+        case 'N':
+            options->readers = atoi(arg);
+            if (options->readers < 0 || options->readers > MAX_READERS)
+            {
+                fprintf(stderr, "Invalid readers supplied, at most %d\n", MAX_READERS);
+                return 0;
+            }
+            break;
+
+        case 'm':
+            options->mqtt_server = arg;
+            break;
+
+        case 't':
+            options->mqtt_topic = arg;
+            break;
+
+        case 's':
+            options->mqtt_spool = arg;
+            break;
+
+        case 'S':
+            options->statsd_server = arg;
+            break;
+
+        case 'P':
+            options->statsd_prefix = arg;
+            break;
+
+        case 'p':
+            options->prom_directory = arg;
+            break;
+
+        case 'a':
+            options->stream_address = arg;
+            break;
+
+        case 'n':
+            options->node = arg;
+            break;
+
+        case 'D':
+            if (options->deadband_count > MAX_PINS)
+            {
+                fprintf(stderr, "Too many deadbands supplied, at most %d\n", MAX_PINS + 1);
+                return 0;
+            }
+            options->deadbands[options->deadband_count++] = arg;
+            break;
+
+        case 'H':
+            options->heartbeat = atol(arg);
+            if (options->heartbeat < 1)
+            {
+                fprintf(stderr, "Invalid heartbeat supplied: %s\n", arg);
+                return 0;
+            }
+            break;
+
+        case 'r':
+            if (!rules_load(arg, &options->rules))
+            {
+                return 0;
+            }
+            break;
+
+        case 'k':
+            if (options->plugin_count >= MAX_PLUGINS)
+            {
+                fprintf(stderr, "Too many sinks supplied, at most %d\n", MAX_PLUGINS);
+                return 0;
+            }
+            options->plugin_policies[options->plugin_count] = options->policy;
+            options->plugins[options->plugin_count++] = arg;
+            break;
+
+        case 'K':
+            if (!parse_sink_policy(arg, &options->policy))
+            {
+                fprintf(stderr, "Invalid sink policy supplied: %s\n", arg);
+                return 0;
+            }
+            break;
+
+        case 'E':
+            options->health = 1;
+            break;
+
+        case 'Z':
+            options->scan = 1;
+            break;
+
+        case 'L':
+            options->calibrate = 1;
+            break;
+
+        case 'Y':
+            options->max_age = atoi(arg);
+            if (options->max_age < 1)
+            {
+                fprintf(stderr, "Invalid maximum age supplied: %s\n", arg);
+                return 0;
+            }
+            break;
+
+        default:
+            return 0;
+    }
+    return 1;
+}
+
+/*******************************************************************************
+ *  \brief  Applies an option given in the configuration file, outside of any
+ *          pin section. The key is the long option name.
+ *  \return Zero if the option is not valid, otherwise 1.
+ */
+static int apply_global_setting
+(
+    const char *key,    /*!<IN    - The long option name        */
+    const char *value,  /*!<IN    - The option argument         */
+    void *arg           /*!<INOUT - The Options to update       */
+)
+{
+    const struct option *option;
+    for (option = long_options; NULL != option->name; ++option)
+    {
+        if (0 == strcmp(option->name, key) && required_argument == option->has_arg &&
+            'c' != option->val)
+        {
+            /* The line buffer is reused, options keep their arguments */
+            char *copy = strdup(value);
+            return (NULL != copy) && apply_option((Options *)arg, option->val, copy);
+        }
+    }
+    return 0;
+}
+
+/*******************************************************************************
+ *  \brief  Prints the health of each pin from its saved statistics, without
+ *          reading the sensors.
+ *  \return Zero if there are no pins to report, otherwise 1.
+ */
+static int report_health
+(
+    const Options *options,     /*!<IN - The output format          */
+    const Settings *settings    /*!<IN - The pins to report on      */
+)
+{
+    PinStats stats;
+    int i;
+
+    if (0 == settings->count)
+    {
+        fprintf(stderr, "No pins have been read\n");
+        return 0;
+    }
+    for (i = 0; i < settings->count; ++i)
+    {
+        stats_load(settings->pins[i].pin, &stats);
+        print_health(stdout, options->format, stats.pin, &stats.health);
+    }
+    return 1;
+}
+
+/*******************************************************************************
+ *  \brief  Probes the pins for sensors and prints what was found on each.
+ *  \return The number of pins with a sensor.
+ */
+static int scan_pins
+(
+    const Options *options,     /*!<IN - The output format          */
+    const Settings *settings    /*!<IN - The pins to probe          */
+)
+{
+    ScanResult results[MAX_PINS];
+    int found;
+    int i;
+
+    if (!gpio_setup())
+    {
+        return 0;
+    }
+    found = scan_sensors(settings, results);
+    for (i = 0; i < settings->count; ++i)
+    {
+        print_scan_result(stdout, options->format, &results[i]);
+    }
+    if (0 == found)
+    {
+        fprintf(stderr, "No sensors found\n");
+    }
+    return found;
+}
+
+/*******************************************************************************
+ *  \brief  Sets the capture loop's calibration on each backend from the
+ *          cache, or times the loop on the first GPIO pin for the backends
+ *          this host has none cached for, or all of them if a measurement is
+ *          asked for. A backend the pin cannot be opened with is left at the
+ *          defaults; opening a pin with wiringPi sets it up on first use.
+ *          Privileges must not yet be dropped, for the real time priority,
+ *          the gpiochip, the cache and that first wiringPi setup.
+ *  \return Zero if a measurement was asked for and none made, otherwise 1.
+ */
+static int calibrate_loop
+(
+    const Settings *settings,   /*!<IN - The pins, the first GPIO one is read */
+    const int force             /*!<IN - Non zero to measure even if cached   */
+)
+{
+    GpioLine line;
+    int measured = 0;
+    int backend;
+    int i;
+
+    for (i = 0; i < settings->count; ++i)
+    {
+        if ('\0' == settings->pins[i].iio[0] && '\0' == settings->pins[i].i2c[0])
+        {
+            break;
+        }
+    }
+    for (backend = GPIO_WIRINGPI; backend < GPIO_BACKEND_COUNT; ++backend)
+    {
+        Calibration *calibration = &calibrations[backend];
+        calibration_init(calibration, (GpioBackend)backend);
+        if ((!force && calibration_load(calibration)) || i == settings->count ||
+            !gpio_open(&line, (GpioBackend)backend, settings->pins[i].pin))
+        {
+            continue;
+        }
+        if (calibration_measure(calibration, &line))
+        {
+            if (calibration->jitter_us > calibration->period_us)
+            {
+                fprintf(stderr, "The capture loop's jitter is high, reads may fail: ");
+                print_calibration(stderr, calibration);
+            }
+            calibration_save(calibration);
+            backends_measured = 1;
+            ++measured;
+        }
+        gpio_close(&line);
+    }
+    return !force || measured > 0;
+}
+
+/*******************************************************************************
+ *  \brief  Compares the capture loops of two backends, a measured one ahead
+ *          of one left at the defaults.
+ *  \return Non zero if the first is the better.
+ */
+static int better_backend
+(
+    const GpioBackend first,    /*!< - A backend        */
+    const GpioBackend second    /*!< - Another backend  */
+)
+{
+    const Calibration *a = &calibrations[first];
+    const Calibration *b = &calibrations[second];
+    if (a->measured != b->measured)
+    {
+        return a->measured;
+    }
+    return calibration_score(a) < calibration_score(b);
+}
+
+/*******************************************************************************
+ *  \brief  Opens a GPIO pin for its backend. With auto, the backend chosen
+ *          before is kept while it can be opened and the backends have not
+ *          been measured again; otherwise the one with the best capture loop
+ *          that the pin can be opened with is chosen and kept. A pin that
+ *          none of the allowed backends can open is left closed, its reads
+ *          fail as invalid and it is tried again on the next reload.
+ */
+static void select_backend
+(
+    PinState *state,            /*!<INOUT - The pin state                   */
+    const PinConfig *config     /*!<IN    - The pin's settings              */
+)
+{
+    GpioBackend order[GPIO_BACKEND_COUNT];
+    int count = 0;
+    int first;
+    int i;
+    int j;
+
+    if ('\0' != config->iio[0] || '\0' != config->i2c[0])
+    {
+        gpio_close(&state->line);
+        return;
+    }
+    if (GPIO_AUTO != config->gpio)
+    {
+        order[count++] = config->gpio;
+    }
+    else
+    {
+        if (GPIO_AUTO != state->stats.backend && !backends_measured)
+        {
+            order[count++] = state->stats.backend;
+        }
+        /* Then the rest, best first */
+        first = count;
+        for (i = GPIO_WIRINGPI; i < GPIO_BACKEND_COUNT; ++i)
+        {
+            if (first > 0 && (GpioBackend)i == order[0])
+            {
+                continue;
+            }
+            for (j = count; j > first && better_backend((GpioBackend)i, order[j - 1]); --j)
+            {
+                order[j] = order[j - 1];
+            }
+            order[j] = (GpioBackend)i;
+            ++count;
+        }
+    }
+    if (GPIO_AUTO != state->line.backend && order[0] == state->line.backend)
+    {
+        return;
+    }
+
+    gpio_close(&state->line);
+    for (i = 0; i < count; ++i)
+    {
+        if (gpio_open(&state->line, order[i], state->pin))
+        {
+            break;
+        }
+    }
+    if (GPIO_AUTO == state->line.backend)
+    {
+        fprintf(stderr, "GPIO %d cannot be opened with %s, it will not be read\n",
+            state->pin, (GPIO_AUTO == config->gpio) ? "any backend" :
+            get_gpio_backend_name(config->gpio));
+        return;
+    }
+    fprintf(stderr, "Reading GPIO %d through %s\n", state->pin,
+        get_gpio_backend_name(state->line.backend));
+    if (GPIO_AUTO == config->gpio)
+    {
+        state->stats.backend = state->line.backend;
+    }
+}
+
+/*******************************************************************************
+ *  \brief  Checks whether wiringPi is likely to be needed: for a GPIO pin
+ *          set to use it, or left to choose while the character device has
+ *          not measured better.
+ *  \return Non zero if it is.
+ */
+static int needs_wiringpi
+(
+    const Settings *settings    /*!<IN - The pins   */
+)
+{
+    int i;
+    for (i = 0; i < settings->count; ++i)
+    {
+        const PinConfig *config = &settings->pins[i];
+        if ('\0' == config->iio[0] && '\0' == config->i2c[0] &&
+            (GPIO_WIRINGPI == config->gpio || (GPIO_AUTO == config->gpio &&
+                !better_backend(GPIO_CHARDEV, GPIO_WIRINGPI))))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*******************************************************************************
+ *  \brief  Gets a pin's latest valid reading if it is recent: the one in
+ *          its shared memory slot, or failing that the one kept with its
+ *          statistics.
+ *  \return Non zero if there is one no older than the given age.
+ */
+static int get_recent_reading
+(
+    const int pin,          /*!<IN  - The pin                       */
+    const int max_age,      /*!<IN  - The oldest to take, seconds   */
+    SensorReport *report    /*!<OUT - The reading, as a report      */
+)
+{
+    KdhtReading reading;
+    PinStats stats;
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    memset(report, 0, sizeof(*report));
+    report->smoothed.result = RESULT_INVALID;
+    report->forecast.result = RESULT_INVALID;
+    report->pin = pin;
+    if (kdht_wait_newer(pin, 0, 0, &reading) > 0 &&
+        RESULT_OK == reading.values.result &&
+        now.tv_sec - reading.timestamp.tv_sec <= max_age)
+    {
+        report->values = reading.values;
+        report->attempts = reading.attempts;
+        report->timestamp = reading.timestamp;
+        return 1;
+    }
+    stats_load(pin, &stats);
+    if (RESULT_OK == stats.last.result && now.tv_sec - stats.last_time <= max_age)
+    {
+        report->values = stats.last;
+        report->timestamp.tv_sec = stats.last_time;
+        return 1;
+    }
+    return 0;
+}
+
+/*******************************************************************************
+ *  \brief  Answers a single read of every pin with recent readings, without
+ *          taking the locks or touching the GPIO. Nothing is printed unless
+ *          every pin has one.
+ *  \return Non zero if the read was answered.
+ */
+static int answer_from_recent
+(
+    const Options *options,     /*!<IN - The maximum age and the format */
+    const Settings *settings    /*!<IN - The pins                       */
+)
+{
+    static SensorReport reports[MAX_PINS];
+    int i;
+
+    for (i = 0; i < settings->count; ++i)
+    {
+        if (0 != settings->pins[i].interval ||
+            !get_recent_reading(settings->pins[i].pin, options->max_age, &reports[i]))
+        {
+            return 0;
+        }
+    }
+    for (i = 0; i < settings->count; ++i)
+    {
+        print_report(stdout, options->format, &reports[i]);
+    }
+    return 1;
+}
+
+/*******************************************************************************
+ *  \brief  Builds the pin settings from the comma separated pin list on the
+ *          command line, i.e. "7,28".
+ *  \return The number of pins found, zero if the list is not valid.
+ */
+static int parse_pins
+(
+    char *list,                 /*!<IN  - The pin list to parse         */
+    const Options *options,     /*!<IN  - The default pin settings      */
+    Settings *settings          /*!<OUT - The pin settings              */
+)
+{
+    char *saveptr = NULL;
+    char *token = strtok_r(list, ",", &saveptr);
+    settings->count = 0;
+    while (NULL != token)
+    {
+        if (settings->count >= MAX_PINS)
+        {
+            fprintf(stderr, "Too many pins supplied, at most %d\n", MAX_PINS);
+            return 0;
+        }
+        settings->pins[settings->count] = options->defaults;
+        settings->pins[settings->count].pin = atoi(token);
+        ++settings->count;
+        token = strtok_r(NULL, ",", &saveptr);
+    }
+    return settings->count;
+}
+
+/*******************************************************************************
+ *  \brief  Checks the pin settings and fills in the deadbands given on the
+ *          command line for pins whose section has none. A pin's own
+ *          --deadband wins over one for all pins, the last one given wins
+ *          otherwise.
+ *  \return Zero if the settings are not valid, otherwise 1.
+ */
+static int resolve_settings
+(
+    const Options *options,     /*!<IN    - The command line options    */
+    Settings *settings          /*!<INOUT - The pin settings            */
+)
+{
+    int i;
+    int j;
+    for (i = 0; i < settings->count; ++i)
+    {
+        PinConfig *config = &settings->pins[i];
+        int pin_specific = 0;
+
+        for (j = 0; j < i; ++j)
+        {
+            if (settings->pins[j].pin == config->pin)
+            {
+                fprintf(stderr, "Pin %d is listed twice\n", config->pin);
+                return 0;
+            }
+        }
+        if (0 != config->interval && config->interval < MIN_WATCH_INTERVAL)
+        {
+            fprintf(stderr, "Invalid interval for pin %d, the minimum is %ds\n",
+                config->pin, MIN_WATCH_INTERVAL);
+            return 0;
+        }
+        if (0 != config->max_interval && config->max_interval < config->interval)
+        {
+            fprintf(stderr, "The max interval for pin %d is below its interval\n",
+                config->pin);
+            return 0;
+        }
+
+        for (j = 0; j < options->deadband_count && !config->deadband_set; ++j)
+        {
+            int band_pin;
+            float temperature;
+            float humidity;
+            if (!parse_deadband(options->deadbands[j], &band_pin, &temperature, &humidity))
+            {
+                fprintf(stderr, "Invalid deadband supplied: %s\n", options->deadbands[j]);
+                return 0;
+            }
+            if ((band_pin == config->pin) || (band_pin < 0 && !pin_specific))
+            {
+                config->temperature_band = temperature;
+                config->humidity_band = humidity;
+                pin_specific = (band_pin >= 0);
+            }
+        }
+    }
+    return 1;
+}
+
+/*******************************************************************************
+ *  \brief  Works out which sinks a pin's readings go to.
+ *  \return The sink mask, SINK_MASK_ALL if the pin does not list its sinks.
+ */
+static unsigned int resolve_sinks
+(
+    const PinConfig *config     /*!<IN - The pin's settings */
+)
+{
+    char names[MAX_SINK_NAMES_LENGTH];
+    char *saveptr = NULL;
+    char *name;
+    unsigned int mask = 0;
+
+    if (0 == config->sinks[0])
+    {
+        return SINK_MASK_ALL;
+    }
+    snprintf(names, sizeof(names), "%s", config->sinks);
+    for (name = strtok_r(names, " \t,", &saveptr); NULL != name;
+         name = strtok_r(NULL, " \t,", &saveptr))
+    {
+        const int bit = sink_find(name);
+        if (bit < 0)
+        {
+            fprintf(stderr, "Pin %d: there is no %s sink, ignoring it\n",
+                config->pin, name);
+        }
+        else
+        {
+            mask |= 1U << bit;
+        }
+    }
+    return mask;
+}
+
+/*******************************************************************************
+ *  \brief  Gets the mask bit of a sink by name.
+ *  \return The bit, zero if there is no such sink.
+ */
+static unsigned int sink_bit
+(
+    const char *name    /*!<IN - The sink name  */
+)
+{
+    const int bit = sink_find(name);
+    return (bit < 0) ? 0 : 1U << bit;
+}
+
+/*******************************************************************************
+ *  \brief  Applies the settings that a reload may change: on change
+ *          publishing, the read interval, the filter, the GPIO backend and
+ *          the sinks the pin's readings go to. The filter keeps its readings
+ *          unless its window changes.
+ */
+static void configure_pin
+(
+    PinState *state,            /*!<INOUT - The pin state                   */
+    const PinConfig *config,    /*!<IN    - The pin's settings              */
+    const Options *options      /*!<IN    - The options                     */
+)
+{
+    publish_init(&state->publish, state->pin, config->temperature_band,
+        config->humidity_band, options->heartbeat);
+    adaptive_init(&state->adaptive, config->interval, config->max_interval,
+        config->adapt_temperature, config->adapt_humidity, &state->stats);
+    if (state->filter.temperature.window != config->filter_window)
+    {
+        reading_filter_init(&state->filter, config->filter_window);
+    }
+    if (0 != strcmp(state->iio.path, config->iio))
+    {
+        iio_close(&state->iio);
+        iio_init(&state->iio);
+        if ('\0' != config->iio[0] && !iio_open(&state->iio, config->iio))
+        {
+            fprintf(stderr, "Pin %d will be read once %s is available\n",
+                state->pin, config->iio);
+        }
+    }
+    select_backend(state, config);
+    state->sink_mask = resolve_sinks(config);
+}
+
+/*******************************************************************************
+ *  \brief  Sets up the state of a pin once the lock is held: statistics,
+ *          alert rules and then its settings.
+ */
+static void start_pin
+(
+    PinState *state,            /*!<INOUT - The pin state, lock and slot set */
+    const PinConfig *config,    /*!<IN    - The pin's settings              */
+    const Options *options      /*!<IN    - The options                     */
+)
+{
+    state->pin = config->pin;
+    state->last_read = (SensorValues)INVALID_VALUES;
+    iio_init(&state->iio);
+    gpio_init(&state->line);
+    stats_load(state->pin, &state->stats);
+    rules_bind(&options->rules, state->pin, &state->stats, &state->rules);
+    configure_pin(state, config, options);
+}
+
+/*******************************************************************************
+ *  \brief  Releases a pin's lock and shared memory.
+ */
+static void stop_pin
+(
+    PinState *state     /*!<INOUT - The pin to stop */
+)
+{
+    if (state->lockfd >= 0)
+    {
+        close_lockfile(state->lockfd);
+        state->lockfd = -1;
+    }
+    iio_close(&state->iio);
+    gpio_close(&state->line);
+    shm_destroy(state->slot);
+    state->slot = NULL;
+}
+
+/*******************************************************************************
+ *  \brief  Rereads the pin sections of the configuration file. Pins kept keep
+ *          their lock, state and place in the schedule, new pins are read
+ *          straight away and pins removed are released. Nothing changes if
+ *          the file is not valid. This is only called between reads.
+ */
+static void reload_settings
+(
+    const Options *options,     /*!<IN    - The options                 */
+    Settings *settings,         /*!<INOUT - The pin settings table      */
+    PinState *pins,             /*!<INOUT - The pin states              */
+    Schedule *schedule          /*!<INOUT - The read schedule           */
+)
+{
+    static Settings loaded;
+    static PinState previous[MAX_PINS];
+    ScheduleEntry saved[MAX_PINS];
+    int kept[MAX_PINS];
+    char buffer[MAX_PATH_LENGTH];
+    ScheduleEntry entry;
+    struct timespec now;
+    int count = 0;
+    int i;
+    int j;
+    PinConfig section_defaults = options->defaults;
+
+    if (0 == section_defaults.interval)
+    {
+        section_defaults.interval = DEFAULT_INTERVAL;
+    }
+
+    fprintf(stderr, "Reloading %s\n", options->config_path);
+    if (!settings_load(options->config_path, &section_defaults, &loaded, NULL, NULL) ||
+        !resolve_settings(options, &loaded) || 0 == loaded.count)
+    {
+        fprintf(stderr, "The configuration was not reloaded\n");
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    memcpy(previous, pins, sizeof(PinState) * (size_t)settings->count);
+    for (i = 0; i < settings->count; ++i)
+    {
+        kept[i] = 0;
+        if (!schedule_remove(schedule, i, &saved[i]))
+        {
+            memset(&saved[i], 0, sizeof(saved[i]));
+            saved[i].due = now;
+        }
+    }
+
+    for (i = 0; i < loaded.count; ++i)
+    {
+        const PinConfig *config = &loaded.pins[i];
+        PinState *state = &pins[count];
+        for (j = 0; j < settings->count && previous[j].pin != config->pin; ++j)
+        {
+        }
+
+        if (j < settings->count)
+        {
+            *state = previous[j];
+            kept[j] = 1;
+            configure_pin(state, config, options);
+        }
+        else
+        {
+            memset(state, 0, sizeof(*state));
+            get_lockfile_name(config->pin, buffer, MAX_PATH_LENGTH);
+            state->lockfd = try_lockfile(buffer);
+            if (state->lockfd < 0)
+            {
+                fprintf(stderr, "Pin %d is not being read\n", config->pin);
+                continue;
+            }
+            state->slot = shm_create(config->pin);
+            start_pin(state, config, options);
+        }
+        settings->pins[count] = *config;
+        if (j < settings->count)
+        {
+            entry = saved[j];
+        }
+        else
+        {
+            memset(&entry, 0, sizeof(entry));
+            entry.due = now;
+        }
+        entry.index = count;
+        schedule_add(schedule, &entry);
+        ++count;
+    }
+
+    for (j = 0; j < settings->count; ++j)
+    {
+        if (!kept[j])
+        {
+            fprintf(stderr, "No longer reading GPIO %d\n", previous[j].pin);
+            stop_pin(&previous[j]);
+        }
+    }
+    settings->count = count;
+    fprintf(stderr, "Reading %d pins\n", count);
+}
+
+/*******************************************************************************
+ *  \brief  Waits until a read is made or the given monotonic time, with
+ *          SIGHUP, SIGINT and SIGTERM unblocked so that they can cut the wait
+ *          short.
+ */
+static void wait_for_reads
+(
+    const int event_fd,             /*!< - Readable once reads are made         */
+    const struct timespec *due,     /*!< - When to stop waiting, NULL for never */
+    const sigset_t *mask            /*!< - The signal mask while waiting        */
+)
+{
+    struct pollfd event = { event_fd, POLLIN, 0 };
+    struct timespec now;
+    struct timespec remaining;
+    if (NULL != due)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        remaining.tv_sec = due->tv_sec - now.tv_sec;
+        remaining.tv_nsec = due->tv_nsec - now.tv_nsec;
+        if (remaining.tv_nsec < 0)
+        {
+            remaining.tv_nsec += 1000000000L;
+            --remaining.tv_sec;
+        }
+        if (remaining.tv_sec < 0)
+        {
+            return;
+        }
+    }
+    (void)ppoll(&event, 1, (NULL != due) ? &remaining : NULL, mask);
+}
+
+/*******************************************************************************
+ *  \brief  Main function.
+ *  \return Result of the sensor evaluation.
+ */
+int main
+(
+    int argc,       /*!< - The number of arguments              */
+    char *argv[]    /*!< - The collection of argument strings   */
+)
+{
+    static Options options;
+    static Settings settings;
+    static PinState pins[MAX_PINS];
+    static Schedule schedule;
+    static ScheduleTimer timers[MAX_PINS];
+    static ReaderPool pool;
+    static ReadJob jobs[MAX_PINS];
+    static FusionTable fusion;
+    static I2cTable i2c;
+    ReadContext context;
+    ReadJob *job;
+    int in_flight = 0;
+    static StatsdClient statsd;
+    static OutputSink output;
+    Alert alerts[MAX_RULES];
+    int alert_count;
+    unsigned int metric_mask;
+    unsigned int mask;
+    KdhtReading reading;
+    MqttSink *mqtt = NULL;
+    StreamSink *stream = NULL;
+    char default_pin[8];
+    char *pin_list = default_pin;
+    char hostname[64];
+    int opt;
+    int i;
+    int j;
+    int longest_interval = 0;
+    int reads_in_cycle = 0;
+    char buffer[MAX_PATH_LENGTH];
+    ScheduleEntry entry;
+    struct timespec now;
+    struct timespec due;
+    struct sigaction action;
+    sigset_t blocked;
+    sigset_t unblocked;
+
+    options.format = FORMAT_HUMAN;
+    options.defaults.model = MODEL_AUTO;
+    options.defaults.tries = DEFAULT_TRIES;
+    options.defaults.retry_delay_ms = DEFAULT_RETRY_DELAY;
+    options.defaults.temperature_band = -1.0f;
+    options.defaults.humidity_band = -1.0f;
+    options.defaults.adapt_temperature = DEFAULT_ADAPT_TEMPERATURE;
+    options.defaults.adapt_humidity = DEFAULT_ADAPT_HUMIDITY;
+    options.heartbeat = DEFAULT_HEARTBEAT;
+    options.mqtt_topic = DEFAULT_MQTT_TOPIC;
+    options.mqtt_spool = DEFAULT_MQTT_SPOOL;
+    options.statsd_prefix = DEFAULT_STATSD_PREFIX;
+    options.policy = SINK_POLICY_DROP;
+
+    /* The configuration file is read first, so the command line wins */
+    opterr = 0;
+    while ((opt = getopt_long(argc, argv, "f:w:c:h", long_options, NULL)) != -1)
+    {
+        if ('c' == opt)
+        {
+            options.config_path = optarg;
+        }
+    }
+    if (NULL != options.config_path &&
+        !settings_load(options.config_path, &options.defaults, &settings,
+            apply_global_setting, &options))
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    opterr = 1;
+    optind = 0;
+    while ((opt = getopt_long(argc, argv, "f:w:c:h", long_options, NULL)) != -1)
+    {
+        if ('h' == opt)
+        {
+            print_usage(argv[0]);
+            exit(EXIT_SUCCESS);
+        }
+        if ('?' == opt || !apply_option(&options, opt, optarg))
+        {
+            print_usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (optind + 1 < argc)
+    {
+        options.defaults.tries = atoi(argv[optind + 1]);
+        if (options.defaults.tries < 1)
+        {
+            fprintf(stderr, "Invalid tries supplied\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (NULL != options.config_path && settings.count > 0)
+    {
+        /* Settings the pin sections leave out follow the command line, and
+         * configured pins are watched unless their interval says otherwise
+         */
+        PinConfig section_defaults = options.defaults;
+        if (0 == section_defaults.interval)
+        {
+            section_defaults.interval = DEFAULT_INTERVAL;
+        }
+        if (!settings_load(options.config_path, &section_defaults, &settings, NULL, NULL))
+        {
+            exit(EXIT_FAILURE);
+        }
+        if (optind < argc)
+        {
+            fprintf(stderr, "Using the pins from %s, not %s\n", options.config_path,
+                argv[optind]);
+        }
+    }
+    else if (options.health && optind >= argc)
+    {
+        /* Without any pins the report covers every pin read before */
+        int found[MAX_PINS];
+        settings.count = stats_find_pins(found, MAX_PINS);
+        for (i = 0; i < settings.count; ++i)
+        {
+            settings.pins[i] = options.defaults;
+            settings.pins[i].pin = found[i];
+        }
+    }
+    else if (options.scan && optind >= argc)
+    {
+        /* Without any pins every general purpose pin on the header is tried */
+        snprintf(buffer, sizeof(buffer), "%s", SCAN_DEFAULT_PINS);
+        if (0 == parse_pins(buffer, &options, &settings))
+        {
+            exit(EXIT_FAILURE);
+        }
+    }
+    else
+    {
+        snprintf(default_pin, sizeof(default_pin), "%d", DEFAULT_PIN);
+        if (optind >= argc)
+        {
+            if (NULL == options.config_path)
+            {
+                print_usage(argv[0]);
+            }
+        }
+        else
+        {
+            pin_list = argv[optind];
+        }
+        if (0 == parse_pins(pin_list, &options, &settings))
+        {
+            fprintf(stderr, "Invalid pins supplied\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (!resolve_settings(&options, &settings))
+    {
+        exit(EXIT_FAILURE);
+    }
+    if (options.health)
+    {
+        exit(report_health(&options, &settings) ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+    if (options.scan)
+    {
+        exit(scan_pins(&options, &settings) > 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+    if (options.calibrate)
+    {
+        /* Measured on the first pin, which must not be being read */
+        get_lockfile_name(settings.pins[0].pin, buffer, MAX_PATH_LENGTH);
+        i = try_lockfile(buffer);
+        if (i < 0)
+        {
+            fprintf(stderr, "Pin %d is in use\n", settings.pins[0].pin);
+            exit(EXIT_FAILURE);
+        }
+        j = calibrate_loop(&settings, 1);
+        close_lockfile(i);
+        for (i = GPIO_WIRINGPI; i < GPIO_BACKEND_COUNT; ++i)
+        {
+            print_calibration(stdout, &calibrations[i]);
+        }
+        exit(j ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    if (options.max_age > 0 && answer_from_recent(&options, &settings))
+    {
+        exit(EXIT_SUCCESS);
+    }
+
+    for (i = 0; i < settings.count; ++i)
+    {
+        fprintf(stderr, "Reading DHT21/22 sensor on GPIO %d\n", settings.pins[i].pin);
+        fprintf(stderr, "%d attempts will be made.\n", settings.pins[i].tries);
+        if (settings.pins[i].interval > longest_interval)
+        {
+            longest_interval = settings.pins[i].interval;
+        }
+        if (settings.pins[i].max_interval > longest_interval)
+        {
+            longest_interval = settings.pins[i].max_interval;
+        }
+    }
+
+    if (NULL != options.mqtt_server)
+    {
+        mqtt = mqtt_sink_create(options.mqtt_server, options.mqtt_topic, options.mqtt_spool,
+            longest_interval > 0 ? 2 * longest_interval + MQTT_KEEPALIVE_MARGIN :
+                MQTT_KEEPALIVE_MARGIN);
+        if (NULL == mqtt)
+        {
+            fprintf(stderr, "Invalid MQTT server supplied: %s\n", options.mqtt_server);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (NULL != options.stream_address)
+    {
+        if (NULL == options.node)
+        {
+            gethostname(hostname, sizeof(hostname));
+            hostname[sizeof(hostname) - 1] = '\0';
+            options.node = hostname;
+        }
+        stream = stream_sink_create(options.stream_address, options.node);
+        if (NULL == stream)
+        {
+            fprintf(stderr, "Invalid node name: %s\n", options.node);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (NULL != options.statsd_server &&
+        !statsd_init(&statsd, options.statsd_server, options.statsd_prefix))
+    {
+        fprintf(stderr, "Invalid StatsD server supplied: %s\n", options.statsd_server);
+        exit(EXIT_FAILURE);
+    }
+
+    /* The locks are held for as long as we run, as privileges are dropped */
+    for (i = 0; i < settings.count; ++i)
+    {
+        get_lockfile_name(settings.pins[i].pin, buffer, MAX_PATH_LENGTH);
+        pins[i].lockfd = open_lockfile(buffer);
+        pins[i].slot = shm_create(settings.pins[i].pin);
+    }
+
+    /* wiringPi is set up while privileged if a pin is likely to be read
+     * with it, and otherwise only if a pin opened later turns out to be
+     */
+    calibrate_loop(&settings, 0);
+    if (needs_wiringpi(&settings) && !gpio_setup())
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    if (setuid(getuid()) < 0)
+    {
+        perror("Dropping privileges failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* Signals are only taken by this thread and between reads, so a read is
+     * never cut short; every thread started from here on blocks them
+     */
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handle_signal;
+    sigaction(SIGHUP, &action, NULL);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    sigemptyset(&blocked);
+    sigaddset(&blocked, SIGHUP);
+    sigaddset(&blocked, SIGINT);
+    sigaddset(&blocked, SIGTERM);
+    sigprocmask(SIG_BLOCK, &blocked, &unblocked);
+    if (NULL == options.config_path)
+    {
+        /* Nothing to reload */
+        signal(SIGHUP, SIG_IGN);
+    }
+
+    /* Outputs each run on their own thread, so none can hold up a read */
+    output.fp = stdout;
+    output.format = options.format;
+    sink_add(&output_sink, &output, SINK_POLICY_BLOCK);
+    if (NULL != mqtt)
+    {
+        sink_add(&mqtt_sink, mqtt, SINK_POLICY_DROP);
+    }
+    if (NULL != options.statsd_server)
+    {
+        sink_add(&statsd_sink, &statsd, SINK_POLICY_DROP);
+    }
+    if (NULL != stream)
+    {
+        sink_add(&stream_sink, stream, SINK_POLICY_DROP);
+    }
+    if (NULL != options.prom_directory)
+    {
+        sink_add(&prometheus_sink, (void *)options.prom_directory, SINK_POLICY_DROP);
+    }
+    for (i = 0; i < options.plugin_count; ++i)
+    {
+        if (!sink_load(options.plugins[i], options.plugin_policies[i]))
+        {
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    /* The metrics count every read, the deadband only holds back readings */
+    metric_mask = sink_bit("statsd") | sink_bit("prometheus");
+
+    for (i = 0; i < settings.count; ++i)
+    {
+        start_pin(&pins[i], &settings.pins[i], &options);
+    }
+
+    /* Reads are made on real time reader threads, at most one per reader at
+     * a time, while this thread schedules them and passes on the results
+     */
+    fusion_init(&fusion, &settings);
+    i2c_init(&i2c, &settings);
+    context.pins = pins;
+    context.settings = &settings;
+    context.fusion = &fusion;
+    context.i2c = &i2c;
+    if (0 == reader_pool_start(&pool, options.readers, read_job, &context))
+    {
+        exit(EXIT_FAILURE);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    schedule_init(&schedule, timers, MAX_PINS, pool.count,
+        MIN_WATCH_INTERVAL * 1000, &now);
+    for (i = 0; i < settings.count; ++i)
+    {
+        memset(&entry, 0, sizeof(entry));
+        entry.due = now;
+        entry.index = i;
+        schedule_add(&schedule, &entry);
+    }
+
+    while (running || in_flight > 0)
+    {
+        while (NULL != (job = reader_pool_collect(&pool)))
+        {
+            const SensorReport *report = &job->report;
+            i = job->entry.index;
+            schedule_done(&schedule);
+            --in_flight;
+            ++reads_in_cycle;
+            if (RESULT_OK != report->values.result)
+            {
+                fprintf(stderr, "Values could not be obtained.\n");
+            }
+            if (NULL != pins[i].slot)
+            {
+                reading.pin = report->pin;
+                reading.values = report->values;
+                reading.attempts = report->attempts;
+                reading.timestamp = report->timestamp;
+                shm_publish(pins[i].slot, &reading);
+            }
+            mask = pins[i].sink_mask;
+            if (!publish_check(&pins[i].publish, report))
+            {
+                mask &= metric_mask;
+            }
+            if (0 != mask)
+            {
+                sink_publish_report(report, &pins[i].stats, mask);
+            }
+            /* Rules see every reading, whether published or not */
+            alert_count = rules_evaluate(&pins[i].rules, report, alerts);
+            for (j = 0; j < alert_count; ++j)
+            {
+                sink_publish_alert(&alerts[j], pins[i].sink_mask);
+            }
+
+            if (settings.pins[i].interval > 0)
+            {
+                /* Keep to the original cadence unless the read overran it,
+                 * the schedule keeps the pin's minimum gap either way
+                 */
+                entry = job->entry;
+                entry.due.tv_sec += adaptive_update(&pins[i].adaptive, report);
+                clock_gettime(CLOCK_MONOTONIC, &now);
+                if (entry.due.tv_sec < now.tv_sec)
+                {
+                    entry.due = now;
+                }
+                schedule_add(&schedule, &entry);
+            }
+        }
+
+        /* A reload moves the pins about, so waits for the reads in progress */
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (running && !reload_requested && schedule_expire(&schedule, &now, &entry))
+        {
+            jobs[entry.index].entry = entry;
+            reader_pool_submit(&pool, &jobs[entry.index], entry.index);
+            ++in_flight;
+            continue;
+        }
+
+        if (0 == in_flight)
+        {
+            /* Everything due has been read */
+            if (reads_in_cycle > 0)
+            {
+                sink_publish_cycle_end();
+                reads_in_cycle = 0;
+            }
+            if (reload_requested)
+            {
+                reload_requested = 0;
+                reload_settings(&options, &settings, pins, &schedule);
+                fusion_destroy(&fusion);
+                fusion_init(&fusion, &settings);
+                i2c_destroy(&i2c);
+                i2c_init(&i2c, &settings);
+                continue;
+            }
+            if (!running || !schedule_next_due(&schedule, &due))
+            {
+                break;
+            }
+            wait_for_reads(pool.event_fd, &due, &unblocked);
+        }
+        else
+        {
+            /* Only a read being made can free a reader */
+            wait_for_reads(pool.event_fd, (running && !reload_requested &&
+                schedule.active < schedule.max_active &&
+                schedule_next_due(&schedule, &due)) ? &due : NULL, &unblocked);
+        }
+    }
+    reader_pool_stop(&pool);
+    fusion_destroy(&fusion);
+    i2c_destroy(&i2c);
+    if (reads_in_cycle > 0)
+    {
+        sink_publish_cycle_end();
+    }
+
+    delay(100);
+    for (i = 0; i < settings.count; ++i)
+    {
+        stop_pin(&pins[i]);
+    }
+
+    /* The pins are free for the next reader while the outputs finish */
+    sink_shutdown();
 
     return 0;
 }
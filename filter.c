@@ -0,0 +1,251 @@
+/*------------------------------------------------------------------------------
+ *! \file   filter.c
+ *! \brief  Sliding window median filter over a pin's valid readings, to
+ *          suppress single readings that pass every check but are still
+ *          wrong.
+ *
+ *  A reading with a good checksum and in range can still be a one off spike.
+ *  With "filter <n>" a pin reports the median of its last n valid readings,
+ *  which follows a real change after about half the window and never passes
+ *  on a spike shorter than that. The values are kept in tenths, as the
+ *  sensor reports them, so the filter works in whole numbers throughout.
+ *------------------------------------------------------------------------------
+ *                   Kris Dunning ippie52@gmail.com 2016.
+ *------------------------------------------------------------------------------
+ */
+
+#include <string.h>
+
+#include "filter.h"
+
+#define LOWER   0   /* The max heap of the lower half */
+#define UPPER   1   /* The min heap of the upper half */
+
+/*******************************************************************************
+ *  \brief  Checks whether one slot belongs above another in a heap.
+ *  \return Non zero if slot a belongs above slot b.
+ */
+static int above
+(
+    const MedianFilter *filter, /*!< - The filter       */
+    const int heap,             /*!< - LOWER or UPPER   */
+    const int a,                /*!< - A ring slot      */
+    const int b                 /*!< - Another slot     */
+)
+{
+    return (LOWER == heap) ? filter->values[a] > filter->values[b] :
+        filter->values[a] < filter->values[b];
+}
+
+/*******************************************************************************
+ *  \brief  Puts a slot at a place in a heap.
+ */
+static void place
+(
+    MedianFilter *filter,   /*!< - The filter           */
+    const int heap,         /*!< - LOWER or UPPER       */
+    const int position,     /*!< - The place in the heap */
+    const int slot          /*!< - The ring slot        */
+)
+{
+    filter->heaps[heap][position] = slot;
+    filter->heap[slot] = heap;
+    filter->position[slot] = position;
+}
+
+/*******************************************************************************
+ *  \brief  Moves the slot at a place in a heap up or down to where it
+ *          belongs.
+ */
+static void sift
+(
+    MedianFilter *filter,   /*!< - The filter           */
+    const int heap,         /*!< - LOWER or UPPER       */
+    int position            /*!< - The place to sift    */
+)
+{
+    const int slot = filter->heaps[heap][position];
+    const int size = filter->sizes[heap];
+
+    while (position > 0 && above(filter, heap, slot, filter->heaps[heap][(position - 1) / 2]))
+    {
+        place(filter, heap, position, filter->heaps[heap][(position - 1) / 2]);
+        position = (position - 1) / 2;
+    }
+    for (;;)
+    {
+        int child = 2 * position + 1;
+        if (child >= size)
+        {
+            break;
+        }
+        if (child + 1 < size &&
+            above(filter, heap, filter->heaps[heap][child + 1], filter->heaps[heap][child]))
+        {
+            ++child;
+        }
+        if (!above(filter, heap, filter->heaps[heap][child], slot))
+        {
+            break;
+        }
+        place(filter, heap, position, filter->heaps[heap][child]);
+        position = child;
+    }
+    place(filter, heap, position, slot);
+}
+
+/*******************************************************************************
+ *  \brief  Adds a slot to a heap.
+ */
+static void push
+(
+    MedianFilter *filter,   /*!< - The filter       */
+    const int heap,         /*!< - LOWER or UPPER   */
+    const int slot          /*!< - The ring slot    */
+)
+{
+    const int position = filter->sizes[heap]++;
+    place(filter, heap, position, slot);
+    sift(filter, heap, position);
+}
+
+/*******************************************************************************
+ *  \brief  Takes a slot out of whichever heap it is in.
+ */
+static void remove_slot
+(
+    MedianFilter *filter,   /*!< - The filter       */
+    const int slot          /*!< - The ring slot    */
+)
+{
+    const int heap = filter->heap[slot];
+    const int position = filter->position[slot];
+    const int last = --filter->sizes[heap];
+
+    if (position != last)
+    {
+        place(filter, heap, position, filter->heaps[heap][last]);
+        sift(filter, heap, position);
+    }
+}
+
+/*******************************************************************************
+ *  \brief  Sets up a filter, which is off if the window is below 2.
+ */
+void median_filter_init
+(
+    MedianFilter *filter,   /*!<OUT - The filter                        */
+    const int window        /*!<IN  - The values to keep, at most 63    */
+)
+{
+    memset(filter, 0, sizeof(*filter));
+    filter->window = (window < 2) ? 0 :
+        (window > MAX_FILTER_WINDOW) ? MAX_FILTER_WINDOW : window;
+}
+
+/*******************************************************************************
+ *  \brief  Adds a value, dropping the oldest once the window is full.
+ *  \return The median of the values in the window, the value itself if the
+ *          filter is off. The median of an even number of values is the mean
+ *          of the middle two, rounded down.
+ */
+int median_filter_update
+(
+    MedianFilter *filter,   /*!<INOUT - The filter          */
+    const int value         /*!<IN    - The new value       */
+)
+{
+    const int slot = filter->oldest;
+    int lower;
+
+    if (0 == filter->window)
+    {
+        return value;
+    }
+    if (filter->count == filter->window)
+    {
+        remove_slot(filter, slot);
+    }
+    else
+    {
+        ++filter->count;
+    }
+    filter->oldest = (slot + 1) % filter->window;
+
+    filter->values[slot] = value;
+    if ((filter->sizes[LOWER] > 0) ? value <= filter->values[filter->heaps[LOWER][0]] :
+        (0 == filter->sizes[UPPER] || value <= filter->values[filter->heaps[UPPER][0]]))
+    {
+        push(filter, LOWER, slot);
+    }
+    else
+    {
+        push(filter, UPPER, slot);
+    }
+
+    /* The lower half holds the middle value when the count is odd */
+    while (filter->sizes[LOWER] > filter->sizes[UPPER] + 1)
+    {
+        const int moved = filter->heaps[LOWER][0];
+        remove_slot(filter, moved);
+        push(filter, UPPER, moved);
+    }
+    while (filter->sizes[UPPER] > filter->sizes[LOWER])
+    {
+        const int moved = filter->heaps[UPPER][0];
+        remove_slot(filter, moved);
+        push(filter, LOWER, moved);
+    }
+
+    lower = filter->values[filter->heaps[LOWER][0]];
+    if (filter->sizes[LOWER] > filter->sizes[UPPER])
+    {
+        return lower;
+    }
+    return lower + (filter->values[filter->heaps[UPPER][0]] - lower) / 2;
+}
+
+/*******************************************************************************
+ *  \brief  Converts a value to whole tenths, to the nearest.
+ *  \return The value in tenths.
+ */
+static int to_tenths
+(
+    const float value   /*!< - The value    */
+)
+{
+    return (int)(value * 10.0f + ((value < 0.0f) ? -0.5f : 0.5f));
+}
+
+/*******************************************************************************
+ *  \brief  Sets up a pin's filters, off if the window is below 2.
+ */
+void reading_filter_init
+(
+    ReadingFilter *filter,  /*!<OUT - The filters                       */
+    const int window        /*!<IN  - The readings to keep              */
+)
+{
+    median_filter_init(&filter->temperature, window);
+    median_filter_init(&filter->humidity, window);
+}
+
+/*******************************************************************************
+ *  \brief  Adds a valid reading to the filters and replaces it with the
+ *          medians. Anything but a valid reading is left alone.
+ */
+void reading_filter_apply
+(
+    ReadingFilter *filter,  /*!<INOUT - The pin's filters       */
+    SensorValues *values    /*!<INOUT - The reading to filter   */
+)
+{
+    if (RESULT_OK != values->result || 0 == filter->temperature.window)
+    {
+        return;
+    }
+    values->temperature = (float)median_filter_update(&filter->temperature,
+        to_tenths(values->temperature)) / 10.0f;
+    values->humidity = (float)median_filter_update(&filter->humidity,
+        to_tenths(values->humidity)) / 10.0f;
+}
@@ -0,0 +1,46 @@
+/*------------------------------------------------------------------------------
+ *! \file   filter.h
+ *! \brief  Sliding window median filter over a pin's valid readings, to
+ *          suppress single readings that pass every check but are still
+ *          wrong.
+ *------------------------------------------------------------------------------
+ *                   Kris Dunning ippie52@gmail.com 2016.
+ *------------------------------------------------------------------------------
+ */
+#pragma once
+
+#include "sensor.h"
+
+#define MAX_FILTER_WINDOW   63
+
+/******************************************************************************/
+/** The median of the last values seen, in tenths. The window is a ring of
+ *  values, each held in one of two heaps: the lower half in a max heap and
+ *  the upper half in a min heap, so the median is at the top of the heaps
+ *  and each value enters and leaves in O(log n).
+ */
+typedef struct MedianFilters
+{
+    int window;                     /*!< The values kept, 0 if off          */
+    int count;                      /*!< The values held so far             */
+    int oldest;                     /*!< The ring slot to replace next      */
+    int values[MAX_FILTER_WINDOW];  /*!< The values, a ring                 */
+    int heap[MAX_FILTER_WINDOW];    /*!< Which heap each slot is in         */
+    int position[MAX_FILTER_WINDOW]; /*!< Each slot's place in its heap     */
+    int heaps[2][MAX_FILTER_WINDOW]; /*!< The lower and upper heaps, slots  */
+    int sizes[2];                   /*!< The number in each heap            */
+} MedianFilter;
+
+/******************************************************************************/
+/** The filters of a pin's temperature and humidity
+ */
+typedef struct ReadingFilters
+{
+    MedianFilter temperature;       /*!< Temperature, tenths of a *C        */
+    MedianFilter humidity;          /*!< Humidity, tenths of a %            */
+} ReadingFilter;
+
+void median_filter_init(MedianFilter *filter, const int window);
+int median_filter_update(MedianFilter *filter, const int value);
+void reading_filter_init(ReadingFilter *filter, const int window);
+void reading_filter_apply(ReadingFilter *filter, SensorValues *values);
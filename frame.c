@@ -0,0 +1,117 @@
+/*------------------------------------------------------------------------------
+ *! \file   frame.c
+ *! \brief  Decoding of the 40 bit frame the sensors send, and telling the
+ *          models apart by it.
+ *
+ *  The frame is five bytes, most significant bit first: humidity high and
+ *  low, temperature high and low, and a checksum of the other four. The
+ *  DHT21/22 send each value in tenths over 16 bits, the DHT11 sends whole
+ *  numbers followed by a byte of tenths. As a DHT22's humidity never goes
+ *  above 100.0% its first byte is at most 3, while a DHT11 reports at least
+ *  a few percent, so the first byte tells them apart and the others confirm
+ *  it. The DHT11 also needs the full 18ms start signal, where the DHT22
+ *  answers to a much shorter one.
+ *------------------------------------------------------------------------------
+ *                   Kris Dunning ippie52@gmail.com 2016.
+ *------------------------------------------------------------------------------
+ */
+
+#include <stdint.h>
+
+#include "frame.h"
+
+#define DHT11_START_US      18000U  /* DHT11 start signal, and when unknown  */
+#define DHT22_START_US      2000U   /* DHT21/22 start signal, 1ms minimum    */
+#define DHT22_MAX_HIGH      3       /* Highest first byte from a DHT22      */
+#define DHT22_MAX_HUMIDITY  1000    /* 100.0%                               */
+#define DHT22_MAX_TEMPERATURE 1250  /* 125.0*C                              */
+#define DHT11_MAX_HUMIDITY  100     /* %                                    */
+#define DHT11_MAX_TEMPERATURE 60    /* *C                                   */
+
+/*******************************************************************************
+ *  \brief  Checks the frame's checksum, the low byte of the sum of the
+ *          others.
+ *  \return Non zero if it matches.
+ */
+int frame_checksum_ok
+(
+    const int *data     /*!<IN - The five bytes received    */
+)
+{
+    const int sum = data[0] + data[1] + data[2] + data[3];
+    return data[4] == (uint8_t)(sum & 0xFF);
+}
+
+/*******************************************************************************
+ *  \brief  Works out which model sent a frame from its byte pattern. The
+ *          checksum should be checked first.
+ *  \return The model, MODEL_AUTO if the frame fits neither.
+ */
+SensorModel frame_classify
+(
+    const int *data     /*!<IN - The five bytes received    */
+)
+{
+    if (data[0] <= DHT22_MAX_HIGH)
+    {
+        if (data[0] * 256 + data[1] <= DHT22_MAX_HUMIDITY &&
+            (data[2] & 0x7F) * 256 + data[3] <= DHT22_MAX_TEMPERATURE)
+        {
+            return MODEL_DHT22;
+        }
+    }
+    else if (data[0] <= DHT11_MAX_HUMIDITY && data[1] <= 9 &&
+        (data[2] & 0x7F) <= DHT11_MAX_TEMPERATURE && (data[3] & 0x7F) <= 9)
+    {
+        return MODEL_DHT11;
+    }
+    return MODEL_AUTO;
+}
+
+/*******************************************************************************
+ *  \brief  Decodes the values in a frame. The DHT21/22 send tenths in 16
+ *          bits, with the top bit of the temperature as its sign, and a frame
+ *          from a model not yet known is taken as theirs. The DHT11 sends
+ *          whole numbers and tenths, those that measure below zero setting
+ *          the top bit of the tenths. The result is left for the caller to
+ *          set.
+ */
+void frame_decode
+(
+    const int *data,            /*!<IN  - The five bytes received   */
+    const SensorModel model,    /*!<IN  - The sensor model          */
+    SensorValues *values        /*!<OUT - The values decoded        */
+)
+{
+    if (MODEL_DHT11 == model)
+    {
+        values->humidity = (float)data[0] + (float)data[1] / 10.0f;
+        values->temperature = (float)(data[2] & 0x7F) + (float)(data[3] & 0x7F) / 10.0f;
+        if (((data[2] | data[3]) & 0x80) != 0)
+        {
+            values->temperature *= -1.0f;
+        }
+        return;
+    }
+    values->humidity = (float)data[0] * 256 + (float)data[1];
+    values->humidity /= 10;
+    values->temperature = (float)(data[2] & 0x7F)* 256 + (float)data[3];
+    values->temperature /= 10.0;
+    if ((data[2] & 0x80) != 0)
+    {
+      values->temperature *= -1.0;
+    }
+}
+
+/*******************************************************************************
+ *  \brief  Gets how long the start signal should hold the line low for a
+ *          model. One not yet known gets the DHT11's, which both answer to.
+ *  \return The start signal's length, us.
+ */
+unsigned int frame_start_us
+(
+    const SensorModel model     /*!<IN - The sensor model   */
+)
+{
+    return (MODEL_DHT22 == model) ? DHT22_START_US : DHT11_START_US;
+}
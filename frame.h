@@ -0,0 +1,19 @@
+/*------------------------------------------------------------------------------
+ *! \file   frame.h
+ *! \brief  Decoding of the 40 bit frame the sensors send, and telling the
+ *          models apart by it.
+ *------------------------------------------------------------------------------
+ *                   Kris Dunning ippie52@gmail.com 2016.
+ *------------------------------------------------------------------------------
+ */
+#pragma once
+
+#include "sensor.h"
+
+#define FRAME_BITS      40
+#define FRAME_BYTES     5
+
+int frame_checksum_ok(const int *data);
+SensorModel frame_classify(const int *data);
+void frame_decode(const int *data, const SensorModel model, SensorValues *values);
+unsigned int frame_start_us(const SensorModel model);
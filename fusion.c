@@ -0,0 +1,293 @@
+/*------------------------------------------------------------------------------
+ *! \file   fusion.c
+ *! \brief  Sensor groups, sensors side by side which check each other's
+ *          readings and are reported together as one fused reading.
+ *
+ *  Pins are put in a group with the "group <name>" setting. Each member's
+ *  last valid reading is kept while it is fresh, for twice the longest
+ *  interval of the group. A member reading far from its own last value, or
+ *  failing its checksum, is checked against the fresh readings of the others
+ *  rather than read again: a jump they share is real, and one they do not is
+ *  the sensor's alone. Every report from a member carries the group's fused
+ *  reading, the mean of the fresh readings within tolerance of the group's
+ *  median, and the share of the group that agreed with it as a confidence.
+ *------------------------------------------------------------------------------
+ *                   Kris Dunning ippie52@gmail.com 2016.
+ *------------------------------------------------------------------------------
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "fusion.h"
+
+/*******************************************************************************
+ *  \brief  Gets the milliseconds elapsed since a monotonic time.
+ *  \return The elapsed time in milliseconds.
+ */
+static long age_ms
+(
+    const struct timespec *now,     /*!< - The time now         */
+    const struct timespec *then     /*!< - The earlier time     */
+)
+{
+    return (long)(now->tv_sec - then->tv_sec) * 1000L +
+        (now->tv_nsec - then->tv_nsec) / 1000000L;
+}
+
+/*******************************************************************************
+ *  \brief  Gets the median of a few values, reordering them.
+ *  \return The median.
+ */
+static float median
+(
+    float *values,      /*!<INOUT - The values, sorted on return    */
+    const int count     /*!<IN    - The number of values, above 0   */
+)
+{
+    int i;
+    int j;
+    for (i = 1; i < count; ++i)
+    {
+        const float value = values[i];
+        for (j = i; j > 0 && values[j - 1] > value; --j)
+        {
+            values[j] = values[j - 1];
+        }
+        values[j] = value;
+    }
+    return (0 == count % 2) ? (values[count / 2 - 1] + values[count / 2]) / 2.0f :
+        values[count / 2];
+}
+
+/*******************************************************************************
+ *  \brief  Checks whether values are within tolerance of others.
+ *  \return Non zero if they are.
+ */
+static int within_tolerance
+(
+    const SensorValues *values,     /*!< - The values to check          */
+    const float temperature,        /*!< - The temperature to compare   */
+    const float humidity            /*!< - The humidity to compare      */
+)
+{
+    const float t = values->temperature - temperature;
+    const float h = values->humidity - humidity;
+    return (t <= FUSION_TEMPERATURE_TOLERANCE && -t <= FUSION_TEMPERATURE_TOLERANCE &&
+        h <= FUSION_HUMIDITY_TOLERANCE && -h <= FUSION_HUMIDITY_TOLERANCE);
+}
+
+/*******************************************************************************
+ *  \brief  Finds the median of the fresh readings in a group, leaving one
+ *          member out. The table must be locked.
+ *  \return The number of fresh readings.
+ */
+static int group_median
+(
+    const SensorGroup *group,       /*!<IN  - The group                 */
+    const int exclude,              /*!<IN  - The member to leave out   */
+    const struct timespec *now,     /*!<IN  - The time now, monotonic   */
+    float *temperature,             /*!<OUT - The median temperature    */
+    float *humidity                 /*!<OUT - The median humidity       */
+)
+{
+    float temperatures[MAX_PINS];
+    float humidities[MAX_PINS];
+    int fresh = 0;
+    int i;
+
+    for (i = 0; i < group->count; ++i)
+    {
+        const GroupMember *member = &group->members[i];
+        if (member->index != exclude && RESULT_OK == member->values.result &&
+            age_ms(now, &member->when) <= group->window_ms)
+        {
+            temperatures[fresh] = member->values.temperature;
+            humidities[fresh] = member->values.humidity;
+            ++fresh;
+        }
+    }
+    if (fresh > 0)
+    {
+        *temperature = median(temperatures, fresh);
+        *humidity = median(humidities, fresh);
+    }
+    return fresh;
+}
+
+/*******************************************************************************
+ *  \brief  Builds the groups from the pin settings. Readings kept from
+ *          before are dropped.
+ */
+void fusion_init
+(
+    FusionTable *table,         /*!<OUT - The table to build    */
+    const Settings *settings    /*!<IN  - The pin settings      */
+)
+{
+    int i;
+    int j;
+
+    memset(table, 0, sizeof(*table));
+    pthread_mutex_init(&table->lock, NULL);
+    for (i = 0; i < MAX_PINS; ++i)
+    {
+        table->group_of[i] = -1;
+    }
+    for (i = 0; i < settings->count; ++i)
+    {
+        const PinConfig *config = &settings->pins[i];
+        const int interval = (config->max_interval > config->interval) ?
+            config->max_interval : config->interval;
+        SensorGroup *group = NULL;
+        GroupMember *member;
+
+        if ('\0' == config->group[0])
+        {
+            continue;
+        }
+        for (j = 0; j < table->count && NULL == group; ++j)
+        {
+            if (0 == strcmp(table->groups[j].name, config->group))
+            {
+                group = &table->groups[j];
+                table->group_of[i] = j;
+            }
+        }
+        if (NULL == group)
+        {
+            table->group_of[i] = table->count;
+            group = &table->groups[table->count++];
+            snprintf(group->name, sizeof(group->name), "%s", config->group);
+            group->window_ms = FUSION_MIN_WINDOW * 1000L;
+        }
+        if (2000L * interval > group->window_ms)
+        {
+            group->window_ms = 2000L * interval;
+        }
+        member = &group->members[group->count++];
+        member->index = i;
+        member->values = (SensorValues)INVALID_VALUES;
+    }
+}
+
+/*******************************************************************************
+ *  \brief  Frees the table's lock.
+ */
+void fusion_destroy
+(
+    FusionTable *table  /*!<INOUT - The table   */
+)
+{
+    pthread_mutex_destroy(&table->lock);
+}
+
+/*******************************************************************************
+ *  \brief  Checks whether a pin is in a group with others.
+ *  \return Non zero if it is.
+ */
+int fusion_is_grouped
+(
+    FusionTable *table,     /*!<IN - The groups             */
+    const int index         /*!<IN - The pin's index        */
+)
+{
+    return table->group_of[index] >= 0 &&
+        table->groups[table->group_of[index]].count > 1;
+}
+
+/*******************************************************************************
+ *  \brief  Checks a reading against the fresh readings of the rest of the
+ *          pin's group. With no values given, only checks that the others
+ *          have fresh readings, FUSION_AGREES if they have.
+ *  \return How the reading compares.
+ */
+FusionCheck fusion_check
+(
+    FusionTable *table,             /*!<INOUT - The groups                  */
+    const int index,                /*!<IN    - The pin's index             */
+    const SensorValues *values      /*!<IN    - Calibrated values, or NULL  */
+)
+{
+    FusionCheck check = FUSION_NO_SIBLINGS;
+    struct timespec now;
+    float temperature;
+    float humidity;
+
+    if (table->group_of[index] < 0)
+    {
+        return check;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    pthread_mutex_lock(&table->lock);
+    if (group_median(&table->groups[table->group_of[index]], index, &now,
+        &temperature, &humidity) > 0)
+    {
+        check = (NULL == values || within_tolerance(values, temperature, humidity)) ?
+            FUSION_AGREES : FUSION_DISAGREES;
+    }
+    pthread_mutex_unlock(&table->lock);
+    return check;
+}
+
+/*******************************************************************************
+ *  \brief  Keeps the pin's reading, if valid, and adds the group's fused
+ *          reading to the report. The values in the report must already be
+ *          calibrated.
+ */
+void fusion_update
+(
+    FusionTable *table,         /*!<INOUT - The groups          */
+    const int index,            /*!<IN    - The pin's index     */
+    SensorReport *report        /*!<INOUT - The pin's report    */
+)
+{
+    SensorGroup *group;
+    struct timespec now;
+    float temperature;
+    float humidity;
+    float sum_temperature = 0.0f;
+    float sum_humidity = 0.0f;
+    int agreeing = 0;
+    int i;
+
+    if (table->group_of[index] < 0)
+    {
+        return;
+    }
+    group = &table->groups[table->group_of[index]];
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    snprintf(report->group, sizeof(report->group), "%s", group->name);
+    report->fused = (SensorValues)INVALID_VALUES;
+    report->confidence = 0.0f;
+
+    pthread_mutex_lock(&table->lock);
+    for (i = 0; i < group->count; ++i)
+    {
+        if (group->members[i].index == index && RESULT_OK == report->values.result)
+        {
+            group->members[i].values = report->values;
+            group->members[i].when = now;
+        }
+    }
+    if (group_median(group, -1, &now, &temperature, &humidity) > 0)
+    {
+        for (i = 0; i < group->count; ++i)
+        {
+            const GroupMember *member = &group->members[i];
+            if (RESULT_OK == member->values.result &&
+                age_ms(&now, &member->when) <= group->window_ms &&
+                within_tolerance(&member->values, temperature, humidity))
+            {
+                sum_temperature += member->values.temperature;
+                sum_humidity += member->values.humidity;
+                ++agreeing;
+            }
+        }
+        report->fused.result = (agreeing > 0) ? RESULT_OK : RESULT_INCONSISTENT;
+        report->fused.temperature = (agreeing > 0) ? sum_temperature / agreeing : temperature;
+        report->fused.humidity = (agreeing > 0) ? sum_humidity / agreeing : humidity;
+        report->confidence = (float)agreeing / (float)group->count;
+    }
+    pthread_mutex_unlock(&table->lock);
+}
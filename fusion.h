@@ -0,0 +1,68 @@
+/*------------------------------------------------------------------------------
+ *! \file   fusion.h
+ *! \brief  Sensor groups, sensors side by side which check each other's
+ *          readings and are reported together as one fused reading.
+ *------------------------------------------------------------------------------
+ *                   Kris Dunning ippie52@gmail.com 2016.
+ *------------------------------------------------------------------------------
+ */
+#pragma once
+
+#include <pthread.h>
+#include <time.h>
+
+#include "output.h"
+#include "settings.h"
+
+#define FUSION_TEMPERATURE_TOLERANCE    1.5f    /* Members agree within, *C */
+#define FUSION_HUMIDITY_TOLERANCE       6.0f    /* Members agree within, %  */
+#define FUSION_MIN_WINDOW               10      /* Shortest freshness, s    */
+
+/******************************************************************************/
+/** How a reading compares with the rest of its group
+ */
+typedef enum FusionChecks
+{
+    FUSION_NO_SIBLINGS,     /*!< No other member has a fresh reading      */
+    FUSION_AGREES,          /*!< Within tolerance of the other members    */
+    FUSION_DISAGREES        /*!< Outside tolerance of the other members   */
+} FusionCheck;
+
+/******************************************************************************/
+/** A group member's last valid reading
+ */
+typedef struct GroupMembers
+{
+    int index;                  /*!< The member's index in the settings     */
+    SensorValues values;        /*!< The last valid values, calibrated      */
+    struct timespec when;       /*!< When they were read, monotonic         */
+} GroupMember;
+
+/******************************************************************************/
+/** A sensor group
+ */
+typedef struct SensorGroups
+{
+    char name[MAX_GROUP_NAME_LENGTH];   /*!< The group name                 */
+    GroupMember members[MAX_PINS];      /*!< The members                    */
+    int count;                          /*!< The number of members          */
+    long window_ms;                     /*!< How long a reading stays fresh */
+} SensorGroup;
+
+/******************************************************************************/
+/** Every sensor group, shared by the reader threads
+ */
+typedef struct FusionTables
+{
+    pthread_mutex_t lock;               /*!< Guards the groups              */
+    SensorGroup groups[MAX_PINS];       /*!< The groups                     */
+    int count;                          /*!< The number of groups           */
+    int group_of[MAX_PINS];             /*!< Each pin's group, -1 if none   */
+} FusionTable;
+
+void fusion_init(FusionTable *table, const Settings *settings);
+void fusion_destroy(FusionTable *table);
+int fusion_is_grouped(FusionTable *table, const int index);
+FusionCheck fusion_check(FusionTable *table, const int index,
+    const SensorValues *values);
+void fusion_update(FusionTable *table, const int index, SensorReport *report);
@@ -0,0 +1,316 @@
+/*------------------------------------------------------------------------------
+ *! \file   gpio.c
+ *! \brief  The ways of driving and polling a sensor pin: wiringPi's mapped
+ *          registers or the kernel's GPIO character device.
+ *
+ *  wiringPi reads the pin straight from the mapped GPIO registers, which
+ *  costs no system call but needs /dev/mem or /dev/gpiomem and a board
+ *  wiringPi knows. The character device asks the kernel for the line, so
+ *  works wherever the kernel drives the GPIO, at the cost of an ioctl per
+ *  read. Which is faster and steadier depends on the board and the kernel,
+ *  so both are measured (see calibration.c) and each pin uses the better
+ *  one that it can open, unless told otherwise.
+ *
+ *  wiringPi is only set up when a pin is opened with it, as the set up
+ *  parses /proc/cpuinfo and maps every peripheral block it might use. The
+ *  character device needs none of that: the wiringPi pin numbers are turned
+ *  into BCM lines from a table, only the Revision line being read to tell
+ *  the first Model B's layout from the one on every board since.
+ *------------------------------------------------------------------------------
+ *                   Kris Dunning ippie52@gmail.com 2016.
+ *------------------------------------------------------------------------------
+ */
+
+#include <wiringPi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+
+#include "gpio.h"
+
+#define GPIO_CONSUMER   "kdht"
+#define GPIO_WPI_PINS   32
+#define MAX_CPUINFO_LINE 256U
+
+/* The BCM line of each wiringPi pin, on the first Model B and since */
+static const int LAYOUT_1[GPIO_WPI_PINS] =
+{
+    17, 18, 21, 22, 23, 24, 25, 4, 0, 1, 8, 7, 10, 9, 11, 14, 15,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+};
+static const int LAYOUT_2[GPIO_WPI_PINS] =
+{
+    17, 18, 27, 22, 23, 24, 25, 4, 2, 3, 8, 7, 10, 9, 11, 14, 15,
+    28, 29, 30, 31, 5, 6, 13, 19, 26, 12, 16, 20, 21, 0, 1
+};
+
+/* Set once wiringPi has been set up, -1 if that failed */
+static int wiringpi_ready = 0;
+
+/* The board's pin layout, found on first use */
+static const int *layout = NULL;
+
+/*******************************************************************************
+ *  \brief  Sets wiringPi up, the first time only.
+ *  \return Zero if wiringPi could not be set up, otherwise 1.
+ */
+int gpio_setup(void)
+{
+    if (0 == wiringpi_ready)
+    {
+        wiringpi_ready = (-1 == wiringPiSetup()) ? -1 : 1;
+        if (wiringpi_ready < 0)
+        {
+            fprintf(stderr, "Problem setting up wiringPi\n");
+        }
+    }
+    return wiringpi_ready > 0;
+}
+
+/*******************************************************************************
+ *  \brief  Gets the BCM line of a wiringPi pin, from wiringPi if it is set up
+ *          and otherwise from the board's layout. Only the first Model B,
+ *          revisions 2 and 3, has the old layout.
+ *  \return The line, -1 if the pin has none.
+ */
+static int get_bcm_line
+(
+    const int pin   /*!< - The wiringPi pin number  */
+)
+{
+    char line[MAX_CPUINFO_LINE];
+    FILE *fp;
+
+    if (wiringpi_ready > 0)
+    {
+        return wpiPinToGpio(pin);
+    }
+    if (NULL == layout)
+    {
+        layout = LAYOUT_2;
+        fp = fopen("/proc/cpuinfo", "r");
+        while (NULL != fp && NULL != fgets(line, sizeof(line), fp))
+        {
+            const char *colon = strchr(line, ':');
+            if (0 == strncmp(line, "Revision", 8) && NULL != colon)
+            {
+                const unsigned long revision = strtoul(colon + 1, NULL, 16);
+                if (0 == (revision & 0x800000UL) &&
+                    ((revision & 0xFFFFUL) == 2 || (revision & 0xFFFFUL) == 3))
+                {
+                    layout = LAYOUT_1;
+                }
+            }
+        }
+        if (NULL != fp)
+        {
+            fclose(fp);
+        }
+    }
+    return (pin >= 0 && pin < GPIO_WPI_PINS) ? layout[pin] : -1;
+}
+
+/*******************************************************************************
+ *  \brief  Sets a line up as not open.
+ */
+void gpio_init
+(
+    GpioLine *line  /*!<OUT - The line  */
+)
+{
+    line->backend = GPIO_AUTO;
+    line->pin = -1;
+    line->fd = -1;
+}
+
+/*******************************************************************************
+ *  \brief  Opens a pin for a backend, as an input. The character device
+ *          line is the pin's BCM number on the first gpiochip.
+ *  \return Zero if the pin cannot be opened for the backend, otherwise 1.
+ */
+int gpio_open
+(
+    GpioLine *line,             /*!<OUT - The line, left closed on failure  */
+    const GpioBackend backend,  /*!<IN  - GPIO_WIRINGPI or GPIO_CHARDEV     */
+    const int pin               /*!<IN  - The wiringPi pin number           */
+)
+{
+    struct gpio_v2_line_request request;
+    int chip;
+    int offset;
+
+    gpio_init(line);
+    if (GPIO_WIRINGPI == backend)
+    {
+        if (!gpio_setup())
+        {
+            return 0;
+        }
+        line->backend = backend;
+        line->pin = pin;
+        pinMode(pin, INPUT);
+        return 1;
+    }
+    if (GPIO_CHARDEV != backend)
+    {
+        return 0;
+    }
+
+    offset = get_bcm_line(pin);
+    chip = open(GPIO_CHIP_DEVICE, O_RDONLY | O_CLOEXEC);
+    if (offset < 0 || chip < 0)
+    {
+        if (chip >= 0)
+        {
+            close(chip);
+        }
+        return 0;
+    }
+    memset(&request, 0, sizeof(request));
+    request.offsets[0] = (unsigned int)offset;
+    request.num_lines = 1;
+    request.config.flags = GPIO_V2_LINE_FLAG_INPUT;
+    snprintf(request.consumer, sizeof(request.consumer), "%s", GPIO_CONSUMER);
+    if (ioctl(chip, GPIO_V2_GET_LINE_IOCTL, &request) < 0)
+    {
+        /* Most likely claimed by a driver, i.e. the dht11 overlay */
+        close(chip);
+        return 0;
+    }
+    close(chip);
+    line->backend = backend;
+    line->pin = pin;
+    line->fd = request.fd;
+    return 1;
+}
+
+/*******************************************************************************
+ *  \brief  Releases a line, which may not be open.
+ */
+void gpio_close
+(
+    GpioLine *line  /*!<INOUT - The line    */
+)
+{
+    if (line->fd >= 0)
+    {
+        close(line->fd);
+    }
+    gpio_init(line);
+}
+
+/*******************************************************************************
+ *  \brief  Drives the line at a level.
+ */
+void gpio_output
+(
+    const GpioLine *line,   /*!<IN - The line           */
+    const int level         /*!<IN - HIGH or LOW        */
+)
+{
+    struct gpio_v2_line_config config;
+
+    if (GPIO_CHARDEV != line->backend)
+    {
+        pinMode(line->pin, OUTPUT);
+        digitalWrite(line->pin, level);
+        return;
+    }
+    memset(&config, 0, sizeof(config));
+    config.flags = GPIO_V2_LINE_FLAG_OUTPUT;
+    config.num_attrs = 1;
+    config.attrs[0].attr.id = GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES;
+    config.attrs[0].attr.values = (LOW == level) ? 0U : 1U;
+    config.attrs[0].mask = 1U;
+    ioctl(line->fd, GPIO_V2_LINE_SET_CONFIG_IOCTL, &config);
+}
+
+/*******************************************************************************
+ *  \brief  Releases the line to be driven by the sensor.
+ */
+void gpio_input
+(
+    const GpioLine *line    /*!<IN - The line   */
+)
+{
+    struct gpio_v2_line_config config;
+
+    if (GPIO_CHARDEV != line->backend)
+    {
+        pinMode(line->pin, INPUT);
+        return;
+    }
+    memset(&config, 0, sizeof(config));
+    config.flags = GPIO_V2_LINE_FLAG_INPUT;
+    ioctl(line->fd, GPIO_V2_LINE_SET_CONFIG_IOCTL, &config);
+}
+
+/*******************************************************************************
+ *  \brief  Reads the line's level.
+ *  \return HIGH or LOW, LOW if the read fails.
+ */
+int gpio_read
+(
+    const GpioLine *line    /*!<IN - The line   */
+)
+{
+    struct gpio_v2_line_values values;
+
+    if (GPIO_CHARDEV != line->backend)
+    {
+        return digitalRead(line->pin);
+    }
+    values.bits = 0;
+    values.mask = 1U;
+    if (ioctl(line->fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &values) < 0)
+    {
+        return LOW;
+    }
+    return (0U != (values.bits & 1U)) ? HIGH : LOW;
+}
+
+/*******************************************************************************
+ *  \brief  Gets a backend's name, as in the settings.
+ *  \return The name, i.e. "chardev".
+ */
+const char *get_gpio_backend_name
+(
+    const GpioBackend backend   /*!< - The backend  */
+)
+{
+    switch (backend)
+    {
+        case GPIO_WIRINGPI:
+            return "wiringpi";
+        case GPIO_CHARDEV:
+            return "chardev";
+        default:
+            return "auto";
+    }
+}
+
+/*******************************************************************************
+ *  \brief  Converts a backend name.
+ *  \return Zero if the name is not a backend, otherwise 1.
+ */
+int parse_gpio_backend
+(
+    const char *name,       /*!<IN  - The name, i.e. "auto"     */
+    GpioBackend *backend    /*!<OUT - The backend identified    */
+)
+{
+    int i;
+    for (i = 0; i < GPIO_BACKEND_COUNT; ++i)
+    {
+        if (0 == strcmp(name, get_gpio_backend_name((GpioBackend)i)))
+        {
+            *backend = (GpioBackend)i;
+            return 1;
+        }
+    }
+    return 0;
+}
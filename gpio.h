@@ -0,0 +1,42 @@
+/*------------------------------------------------------------------------------
+ *! \file   gpio.h
+ *! \brief  The ways of driving and polling a sensor pin: wiringPi's mapped
+ *          registers or the kernel's GPIO character device.
+ *------------------------------------------------------------------------------
+ *                   Kris Dunning ippie52@gmail.com 2016.
+ *------------------------------------------------------------------------------
+ */
+#pragma once
+
+#define GPIO_CHIP_DEVICE    "/dev/gpiochip0"
+
+/******************************************************************************/
+/** A way of accessing the pins
+ */
+typedef enum GpioBackends
+{
+    GPIO_AUTO,              /*!< The fastest measured, chosen per pin   */
+    GPIO_WIRINGPI,          /*!< wiringPi's mapped registers            */
+    GPIO_CHARDEV,           /*!< A line requested from the gpiochip     */
+    GPIO_BACKEND_COUNT
+} GpioBackend;
+
+/******************************************************************************/
+/** A pin opened for a backend
+ */
+typedef struct GpioLines
+{
+    GpioBackend backend;    /*!< The backend, GPIO_AUTO if not open     */
+    int pin;                /*!< The wiringPi pin number                */
+    int fd;                 /*!< The line request, -1 if none           */
+} GpioLine;
+
+int gpio_setup(void);
+void gpio_init(GpioLine *line);
+int gpio_open(GpioLine *line, const GpioBackend backend, const int pin);
+void gpio_close(GpioLine *line);
+void gpio_output(const GpioLine *line, const int level);
+void gpio_input(const GpioLine *line);
+int gpio_read(const GpioLine *line);
+const char *get_gpio_backend_name(const GpioBackend backend);
+int parse_gpio_backend(const char *name, GpioBackend *backend);
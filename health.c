@@ -0,0 +1,251 @@
+/*------------------------------------------------------------------------------
+ *! \file   health.c
+ *! \brief  Per pin sensor health, smoothed failure rates and signal margins
+ *          scored so that failing sensors and cables stand out.
+ *
+ *  Each read updates moving averages of how often its attempts failed, and
+ *  how, of the attempts needed for a valid reading and of how far the data
+ *  bit timings were from the threshold between a 0 and a 1. A sensor or cable
+ *  on its way out shows first as a shrinking margin and a creeping failure
+ *  rate, well before reads start to need tens of retries and hold up the
+ *  schedule. The score starts from 100 and loses up to half for failed
+ *  attempts, a quarter for retries and a quarter for a thin margin.
+ *------------------------------------------------------------------------------
+ *                   Kris Dunning ippie52@gmail.com 2016.
+ *------------------------------------------------------------------------------
+ */
+
+#include <string.h>
+
+#include "health.h"
+
+#define HEALTH_MAX_ATTEMPTS     20.0f   /* Attempts per read costing the most */
+#define HEALTH_MIN_MARGIN       0.4f    /* Margins below this cost points     */
+
+static const char *RATE_NAMES[HEALTH_RATE_COUNT] =
+{
+    "bad_data", "all_zero", "inconsistent", "timeout"
+};
+
+/*******************************************************************************
+ *  \brief  Moves an average towards a new value. Until enough reads have been
+ *          seen the average is a plain mean, so a new pin settles quickly.
+ *  \return The new average.
+ */
+static float smooth
+(
+    const float average,        /*!< - The average so far               */
+    const float value,          /*!< - The new value                    */
+    const unsigned long samples /*!< - Values seen, including this one  */
+)
+{
+    float weight = 1.0f / (float)samples;
+    if (weight < HEALTH_WEIGHT)
+    {
+        weight = HEALTH_WEIGHT;
+    }
+    return average + weight * (value - average);
+}
+
+/*******************************************************************************
+ *  \brief  Sets up the health of a pin with no reads.
+ */
+void health_init
+(
+    PinHealth *health   /*!<OUT - The health to set up  */
+)
+{
+    memset(health, 0, sizeof(*health));
+    health->margin = -1.0f;
+}
+
+/*******************************************************************************
+ *  \brief  Takes a read into account. Timed out attempts are also counted as
+ *          bad data by the read, they are only counted as timeouts here.
+ */
+void health_update
+(
+    PinHealth *health,          /*!<INOUT - The pin's health            */
+    const SensorReport *report  /*!<IN    - The outcome of the read     */
+)
+{
+    float failed[HEALTH_RATE_COUNT];
+    int i;
+
+    if (report->attempts < 1)
+    {
+        return;
+    }
+    failed[HEALTH_BAD_DATA] = (float)(report->outcomes[RESULT_BAD_DATA] - report->timeouts);
+    failed[HEALTH_ALL_ZERO] = (float)report->outcomes[RESULT_ALL_ZERO];
+    failed[HEALTH_INCONSISTENT] = (float)report->outcomes[RESULT_INCONSISTENT];
+    failed[HEALTH_TIMEOUT] = (float)report->timeouts;
+
+    ++health->samples;
+    for (i = 0; i < HEALTH_RATE_COUNT; ++i)
+    {
+        health->rates[i] = smooth(health->rates[i],
+            failed[i] / (float)report->attempts, health->samples);
+    }
+    if (RESULT_OK == report->values.result)
+    {
+        health->attempts = (health->attempts > 0.0f) ?
+            smooth(health->attempts, (float)report->attempts, health->samples) :
+            (float)report->attempts;
+    }
+    if (report->margin_bits > 0)
+    {
+        const float margin = report->margin_sum / (float)report->margin_bits;
+        health->margin = (health->margin >= 0.0f) ?
+            smooth(health->margin, margin, health->samples) : margin;
+    }
+}
+
+/*******************************************************************************
+ *  \brief  Scores the health of a pin.
+ *  \return The score, from 0 for failing completely to 100 for healthy, or
+ *          -1 if the pin has no reads.
+ */
+int health_score
+(
+    const PinHealth *health     /*!<IN - The pin's health   */
+)
+{
+    float score = 100.0f;
+    float failed = 0.0f;
+    int i;
+
+    if (0 == health->samples)
+    {
+        return -1;
+    }
+    for (i = 0; i < HEALTH_RATE_COUNT; ++i)
+    {
+        failed += health->rates[i];
+    }
+    score -= 50.0f * ((failed < 1.0f) ? failed : 1.0f);
+
+    if (0.0f == health->attempts)
+    {
+        score -= 25.0f;
+    }
+    else if (health->attempts > 1.0f)
+    {
+        const float retries = (health->attempts - 1.0f) / (HEALTH_MAX_ATTEMPTS - 1.0f);
+        score -= 25.0f * ((retries < 1.0f) ? retries : 1.0f);
+    }
+
+    if (health->margin >= 0.0f && health->margin < HEALTH_MIN_MARGIN)
+    {
+        score -= 25.0f * (1.0f - health->margin / HEALTH_MIN_MARGIN);
+    }
+    return (score > 0.0f) ? (int)(score + 0.5f) : 0;
+}
+
+/*******************************************************************************
+ *  \brief  Names the state a score puts the pin in.
+ *  \return "ok", "degrading", "failing" or "unknown".
+ */
+const char *health_status
+(
+    const int score     /*!<IN - The pin's score    */
+)
+{
+    if (score < 0)
+    {
+        return "unknown";
+    }
+    if (score < HEALTH_FAILING)
+    {
+        return "failing";
+    }
+    return (score < HEALTH_DEGRADING) ? "degrading" : "ok";
+}
+
+/*******************************************************************************
+ *  \brief  Prints a pin's health in the given format, one line per pin. The
+ *          CSV columns are pin, score, status, reads, attempts per valid
+ *          read, the four failure rates and the margin. Rates are per
+ *          attempt, the margin is a fraction of the bit threshold.
+ */
+void print_health
+(
+    FILE *fp,                   /*!<IN - The stream to print to     */
+    const OutputFormat format,  /*!<IN - The format to print in     */
+    const int pin,              /*!<IN - The sensor pin             */
+    const PinHealth *health     /*!<IN - The pin's health           */
+)
+{
+    const int score = health_score(health);
+    int i;
+
+    switch (format)
+    {
+        case FORMAT_HUMAN:
+            if (score < 0)
+            {
+                fprintf(fp, "Pin %d: no reads\n", pin);
+                break;
+            }
+            fprintf(fp, "Pin %d: %s, score %d, %.1f attempts per read", pin,
+                health_status(score), score, health->attempts);
+            for (i = 0; i < HEALTH_RATE_COUNT; ++i)
+            {
+                fprintf(fp, ", %s %.1f%%", RATE_NAMES[i], 100.0f * health->rates[i]);
+            }
+            if (health->margin >= 0.0f)
+            {
+                fprintf(fp, ", margin %.2f", health->margin);
+            }
+            fprintf(fp, " (%lu reads)\n", health->samples);
+            break;
+
+        case FORMAT_JSON:
+            fprintf(fp, "{\"pin\":%d,\"score\":%d,\"status\":\"%s\",\"reads\":%lu,"
+                "\"attempts\":%.2f", pin, score, health_status(score),
+                health->samples, health->attempts);
+            for (i = 0; i < HEALTH_RATE_COUNT; ++i)
+            {
+                fprintf(fp, ",\"%s\":%.4f", RATE_NAMES[i], health->rates[i]);
+            }
+            if (health->margin >= 0.0f)
+            {
+                fprintf(fp, ",\"margin\":%.3f", health->margin);
+            }
+            fprintf(fp, "}\n");
+            break;
+
+        case FORMAT_CSV:
+            fprintf(fp, "%d,%d,%s,%lu,%.2f", pin, score, health_status(score),
+                health->samples, health->attempts);
+            for (i = 0; i < HEALTH_RATE_COUNT; ++i)
+            {
+                fprintf(fp, ",%.4f", health->rates[i]);
+            }
+            if (health->margin >= 0.0f)
+            {
+                fprintf(fp, ",%.3f", health->margin);
+            }
+            else
+            {
+                fprintf(fp, ",");
+            }
+            fprintf(fp, "\n");
+            break;
+
+        case FORMAT_INFLUX:
+            fprintf(fp, "dht_health,pin=%d score=%di,status=\"%s\",reads=%lui,"
+                "attempts=%.2f", pin, score, health_status(score),
+                health->samples, health->attempts);
+            for (i = 0; i < HEALTH_RATE_COUNT; ++i)
+            {
+                fprintf(fp, ",%s=%.4f", RATE_NAMES[i], health->rates[i]);
+            }
+            if (health->margin >= 0.0f)
+            {
+                fprintf(fp, ",margin=%.3f", health->margin);
+            }
+            fprintf(fp, "\n");
+            break;
+    }
+}
@@ -0,0 +1,49 @@
+/*------------------------------------------------------------------------------
+ *! \file   health.h
+ *! \brief  Per pin sensor health, smoothed failure rates and signal margins
+ *          scored so that failing sensors and cables stand out.
+ *------------------------------------------------------------------------------
+ *                   Kris Dunning ippie52@gmail.com 2016.
+ *------------------------------------------------------------------------------
+ */
+#pragma once
+
+#include <stdio.h>
+
+#include "output.h"
+
+#define HEALTH_WEIGHT       0.05f   /* Weight of each read, about the last 20 */
+#define HEALTH_DEGRADING    80      /* Scores below this are degrading        */
+#define HEALTH_FAILING      50      /* Scores below this are failing          */
+
+/******************************************************************************/
+/** The kinds of failed attempt tracked
+ */
+typedef enum HealthRates
+{
+    HEALTH_BAD_DATA,        /*!< Bits captured but the checksum failed    */
+    HEALTH_ALL_ZERO,        /*!< All values zero                          */
+    HEALTH_INCONSISTENT,    /*!< Too far from the last reading            */
+    HEALTH_TIMEOUT          /*!< The sensor stopped sending mid read      */
+} HealthRate;
+
+#define HEALTH_RATE_COUNT   (HEALTH_TIMEOUT + 1)
+
+/******************************************************************************/
+/** A pin's health, smoothed over its recent reads
+ */
+typedef struct PinHealths
+{
+    unsigned long samples;              /*!< Reads taken into account       */
+    float rates[HEALTH_RATE_COUNT];     /*!< Failed attempts, per attempt   */
+    float attempts;                     /*!< Attempts per valid read        */
+    float margin;                       /*!< Bit timing margin, negative if
+                                             none has been measured         */
+} PinHealth;
+
+void health_init(PinHealth *health);
+void health_update(PinHealth *health, const SensorReport *report);
+int health_score(const PinHealth *health);
+const char *health_status(const int score);
+void print_health(FILE *fp, const OutputFormat format, const int pin,
+    const PinHealth *health);
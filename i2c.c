@@ -0,0 +1,379 @@
+/*------------------------------------------------------------------------------
+ *! \file   i2c.c
+ *! \brief  Reads of the AM2320/AM2315, the I2C members of the sensor family,
+ *          every sensor on a bus swept together.
+ *
+ *  The sensor sleeps between reads, and refuses its address while it wakes.
+ *  A read is then a wake, a read command (function 0x03, registers 0 to 3)
+ *  and, after the measurement, a fetch of the eight byte answer: the
+ *  function, the register count, humidity and temperature in tenths as the
+ *  DHT22 sends them, and a Modbus CRC16, low byte first.
+ *
+ *  The pins of a bus are read together. A read of one sweeps them all: a
+ *  wake of each, the read commands of all of them in one I2C_RDWR transfer,
+ *  one wait for the measurements and the answers of all of them in another,
+ *  so the bus costs two transfers and one set of waits however many sensors
+ *  it has. The other sensors' readings are kept for their own reads while
+ *  fresh. The AM2320 only answers at 0x5C, so more than one on a bus needs
+ *  address translators; the address is a setting for that.
+ *------------------------------------------------------------------------------
+ *                   Kris Dunning ippie52@gmail.com 2016.
+ *------------------------------------------------------------------------------
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/i2c-dev.h>
+
+#include "i2c.h"
+#include "frame.h"
+
+#define AM2320_READ             0x03    /* Read registers function          */
+#define AM2320_REGISTERS        4       /* Humidity and temperature         */
+#define AM2320_ANSWER_LENGTH    8       /* Function, count, data, CRC       */
+#define AM2320_WAKE_US          1000U   /* Wake to first command, 800us min */
+#define AM2320_MEASURE_US       2000U   /* Read command to answer, 1.5ms min */
+
+/*******************************************************************************
+ *  \brief  Gets the milliseconds elapsed since a monotonic time.
+ *  \return The elapsed time in milliseconds.
+ */
+static long age_ms
+(
+    const struct timespec *now,     /*!< - The time now         */
+    const struct timespec *then     /*!< - The earlier time     */
+)
+{
+    return (long)(now->tv_sec - then->tv_sec) * 1000L +
+        (now->tv_nsec - then->tv_nsec) / 1000000L;
+}
+
+/*******************************************************************************
+ *  \brief  Makes a transfer on an i2c-dev device.
+ *  \return The number of messages made, -1 if the transfer failed.
+ */
+static int dev_transfer
+(
+    I2cBus *bus,            /*!<INOUT - The bus                 */
+    struct i2c_msg *msgs,   /*!<INOUT - The messages            */
+    const int count         /*!<IN    - The number of messages  */
+)
+{
+    struct i2c_rdwr_ioctl_data data;
+
+    data.msgs = msgs;
+    data.nmsgs = (unsigned int)count;
+    return ioctl(bus->fd, I2C_RDWR, &data);
+}
+
+/*******************************************************************************
+ *  \brief  Calculates the Modbus CRC16 the sensor sends.
+ *  \return The CRC.
+ */
+static uint16_t crc16
+(
+    const uint8_t *data,    /*!< - The bytes to check   */
+    const int length        /*!< - The number of bytes  */
+)
+{
+    uint16_t crc = 0xFFFF;
+    int i;
+    int bit;
+    for (i = 0; i < length; ++i)
+    {
+        crc ^= data[i];
+        for (bit = 0; bit < 8; ++bit)
+        {
+            crc = (crc & 1) ? (uint16_t)((crc >> 1) ^ 0xA001) : (uint16_t)(crc >> 1);
+        }
+    }
+    return crc;
+}
+
+/*******************************************************************************
+ *  \brief  Decodes a sensor's answer.
+ *  \return RESULT_OK with the values set, or RESULT_BAD_DATA if the answer
+ *          is not a valid one.
+ */
+static SensorReadingResults decode_answer
+(
+    const uint8_t *answer,  /*!<IN  - The eight bytes received  */
+    SensorValues *values    /*!<OUT - The values decoded        */
+)
+{
+    int data[FRAME_BYTES];
+    int i;
+
+    if (AM2320_READ != answer[0] || AM2320_REGISTERS != answer[1] ||
+        crc16(answer, 6) != (uint16_t)(answer[6] | (answer[7] << 8)))
+    {
+        values->result = RESULT_BAD_DATA;
+        return values->result;
+    }
+    for (i = 0; i < 4; ++i)
+    {
+        data[i] = answer[2 + i];
+    }
+    data[4] = 0;
+    frame_decode(data, MODEL_DHT22, values);
+    values->result = RESULT_OK;
+    return values->result;
+}
+
+/*******************************************************************************
+ *  \brief  Makes the messages in one transfer, or one at a time if that is
+ *          refused, so one sensor not answering does not fail the others.
+ */
+static void transfer_all
+(
+    I2cBus *bus,            /*!<INOUT - The bus                         */
+    struct i2c_msg *msgs,   /*!<INOUT - The messages, one per sensor    */
+    const int count,        /*!<IN    - The number of messages          */
+    int *made               /*!<OUT   - Non zero for each message made  */
+)
+{
+    int i;
+    const int all = (count == bus->transfer(bus, msgs, count));
+    for (i = 0; i < count; ++i)
+    {
+        made[i] = all || 1 == bus->transfer(bus, &msgs[i], 1);
+    }
+}
+
+/*******************************************************************************
+ *  \brief  Opens an i2c-dev bus if it is not open. A bus given another
+ *          transfer by i2c_set_transfer() needs no opening.
+ *  \return Zero if it could not be opened, otherwise 1.
+ */
+static int open_bus
+(
+    I2cBus *bus     /*!<INOUT - The bus */
+)
+{
+    if (dev_transfer == bus->transfer && bus->fd < 0)
+    {
+        bus->fd = open(bus->path, O_RDWR | O_CLOEXEC);
+        if (bus->fd < 0)
+        {
+            fprintf(stderr, "Failed to open %s: %s\n", bus->path, strerror(errno));
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*******************************************************************************
+ *  \brief  Reads every sensor on a bus. The bus must be locked.
+ */
+static void sweep
+(
+    I2cBus *bus     /*!<INOUT - The bus */
+)
+{
+    static uint8_t command[3] = { AM2320_READ, 0x00, AM2320_REGISTERS };
+    struct i2c_msg msgs[MAX_PINS];
+    uint8_t answers[MAX_PINS][AM2320_ANSWER_LENGTH];
+    int commanded[MAX_PINS];
+    int answered[MAX_PINS];
+    int slot[MAX_PINS];
+    struct timespec now;
+    int count = 0;
+    int i;
+
+    for (i = 0; i < bus->count; ++i)
+    {
+        bus->sensors[i].values.result = RESULT_BAD_DATA;
+    }
+    if (open_bus(bus))
+    {
+        /* The wake is refused, which ends a transfer, so each has its own */
+        for (i = 0; i < bus->count; ++i)
+        {
+            msgs[0].addr = (uint16_t)bus->sensors[i].address;
+            msgs[0].flags = 0;
+            msgs[0].len = 0;
+            msgs[0].buf = command;
+            bus->transfer(bus, msgs, 1);
+        }
+        usleep(AM2320_WAKE_US);
+
+        for (i = 0; i < bus->count; ++i)
+        {
+            msgs[i].addr = (uint16_t)bus->sensors[i].address;
+            msgs[i].flags = 0;
+            msgs[i].len = sizeof(command);
+            msgs[i].buf = command;
+        }
+        transfer_all(bus, msgs, bus->count, commanded);
+        usleep(AM2320_MEASURE_US);
+
+        for (i = 0; i < bus->count; ++i)
+        {
+            if (commanded[i])
+            {
+                slot[count] = i;
+                msgs[count].addr = (uint16_t)bus->sensors[i].address;
+                msgs[count].flags = I2C_M_RD;
+                msgs[count].len = AM2320_ANSWER_LENGTH;
+                msgs[count].buf = answers[i];
+                ++count;
+            }
+        }
+        if (count > 0)
+        {
+            transfer_all(bus, msgs, count, answered);
+        }
+        for (i = 0; i < count; ++i)
+        {
+            if (answered[i])
+            {
+                decode_answer(answers[slot[i]], &bus->sensors[slot[i]].values);
+            }
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    for (i = 0; i < bus->count; ++i)
+    {
+        bus->sensors[i].when = now;
+        bus->sensors[i].taken = 0;
+    }
+}
+
+/*******************************************************************************
+ *  \brief  Builds the buses from the pin settings. Nothing is opened until
+ *          the first read.
+ */
+void i2c_init
+(
+    I2cTable *table,            /*!<OUT - The table to build    */
+    const Settings *settings    /*!<IN  - The pin settings      */
+)
+{
+    int i;
+    int j;
+
+    memset(table, 0, sizeof(*table));
+    for (i = 0; i < MAX_PINS; ++i)
+    {
+        table->bus_of[i] = -1;
+    }
+    for (i = 0; i < settings->count; ++i)
+    {
+        const PinConfig *config = &settings->pins[i];
+        I2cBus *bus = NULL;
+        I2cSensor *sensor;
+
+        if ('\0' == config->i2c[0])
+        {
+            continue;
+        }
+        for (j = 0; j < table->count && NULL == bus; ++j)
+        {
+            if (0 == strcmp(table->buses[j].path, config->i2c))
+            {
+                bus = &table->buses[j];
+                table->bus_of[i] = j;
+            }
+        }
+        if (NULL == bus)
+        {
+            table->bus_of[i] = table->count;
+            bus = &table->buses[table->count++];
+            pthread_mutex_init(&bus->lock, NULL);
+            snprintf(bus->path, sizeof(bus->path), "%s", config->i2c);
+            bus->fd = -1;
+            bus->transfer = dev_transfer;
+        }
+        table->sensor_of[i] = bus->count;
+        sensor = &bus->sensors[bus->count++];
+        sensor->index = i;
+        sensor->address = config->i2c_address;
+        sensor->values = (SensorValues)INVALID_VALUES;
+        sensor->taken = 1;
+    }
+}
+
+/*******************************************************************************
+ *  \brief  Makes every bus use another transfer instead of its i2c-dev
+ *          device, so that the reads can be checked against a fake adapter.
+ */
+void i2c_set_transfer
+(
+    I2cTable *table,                /*!<INOUT - The table               */
+    const I2cTransfer transfer      /*!<IN    - The transfer to use     */
+)
+{
+    int i;
+    for (i = 0; i < table->count; ++i)
+    {
+        table->buses[i].transfer = transfer;
+    }
+}
+
+/*******************************************************************************
+ *  \brief  Closes the buses and frees their locks.
+ */
+void i2c_destroy
+(
+    I2cTable *table     /*!<INOUT - The table   */
+)
+{
+    int i;
+    for (i = 0; i < table->count; ++i)
+    {
+        if (table->buses[i].fd >= 0)
+        {
+            close(table->buses[i].fd);
+        }
+        pthread_mutex_destroy(&table->buses[i].lock);
+    }
+    table->count = 0;
+}
+
+/*******************************************************************************
+ *  \brief  Checks whether a pin is read over I2C.
+ *  \return Non zero if it is.
+ */
+int i2c_is_used
+(
+    const I2cTable *table,  /*!<IN - The table                      */
+    const int index         /*!<IN - The pin's index in the settings */
+)
+{
+    return table->bus_of[index] >= 0;
+}
+
+/*******************************************************************************
+ *  \brief  Reads a pin's sensor: its reading from the last sweep of the bus
+ *          if fresh and not yet used, otherwise from a new sweep.
+ *  \return RESULT_OK with the values set, or RESULT_BAD_DATA if the sensor
+ *          did not answer or its answer was not valid.
+ */
+SensorReadingResults i2c_read
+(
+    I2cTable *table,        /*!<INOUT - The table                       */
+    const int index,        /*!<IN    - The pin's index in the settings */
+    SensorValues *values    /*!<OUT   - The values read                 */
+)
+{
+    I2cBus *bus = &table->buses[table->bus_of[index]];
+    I2cSensor *sensor = &bus->sensors[table->sensor_of[index]];
+    struct timespec now;
+
+    pthread_mutex_lock(&bus->lock);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (sensor->taken || age_ms(&now, &sensor->when) > I2C_FRESH_MS)
+    {
+        sweep(bus);
+    }
+    *values = sensor->values;
+    sensor->taken = 1;
+    pthread_mutex_unlock(&bus->lock);
+    return values->result;
+}
@@ -0,0 +1,72 @@
+/*------------------------------------------------------------------------------
+ *! \file   i2c.h
+ *! \brief  Reads of the AM2320/AM2315, the I2C members of the sensor family,
+ *          every sensor on a bus swept together.
+ *------------------------------------------------------------------------------
+ *                   Kris Dunning ippie52@gmail.com 2016.
+ *------------------------------------------------------------------------------
+ */
+#pragma once
+
+#include <pthread.h>
+#include <time.h>
+#include <linux/i2c.h>
+
+#include "settings.h"
+
+#define I2C_DEFAULT_ADDRESS     0x5C    /* The AM2320's fixed address       */
+#define I2C_FRESH_MS            1000L   /* A swept reading is kept for      */
+
+struct I2cBuses;
+
+/* Makes the messages in one transfer, as the I2C_RDWR ioctl does: the
+ * number of messages made, or -1 with errno set if one was refused
+ */
+typedef int (*I2cTransfer)(struct I2cBuses *bus, struct i2c_msg *msgs,
+    const int count);
+
+/******************************************************************************/
+/** A sensor on a bus and its reading from the last sweep
+ */
+typedef struct I2cSensors
+{
+    int index;                  /*!< The sensor's index in the settings     */
+    int address;                /*!< The sensor's address                   */
+    SensorValues values;        /*!< The reading from the last sweep        */
+    struct timespec when;       /*!< When the bus was swept, monotonic      */
+    int taken;                  /*!< Non zero once the reading was used     */
+} I2cSensor;
+
+/******************************************************************************/
+/** A bus and the sensors on it
+ */
+typedef struct I2cBuses
+{
+    pthread_mutex_t lock;               /*!< Held for a sweep               */
+    char path[MAX_DEVICE_PATH_LENGTH];  /*!< The device, i.e. /dev/i2c-1    */
+    int fd;                             /*!< The device, -1 if not open     */
+    I2cTransfer transfer;               /*!< The adapter's transfer         */
+    I2cSensor sensors[MAX_PINS];        /*!< The sensors on the bus         */
+    int count;                          /*!< The number of sensors          */
+} I2cBus;
+
+/******************************************************************************/
+/** Every bus, shared by the reader threads
+ */
+typedef struct I2cTables
+{
+    I2cBus buses[MAX_PINS];             /*!< The buses                      */
+    int count;                          /*!< The number of buses            */
+    int bus_of[MAX_PINS];               /*!< Each pin's bus, -1 if none     */
+    int sensor_of[MAX_PINS];            /*!< Each pin's place on its bus    */
+} I2cTable;
+
+void i2c_init(I2cTable *table, const Settings *settings);
+void i2c_destroy(I2cTable *table);
+int i2c_is_used(const I2cTable *table, const int index);
+SensorReadingResults i2c_read(I2cTable *table, const int index,
+    SensorValues *values);
+void i2c_set_transfer(I2cTable *table, const I2cTransfer transfer);
+
+/* The fake adapter of i2c_fake.c, only built into i2c-check */
+int i2c_fake_transfer(I2cBus *bus, struct i2c_msg *msgs, const int count);
@@ -0,0 +1,72 @@
+/*------------------------------------------------------------------------------
+ *! \file   i2c_check.c
+ *! \brief  Checks the I2C sweep against the fake adapter of i2c_fake.c.
+ *
+ *  Three sensors on two buses are read through the fake adapter, which
+ *  answers each address with a reading of its own, and every reading is
+ *  compared with the one the address should give. Run by "make check".
+ *------------------------------------------------------------------------------
+ *                   Kris Dunning ippie52@gmail.com 2016.
+ *------------------------------------------------------------------------------
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "i2c.h"
+
+#define CHECK_TOLERANCE     0.05f
+
+/* The sensors read: their bus and address */
+static const struct
+{
+    const char *bus;
+    int address;
+} SENSORS[] =
+{
+    { "/dev/i2c-1", 0x5C },
+    { "/dev/i2c-1", 0x5D },
+    { "/dev/i2c-3", 0x38 },
+    { NULL, 0 }
+};
+
+/*******************************************************************************
+ *  \brief  Main function.
+ *  \return EXIT_SUCCESS if every sensor read as expected.
+ */
+int main(void)
+{
+    static Settings settings;
+    static I2cTable table;
+    int failures = 0;
+    int i;
+
+    for (i = 0; NULL != SENSORS[i].bus; ++i)
+    {
+        PinConfig *config = &settings.pins[settings.count++];
+        config->pin = 40 + i;
+        snprintf(config->i2c, sizeof(config->i2c), "%s", SENSORS[i].bus);
+        config->i2c_address = SENSORS[i].address;
+    }
+    i2c_init(&table, &settings);
+    i2c_set_transfer(&table, i2c_fake_transfer);
+
+    for (i = 0; i < settings.count; ++i)
+    {
+        const int address = SENSORS[i].address;
+        const float humidity = 45.0f + (float)(address % 10);
+        const float temperature = 21.0f + 0.5f * (float)(address & 7);
+        SensorValues values;
+        const int found = i2c_is_used(&table, i) &&
+            RESULT_OK == i2c_read(&table, i, &values) &&
+            fabsf(values.humidity - humidity) < CHECK_TOLERANCE &&
+            fabsf(values.temperature - temperature) < CHECK_TOLERANCE;
+        printf("%s: %s 0x%02x %.1f%% %.1f*C\n", found ? "PASS" : "FAIL",
+            SENSORS[i].bus, address, humidity, temperature);
+        failures += !found;
+    }
+    i2c_destroy(&table);
+    return (0 == failures) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,114 @@
+/*------------------------------------------------------------------------------
+ *! \file   i2c_fake.c
+ *! \brief  A userspace fake of an I2C adapter with an AM2320 at every
+ *          address, injected by i2c-check to check the I2C reads without the
+ *          hardware. It is not built into kdht.
+ *
+ *  Each fake sensor refuses its address once while it wakes, takes a read
+ *  command while awake, and answers it with a steady reading that depends
+ *  on its address, then sleeps again, as the real sensor does.
+ *------------------------------------------------------------------------------
+ *                   Kris Dunning ippie52@gmail.com 2016.
+ *------------------------------------------------------------------------------
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "i2c.h"
+
+#define FAKE_ADDRESSES  128
+
+/******************************************************************************/
+/** A fake sensor's state
+ */
+typedef struct FakeSensors
+{
+    int awake;          /*!< Non zero once woken        */
+    int commanded;      /*!< Non zero once commanded    */
+} FakeSensor;
+
+static FakeSensor sensors[FAKE_ADDRESSES];
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*******************************************************************************
+ *  \brief  Fills a fake sensor's answer: 45% plus the address's last digit
+ *          and 21*C plus half a degree for each of its lowest three bits.
+ */
+static void answer
+(
+    const int address,  /*!< - The sensor's address    */
+    uint8_t *buffer     /*!< - The eight byte answer   */
+)
+{
+    const int humidity = 450 + 10 * (address % 10);
+    const int temperature = 210 + 5 * (address & 7);
+    uint16_t crc = 0xFFFF;
+    int i;
+    int bit;
+
+    buffer[0] = 0x03;
+    buffer[1] = 0x04;
+    buffer[2] = (uint8_t)(humidity >> 8);
+    buffer[3] = (uint8_t)(humidity & 0xFF);
+    buffer[4] = (uint8_t)(temperature >> 8);
+    buffer[5] = (uint8_t)(temperature & 0xFF);
+    for (i = 0; i < 6; ++i)
+    {
+        crc ^= buffer[i];
+        for (bit = 0; bit < 8; ++bit)
+        {
+            crc = (crc & 1) ? (uint16_t)((crc >> 1) ^ 0xA001) : (uint16_t)(crc >> 1);
+        }
+    }
+    buffer[6] = (uint8_t)(crc & 0xFF);
+    buffer[7] = (uint8_t)(crc >> 8);
+}
+
+/*******************************************************************************
+ *  \brief  Makes the messages in one transfer on the fake adapter, stopping
+ *          at the first refused, as a real adapter does.
+ *  \return The number of messages made, or -1 with errno set to EREMOTEIO.
+ */
+int i2c_fake_transfer
+(
+    I2cBus *bus,            /*!<INOUT - The bus                 */
+    struct i2c_msg *msgs,   /*!<INOUT - The messages            */
+    const int count         /*!<IN    - The number of messages  */
+)
+{
+    int i;
+    (void)bus;
+
+    pthread_mutex_lock(&lock);
+    for (i = 0; i < count; ++i)
+    {
+        FakeSensor *sensor = &sensors[msgs[i].addr % FAKE_ADDRESSES];
+        int made = 0;
+        if (0 == msgs[i].len)
+        {
+            made = sensor->awake;
+            sensor->awake = 1;
+        }
+        else if (0 == (msgs[i].flags & I2C_M_RD))
+        {
+            made = sensor->awake && 3 == msgs[i].len && 0x03 == msgs[i].buf[0];
+            sensor->commanded = made;
+        }
+        else if (sensor->commanded && msgs[i].len >= 8)
+        {
+            answer(msgs[i].addr, msgs[i].buf);
+            memset(sensor, 0, sizeof(*sensor));
+            made = 1;
+        }
+        if (!made)
+        {
+            pthread_mutex_unlock(&lock);
+            errno = EREMOTEIO;
+            return -1;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    return count;
+}
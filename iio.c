@@ -0,0 +1,196 @@
+/*------------------------------------------------------------------------------
+ *! \file   iio.c
+ *! \brief  Reads through the kernel's dht11 IIO driver, which times the
+ *          sensor's edges from interrupts instead of by polling.
+ *
+ *  With the dht11 overlay loaded (it handles the DHT22 too) the sensor shows
+ *  as /sys/bus/iio/devices/iio:deviceN, and reading in_temp_input makes a
+ *  read of the sensor, or gives the last one if it was under 2s ago. The
+ *  values are in thousandths of a *C and of a %. The attribute files are
+ *  opened once and read with pread() from the start each time, as sysfs
+ *  makes a new value for every read at offset 0. A failed read sets errno:
+ *  EIO for a frame with the wrong edge count or checksum, ETIMEDOUT for a
+ *  sensor that did not answer.
+ *
+ *  Any directory holding the two files will do, so a fake device can be made
+ *  of plain files for testing, as iio-check does.
+ *------------------------------------------------------------------------------
+ *                   Kris Dunning ippie52@gmail.com 2016.
+ *------------------------------------------------------------------------------
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "iio.h"
+
+#define IIO_VALUE_LENGTH    32U
+
+/*******************************************************************************
+ *  \brief  Sets up a sensor with no device.
+ */
+void iio_init
+(
+    IioSensor *sensor   /*!<OUT - The sensor    */
+)
+{
+    sensor->path[0] = '\0';
+    sensor->temperature_fd = -1;
+    sensor->humidity_fd = -1;
+}
+
+/*******************************************************************************
+ *  \brief  Opens one of the device's attribute files.
+ *  \return The file descriptor, -1 if it could not be opened.
+ */
+static int open_attribute
+(
+    const char *path,   /*!<IN - The device directory   */
+    const char *name    /*!<IN - The attribute file     */
+)
+{
+    char filename[MAX_DEVICE_PATH_LENGTH + 32U];
+    int fd;
+
+    snprintf(filename, sizeof(filename), "%s/%s", path, name);
+    fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Failed to open %s: %s\n", filename, strerror(errno));
+    }
+    return fd;
+}
+
+/*******************************************************************************
+ *  \brief  Opens the device's attribute files, closing any open before. The
+ *          path is kept even if they cannot be opened, and opening is tried
+ *          again on each read.
+ *  \return Zero if they could not be opened, otherwise 1.
+ */
+int iio_open
+(
+    IioSensor *sensor,  /*!<INOUT - The sensor                          */
+    const char *path    /*!<IN    - The device directory, i.e.
+                                    /sys/bus/iio/devices/iio:device0    */
+)
+{
+    iio_close(sensor);
+    if (path != sensor->path)
+    {
+        snprintf(sensor->path, sizeof(sensor->path), "%s", path);
+    }
+    sensor->temperature_fd = open_attribute(path, IIO_TEMPERATURE_FILE);
+    sensor->humidity_fd = open_attribute(path, IIO_HUMIDITY_FILE);
+    if (sensor->temperature_fd < 0 || sensor->humidity_fd < 0)
+    {
+        iio_close(sensor);
+        return 0;
+    }
+    return 1;
+}
+
+/*******************************************************************************
+ *  \brief  Closes the device's attribute files, keeping its path.
+ */
+void iio_close
+(
+    IioSensor *sensor   /*!<INOUT - The sensor  */
+)
+{
+    if (sensor->temperature_fd >= 0)
+    {
+        close(sensor->temperature_fd);
+        sensor->temperature_fd = -1;
+    }
+    if (sensor->humidity_fd >= 0)
+    {
+        close(sensor->humidity_fd);
+        sensor->humidity_fd = -1;
+    }
+}
+
+/*******************************************************************************
+ *  \brief  Reads an attribute from its start.
+ *  \return Zero with errno set if the read failed, otherwise 1.
+ */
+static int read_attribute
+(
+    const int fd,       /*!<IN  - The attribute file        */
+    long *value         /*!<OUT - The value, thousandths    */
+)
+{
+    char buffer[IIO_VALUE_LENGTH];
+    char *end;
+    ssize_t length;
+
+    do
+    {
+        length = pread(fd, buffer, sizeof(buffer) - 1, 0);
+    } while (length < 0 && EINTR == errno);
+    if (length <= 0)
+    {
+        if (0 == length)
+        {
+            errno = EIO;
+        }
+        return 0;
+    }
+    buffer[length] = '\0';
+    *value = strtol(buffer, &end, 10);
+    if (end == buffer || ('\0' != *end && '\n' != *end))
+    {
+        errno = EIO;
+        return 0;
+    }
+    return 1;
+}
+
+/*******************************************************************************
+ *  \brief  Reads the sensor through the driver. The temperature is read
+ *          first, as that makes the reading, and the humidity then comes
+ *          from the same one.
+ *  \return RESULT_OK with the values set, or RESULT_BAD_DATA if the driver
+ *          could not read the sensor.
+ */
+SensorReadingResults iio_read
+(
+    IioSensor *sensor,      /*!<INOUT - The sensor                          */
+    SensorValues *values,   /*!<OUT   - The values read                     */
+    int *timed_out          /*!<OUT   - Non zero if the sensor did not answer */
+)
+{
+    long temperature;
+    long humidity;
+
+    *timed_out = 0;
+    if ((sensor->temperature_fd < 0 || sensor->humidity_fd < 0) &&
+        !iio_open(sensor, sensor->path))
+    {
+        values->result = RESULT_BAD_DATA;
+        return values->result;
+    }
+    if (!read_attribute(sensor->temperature_fd, &temperature) ||
+        !read_attribute(sensor->humidity_fd, &humidity))
+    {
+        if (ETIMEDOUT == errno)
+        {
+            *timed_out = 1;
+        }
+        else if (EIO != errno)
+        {
+            /* Not the sensor but the device, which may come back */
+            fprintf(stderr, "Failed to read %s: %s\n", sensor->path, strerror(errno));
+            iio_close(sensor);
+        }
+        values->result = RESULT_BAD_DATA;
+        return values->result;
+    }
+    values->temperature = (float)temperature / 1000.0f;
+    values->humidity = (float)humidity / 1000.0f;
+    values->result = RESULT_OK;
+    return values->result;
+}
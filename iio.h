@@ -0,0 +1,30 @@
+/*------------------------------------------------------------------------------
+ *! \file   iio.h
+ *! \brief  Reads through the kernel's dht11 IIO driver, which times the
+ *          sensor's edges from interrupts instead of by polling.
+ *------------------------------------------------------------------------------
+ *                   Kris Dunning ippie52@gmail.com 2016.
+ *------------------------------------------------------------------------------
+ */
+#pragma once
+
+#include "sensor.h"
+
+#define IIO_TEMPERATURE_FILE    "in_temp_input"
+#define IIO_HUMIDITY_FILE       "in_humidityrelative_input"
+
+/******************************************************************************/
+/** An IIO device's attribute files, held open between reads
+ */
+typedef struct IioSensors
+{
+    char path[MAX_DEVICE_PATH_LENGTH];  /*!< The device directory, empty if none */
+    int temperature_fd;                 /*!< in_temp_input, -1 if not open  */
+    int humidity_fd;                    /*!< in_humidityrelative_input      */
+} IioSensor;
+
+void iio_init(IioSensor *sensor);
+int iio_open(IioSensor *sensor, const char *path);
+void iio_close(IioSensor *sensor);
+SensorReadingResults iio_read(IioSensor *sensor, SensorValues *values,
+    int *timed_out);
@@ -0,0 +1,117 @@
+/*------------------------------------------------------------------------------
+ *! \file   iio_check.c
+ *! \brief  Checks the IIO reads against a fake device of plain files.
+ *
+ *  A temporary directory stands in for /sys/bus/iio/devices/iio:deviceN,
+ *  and iio_read() is checked on a valid reading, on a malformed value and
+ *  on a device whose files are missing until the next read. Run by
+ *  "make check".
+ *------------------------------------------------------------------------------
+ *                   Kris Dunning ippie52@gmail.com 2016.
+ *------------------------------------------------------------------------------
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "iio.h"
+
+#define CHECK_TOLERANCE     0.0005f
+
+/*******************************************************************************
+ *  \brief  Writes a value to one of the fake device's attribute files, or
+ *          removes the file if the value is NULL.
+ *  \return Zero on failure, otherwise 1.
+ */
+static int set_attribute
+(
+    const char *directory,  /*!< - The fake device      */
+    const char *name,       /*!< - The attribute file   */
+    const char *value       /*!< - The contents, or NULL */
+)
+{
+    char filename[MAX_DEVICE_PATH_LENGTH + 32U];
+    FILE *fp;
+
+    snprintf(filename, sizeof(filename), "%s/%s", directory, name);
+    if (NULL == value)
+    {
+        return 0 == unlink(filename);
+    }
+    fp = fopen(filename, "w");
+    if (NULL == fp)
+    {
+        perror(filename);
+        return 0;
+    }
+    fputs(value, fp);
+    return 0 == fclose(fp);
+}
+
+/*******************************************************************************
+ *  \brief  Reads the fake device and compares the outcome with the one
+ *          expected, printing the check.
+ *  \return Zero if it differs, otherwise 1.
+ */
+static int check_read
+(
+    IioSensor *sensor,                  /*!< - The sensor to read           */
+    const char *name,                   /*!< - What is being checked        */
+    const SensorReadingResults result,  /*!< - The result expected          */
+    const float temperature,            /*!< - The temperature, if OK       */
+    const float humidity                /*!< - The humidity, if OK          */
+)
+{
+    SensorValues values;
+    int timed_out;
+    const int passed = result == iio_read(sensor, &values, &timed_out) &&
+        !timed_out && (RESULT_OK != result ||
+        (fabsf(values.temperature - temperature) < CHECK_TOLERANCE &&
+         fabsf(values.humidity - humidity) < CHECK_TOLERANCE));
+
+    printf("%s: %s\n", passed ? "PASS" : "FAIL", name);
+    return passed;
+}
+
+/*******************************************************************************
+ *  \brief  Main function.
+ *  \return EXIT_SUCCESS if every read gave what was expected.
+ */
+int main(void)
+{
+    char directory[] = "/tmp/iio-check.XXXXXX";
+    IioSensor sensor;
+    int passed = 1;
+
+    if (NULL == mkdtemp(directory))
+    {
+        perror("Failed to make the fake device");
+        return EXIT_FAILURE;
+    }
+    iio_init(&sensor);
+
+    passed &= set_attribute(directory, IIO_TEMPERATURE_FILE, "21500\n") &&
+        set_attribute(directory, IIO_HUMIDITY_FILE, "48300\n") &&
+        iio_open(&sensor, directory);
+    passed &= check_read(&sensor, "thousandths read", RESULT_OK, 21.5f, 48.3f);
+
+    passed &= set_attribute(directory, IIO_TEMPERATURE_FILE, "21.5x\n");
+    passed &= check_read(&sensor, "malformed value is bad data", RESULT_BAD_DATA, 0, 0);
+    passed &= set_attribute(directory, IIO_TEMPERATURE_FILE, "-4250\n");
+    passed &= check_read(&sensor, "negative value read", RESULT_OK, -4.25f, 48.3f);
+
+    iio_close(&sensor);
+    passed &= set_attribute(directory, IIO_HUMIDITY_FILE, NULL);
+    passed &= check_read(&sensor, "missing file is bad data", RESULT_BAD_DATA, 0, 0);
+    passed &= set_attribute(directory, IIO_HUMIDITY_FILE, "51000\n");
+    passed &= check_read(&sensor, "reopened on the next read", RESULT_OK, -4.25f, 51.0f);
+
+    iio_close(&sensor);
+    set_attribute(directory, IIO_TEMPERATURE_FILE, NULL);
+    set_attribute(directory, IIO_HUMIDITY_FILE, NULL);
+    rmdir(directory);
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,255 @@
+/*------------------------------------------------------------------------------
+ *! \file   kalman.c
+ *! \brief  Per pin Kalman filters of temperature and humidity, used to gate
+ *          new readings against a prediction and to smooth and forecast.
+ *
+ *  Each quantity is modelled as a level changing at a rate, the rate itself
+ *  drifting. A new reading is predicted from the last estimate and the time
+ *  since, and is only accepted straight away if it falls within a few
+ *  standard deviations of the prediction, so a room warming quickly is
+ *  followed without confirmation reads while a glitch of the same size out
+ *  of nowhere is caught. The gate widens with the time since the last
+ *  reading, and never narrows below a fixed floor.
+ *
+ *  The sensor noise is fixed at about its resolution. How fast the rate may
+ *  drift is learned: the normalised innovation squared, which averages one
+ *  for a filter that predicts as well as it thinks it does, is smoothed over
+ *  the readings and the process noise is raised while it is high and
+ *  lowered while it is low. The filter state is kept with the pin's
+ *  statistics, so it carries on across runs.
+ *------------------------------------------------------------------------------
+ *                   Kris Dunning ippie52@gmail.com 2016.
+ *------------------------------------------------------------------------------
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "kalman.h"
+
+#define NIS_WEIGHT      0.1f    /* Weight of each reading in the NIS average */
+#define Q_STEP          1.25f   /* Process noise change per reading          */
+
+/******************************************************************************/
+/** The fixed parameters of a quantity
+ */
+typedef struct KalmanParameters
+{
+    float r;            /*!< Measurement noise variance             */
+    float q;            /*!< Initial process noise                  */
+    float q_min;        /*!< Lowest process noise                   */
+    float q_max;        /*!< Highest process noise                  */
+    float gate_min;     /*!< Narrowest gate, either side            */
+} KalmanParameters;
+
+static const KalmanParameters TEMPERATURE = { 0.01f, 1e-7f, 1e-10f, 1e-3f, 0.5f };
+static const KalmanParameters HUMIDITY = { 0.09f, 1e-6f, 1e-9f, 1e-2f, 2.0f };
+
+/*******************************************************************************
+ *  \brief  Sets up a filter with no readings.
+ */
+static void kalman_init
+(
+    KalmanFilter *filter,               /*!<OUT - The filter        */
+    const KalmanParameters *parameters  /*!<IN  - Its parameters    */
+)
+{
+    memset(filter, 0, sizeof(*filter));
+    filter->q = parameters->q;
+    filter->nis = 1.0f;
+}
+
+/*******************************************************************************
+ *  \brief  Predicts the filter forward to a time.
+ */
+static void kalman_predict
+(
+    const KalmanFilter *filter, /*!<IN  - The filter                        */
+    const double when,          /*!<IN  - The time to predict for, s        */
+    float *level,               /*!<OUT - The predicted level               */
+    float *p                    /*!<OUT - The predicted covariance, or NULL */
+)
+{
+    const float dt = (when > filter->time) ? (float)(when - filter->time) : 0.0f;
+    *level = filter->level + filter->rate * dt;
+    if (NULL != p)
+    {
+        p[0] = filter->p[0] + 2.0f * dt * filter->p[1] + dt * dt * filter->p[2] +
+            filter->q * dt * dt * dt / 3.0f;
+        p[1] = filter->p[1] + dt * filter->p[2] + filter->q * dt * dt / 2.0f;
+        p[2] = filter->p[2] + filter->q * dt;
+    }
+}
+
+/*******************************************************************************
+ *  \brief  Checks a reading against the filter's prediction.
+ *  \return Non zero if the reading is within the gate.
+ */
+static int kalman_gate
+(
+    const KalmanFilter *filter,         /*!<IN - The filter         */
+    const KalmanParameters *parameters, /*!<IN - Its parameters     */
+    const float value,                  /*!<IN - The reading        */
+    const double when                   /*!<IN - When it was read   */
+)
+{
+    float level;
+    float p[3];
+    float gate;
+
+    kalman_predict(filter, when, &level, p);
+    gate = KALMAN_GATE_SIGMAS * sqrtf(p[0] + parameters->r);
+    if (gate < parameters->gate_min)
+    {
+        gate = parameters->gate_min;
+    }
+    return fabsf(value - level) <= gate;
+}
+
+/*******************************************************************************
+ *  \brief  Takes a reading into the filter. A reading outside the gate has
+ *          been confirmed by a second read, so the change is real: the
+ *          filter's uncertainty is widened to take it in, level and rate,
+ *          rather than the reading being weighed against the old estimate.
+ */
+static void kalman_update
+(
+    KalmanFilter *filter,               /*!<INOUT - The filter          */
+    const KalmanParameters *parameters, /*!<IN    - Its parameters      */
+    const float value,                  /*!<IN    - The reading         */
+    const double when                   /*!<IN    - When it was read    */
+)
+{
+    const int expected = filter->ready && kalman_gate(filter, parameters, value, when);
+    float level;
+    float p[3];
+    float s;
+    float k0;
+    float k1;
+    float innovation;
+
+    if (!filter->ready || when < filter->time)
+    {
+        const float q = filter->ready ? filter->q : parameters->q;
+        memset(filter, 0, sizeof(*filter));
+        filter->ready = 1;
+        filter->time = when;
+        filter->level = value;
+        filter->p[0] = parameters->r;
+        filter->p[2] = parameters->r / 3600.0f;
+        filter->q = q;
+        filter->nis = 1.0f;
+        return;
+    }
+
+    kalman_predict(filter, when, &level, NULL);
+    innovation = value - level;
+    if (!expected)
+    {
+        const float dt = (float)(when - filter->time);
+        filter->p[0] += innovation * innovation;
+        if (dt > 0.0f)
+        {
+            filter->p[2] += (innovation / dt) * (innovation / dt);
+        }
+    }
+
+    kalman_predict(filter, when, &level, p);
+    s = p[0] + parameters->r;
+    k0 = p[0] / s;
+    k1 = p[1] / s;
+
+    filter->level = level + k0 * innovation;
+    filter->rate += k1 * innovation;
+    filter->p[0] = (1.0f - k0) * p[0];
+    filter->p[1] = (1.0f - k0) * p[1];
+    filter->p[2] = p[2] - k1 * p[1];
+    filter->time = when;
+
+    /* Predicting worse than expected means the rate drifts faster */
+    if (expected)
+    {
+        filter->nis += NIS_WEIGHT * (innovation * innovation / s - filter->nis);
+    }
+    if (filter->nis > 2.0f && filter->q * Q_STEP <= parameters->q_max)
+    {
+        filter->q *= Q_STEP;
+    }
+    else if (filter->nis < 0.5f && filter->q / Q_STEP >= parameters->q_min)
+    {
+        filter->q /= Q_STEP;
+    }
+}
+
+/*******************************************************************************
+ *  \brief  Sets up a pin's filters with no readings.
+ */
+void tracker_init
+(
+    PinTracker *tracker     /*!<OUT - The filters   */
+)
+{
+    kalman_init(&tracker->temperature, &TEMPERATURE);
+    kalman_init(&tracker->humidity, &HUMIDITY);
+}
+
+/*******************************************************************************
+ *  \brief  Checks whether the filters have taken a reading.
+ *  \return Non zero if they have.
+ */
+int tracker_ready
+(
+    const PinTracker *tracker   /*!<IN - The filters    */
+)
+{
+    return tracker->temperature.ready && tracker->humidity.ready;
+}
+
+/*******************************************************************************
+ *  \brief  Checks raw values against the prediction of both filters.
+ *  \return Non zero if both are within the gate.
+ */
+int tracker_gate
+(
+    const PinTracker *tracker,  /*!<IN - The filters                */
+    const SensorValues *values, /*!<IN - The raw values read        */
+    const double now            /*!<IN - When they were read, s     */
+)
+{
+    return kalman_gate(&tracker->temperature, &TEMPERATURE, values->temperature, now) &&
+        kalman_gate(&tracker->humidity, &HUMIDITY, values->humidity, now);
+}
+
+/*******************************************************************************
+ *  \brief  Takes valid raw values into the filters.
+ */
+void tracker_update
+(
+    PinTracker *tracker,        /*!<INOUT - The filters             */
+    const SensorValues *values, /*!<IN    - The raw values read     */
+    const double now            /*!<IN    - When they were read, s  */
+)
+{
+    if (RESULT_OK == values->result)
+    {
+        kalman_update(&tracker->temperature, &TEMPERATURE, values->temperature, now);
+        kalman_update(&tracker->humidity, &HUMIDITY, values->humidity, now);
+    }
+}
+
+/*******************************************************************************
+ *  \brief  Gets the filters' estimate at a time, the smoothed values at the
+ *          last reading or a forecast after it. The result is not OK if the
+ *          filters have no readings.
+ */
+void tracker_estimate
+(
+    const PinTracker *tracker,  /*!<IN  - The filters               */
+    const double when,          /*!<IN  - The time to estimate, s   */
+    SensorValues *values        /*!<OUT - The estimate              */
+)
+{
+    values->result = tracker_ready(tracker) ? RESULT_OK : RESULT_INVALID;
+    kalman_predict(&tracker->temperature, when, &values->temperature, NULL);
+    kalman_predict(&tracker->humidity, when, &values->humidity, NULL);
+}
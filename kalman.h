@@ -0,0 +1,47 @@
+/*------------------------------------------------------------------------------
+ *! \file   kalman.h
+ *! \brief  Per pin Kalman filters of temperature and humidity, used to gate
+ *          new readings against a prediction and to smooth and forecast.
+ *------------------------------------------------------------------------------
+ *                   Kris Dunning ippie52@gmail.com 2016.
+ *------------------------------------------------------------------------------
+ */
+#pragma once
+
+#include "sensor.h"
+
+#define KALMAN_GATE_SIGMAS      5.0f    /* Gate width, standard deviations  */
+#define KALMAN_FORECAST         300     /* Forecast horizon, seconds        */
+
+/******************************************************************************/
+/** A Kalman filter of one quantity, tracking its level and rate of change.
+ *  The process noise is learned from how well the filter predicts.
+ */
+typedef struct KalmanFilters
+{
+    int ready;          /*!< Non zero once a reading has been taken     */
+    double time;        /*!< When the filter was last updated, s        */
+    float level;        /*!< The estimated value                        */
+    float rate;         /*!< The estimated change per second            */
+    float p[3];         /*!< Covariance: level, level/rate, rate        */
+    float q;            /*!< Process noise, learned                     */
+    float nis;          /*!< Smoothed normalised innovation squared     */
+} KalmanFilter;
+
+/******************************************************************************/
+/** The filters of a pin's temperature and humidity, on the raw readings
+ */
+typedef struct PinTrackers
+{
+    KalmanFilter temperature;   /*!< Temperature, *C            */
+    KalmanFilter humidity;      /*!< Humidity, %                */
+} PinTracker;
+
+void tracker_init(PinTracker *tracker);
+int tracker_ready(const PinTracker *tracker);
+int tracker_gate(const PinTracker *tracker, const SensorValues *values,
+    const double now);
+void tracker_update(PinTracker *tracker, const SensorValues *values,
+    const double now);
+void tracker_estimate(const PinTracker *tracker, const double when,
+    SensorValues *values);
@@ -11,6 +11,7 @@
  */
 
 #include <sys/file.h>
+#include <sys/stat.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -20,6 +21,97 @@
 
 #include "locking.h"
 
+#define MAX_LOCK_PATH_LENGTH    128
+#define MAX_COUNT_LENGTH        24
+
+/*******************************************************************************
+ *  \brief  Reads the count held in a contention counter file. A file written
+ *          before the count was kept as a number holds a byte per event, so
+ *          its size is the count.
+ *  \return The count, zero if it could not be read.
+ */
+static long read_contention
+(
+   const int fd      /*!<IN - The counter file, locked   */
+)
+{
+   char buffer[MAX_COUNT_LENGTH];
+   char *end;
+   long count;
+   struct stat info;
+   ssize_t length = pread(fd, buffer, sizeof(buffer) - 1, 0);
+   if (length <= 0)
+   {
+      return 0;
+   }
+   buffer[length] = '\0';
+   count = strtol(buffer, &end, 10);
+   if (end == buffer || ('\0' != *end && '\n' != *end))
+   {
+      count = (fstat(fd, &info) < 0) ? 0 : (long)info.st_size;
+   }
+   return count;
+}
+
+/*******************************************************************************
+ *  \brief  Records that the lock was found in use, adding one to the count
+ *          kept as a number in a counter file next to the lock. The counter
+ *          file has its own flock, as the pin lock is held by another process.
+ */
+static void record_contention
+(
+   const char *filename    /*!<IN - The file name of the lock file in use   */
+)
+{
+   char counter[MAX_LOCK_PATH_LENGTH];
+   char buffer[MAX_COUNT_LENGTH];
+   int length;
+   int fd;
+   snprintf(counter, sizeof(counter), "%s.contention", filename);
+   fd = open(counter, O_CREAT | O_RDWR | O_CLOEXEC, 0644);
+   if (fd < 0)
+   {
+      return;
+   }
+   if (0 == flock(fd, LOCK_EX))
+   {
+      length = snprintf(buffer, sizeof(buffer), "%ld\n", read_contention(fd) + 1);
+      if (pwrite(fd, buffer, (size_t)length, 0) != length ||
+          ftruncate(fd, length) < 0)
+      {
+         perror("Failed to record lock contention");
+      }
+   }
+   close(fd);
+}
+
+/*******************************************************************************
+ *  \brief  Gets the number of times the lock for the sensor was found in use.
+ *  \return The number of contention events recorded.
+ */
+long get_lock_contention_count
+(
+   const int sensor  /*!<IN - The sensor ID */
+)
+{
+   char counter[MAX_LOCK_PATH_LENGTH];
+   long count = 0;
+   int fd;
+   int length = get_lockfile_name(sensor, counter, MAX_LOCK_PATH_LENGTH);
+   snprintf(counter + length, sizeof(counter) - length, ".contention");
+   fd = open(counter, O_RDONLY | O_CLOEXEC);
+   if (fd < 0)
+   {
+      return 0;
+   }
+   if (0 == flock(fd, LOCK_SH))
+   {
+      count = read_contention(fd);
+   }
+   close(fd);
+   return count;
+}
+
 /*******************************************************************************
  *  \brief  Gets the string name of the lock file, taking the sensor pin into
  *          account.
@@ -36,11 +128,11 @@ int get_lockfile_name
 }
 
 /*******************************************************************************
- *  \brief  Opens the lock file at the given file name and returns the file
- *          descriptor.
- *  \return The file descriptor of the lock file.
+ *  \brief  Tries to take the lock file at the given file name, without
+ *          exiting on failure.
+ *  \return The file descriptor of the lock file, -1 if it could not be taken.
  */
-int open_lockfile
+int try_lockfile
 (
    const char *filename    /*!<IN - The file name of the lock file to create  */
 )
@@ -50,22 +142,49 @@ int open_lockfile
 
    if (fd < 0)
    {
-      printf("Failed to access lock file: %s\nerror: %s\n",
+      fprintf(stderr, "Failed to access lock file: %s\nerror: %s\n",
 		filename, strerror(errno));
-      exit(EXIT_FAILURE);
+      return -1;
    }
 
    while(flock(fd, LOCK_EX | LOCK_NB) == -1)
    {
       if(errno == EWOULDBLOCK)
       {
-         printf("Lock file is in use, exiting...\n");
-         /* If the lock file is in use, we COULD sleep and try again.
-          * However, a lock file would more likely indicate an already runaway
-	       * process. */
-	     exit(EXIT_FAILURE);
+         fprintf(stderr, "Lock file is in use\n");
+         record_contention(filename);
+      }
+      else if(errno == EINTR)
+      {
+         continue;
+      }
+      else
+      {
+         perror("Flock failed");
       }
-      perror("Flock failed");
+      close(fd);
+      return -1;
+   }
+   return fd;
+}
+
+/*******************************************************************************
+ *  \brief  Opens the lock file at the given file name and returns the file
+ *          descriptor.
+ *  \return The file descriptor of the lock file.
+ */
+int open_lockfile
+(
+   const char *filename    /*!<IN - The file name of the lock file to create  */
+)
+{
+   int fd = try_lockfile(filename);
+   if (fd < 0)
+   {
+      /* If the lock file is in use, we COULD sleep and try again.
+       * However, a lock file would more likely indicate an already runaway
+       * process. */
+      fprintf(stderr, "Exiting...\n");
       exit(EXIT_FAILURE);
    }
    return fd;
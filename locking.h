@@ -12,6 +12,8 @@
 #pragma once
 
 int get_lockfile_name(const int sensor, char *buffer, const int size);
+int try_lockfile(const char *filename);
 int open_lockfile(const char *filename);
 void close_lockfile(const int fd);
+long get_lock_contention_count(const int sensor);
 
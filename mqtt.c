@@ -0,0 +1,686 @@
+/*------------------------------------------------------------------------------
+ *! \file   mqtt.c
+ *! \brief  Minimal MQTT 3.1.1 publisher (QoS 0) with an on-disk spool for
+ *          messages which could not be delivered.
+ *
+ *  The connection is kept open between publishes. When the broker cannot be
+ *  reached the message is appended to a bounded spool file instead, and the
+ *  spool is drained a few messages at a time once the broker is back, so a
+ *  long outage does not turn into a burst on reconnect.
+ *------------------------------------------------------------------------------
+ *                   Kris Dunning ippie52@gmail.com 2016.
+ *------------------------------------------------------------------------------
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <netdb.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mqtt.h"
+
+#define MQTT_DEFAULT_PORT       "1883"
+#define MQTT_MAX_PACKET_LENGTH  8192U
+#define MQTT_SPOOL_MAX_BYTES    (1024L * 1024L)
+#define MQTT_DRAIN_PER_PUBLISH  20
+#define MQTT_TIMEOUT_MS         5000
+#define MQTT_MAX_BATCH_LENGTH   (MQTT_MAX_PACKET_LENGTH - MQTT_MAX_TOPIC_LENGTH - 8)
+
+#define MQTT_CONNECT            0x10
+#define MQTT_CONNACK            0x20
+#define MQTT_PUBLISH            0x30
+#define MQTT_PINGREQ            0xC0
+#define MQTT_PINGRESP           0xD0
+#define MQTT_DISCONNECT         0xE0
+
+/*******************************************************************************
+ *  \brief  Encodes the MQTT remaining length field.
+ *  \return The number of bytes used.
+ */
+static size_t encode_length
+(
+    uint8_t *buffer,        /*!<OUT - At least 4 bytes to write to  */
+    size_t length           /*!<IN  - The length to encode          */
+)
+{
+    size_t used = 0;
+    do
+    {
+        uint8_t byte = (uint8_t)(length % 128);
+        length /= 128;
+        if (length > 0)
+        {
+            byte |= 0x80;
+        }
+        buffer[used++] = byte;
+    } while (length > 0 && used < 4);
+    return used;
+}
+
+/*******************************************************************************
+ *  \brief  Appends a length prefixed MQTT string.
+ *  \return The number of bytes used.
+ */
+static size_t encode_string
+(
+    uint8_t *buffer,        /*!<OUT - The buffer to write to    */
+    const char *string,     /*!<IN  - The string to encode      */
+    const size_t length     /*!<IN  - The string length         */
+)
+{
+    buffer[0] = (uint8_t)(length >> 8);
+    buffer[1] = (uint8_t)(length & 0xFF);
+    memcpy(buffer + 2, string, length);
+    return length + 2;
+}
+
+/*******************************************************************************
+ *  \brief  Gets the monotonic time in seconds.
+ *  \return The time.
+ */
+static time_t monotonic_seconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec;
+}
+
+/*******************************************************************************
+ *  \brief  Sends a whole packet, without raising SIGPIPE on a dead socket.
+ *  \return Zero on failure, otherwise 1.
+ */
+static int send_all
+(
+    const int fd,           /*!<IN - The socket to send on      */
+    const uint8_t *data,    /*!<IN - The data to send           */
+    size_t length           /*!<IN - The number of bytes        */
+)
+{
+    while (length > 0)
+    {
+        ssize_t sent = send(fd, data, length, MSG_NOSIGNAL);
+        if (sent < 0)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            return 0;
+        }
+        data += sent;
+        length -= (size_t)sent;
+    }
+    return 1;
+}
+
+/*******************************************************************************
+ *  \brief  Drops the broker connection.
+ */
+static void disconnect_broker
+(
+    MqttClient *client      /*!<INOUT - The client to disconnect    */
+)
+{
+    if (client->fd >= 0)
+    {
+        close(client->fd);
+        client->fd = -1;
+    }
+}
+
+/*******************************************************************************
+ *  \brief  Checks whether an open connection is still alive. Anything the
+ *          broker sends at QoS 0 is discarded, end of stream means the broker
+ *          has closed the connection.
+ *  \return Zero if the connection has been lost, otherwise 1.
+ */
+static int connection_alive
+(
+    MqttClient *client      /*!<INOUT - The client to check     */
+)
+{
+    uint8_t discard[64];
+    ssize_t received;
+    do
+    {
+        received = recv(client->fd, discard, sizeof(discard), MSG_DONTWAIT);
+    } while (received > 0);
+
+    if (0 == received || (received < 0 && EAGAIN != errno && EWOULDBLOCK != errno))
+    {
+        disconnect_broker(client);
+        return 0;
+    }
+    return 1;
+}
+
+/*******************************************************************************
+ *  \brief  Connects a socket, giving up after MQTT_TIMEOUT_MS rather than the
+ *          kernel's TCP timeout when the broker drops the packets.
+ *  \return Zero on failure, otherwise 1.
+ */
+static int connect_within
+(
+    const int fd,                       /*!< - The socket, blocking     */
+    const struct addrinfo *address      /*!< - The address to connect to */
+)
+{
+    const int flags = fcntl(fd, F_GETFL, 0);
+    struct pollfd pending;
+    int error = 0;
+    socklen_t length = sizeof(error);
+
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+    {
+        return 0;
+    }
+    if (connect(fd, address->ai_addr, address->ai_addrlen) < 0)
+    {
+        if (EINPROGRESS != errno)
+        {
+            return 0;
+        }
+        pending.fd = fd;
+        pending.events = POLLOUT;
+        if (poll(&pending, 1, MQTT_TIMEOUT_MS) <= 0 ||
+            getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) < 0 || 0 != error)
+        {
+            return 0;
+        }
+    }
+    return fcntl(fd, F_SETFL, flags) >= 0;
+}
+
+/*******************************************************************************
+ *  \brief  Connects to the broker and completes the MQTT handshake.
+ *  \return Zero on failure, otherwise 1.
+ */
+static int connect_broker
+(
+    MqttClient *client      /*!<INOUT - The client to connect   */
+)
+{
+    struct addrinfo hints;
+    struct addrinfo *addresses = NULL;
+    struct addrinfo *address;
+    struct timeval timeout = { MQTT_TIMEOUT_MS / 1000, 0 };
+    uint8_t packet[128];
+    uint8_t body[96];
+    uint8_t reply[4];
+    char client_id[32];
+    size_t used = 0;
+    size_t header;
+    int fd = -1;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (0 != getaddrinfo(client->host, client->port, &hints, &addresses))
+    {
+        fprintf(stderr, "MQTT: Could not resolve %s\n", client->host);
+        return 0;
+    }
+    for (address = addresses; NULL != address && fd < 0; address = address->ai_next)
+    {
+        fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (fd >= 0 && !connect_within(fd, address))
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+    if (fd < 0)
+    {
+        fprintf(stderr, "MQTT: Could not connect to %s:%s\n", client->host, client->port);
+        return 0;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    /* Variable header: protocol name, level 4, clean session, keep alive */
+    snprintf(client_id, sizeof(client_id), "kdht-%ld", (long)getpid());
+    used += encode_string(body + used, "MQTT", 4);
+    body[used++] = 4;
+    body[used++] = 0x02;
+    body[used++] = (uint8_t)(client->keepalive >> 8);
+    body[used++] = (uint8_t)(client->keepalive & 0xFF);
+    used += encode_string(body + used, client_id, strlen(client_id));
+
+    packet[0] = MQTT_CONNECT;
+    header = 1 + encode_length(packet + 1, used);
+    memcpy(packet + header, body, used);
+
+    if (!send_all(fd, packet, header + used) ||
+        recv(fd, reply, sizeof(reply), MSG_WAITALL) != (ssize_t)sizeof(reply) ||
+        MQTT_CONNACK != reply[0] || 0 != reply[3])
+    {
+        fprintf(stderr, "MQTT: Broker refused the connection\n");
+        close(fd);
+        return 0;
+    }
+    client->fd = fd;
+    client->last_sent = monotonic_seconds();
+    return 1;
+}
+
+/*******************************************************************************
+ *  \brief  Publishes a single message, connecting first if required.
+ *  \return Zero on failure, otherwise 1.
+ */
+static int publish
+(
+    MqttClient *client,     /*!<INOUT - The client to publish with  */
+    const char *payload,    /*!<IN    - The message payload         */
+    const size_t length     /*!<IN    - The payload length          */
+)
+{
+    static uint8_t packet[MQTT_MAX_PACKET_LENGTH];
+    const size_t topic_length = strlen(client->topic);
+    const size_t remaining = 2 + topic_length + length;
+    size_t used;
+
+    if (client->fd >= 0)
+    {
+        (void)connection_alive(client);
+    }
+    if (client->fd < 0 && !connect_broker(client))
+    {
+        return 0;
+    }
+    if (remaining + 5 > sizeof(packet))
+    {
+        fprintf(stderr, "MQTT: Message too long, dropped\n");
+        return 1;
+    }
+
+    packet[0] = MQTT_PUBLISH;
+    used = 1 + encode_length(packet + 1, remaining);
+    used += encode_string(packet + used, client->topic, topic_length);
+    memcpy(packet + used, payload, length);
+    used += length;
+
+    if (!send_all(client->fd, packet, used))
+    {
+        disconnect_broker(client);
+        return 0;
+    }
+    client->last_sent = monotonic_seconds();
+    return 1;
+}
+
+/*******************************************************************************
+ *  \brief  Keeps only the newest half of the spool, so that it stays within
+ *          its size limit.
+ */
+static void trim_spool
+(
+    const char *path        /*!<IN - The spool file path    */
+)
+{
+    char temp[MQTT_MAX_PATH_LENGTH + 4];
+    char *line = NULL;
+    size_t capacity = 0;
+    ssize_t length;
+    long skip;
+    FILE *in = fopen(path, "r");
+    FILE *out;
+
+    if (NULL == in)
+    {
+        return;
+    }
+    fseek(in, 0L, SEEK_END);
+    skip = ftell(in) - MQTT_SPOOL_MAX_BYTES / 2;
+    rewind(in);
+
+    snprintf(temp, sizeof(temp), "%s.new", path);
+    out = fopen(temp, "w");
+    if (NULL != out)
+    {
+        while ((length = getline(&line, &capacity, in)) > 0)
+        {
+            if (skip > 0)
+            {
+                skip -= length;
+            }
+            else
+            {
+                fputs(line, out);
+            }
+        }
+        fclose(out);
+        rename(temp, path);
+        fprintf(stderr, "MQTT: Spool full, oldest messages dropped\n");
+    }
+    free(line);
+    fclose(in);
+}
+
+/*******************************************************************************
+ *  \brief  Appends an undelivered message to the spool.
+ */
+static void spool_message
+(
+    const MqttClient *client,   /*!<IN - The client owning the spool    */
+    const char *payload,        /*!<IN - The message payload            */
+    const size_t length         /*!<IN - The payload length             */
+)
+{
+    struct stat info;
+    FILE *fp;
+
+    if (0 == stat(client->spool, &info) &&
+        info.st_size + (off_t)length >= MQTT_SPOOL_MAX_BYTES)
+    {
+        trim_spool(client->spool);
+    }
+    fp = fopen(client->spool, "a");
+    if (NULL == fp)
+    {
+        fprintf(stderr, "MQTT: Could not open spool %s, message lost\n", client->spool);
+        return;
+    }
+    fwrite(payload, 1, length, fp);
+    fputc('\n', fp);
+    fclose(fp);
+}
+
+/*******************************************************************************
+ *  \brief  Publishes up to MQTT_DRAIN_PER_PUBLISH spooled messages, oldest
+ *          first, keeping anything not delivered for the next call.
+ *  \return Zero if the broker could not be reached, otherwise 1.
+ */
+static int drain_spool
+(
+    MqttClient *client      /*!<INOUT - The client owning the spool */
+)
+{
+    char temp[MQTT_MAX_PATH_LENGTH + 4];
+    char *line = NULL;
+    size_t capacity = 0;
+    ssize_t length;
+    int sent = 0;
+    int delivering = 1;
+    FILE *in = fopen(client->spool, "r");
+    FILE *out;
+
+    if (NULL == in)
+    {
+        return 1;
+    }
+    snprintf(temp, sizeof(temp), "%s.new", client->spool);
+    out = fopen(temp, "w");
+    if (NULL == out)
+    {
+        fclose(in);
+        return 1;
+    }
+
+    while ((length = getline(&line, &capacity, in)) > 0)
+    {
+        if (delivering && sent < MQTT_DRAIN_PER_PUBLISH)
+        {
+            if (publish(client, line, (size_t)length - 1))
+            {
+                ++sent;
+                continue;
+            }
+            delivering = 0;
+        }
+        fputs(line, out);
+    }
+    free(line);
+    fclose(in);
+
+    if (0 == ftell(out))
+    {
+        fclose(out);
+        unlink(temp);
+        unlink(client->spool);
+    }
+    else
+    {
+        fclose(out);
+        rename(temp, client->spool);
+    }
+    return delivering;
+}
+
+/*******************************************************************************
+ *  \brief  Initialises the client. No connection is made until the first
+ *          publish.
+ *  \return Zero if the server is not valid, otherwise 1.
+ */
+int mqtt_init
+(
+    MqttClient *client,             /*!<OUT - The client to initialise          */
+    const char *server,             /*!<IN  - The broker as host[:port]         */
+    const char *topic,              /*!<IN  - The topic to publish to           */
+    const char *spool,              /*!<IN  - The spool file path               */
+    const unsigned int keepalive    /*!<IN  - The keep alive time in seconds    */
+)
+{
+    const char *colon = strrchr(server, ':');
+    size_t host_length = colon ? (size_t)(colon - server) : strlen(server);
+
+    memset(client, 0, sizeof(*client));
+    client->fd = -1;
+    client->keepalive = keepalive > 0xFFFF ? 0xFFFF : keepalive;
+    if (0 == host_length || host_length >= sizeof(client->host))
+    {
+        return 0;
+    }
+    memcpy(client->host, server, host_length);
+    snprintf(client->port, sizeof(client->port), "%s",
+        colon ? colon + 1 : MQTT_DEFAULT_PORT);
+    snprintf(client->topic, sizeof(client->topic), "%s", topic);
+    snprintf(client->spool, sizeof(client->spool), "%s", spool);
+    return 1;
+}
+
+/*******************************************************************************
+ *  \brief  Publishes a batch of readings. Any spooled messages are sent first
+ *          so ordering is kept; the batch is spooled if it cannot be sent.
+ *  \return Zero if the batch was spooled, otherwise 1.
+ */
+int mqtt_publish_batch
+(
+    MqttClient *client,     /*!<INOUT - The client to publish with  */
+    const char *payload,    /*!<IN    - The batch payload           */
+    const size_t length     /*!<IN    - The payload length          */
+)
+{
+    if (access(client->spool, F_OK) == 0 && !drain_spool(client))
+    {
+        spool_message(client, payload, length);
+        return 0;
+    }
+    if (access(client->spool, F_OK) == 0 || !publish(client, payload, length))
+    {
+        /* Still a backlog (or a failed send), keep the order */
+        spool_message(client, payload, length);
+        return 0;
+    }
+    return 1;
+}
+
+/*******************************************************************************
+ *  \brief  Pings the broker once half the keep alive has passed with nothing
+ *          sent, so that it keeps the connection while the deadband holds
+ *          back the readings. A connection that does not answer is dropped,
+ *          to be made again by the next publish.
+ */
+void mqtt_keep_alive
+(
+    MqttClient *client      /*!<INOUT - The client to keep connected */
+)
+{
+    const uint8_t packet[2] = { MQTT_PINGREQ, 0 };
+    uint8_t reply[2];
+
+    if (client->fd < 0 || 0 == client->keepalive ||
+        monotonic_seconds() - client->last_sent < (time_t)(client->keepalive / 2) ||
+        !connection_alive(client))
+    {
+        return;
+    }
+    if (!send_all(client->fd, packet, sizeof(packet)) ||
+        recv(client->fd, reply, sizeof(reply), MSG_WAITALL) != (ssize_t)sizeof(reply) ||
+        MQTT_PINGRESP != reply[0])
+    {
+        fprintf(stderr, "MQTT: No answer to a ping, reconnecting on the next publish\n");
+        disconnect_broker(client);
+        return;
+    }
+    client->last_sent = monotonic_seconds();
+}
+
+/*******************************************************************************
+ *  \brief  Disconnects cleanly from the broker.
+ */
+void mqtt_close
+(
+    MqttClient *client      /*!<INOUT - The client to close */
+)
+{
+    const uint8_t packet[2] = { MQTT_DISCONNECT, 0 };
+    if (client->fd >= 0)
+    {
+        (void)send_all(client->fd, packet, sizeof(packet));
+        disconnect_broker(client);
+    }
+}
+
+/******************************************************************************/
+/** The MQTT sink, collecting a cycle's reports into one JSON array
+ */
+struct MqttSinks
+{
+    MqttClient client;                      /*!< The broker connection      */
+    char batch[MQTT_MAX_BATCH_LENGTH];      /*!< The batch being built      */
+    size_t used;                            /*!< Batch length so far        */
+};
+
+/*******************************************************************************
+ *  \brief  Publishes the batch built up so far, if any.
+ */
+static void publish_pending
+(
+    MqttSink *sink  /*!<INOUT - The MqttSink    */
+)
+{
+    if (sink->used > 0)
+    {
+        sink->batch[sink->used++] = ']';
+        mqtt_publish_batch(&sink->client, sink->batch, sink->used);
+        sink->used = 0;
+    }
+}
+
+/*******************************************************************************
+ *  \brief  Adds a report or alert to the batch for this cycle. A batch that
+ *          has no room for it is published first and a new one started.
+ */
+static void mqtt_sink_write
+(
+    void *context,              /*!<INOUT - The MqttSink            */
+    const SinkEvent *event      /*!<IN    - The report or alert to add */
+)
+{
+    MqttSink *sink = (MqttSink *)context;
+    char line[MAX_REPORT_LENGTH];
+    size_t length;
+
+    if (SINK_EVENT_ALERT == event->type)
+    {
+        length = format_alert(line, sizeof(line), FORMAT_JSON, &event->alert);
+    }
+    else
+    {
+        length = format_report(line, sizeof(line), FORMAT_JSON, &event->report);
+    }
+    if (0 == length)
+    {
+        return;
+    }
+    if (length >= sizeof(line))
+    {
+        fprintf(stderr, "MQTT: Report too long, dropped\n");
+        return;
+    }
+    /* Drop the line ending, the batch is a single message */
+    --length;
+
+    /* The separator, the report and the closing bracket must all fit */
+    if (sink->used + length + 2 > sizeof(sink->batch))
+    {
+        publish_pending(sink);
+    }
+    sink->batch[sink->used] = (0 == sink->used) ? '[' : ',';
+    ++sink->used;
+    memcpy(sink->batch + sink->used, line, length);
+    sink->used += length;
+}
+
+/*******************************************************************************
+ *  \brief  Publishes the batch built up over the cycle, or keeps the
+ *          connection alive if the cycle had nothing to publish.
+ */
+static void mqtt_sink_flush
+(
+    void *context   /*!<INOUT - The MqttSink    */
+)
+{
+    MqttSink *sink = (MqttSink *)context;
+    publish_pending(sink);
+    mqtt_keep_alive(&sink->client);
+}
+
+/*******************************************************************************
+ *  \brief  Publishes anything outstanding and disconnects.
+ */
+static void mqtt_sink_close
+(
+    void *context   /*!<INOUT - The MqttSink    */
+)
+{
+    MqttSink *sink = (MqttSink *)context;
+    publish_pending(sink);
+    mqtt_close(&sink->client);
+    free(sink);
+}
+
+const SinkOps mqtt_sink =
+{
+    SINK_API_VERSION, "mqtt", NULL, mqtt_sink_write, mqtt_sink_flush, mqtt_sink_close
+};
+
+/*******************************************************************************
+ *  \brief  Creates the context for the MQTT sink.
+ *  \return The sink context, NULL if the server is not valid.
+ */
+MqttSink *mqtt_sink_create
+(
+    const char *server,             /*!<IN - The broker as host[:port]          */
+    const char *topic,              /*!<IN - The topic to publish to            */
+    const char *spool,              /*!<IN - The spool file path                */
+    const unsigned int keepalive    /*!<IN - The keep alive time in seconds     */
+)
+{
+    MqttSink *sink = calloc(1, sizeof(*sink));
+    if (NULL != sink && !mqtt_init(&sink->client, server, topic, spool, keepalive))
+    {
+        free(sink);
+        sink = NULL;
+    }
+    return sink;
+}
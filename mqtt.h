@@ -0,0 +1,45 @@
+/*------------------------------------------------------------------------------
+ *! \file   mqtt.h
+ *! \brief  Minimal MQTT 3.1.1 publisher (QoS 0) with an on-disk spool for
+ *          messages which could not be delivered.
+ *------------------------------------------------------------------------------
+ *                   Kris Dunning ippie52@gmail.com 2016.
+ *------------------------------------------------------------------------------
+ */
+#pragma once
+
+#include <stddef.h>
+#include <time.h>
+
+#include "sink.h"
+
+#define MQTT_MAX_HOST_LENGTH    64U
+#define MQTT_MAX_TOPIC_LENGTH   128U
+#define MQTT_MAX_PATH_LENGTH    100U
+
+/******************************************************************************/
+/** MQTT connection and spool state
+ */
+typedef struct MqttClients
+{
+    char host[MQTT_MAX_HOST_LENGTH];    /*!< The broker host name           */
+    char port[8];                       /*!< The broker port                */
+    char topic[MQTT_MAX_TOPIC_LENGTH];  /*!< The topic to publish to        */
+    char spool[MQTT_MAX_PATH_LENGTH];   /*!< The spool file path            */
+    int fd;                             /*!< The broker socket, -1 if none  */
+    unsigned int keepalive;             /*!< The keep alive in seconds      */
+    time_t last_sent;                   /*!< When a packet was last sent, monotonic */
+} MqttClient;
+
+int mqtt_init(MqttClient *client, const char *server, const char *topic,
+    const char *spool, const unsigned int keepalive);
+int mqtt_publish_batch(MqttClient *client, const char *payload,
+    const size_t length);
+void mqtt_keep_alive(MqttClient *client);
+void mqtt_close(MqttClient *client);
+
+/* The MQTT sink, its context is a MqttSink from mqtt_sink_create() */
+typedef struct MqttSinks MqttSink;
+extern const SinkOps mqtt_sink;
+MqttSink *mqtt_sink_create(const char *server, const char *topic,
+    const char *spool, const unsigned int keepalive);
@@ -0,0 +1,398 @@
+/*------------------------------------------------------------------------------
+ *! \file   output.c
+ *! \brief  Formats the final sensor report for humans or for collectors.
+ *
+ *  The machine readable formats always produce exactly one line per run, so
+ *  that collectors never need to parse the human readable text.
+ *------------------------------------------------------------------------------
+ *                   Kris Dunning ippie52@gmail.com 2016.
+ *------------------------------------------------------------------------------
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include "output.h"
+
+/*******************************************************************************
+ *  \brief  Gets the short name of a reading result, as used by the machine
+ *          readable formats.
+ *  \return The result name, "unknown" if not recognised.
+ */
+const char *get_result_name
+(
+    const SensorReadingResults result   /*!<IN - The result to name */
+)
+{
+    switch (result)
+    {
+        case RESULT_OK:             return "ok";
+        case RESULT_BAD_DATA:       return "bad_data";
+        case RESULT_ALL_ZERO:       return "all_zero";
+        case RESULT_INCONSISTENT:   return "inconsistent";
+        case RESULT_INVALID:        return "invalid";
+    }
+    return "unknown";
+}
+
+/*******************************************************************************
+ *  \brief  Gets the short name of a sensor model, as used by the machine
+ *          readable formats.
+ *  \return The model name, "unknown" if not recognised.
+ */
+const char *get_model_name
+(
+    const SensorModel model     /*!<IN - The model to name  */
+)
+{
+    switch (model)
+    {
+        case MODEL_AUTO:            return "auto";
+        case MODEL_DHT11:           return "dht11";
+        case MODEL_DHT22:           return "dht22";
+    }
+    return "unknown";
+}
+
+/*******************************************************************************
+ *  \brief  Converts a format name given on the command line.
+ *  \return Zero if the name is not recognised, otherwise 1.
+ */
+int parse_output_format
+(
+    const char *name,       /*!<IN  - The format name, i.e. "json"  */
+    OutputFormat *format    /*!<OUT - The format identified         */
+)
+{
+    int result = 1;
+    if (0 == strcmp(name, "human"))
+    {
+        *format = FORMAT_HUMAN;
+    }
+    else if (0 == strcmp(name, "json"))
+    {
+        *format = FORMAT_JSON;
+    }
+    else if (0 == strcmp(name, "csv"))
+    {
+        *format = FORMAT_CSV;
+    }
+    else if (0 == strcmp(name, "influx"))
+    {
+        *format = FORMAT_INFLUX;
+    }
+    else
+    {
+        result = 0;
+    }
+    return result;
+}
+
+/*******************************************************************************
+ *  \brief  Appends formatted text to the buffer, keeping track of the length
+ *          used. Output beyond the buffer size is truncated.
+ */
+static void append
+(
+    char *buffer,       /*!<OUT   - The buffer to write to          */
+    const size_t size,  /*!<IN    - The size of the buffer          */
+    size_t *used,       /*!<INOUT - The number of characters used   */
+    const char *fmt,    /*!<IN    - The printf style format         */
+    ...
+)
+{
+    va_list args;
+    int written;
+    if (*used < size)
+    {
+        va_start(args, fmt);
+        written = vsnprintf(buffer + *used, size - *used, fmt, args);
+        va_end(args);
+        if (written > 0)
+        {
+            *used += (size_t)written;
+        }
+    }
+}
+
+/*******************************************************************************
+ *  \brief  Formats the report in the given format, including the trailing
+ *          newline. Values are only included in the machine readable formats
+ *          when the result is OK. Reports from a sensor group also carry the
+ *          group, its confidence and, when it has one, its fused reading.
+ *          JSON and InfluxDB reports carry the filtered estimate and forecast
+ *          once the pin's filters have a history.
+ *  \return The length of the formatted report, zero if there is nothing to
+ *          report (human format with no valid values).
+ */
+size_t format_report
+(
+    char *buffer,                   /*!<OUT - The buffer to write to    */
+    const size_t size,              /*!<IN  - The size of the buffer    */
+    const OutputFormat format,      /*!<IN  - The format to use         */
+    const SensorReport *report      /*!<IN  - The report to format      */
+)
+{
+    const SensorValues *values = &report->values;
+    const int ok = (RESULT_OK == values->result);
+    const int grouped = ('\0' != report->group[0]);
+    const int fused = grouped && (RESULT_OK == report->fused.result);
+    const int smoothed = (RESULT_OK == report->smoothed.result);
+    const long long ms = (long long)report->timestamp.tv_sec * 1000LL +
+        report->timestamp.tv_nsec / 1000000L;
+    size_t used = 0;
+
+    if (size > 0)
+    {
+        buffer[0] = '\0';
+    }
+
+    switch (format)
+    {
+        case FORMAT_HUMAN:
+            if (ok)
+            {
+                append(buffer, size, &used,
+                    "Humidity = %.2f %% Temperature = %.2f *C (%.2f *F)\n",
+                    values->humidity, values->temperature,
+                    C_TO_F(values->temperature));
+            }
+            if (fused)
+            {
+                append(buffer, size, &used,
+                    "Group %s: Humidity = %.2f %% Temperature = %.2f *C (%.2f *F), confidence %.2f\n",
+                    report->group, report->fused.humidity, report->fused.temperature,
+                    C_TO_F(report->fused.temperature), report->confidence);
+            }
+            break;
+
+        case FORMAT_JSON:
+            append(buffer, size, &used, "{\"ts\":%lld,\"pin\":%d,\"result\":\"%s\","
+                "\"attempts\":%d,\"latency_us\":%ld",
+                ms, report->pin, get_result_name(values->result),
+                report->attempts, report->latency_us);
+            if (ok)
+            {
+                append(buffer, size, &used,
+                    ",\"humidity\":%.1f,\"temperature\":%.1f",
+                    values->humidity, values->temperature);
+            }
+            if (grouped)
+            {
+                append(buffer, size, &used, ",\"group\":\"%s\",\"confidence\":%.2f",
+                    report->group, report->confidence);
+            }
+            if (fused)
+            {
+                append(buffer, size, &used,
+                    ",\"fused_humidity\":%.1f,\"fused_temperature\":%.1f",
+                    report->fused.humidity, report->fused.temperature);
+            }
+            if (smoothed)
+            {
+                append(buffer, size, &used,
+                    ",\"smoothed_humidity\":%.1f,\"smoothed_temperature\":%.1f,"
+                    "\"forecast_humidity\":%.1f,\"forecast_temperature\":%.1f",
+                    report->smoothed.humidity, report->smoothed.temperature,
+                    report->forecast.humidity, report->forecast.temperature);
+            }
+            append(buffer, size, &used, "}\n");
+            break;
+
+        case FORMAT_CSV:
+            /* timestamp_ms,pin,result,attempts,latency_us,humidity,temperature */
+            append(buffer, size, &used, "%lld,%d,%s,%d,%ld,", ms, report->pin,
+                get_result_name(values->result), report->attempts,
+                report->latency_us);
+            if (ok)
+            {
+                append(buffer, size, &used, "%.1f,%.1f",
+                    values->humidity, values->temperature);
+            }
+            else
+            {
+                append(buffer, size, &used, ",");
+            }
+            if (grouped)
+            {
+                /* ...,group,confidence,fused_humidity,fused_temperature */
+                append(buffer, size, &used, ",%s,%.2f,", report->group,
+                    report->confidence);
+                if (fused)
+                {
+                    append(buffer, size, &used, "%.1f,%.1f",
+                        report->fused.humidity, report->fused.temperature);
+                }
+                else
+                {
+                    append(buffer, size, &used, ",");
+                }
+            }
+            append(buffer, size, &used, "\n");
+            break;
+
+        case FORMAT_INFLUX:
+            append(buffer, size, &used, "dht,pin=%d", report->pin);
+            if (grouped)
+            {
+                append(buffer, size, &used, ",group=%s", report->group);
+            }
+            append(buffer, size, &used,
+                " result=\"%s\",attempts=%di,latency_us=%ldi",
+                get_result_name(values->result), report->attempts,
+                report->latency_us);
+            if (ok)
+            {
+                append(buffer, size, &used, ",humidity=%.1f,temperature=%.1f",
+                    values->humidity, values->temperature);
+            }
+            if (grouped)
+            {
+                append(buffer, size, &used, ",confidence=%.2f", report->confidence);
+            }
+            if (fused)
+            {
+                append(buffer, size, &used, ",fused_humidity=%.1f,fused_temperature=%.1f",
+                    report->fused.humidity, report->fused.temperature);
+            }
+            if (smoothed)
+            {
+                append(buffer, size, &used,
+                    ",smoothed_humidity=%.1f,smoothed_temperature=%.1f,"
+                    "forecast_humidity=%.1f,forecast_temperature=%.1f",
+                    report->smoothed.humidity, report->smoothed.temperature,
+                    report->forecast.humidity, report->forecast.temperature);
+            }
+            append(buffer, size, &used, " %lld%09ld\n",
+                (long long)report->timestamp.tv_sec, report->timestamp.tv_nsec);
+            break;
+    }
+    return (used < size) ? used : (size > 0 ? size - 1 : 0);
+}
+
+/*******************************************************************************
+ *  \brief  Prints the report in the given format.
+ */
+void print_report
+(
+    FILE *fp,                       /*!<IN - The stream to print to     */
+    const OutputFormat format,      /*!<IN - The format to print in     */
+    const SensorReport *report      /*!<IN - The report to print        */
+)
+{
+    char buffer[MAX_REPORT_LENGTH];
+    if (format_report(buffer, sizeof(buffer), format, report) > 0)
+    {
+        fputs(buffer, fp);
+    }
+}
+
+/*******************************************************************************
+ *  \brief  Gets the names of an alert's condition and quantity.
+ */
+static void get_alert_names
+(
+    const Alert *alert,         /*!<IN  - The alert to name             */
+    const char **condition,     /*!<OUT - The condition name            */
+    const char **quantity       /*!<OUT - The quantity name, "" if none */
+)
+{
+    static const char *CONDITION_NAMES[] = { "above", "below", "rate", "stale" };
+    *condition = CONDITION_NAMES[alert->condition];
+    *quantity = (CONDITION_STALE == alert->condition) ? "" :
+        (QUANTITY_TEMPERATURE == alert->quantity) ? "temperature" : "humidity";
+}
+
+/*******************************************************************************
+ *  \brief  Formats an alert in the given format, including the trailing
+ *          newline. The CSV columns are timestamp_ms, pin, "alert:<rule>",
+ *          state, condition (i.e. "temperature_above"), value and threshold.
+ *  \return The length of the formatted alert.
+ */
+size_t format_alert
+(
+    char *buffer,                   /*!<OUT - The buffer to write to    */
+    const size_t size,              /*!<IN  - The size of the buffer    */
+    const OutputFormat format,      /*!<IN  - The format to use         */
+    const Alert *alert              /*!<IN  - The alert to format       */
+)
+{
+    const char *state = alert->raised ? "raised" : "cleared";
+    const long long ms = (long long)alert->timestamp.tv_sec * 1000LL +
+        alert->timestamp.tv_nsec / 1000000L;
+    const char *condition;
+    const char *quantity;
+    size_t used = 0;
+
+    get_alert_names(alert, &condition, &quantity);
+    if (size > 0)
+    {
+        buffer[0] = '\0';
+    }
+
+    switch (format)
+    {
+        case FORMAT_HUMAN:
+            if (CONDITION_STALE == alert->condition)
+            {
+                append(buffer, size, &used,
+                    "Alert %s %s on pin %d: no valid reading for %.1f minutes (limit %.1f)\n",
+                    alert->rule, state, alert->pin, alert->value, alert->threshold);
+            }
+            else
+            {
+                append(buffer, size, &used,
+                    "Alert %s %s on pin %d: %s %s %.1f (threshold %.1f)\n",
+                    alert->rule, state, alert->pin, quantity,
+                    (CONDITION_RATE == alert->condition) ? "changing per minute by" : "at",
+                    alert->value, alert->threshold);
+            }
+            break;
+
+        case FORMAT_JSON:
+            append(buffer, size, &used, "{\"ts\":%lld,\"pin\":%d,\"alert\":\"%s\","
+                "\"state\":\"%s\",\"condition\":\"%s\"", ms, alert->pin,
+                alert->rule, state, condition);
+            if (CONDITION_STALE != alert->condition)
+            {
+                append(buffer, size, &used, ",\"quantity\":\"%s\"", quantity);
+            }
+            append(buffer, size, &used, ",\"value\":%.1f,\"threshold\":%.1f}\n",
+                alert->value, alert->threshold);
+            break;
+
+        case FORMAT_CSV:
+            append(buffer, size, &used, "%lld,%d,alert:%s,%s,%s%s%s,%.1f,%.1f\n",
+                ms, alert->pin, alert->rule, state, quantity,
+                quantity[0] ? "_" : "", condition, alert->value, alert->threshold);
+            break;
+
+        case FORMAT_INFLUX:
+            append(buffer, size, &used,
+                "dht_alert,pin=%d,rule=%s,condition=%s state=\"%s\",raised=%di,"
+                "value=%.1f,threshold=%.1f %lld%09ld\n",
+                alert->pin, alert->rule, condition, state, alert->raised,
+                alert->value, alert->threshold,
+                (long long)alert->timestamp.tv_sec, alert->timestamp.tv_nsec);
+            break;
+    }
+    return (used < size) ? used : (size > 0 ? size - 1 : 0);
+}
+
+/*******************************************************************************
+ *  \brief  Prints an alert in the given format.
+ */
+void print_alert
+(
+    FILE *fp,                       /*!<IN - The stream to print to     */
+    const OutputFormat format,      /*!<IN - The format to print in     */
+    const Alert *alert              /*!<IN - The alert to print         */
+)
+{
+    char buffer[MAX_REPORT_LENGTH];
+    if (format_alert(buffer, sizeof(buffer), format, alert) > 0)
+    {
+        fputs(buffer, fp);
+    }
+}
@@ -0,0 +1,99 @@
+/*------------------------------------------------------------------------------
+ *! \file   output.h
+ *! \brief  Formats the final sensor report for humans or for collectors.
+ *------------------------------------------------------------------------------
+ *                   Kris Dunning ippie52@gmail.com 2016.
+ *------------------------------------------------------------------------------
+ */
+#pragma once
+
+#include <stdio.h>
+#include <time.h>
+
+#include "sensor.h"
+#include "perf.h"
+
+#define MAX_REPORT_LENGTH   384U
+#define MAX_RULE_NAME_LENGTH 32U
+
+/******************************************************************************/
+/** The available report formats
+ */
+typedef enum Formats
+{
+    FORMAT_HUMAN,   /*!< The original "Humidity = ..." line         */
+    FORMAT_JSON,    /*!< A single JSON object per line              */
+    FORMAT_CSV,     /*!< Comma separated values, no header          */
+    FORMAT_INFLUX   /*!< InfluxDB line protocol                     */
+} OutputFormat;
+
+/******************************************************************************/
+/** The complete outcome of a read, as reported to the user or collector
+ */
+typedef struct Report
+{
+    int pin;                    /*!< The sensor pin read                    */
+    SensorValues values;        /*!< The final values and result            */
+    int attempts;               /*!< The number of reads made               */
+    int outcomes[RESULT_COUNT]; /*!< The number of attempts with each result */
+    int timeouts;               /*!< Attempts the sensor stopped sending in */
+    float margin_sum;           /*!< Data bit timing margins, summed        */
+    int margin_bits;            /*!< The number of margins summed           */
+    char group[MAX_GROUP_NAME_LENGTH]; /*!< The pin's sensor group, or empty */
+    SensorValues fused;         /*!< The group's fused values               */
+    float confidence;           /*!< Share of the group agreeing, 0 to 1    */
+    SensorValues smoothed;      /*!< The filtered estimate, now             */
+    SensorValues forecast;      /*!< The estimate KALMAN_FORECAST s ahead   */
+    long latency_us;            /*!< Time spent reading, in microseconds    */
+    long phase_us[PHASE_COUNT]; /*!< Time spent in each phase, all attempts */
+    struct timespec timestamp;  /*!< Wall clock time of the final reading   */
+    unsigned int perf_mask;     /*!< Bit per performance event counted      */
+    uint64_t perf[RESULT_COUNT][PERF_EVENT_COUNT]; /*!< Events over the captures,
+                                                        by attempt result   */
+} SensorReport;
+
+/******************************************************************************/
+/** The conditions an alert rule can check
+ */
+typedef enum AlertConditions
+{
+    CONDITION_ABOVE,    /*!< The value has risen above the threshold        */
+    CONDITION_BELOW,    /*!< The value has fallen below the threshold       */
+    CONDITION_RATE,     /*!< The value is changing faster than the threshold */
+    CONDITION_STALE     /*!< No valid reading for the threshold in minutes  */
+} AlertCondition;
+
+/******************************************************************************/
+/** The values an alert rule can check
+ */
+typedef enum Quantities
+{
+    QUANTITY_TEMPERATURE,   /*!< Temperature, *C    */
+    QUANTITY_HUMIDITY       /*!< Humidity, %        */
+} Quantity;
+
+/******************************************************************************/
+/** An alert raised or cleared by a rule
+ */
+typedef struct Alerts
+{
+    char rule[MAX_RULE_NAME_LENGTH];    /*!< The name of the rule               */
+    int pin;                            /*!< The sensor pin                     */
+    int raised;                         /*!< 1 if raised, 0 if cleared          */
+    AlertCondition condition;           /*!< The condition checked              */
+    Quantity quantity;                  /*!< The value checked, if any          */
+    float value;                        /*!< Value, rate per minute or minutes  */
+    float threshold;                    /*!< The rule's threshold               */
+    struct timespec timestamp;          /*!< The reading that changed it        */
+} Alert;
+
+const char *get_result_name(const SensorReadingResults result);
+const char *get_model_name(const SensorModel model);
+int parse_output_format(const char *name, OutputFormat *format);
+size_t format_report(char *buffer, const size_t size,
+    const OutputFormat format, const SensorReport *report);
+void print_report(FILE *fp, const OutputFormat format,
+    const SensorReport *report);
+size_t format_alert(char *buffer, const size_t size,
+    const OutputFormat format, const Alert *alert);
+void print_alert(FILE *fp, const OutputFormat format, const Alert *alert);
@@ -0,0 +1,228 @@
+/*------------------------------------------------------------------------------
+ *! \file   perf.c
+ *! \brief  Per reader performance counters over each capture, to tie failed
+ *          frames to what the kernel did to the reader meanwhile.
+ *
+ *  Each reader opens a group of counters on its own thread the first time
+ *  it captures, with perf_event_open(). The group is reset and enabled
+ *  before the start signal and disabled after the last bit, so a capture
+ *  costs two ioctls and a read, none of them while the bits arrive. Events
+ *  the kernel does not allow (perf_event_paranoid) or the CPU does not have
+ *  are left out; kernel time is counted where permitted, otherwise only
+ *  user time, which still shows the switches and faults themselves.
+ *------------------------------------------------------------------------------
+ *                   Kris Dunning ippie52@gmail.com 2016.
+ *------------------------------------------------------------------------------
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "perf.h"
+
+/******************************************************************************/
+/** How each event is asked for
+ */
+typedef struct PerfEventTypes
+{
+    uint32_t type;          /*!< Hardware or software               */
+    uint64_t config;        /*!< The event                          */
+    const char *name;       /*!< The event's name, for the metrics  */
+} PerfEventType;
+
+static const PerfEventType EVENTS[PERF_EVENT_COUNT] =
+{
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES,         "cycles"            },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS,       "instructions"      },
+    { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES,   "context_switches"  },
+    { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS,     "migrations"        },
+    { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS,        "page_faults"       }
+};
+
+/*******************************************************************************
+ *  \brief  Sets up the counters, to be opened on the first capture.
+ */
+void perf_init
+(
+    PerfCounter *counter    /*!<OUT - The counters  */
+)
+{
+    int i;
+    memset(counter, 0, sizeof(*counter));
+    counter->leader = -1;
+    for (i = 0; i < PERF_EVENT_COUNT; ++i)
+    {
+        counter->fds[i] = -1;
+    }
+}
+
+/*******************************************************************************
+ *  \brief  Opens a counter of the calling thread, disabled.
+ *  \return The fd, -1 if the event is not allowed or not there.
+ */
+static int open_event
+(
+    const PerfEventType *event, /*!< - The event to count           */
+    const int leader,           /*!< - The group leader, -1 for none */
+    const int exclude_kernel    /*!< - Non zero to count user time  */
+)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = event->type;
+    attr.config = event->config;
+    attr.disabled = (leader < 0) ? 1 : 0;
+    attr.exclude_kernel = exclude_kernel ? 1 : 0;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+    return (int)syscall(__NR_perf_event_open, &attr, 0, -1, leader, 0);
+}
+
+/*******************************************************************************
+ *  \brief  Opens the counters on the calling thread, each that is allowed.
+ */
+static void perf_open
+(
+    PerfCounter *counter    /*!<INOUT - The counters    */
+)
+{
+    int exclude_kernel = 0;
+    int i;
+
+    counter->opened = 1;
+    for (i = 0; i < PERF_EVENT_COUNT; ++i)
+    {
+        int fd = open_event(&EVENTS[i], counter->leader, exclude_kernel);
+        if (fd < 0 && (EACCES == errno || EPERM == errno) && !exclude_kernel)
+        {
+            exclude_kernel = 1;
+            fd = open_event(&EVENTS[i], counter->leader, exclude_kernel);
+        }
+        if (fd < 0)
+        {
+            continue;
+        }
+        if (counter->leader < 0)
+        {
+            counter->leader = fd;
+        }
+        counter->fds[i] = fd;
+        counter->order[counter->count++] = i;
+    }
+    if (counter->count < PERF_EVENT_COUNT)
+    {
+        fprintf(stderr, "%d of %d performance counters are available\n",
+            counter->count, PERF_EVENT_COUNT);
+    }
+}
+
+/*******************************************************************************
+ *  \brief  Closes the counters.
+ */
+void perf_close
+(
+    PerfCounter *counter    /*!<INOUT - The counters    */
+)
+{
+    int i;
+    for (i = 0; i < PERF_EVENT_COUNT; ++i)
+    {
+        if (counter->fds[i] >= 0)
+        {
+            close(counter->fds[i]);
+        }
+    }
+    perf_init(counter);
+}
+
+/*******************************************************************************
+ *  \brief  Resets and starts the counters, opening them on the first call.
+ *          This must be called on the thread to count.
+ */
+void perf_start
+(
+    PerfCounter *counter    /*!<INOUT - The counters    */
+)
+{
+    if (!counter->opened)
+    {
+        perf_open(counter);
+    }
+    if (counter->leader >= 0)
+    {
+        ioctl(counter->leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(counter->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+}
+
+/*******************************************************************************
+ *  \brief  Stops the counters and reads them. The sample's mask is zero if
+ *          there are none.
+ */
+void perf_stop
+(
+    PerfCounter *counter,   /*!<INOUT - The counters            */
+    PerfSample *sample      /*!<OUT   - The counts since started */
+)
+{
+    uint64_t values[PERF_EVENT_COUNT + 1];
+    int i;
+
+    memset(sample, 0, sizeof(*sample));
+    if (counter->leader < 0)
+    {
+        return;
+    }
+    ioctl(counter->leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    if (read(counter->leader, values, sizeof(values)) < (ssize_t)sizeof(uint64_t) ||
+        values[0] != (uint64_t)counter->count)
+    {
+        return;
+    }
+    for (i = 0; i < counter->count; ++i)
+    {
+        sample->counts[counter->order[i]] = values[i + 1];
+        sample->mask |= 1U << counter->order[i];
+    }
+}
+
+/*******************************************************************************
+ *  \brief  Gets the name of an event, as used in the metrics.
+ *  \return The event name.
+ */
+const char *perf_event_name
+(
+    const PerfEvent event   /*!<IN - The event  */
+)
+{
+    return EVENTS[event].name;
+}
+
+/*******************************************************************************
+ *  \brief  Prints the counts of a sample that were counted, i.e.
+ *          "context_switches 2, migrations 0, ...".
+ */
+void print_perf_sample
+(
+    FILE *fp,                   /*!<IN - The stream to print to     */
+    const PerfSample *sample    /*!<IN - The sample                 */
+)
+{
+    const char *separator = "";
+    int i;
+    for (i = 0; i < PERF_EVENT_COUNT; ++i)
+    {
+        if (sample->mask & (1U << i))
+        {
+            fprintf(fp, "%s%s %llu", separator, EVENTS[i].name,
+                (unsigned long long)sample->counts[i]);
+            separator = ", ";
+        }
+    }
+}
@@ -0,0 +1,54 @@
+/*------------------------------------------------------------------------------
+ *! \file   perf.h
+ *! \brief  Per reader performance counters over each capture, to tie failed
+ *          frames to what the kernel did to the reader meanwhile.
+ *------------------------------------------------------------------------------
+ *                   Kris Dunning ippie52@gmail.com 2016.
+ *------------------------------------------------------------------------------
+ */
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+
+/******************************************************************************/
+/** The events counted
+ */
+typedef enum PerfEvents
+{
+    PERF_CYCLES,            /*!< CPU cycles                               */
+    PERF_INSTRUCTIONS,      /*!< Instructions retired                     */
+    PERF_CONTEXT_SWITCHES,  /*!< Times the reader was switched out        */
+    PERF_MIGRATIONS,        /*!< Times the reader moved to another core   */
+    PERF_PAGE_FAULTS        /*!< Page faults taken                        */
+} PerfEvent;
+
+#define PERF_EVENT_COUNT    (PERF_PAGE_FAULTS + 1)
+
+/******************************************************************************/
+/** A reader thread's counters, one group enabled and read together
+ */
+typedef struct PerfCounters
+{
+    int opened;                     /*!< Non zero once opening was tried    */
+    int leader;                     /*!< The group leader's fd, -1 if none  */
+    int fds[PERF_EVENT_COUNT];      /*!< Each event's fd, -1 if not allowed */
+    int order[PERF_EVENT_COUNT];    /*!< The events in group order          */
+    int count;                      /*!< The number of events opened        */
+} PerfCounter;
+
+/******************************************************************************/
+/** The counts over one capture
+ */
+typedef struct PerfSamples
+{
+    unsigned int mask;                  /*!< Bit per event counted          */
+    uint64_t counts[PERF_EVENT_COUNT];  /*!< The counts                     */
+} PerfSample;
+
+void perf_init(PerfCounter *counter);
+void perf_close(PerfCounter *counter);
+void perf_start(PerfCounter *counter);
+void perf_stop(PerfCounter *counter, PerfSample *sample);
+const char *perf_event_name(const PerfEvent event);
+void print_perf_sample(FILE *fp, const PerfSample *sample);
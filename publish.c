@@ -0,0 +1,212 @@
+/*------------------------------------------------------------------------------
+ *! \file   publish.c
+ *! \brief  On change publishing, readings are only passed to the outputs when
+ *          they move by more than a deadband or a heartbeat is due.
+ *
+ *  The last published reading is kept in /tmp/dhtpublished.<pin>, apart from
+ *  the stored reading used for the consistency check, so one shot runs from
+ *  cron behave the same as watch mode.
+ *------------------------------------------------------------------------------
+ *                   Kris Dunning ippie52@gmail.com 2016.
+ *------------------------------------------------------------------------------
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "publish.h"
+
+#define MAX_PUBLISH_PATH_LENGTH 100U
+
+/*******************************************************************************
+ *  \brief  Gets the file name holding the last published reading.
+ */
+static void get_publish_file_name
+(
+    const int pin,      /*!<IN  - The sensor pin                */
+    char *filename      /*!<OUT - MAX_PUBLISH_PATH_LENGTH bytes */
+)
+{
+    snprintf(filename, MAX_PUBLISH_PATH_LENGTH, "/tmp/dhtpublished.%d", pin);
+}
+
+/*******************************************************************************
+ *  \brief  Gets the size of the change between two values.
+ *  \return The absolute difference.
+ */
+static float change
+(
+    const float from,   /*!< - The previous value   */
+    const float to      /*!< - The new value        */
+)
+{
+    return (to > from) ? to - from : from - to;
+}
+
+/*******************************************************************************
+ *  \brief  Converts a value to thousandths for storage.
+ *  \return The value in thousandths, rounded.
+ */
+static int to_thousandths
+(
+    const float value   /*!< - The value to convert */
+)
+{
+    return (int)(1000.0f * value + ((value < 0.0f) ? -0.5f : 0.5f));
+}
+
+/*******************************************************************************
+ *  \brief  Parses a deadband, "[<pin>=]<temperature>[:<humidity>]". The
+ *          humidity band is the same as the temperature band if not given.
+ *  \return Zero if the deadband is not valid, otherwise 1.
+ */
+int parse_deadband
+(
+    const char *spec,       /*!<IN  - The deadband to parse                 */
+    int *pin,               /*!<OUT - The pin, -1 if it applies to all pins */
+    float *temperature,     /*!<OUT - The temperature band, *C              */
+    float *humidity         /*!<OUT - The humidity band, %                  */
+)
+{
+    const char *equals = strchr(spec, '=');
+    char *end = NULL;
+
+    *pin = -1;
+    if (NULL != equals)
+    {
+        *pin = (int)strtol(spec, &end, 10);
+        if (end != equals || end == spec)
+        {
+            return 0;
+        }
+        spec = equals + 1;
+    }
+
+    *temperature = strtof(spec, &end);
+    if (end == spec || *temperature < 0.0f)
+    {
+        return 0;
+    }
+    *humidity = *temperature;
+    if (':' == *end)
+    {
+        spec = end + 1;
+        *humidity = strtof(spec, &end);
+        if (end == spec || *humidity < 0.0f)
+        {
+            return 0;
+        }
+    }
+    return ('\0' == *end);
+}
+
+/*******************************************************************************
+ *  \brief  Sets up on change publishing for a pin, loading the reading last
+ *          published. A negative band disables it, every reading is published.
+ */
+void publish_init
+(
+    PublishState *state,        /*!<OUT - The state to set up           */
+    const int pin,              /*!<IN  - The sensor pin                */
+    const float temperature,    /*!<IN  - The temperature band, *C      */
+    const float humidity,       /*!<IN  - The humidity band, %          */
+    const long heartbeat        /*!<IN  - Longest between publishes, s  */
+)
+{
+    char filename[MAX_PUBLISH_PATH_LENGTH];
+    FILE *fp;
+    int read_pin = -1;
+    int result = RESULT_INVALID;
+    int read_temp = 0;
+    int read_hum = 0;
+    long read_time = 0L;
+
+    memset(state, 0, sizeof(*state));
+    state->pin = pin;
+    state->temperature_band = temperature;
+    state->humidity_band = humidity;
+    state->heartbeat = heartbeat;
+    state->enabled = (temperature >= 0.0f);
+    state->last = (SensorValues)INVALID_VALUES;
+    if (!state->enabled)
+    {
+        return;
+    }
+
+    get_publish_file_name(pin, filename);
+    fp = fopen(filename, "r");
+    if (NULL == fp)
+    {
+        return;
+    }
+    if (5 == fscanf(fp, "%d %d %d %d %ld", &read_pin, &result, &read_temp,
+            &read_hum, &read_time) &&
+        pin == read_pin && result >= RESULT_OK && result < RESULT_COUNT)
+    {
+        state->published = 1;
+        state->last.result = (SensorReadingResults)result;
+        state->last.temperature = (float)read_temp / 1000.0f;
+        state->last.humidity = (float)read_hum / 1000.0f;
+        state->last_time = (time_t)read_time;
+    }
+    fclose(fp);
+}
+
+/*******************************************************************************
+ *  \brief  Checks whether a reading should be published, recording it as the
+ *          last published reading if so. A change of result is always
+ *          published, as is anything once the heartbeat is due.
+ *  \return Zero if the reading should be held back, otherwise 1.
+ */
+int publish_check
+(
+    PublishState *state,        /*!<INOUT - The pin's publish state     */
+    const SensorReport *report  /*!<IN    - The reading to check        */
+)
+{
+    const SensorValues *values = &report->values;
+    char filename[MAX_PUBLISH_PATH_LENGTH];
+    FILE *fp;
+    int publish;
+
+    if (!state->enabled)
+    {
+        return 1;
+    }
+
+    publish = !state->published ||
+        values->result != state->last.result ||
+        (long)(report->timestamp.tv_sec - state->last_time) >= state->heartbeat ||
+        report->timestamp.tv_sec < state->last_time;
+    if (!publish && RESULT_OK == values->result)
+    {
+        publish =
+            change(state->last.temperature, values->temperature) > state->temperature_band ||
+            change(state->last.humidity, values->humidity) > state->humidity_band;
+    }
+    if (!publish)
+    {
+        return 0;
+    }
+
+    state->published = 1;
+    state->last = *values;
+    state->last_time = report->timestamp.tv_sec;
+
+    get_publish_file_name(state->pin, filename);
+    fp = fopen(filename, "w");
+    if (NULL != fp)
+    {
+        fprintf(fp, "%d %d %d %d %ld\n", state->pin, (int)values->result,
+            to_thousandths(values->temperature),
+            to_thousandths(values->humidity),
+            (long)state->last_time);
+        fclose(fp);
+    }
+    else
+    {
+        fprintf(stderr, "Could not store the published reading in %s\n", filename);
+    }
+    return 1;
+}
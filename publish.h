@@ -0,0 +1,36 @@
+/*------------------------------------------------------------------------------
+ *! \file   publish.h
+ *! \brief  On change publishing, readings are only passed to the outputs when
+ *          they move by more than a deadband or a heartbeat is due.
+ *------------------------------------------------------------------------------
+ *                   Kris Dunning ippie52@gmail.com 2016.
+ *------------------------------------------------------------------------------
+ */
+#pragma once
+
+#include <time.h>
+
+#include "output.h"
+
+#define DEFAULT_HEARTBEAT   300
+
+/******************************************************************************/
+/** The last published reading for a pin and the policy used to publish it
+ */
+typedef struct PublishStates
+{
+    int pin;                        /*!< The sensor pin                         */
+    float temperature_band;         /*!< Change needed to publish, *C           */
+    float humidity_band;            /*!< Change needed to publish, %            */
+    long heartbeat;                 /*!< Longest between publishes, seconds     */
+    int enabled;                    /*!< Zero to publish every reading          */
+    int published;                  /*!< Non zero once something was published  */
+    SensorValues last;              /*!< The last published values              */
+    time_t last_time;               /*!< When last was published                */
+} PublishState;
+
+int parse_deadband(const char *spec, int *pin, float *temperature,
+    float *humidity);
+void publish_init(PublishState *state, const int pin, const float temperature,
+    const float humidity, const long heartbeat);
+int publish_check(PublishState *state, const SensorReport *report);
@@ -0,0 +1,303 @@
+/*------------------------------------------------------------------------------
+ *! \file   readers.c
+ *! \brief  The reader pool, sensor reads spread over real time threads, each
+ *          pinned to a core, which take work from each other when idle.
+ *
+ *  Every reader has its own queue and its own capture buffer. A read is queued
+ *  for the reader that owns the pin, so a pin tends to stay on one core, and a
+ *  reader with nothing of its own to do takes the most recently queued read
+ *  from another reader's queue. The scheduler limits how many reads are
+ *  handed out at once, so the queues stay short; the pool only keeps every
+ *  core busy while a backlog lasts. Reads made are passed back through a
+ *  queue and an eventfd, so the main loop can wait for them alongside its
+ *  timers and signals.
+ *------------------------------------------------------------------------------
+ *                   Kris Dunning ippie52@gmail.com 2016.
+ *------------------------------------------------------------------------------
+ */
+
+#define _GNU_SOURCE
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "readers.h"
+
+/*******************************************************************************
+ *  \brief  Takes the oldest read from a reader's own queue.
+ *  \return The read, NULL if the queue is empty.
+ */
+static ReadJob *take_own
+(
+    Reader *reader  /*!< - The reader   */
+)
+{
+    ReadJob *job = NULL;
+    pthread_mutex_lock(&reader->lock);
+    if (reader->count > 0)
+    {
+        job = reader->queue[reader->head];
+        reader->head = (reader->head + 1) % READER_QUEUE_LENGTH;
+        --reader->count;
+    }
+    pthread_mutex_unlock(&reader->lock);
+    return job;
+}
+
+/*******************************************************************************
+ *  \brief  Takes the newest read from another reader's queue, leaving the
+ *          owner the reads it will get to first.
+ *  \return The read, NULL if the queue is empty.
+ */
+static ReadJob *take_other
+(
+    Reader *victim  /*!< - The reader to take from  */
+)
+{
+    ReadJob *job = NULL;
+    pthread_mutex_lock(&victim->lock);
+    if (victim->count > 0)
+    {
+        --victim->count;
+        job = victim->queue[(victim->head + victim->count) % READER_QUEUE_LENGTH];
+    }
+    pthread_mutex_unlock(&victim->lock);
+    return job;
+}
+
+/*******************************************************************************
+ *  \brief  The reader thread, making reads until the pool is stopped. A read
+ *          is claimed from the pool's count before it is looked for, so a
+ *          reader that claims one always finds one.
+ *  \return Always NULL.
+ */
+static void *reader_thread
+(
+    void *arg   /*!<IN - The Reader to run  */
+)
+{
+    Reader *reader = (Reader *)arg;
+    ReaderPool *pool = reader->pool;
+    const uint64_t one = 1;
+
+    for (;;)
+    {
+        ReadJob *job = NULL;
+        int i;
+
+        pthread_mutex_lock(&pool->lock);
+        while (0 == pool->waiting && !pool->stopping)
+        {
+            pthread_cond_wait(&pool->work, &pool->lock);
+        }
+        if (0 == pool->waiting)
+        {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+        --pool->waiting;
+        pthread_mutex_unlock(&pool->lock);
+
+        while (NULL == job)
+        {
+            job = take_own(reader);
+            for (i = 1; NULL == job && i < pool->count; ++i)
+            {
+                job = take_other(&pool->readers[(reader->id + i) % pool->count]);
+                if (NULL != job)
+                {
+                    ++reader->stolen;
+                }
+            }
+        }
+
+        pool->read(job, &reader->buffer, pool->arg);
+        ++reader->reads;
+
+        pthread_mutex_lock(&pool->lock);
+        pool->done[(pool->done_head + pool->done_count) % READER_QUEUE_LENGTH] = job;
+        ++pool->done_count;
+        pthread_mutex_unlock(&pool->lock);
+        if (write(pool->event_fd, &one, sizeof(one)) < 0)
+        {
+            /* The counter cannot overflow with this few reads */
+        }
+    }
+    return NULL;
+}
+
+/*******************************************************************************
+ *  \brief  Starts the readers, one per core if the count is zero. Each runs
+ *          at the highest FIFO priority, to give the best chance of not
+ *          losing data when bit-bashing the sensor, and is pinned to a core.
+ *          If real time scheduling is not allowed the readers run at normal
+ *          priority instead.
+ *  \return The number of readers started, zero on failure.
+ */
+int reader_pool_start
+(
+    ReaderPool *pool,           /*!<OUT - The pool to start             */
+    int count,                  /*!<IN  - The number of readers         */
+    ReadFunction read,          /*!<IN  - Makes each read               */
+    void *arg                   /*!<IN  - Passed to read                */
+)
+{
+    const long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int i;
+
+    if (count < 1)
+    {
+        count = (cores > 0) ? (int)cores : 1;
+    }
+    if (count > MAX_READERS)
+    {
+        count = MAX_READERS;
+    }
+
+    memset(pool, 0, sizeof(*pool));
+    pool->read = read;
+    pool->arg = arg;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pool->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (pool->event_fd < 0)
+    {
+        perror("Failed to create the reader event");
+        return 0;
+    }
+
+    for (i = 0; i < count; ++i)
+    {
+        Reader *reader = &pool->readers[i];
+        pthread_attr_t attr;
+        struct sched_param param;
+        cpu_set_t cpus;
+        int result;
+
+        reader->pool = pool;
+        reader->id = i;
+        reader->cpu = (cores > 0) ? i % (int)cores : 0;
+        pthread_mutex_init(&reader->lock, NULL);
+        perf_init(&reader->buffer.perf);
+
+        CPU_ZERO(&cpus);
+        CPU_SET(reader->cpu, &cpus);
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = sched_get_priority_max(SCHED_FIFO);
+        pthread_attr_init(&attr);
+        pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+        pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+        pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+        pthread_attr_setschedparam(&attr, &param);
+        result = pthread_create(&reader->thread, &attr, reader_thread, reader);
+        if (0 != result)
+        {
+            param.sched_priority = 0;
+            pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+            pthread_attr_setschedparam(&attr, &param);
+            result = pthread_create(&reader->thread, &attr, reader_thread, reader);
+        }
+        pthread_attr_destroy(&attr);
+        if (0 != result)
+        {
+            fprintf(stderr, "Failed to start reader %d\n", i);
+            pthread_mutex_destroy(&reader->lock);
+            break;
+        }
+        pool->count = i + 1;
+    }
+    return pool->count;
+}
+
+/*******************************************************************************
+ *  \brief  Queues a read for the given reader, or any idle one.
+ */
+void reader_pool_submit
+(
+    ReaderPool *pool,       /*!<INOUT - The pool                        */
+    ReadJob *job,           /*!<IN    - The read, kept until collected  */
+    const int owner         /*!<IN    - The reader it should go to      */
+)
+{
+    Reader *reader = &pool->readers[owner % pool->count];
+
+    pthread_mutex_lock(&reader->lock);
+    reader->queue[(reader->head + reader->count) % READER_QUEUE_LENGTH] = job;
+    ++reader->count;
+    pthread_mutex_unlock(&reader->lock);
+
+    pthread_mutex_lock(&pool->lock);
+    ++pool->waiting;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/*******************************************************************************
+ *  \brief  Takes the next read made, without waiting. Wait for the pool's
+ *          event_fd to be readable for more.
+ *  \return The read, NULL if none has been made.
+ */
+ReadJob *reader_pool_collect
+(
+    ReaderPool *pool    /*!<INOUT - The pool    */
+)
+{
+    ReadJob *job = NULL;
+    uint64_t events;
+
+    if (read(pool->event_fd, &events, sizeof(events)) < 0)
+    {
+        /* Nothing new, there may still be reads from before */
+    }
+    pthread_mutex_lock(&pool->lock);
+    if (pool->done_count > 0)
+    {
+        job = pool->done[pool->done_head];
+        pool->done_head = (pool->done_head + 1) % READER_QUEUE_LENGTH;
+        --pool->done_count;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return job;
+}
+
+/*******************************************************************************
+ *  \brief  Stops the readers once the reads queued have been made, and
+ *          reports how the reads were shared out.
+ */
+void reader_pool_stop
+(
+    ReaderPool *pool    /*!<INOUT - The pool    */
+)
+{
+    int i;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (i = 0; i < pool->count; ++i)
+    {
+        Reader *reader = &pool->readers[i];
+        pthread_join(reader->thread, NULL);
+        pthread_mutex_destroy(&reader->lock);
+        perf_close(&reader->buffer.perf);
+        if (pool->count > 1)
+        {
+            fprintf(stderr, "Reader %d on core %d: %lu reads, %lu taken from others\n",
+                reader->id, reader->cpu, reader->reads, reader->stolen);
+        }
+    }
+    pool->count = 0;
+    if (pool->event_fd >= 0)
+    {
+        close(pool->event_fd);
+        pool->event_fd = -1;
+    }
+    pthread_cond_destroy(&pool->work);
+    pthread_mutex_destroy(&pool->lock);
+}
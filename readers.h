@@ -0,0 +1,88 @@
+/*------------------------------------------------------------------------------
+ *! \file   readers.h
+ *! \brief  The reader pool, sensor reads spread over real time threads, each
+ *          pinned to a core, which take work from each other when idle.
+ *------------------------------------------------------------------------------
+ *                   Kris Dunning ippie52@gmail.com 2016.
+ *------------------------------------------------------------------------------
+ */
+#pragma once
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "output.h"
+#include "perf.h"
+#include "schedule.h"
+#include "settings.h"
+
+#define MAX_READERS             16
+#define MAX_CAPTURE_TIMINGS     85
+#define READER_QUEUE_LENGTH     MAX_PINS
+
+/******************************************************************************/
+/** A reader's capture buffer and decode state, kept apart from every other
+ *  reader's so that reads on different threads never share memory
+ */
+typedef struct CaptureBuffers
+{
+    uint8_t timings[MAX_CAPTURE_TIMINGS];   /*!< Loop counts of each level    */
+    int data[5];                            /*!< The bytes decoded            */
+    PerfCounter perf;                       /*!< The reader's event counters  */
+} CaptureBuffer;
+
+/******************************************************************************/
+/** A read to make, and its outcome
+ */
+typedef struct ReadJobs
+{
+    ScheduleEntry entry;        /*!< The scheduled read                     */
+    SensorReport report;        /*!< The outcome, set by the reader         */
+} ReadJob;
+
+/* Makes a read, called on a reader thread */
+typedef void (*ReadFunction)(ReadJob *job, CaptureBuffer *buffer, void *arg);
+
+struct ReaderPools;
+
+/******************************************************************************/
+/** A reader thread and the reads queued for it
+ */
+typedef struct Readers
+{
+    struct ReaderPools *pool;               /*!< The pool the reader is in  */
+    int id;                                 /*!< The reader's number        */
+    int cpu;                                /*!< The core it is pinned to   */
+    pthread_t thread;                       /*!< The reader thread          */
+    pthread_mutex_t lock;                   /*!< Guards the queue           */
+    ReadJob *queue[READER_QUEUE_LENGTH];    /*!< Reads waiting, a ring      */
+    int head;                               /*!< The oldest read waiting    */
+    int count;                              /*!< The number waiting         */
+    unsigned long reads;                    /*!< Reads made                 */
+    unsigned long stolen;                   /*!< Reads taken from others    */
+    CaptureBuffer buffer;                   /*!< The reader's own buffer    */
+} Reader;
+
+/******************************************************************************/
+/** The reader pool
+ */
+typedef struct ReaderPools
+{
+    Reader readers[MAX_READERS];            /*!< The readers                */
+    int count;                              /*!< The number of readers      */
+    ReadFunction read;                      /*!< Makes each read            */
+    void *arg;                              /*!< Passed to read             */
+    pthread_mutex_t lock;                   /*!< Guards what follows        */
+    pthread_cond_t work;                    /*!< Signalled as reads arrive  */
+    int waiting;                            /*!< Reads queued, all readers  */
+    int stopping;                           /*!< Non zero to stop           */
+    ReadJob *done[READER_QUEUE_LENGTH];     /*!< Reads made, a ring         */
+    int done_head;                          /*!< The oldest read made       */
+    int done_count;                         /*!< The number of reads made   */
+    int event_fd;                           /*!< Readable once reads are made */
+} ReaderPool;
+
+int reader_pool_start(ReaderPool *pool, int count, ReadFunction read, void *arg);
+void reader_pool_submit(ReaderPool *pool, ReadJob *job, const int owner);
+ReadJob *reader_pool_collect(ReaderPool *pool);
+void reader_pool_stop(ReaderPool *pool);
@@ -0,0 +1,320 @@
+/*------------------------------------------------------------------------------
+ *! \file   rules.c
+ *! \brief  Alert rules, compiled once from a rules file and evaluated on
+ *          every reading.
+ *
+ *  The rules file has one rule per line, '#' starts a comment:
+ *
+ *      <name> <pin|*> temperature|humidity above|below <value> [clear <value>]
+ *      <name> <pin|*> temperature|humidity rate <per minute> [clear <value>]
+ *      <name> <pin|*> stale <minutes>
+ *
+ *  Each pin is given only the rules that apply to it, and each rule keeps its
+ *  own raised state, so a reading costs a fixed amount of work per rule and
+ *  an alert is only passed on when a rule is raised or cleared.
+ *------------------------------------------------------------------------------
+ *                   Kris Dunning ippie52@gmail.com 2016.
+ *------------------------------------------------------------------------------
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rules.h"
+
+#define MAX_RULE_LINE_LENGTH    256U
+#define MAX_RULE_TOKENS         8
+
+/*******************************************************************************
+ *  \brief  Parses a number from the rules file.
+ *  \return Zero if the token is not a number, otherwise 1.
+ */
+static int parse_value
+(
+    const char *token,  /*!<IN  - The token to parse, may be NULL   */
+    float *value        /*!<OUT - The value parsed                  */
+)
+{
+    char *end = NULL;
+    if (NULL == token)
+    {
+        return 0;
+    }
+    *value = strtof(token, &end);
+    return (end != token && '\0' == *end);
+}
+
+/*******************************************************************************
+ *  \brief  Compiles a single rule from the tokens of a line.
+ *  \return Zero if the rule is not valid, otherwise 1.
+ */
+static int parse_rule
+(
+    char **tokens,      /*!<IN  - The tokens of the line    */
+    const int count,    /*!<IN  - The number of tokens      */
+    Rule *rule          /*!<OUT - The rule compiled         */
+)
+{
+    int next = 3;
+    char *end = NULL;
+
+    memset(rule, 0, sizeof(*rule));
+    if (count < 4 || strlen(tokens[0]) >= sizeof(rule->name))
+    {
+        return 0;
+    }
+    snprintf(rule->name, sizeof(rule->name), "%s", tokens[0]);
+
+    rule->pin = -1;
+    if (0 != strcmp(tokens[1], "*"))
+    {
+        rule->pin = (int)strtol(tokens[1], &end, 10);
+        if (end == tokens[1] || '\0' != *end || rule->pin < 0)
+        {
+            return 0;
+        }
+    }
+
+    if (0 == strcmp(tokens[2], "stale"))
+    {
+        rule->condition = CONDITION_STALE;
+        return (4 == count && parse_value(tokens[3], &rule->threshold) &&
+            rule->threshold > 0.0f);
+    }
+    else if (0 == strcmp(tokens[2], "temperature"))
+    {
+        rule->quantity = QUANTITY_TEMPERATURE;
+    }
+    else if (0 == strcmp(tokens[2], "humidity"))
+    {
+        rule->quantity = QUANTITY_HUMIDITY;
+    }
+    else
+    {
+        return 0;
+    }
+
+    if (0 == strcmp(tokens[next], "above"))
+    {
+        rule->condition = CONDITION_ABOVE;
+    }
+    else if (0 == strcmp(tokens[next], "below"))
+    {
+        rule->condition = CONDITION_BELOW;
+    }
+    else if (0 == strcmp(tokens[next], "rate"))
+    {
+        rule->condition = CONDITION_RATE;
+    }
+    else
+    {
+        return 0;
+    }
+    if (!parse_value((++next < count) ? tokens[next] : NULL, &rule->threshold))
+    {
+        return 0;
+    }
+
+    /* Without a clear level the rule clears as soon as it is no longer true */
+    rule->clear = rule->threshold;
+    if (++next < count)
+    {
+        if (0 != strcmp(tokens[next], "clear") ||
+            !parse_value((++next < count) ? tokens[next] : NULL, &rule->clear) ||
+            ++next != count)
+        {
+            return 0;
+        }
+    }
+
+    switch (rule->condition)
+    {
+        case CONDITION_ABOVE:   return (rule->clear <= rule->threshold);
+        case CONDITION_BELOW:   return (rule->clear >= rule->threshold);
+        case CONDITION_RATE:    return (rule->threshold > 0.0f &&
+                                    rule->clear <= rule->threshold);
+        case CONDITION_STALE:   break;
+    }
+    return 1;
+}
+
+/*******************************************************************************
+ *  \brief  Reads and compiles the rules file.
+ *  \return Zero if the file cannot be read or a rule is not valid, otherwise 1.
+ */
+int rules_load
+(
+    const char *path,   /*!<IN  - The rules file        */
+    RuleSet *set        /*!<OUT - The rules compiled    */
+)
+{
+    char line[MAX_RULE_LINE_LENGTH];
+    int line_number = 0;
+    int result = 1;
+    FILE *fp = fopen(path, "r");
+
+    memset(set, 0, sizeof(*set));
+    if (NULL == fp)
+    {
+        fprintf(stderr, "Failed to open the rules file %s\n", path);
+        return 0;
+    }
+
+    while (result && NULL != fgets(line, sizeof(line), fp))
+    {
+        char *tokens[MAX_RULE_TOKENS];
+        char *saveptr = NULL;
+        char *comment = strchr(line, '#');
+        char *token;
+        int count = 0;
+
+        ++line_number;
+        if (NULL != comment)
+        {
+            *comment = '\0';
+        }
+        token = strtok_r(line, " \t\r\n", &saveptr);
+        while (NULL != token && count < MAX_RULE_TOKENS)
+        {
+            tokens[count++] = token;
+            token = strtok_r(NULL, " \t\r\n", &saveptr);
+        }
+        if (0 == count)
+        {
+            continue;
+        }
+
+        if (set->count >= MAX_RULES)
+        {
+            fprintf(stderr, "%s:%d: Too many rules, at most %d\n", path,
+                line_number, MAX_RULES);
+            result = 0;
+        }
+        else if (NULL != token || !parse_rule(tokens, count, &set->rules[set->count]))
+        {
+            fprintf(stderr, "%s:%d: Invalid rule\n", path, line_number);
+            result = 0;
+        }
+        else
+        {
+            ++set->count;
+        }
+    }
+    fclose(fp);
+    return result;
+}
+
+/*******************************************************************************
+ *  \brief  Picks out the rules for a pin. The last valid reading is taken from
+ *          the pin's statistics, so stale rules carry on across restarts.
+ */
+void rules_bind
+(
+    const RuleSet *set,     /*!<IN  - The compiled rules                */
+    const int pin,          /*!<IN  - The sensor pin                    */
+    const PinStats *stats,  /*!<IN  - The pin statistics                */
+    PinRules *rules         /*!<OUT - The pin's rules and their state   */
+)
+{
+    int i;
+    memset(rules, 0, sizeof(*rules));
+    for (i = 0; i < set->count; ++i)
+    {
+        if (set->rules[i].pin < 0 || set->rules[i].pin == pin)
+        {
+            rules->rules[rules->count++] = &set->rules[i];
+        }
+    }
+    rules->last_valid = stats->last;
+    rules->last_valid_time = (double)stats->last_time;
+    if (0 == stats->last_time)
+    {
+        /* Never read, so count from now */
+        rules->last_valid.result = RESULT_INVALID;
+        rules->last_valid_time = (double)time(NULL);
+    }
+}
+
+/*******************************************************************************
+ *  \brief  Evaluates a pin's rules against a new reading.
+ *  \return The number of alerts raised or cleared, at most MAX_RULES.
+ */
+int rules_evaluate
+(
+    PinRules *rules,                /*!<INOUT - The pin's rules and state       */
+    const SensorReport *report,     /*!<IN    - The new reading                 */
+    Alert *alerts                   /*!<OUT   - MAX_RULES alerts to fill        */
+)
+{
+    const SensorValues *values = &report->values;
+    const int ok = (RESULT_OK == values->result);
+    const double now = (double)report->timestamp.tv_sec +
+        (double)report->timestamp.tv_nsec / 1e9;
+    int count = 0;
+    int i;
+
+    for (i = 0; i < rules->count; ++i)
+    {
+        const Rule *rule = rules->rules[i];
+        const float current = (QUANTITY_TEMPERATURE == rule->quantity) ?
+            values->temperature : values->humidity;
+        const float previous = (QUANTITY_TEMPERATURE == rule->quantity) ?
+            rules->last_valid.temperature : rules->last_valid.humidity;
+        int active = rules->active[i];
+        float value = current;
+
+        switch (rule->condition)
+        {
+            case CONDITION_ABOVE:
+                if (ok)
+                {
+                    active = active ? (current >= rule->clear) : (current > rule->threshold);
+                }
+                break;
+
+            case CONDITION_BELOW:
+                if (ok)
+                {
+                    active = active ? (current <= rule->clear) : (current < rule->threshold);
+                }
+                break;
+
+            case CONDITION_RATE:
+                if (ok && RESULT_OK == rules->last_valid.result &&
+                    now > rules->last_valid_time)
+                {
+                    value = (current > previous) ? current - previous : previous - current;
+                    value = (float)(value * 60.0 / (now - rules->last_valid_time));
+                    active = active ? (value > rule->clear) : (value > rule->threshold);
+                }
+                break;
+
+            case CONDITION_STALE:
+                value = ok ? 0.0f : (float)((now - rules->last_valid_time) / 60.0);
+                active = !ok && value >= rule->threshold;
+                break;
+        }
+
+        if (active != rules->active[i])
+        {
+            Alert *alert = &alerts[count++];
+            rules->active[i] = active;
+            snprintf(alert->rule, sizeof(alert->rule), "%s", rule->name);
+            alert->pin = report->pin;
+            alert->raised = active;
+            alert->condition = rule->condition;
+            alert->quantity = rule->quantity;
+            alert->value = value;
+            alert->threshold = rule->threshold;
+            alert->timestamp = report->timestamp;
+        }
+    }
+
+    if (ok)
+    {
+        rules->last_valid = *values;
+        rules->last_valid_time = now;
+    }
+    return count;
+}
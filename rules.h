@@ -0,0 +1,53 @@
+/*------------------------------------------------------------------------------
+ *! \file   rules.h
+ *! \brief  Alert rules, compiled once from a rules file and evaluated on
+ *          every reading.
+ *------------------------------------------------------------------------------
+ *                   Kris Dunning ippie52@gmail.com 2016.
+ *------------------------------------------------------------------------------
+ */
+#pragma once
+
+#include "output.h"
+#include "stats.h"
+
+#define MAX_RULES   32
+
+/******************************************************************************/
+/** A rule as read from the rules file
+ */
+typedef struct Rules
+{
+    char name[MAX_RULE_NAME_LENGTH];    /*!< The rule name, used in alerts      */
+    int pin;                            /*!< The pin checked, -1 for all pins   */
+    AlertCondition condition;           /*!< The condition checked              */
+    Quantity quantity;                  /*!< The value checked                  */
+    float threshold;                    /*!< Raised beyond this                 */
+    float clear;                        /*!< Cleared once back beyond this      */
+} Rule;
+
+/******************************************************************************/
+/** All rules read from the rules file
+ */
+typedef struct RuleSets
+{
+    Rule rules[MAX_RULES];  /*!< The rules                  */
+    int count;              /*!< The number of rules        */
+} RuleSet;
+
+/******************************************************************************/
+/** The rules for a single pin and the state needed to evaluate them
+ */
+typedef struct PinRuleStates
+{
+    const Rule *rules[MAX_RULES];   /*!< Only the rules for this pin        */
+    int active[MAX_RULES];          /*!< Non zero while a rule is raised    */
+    int count;                      /*!< The number of rules for this pin   */
+    SensorValues last_valid;        /*!< The last valid values              */
+    double last_valid_time;         /*!< When last_valid was read, seconds  */
+} PinRules;
+
+int rules_load(const char *path, RuleSet *set);
+void rules_bind(const RuleSet *set, const int pin, const PinStats *stats,
+    PinRules *rules);
+int rules_evaluate(PinRules *rules, const SensorReport *report, Alert *alerts);
@@ -0,0 +1,327 @@
+/*------------------------------------------------------------------------------
+ *! \file   scan.c
+ *! \brief  Sensor discovery, every candidate pin probed at once for a
+ *          DHT style response.
+ *
+ *  All the candidate pins are given the start signal together, then
+ *  released and polled in turn, each pin's edges timed against the clock so
+ *  the polling order does not matter. A pin has a sensor if it answers with
+ *  the 80us low, 80us high preamble; the bits that follow are captured too,
+ *  so a sensor is reported with its model and a reading when the frame is
+ *  good. Pins locked by a running kdht are left alone.
+ *------------------------------------------------------------------------------
+ *                   Kris Dunning ippie52@gmail.com 2016.
+ *------------------------------------------------------------------------------
+ */
+
+#include <wiringPi.h>
+#include <stdio.h>
+#include <string.h>
+#include <sched.h>
+
+#include "scan.h"
+#include "frame.h"
+#include "locking.h"
+
+#define SCAN_CAPTURE_US     8000U   /* Longest wait for a whole frame       */
+#define SCAN_RESPONSE_US    200U    /* Longest wait for the sensor to answer */
+#define SCAN_PREAMBLE_MIN   40U     /* Shortest preamble level accepted     */
+#define SCAN_PREAMBLE_MAX   160U    /* Longest preamble level accepted      */
+#define SCAN_ONE_US         48U     /* High times above this are a 1        */
+#define SCAN_LOCK_LENGTH    100U
+
+/******************************************************************************/
+/** The capture state of a pin being probed
+ */
+typedef struct ScanCaptures
+{
+    int level;              /*!< The level last read                    */
+    int edges;              /*!< The edges seen since release           */
+    int done;               /*!< Non zero once nothing more is expected */
+    unsigned int last_edge; /*!< When the last edge was seen, us        */
+    unsigned int release;   /*!< When the pin was released, us          */
+    int lockfd;             /*!< The pin's lock, -1 if not held         */
+} ScanCapture;
+
+/*******************************************************************************
+ *  \brief  Checks a preamble level's length.
+ *  \return Non zero if it is plausible for a sensor.
+ */
+static int preamble_ok
+(
+    const unsigned int us   /*!< - The level's length   */
+)
+{
+    return us >= SCAN_PREAMBLE_MIN && us <= SCAN_PREAMBLE_MAX;
+}
+
+/*******************************************************************************
+ *  \brief  Takes an edge seen on a pin into its result. The first three are
+ *          the preamble, after which each falling edge ends a data bit.
+ */
+static void take_edge
+(
+    ScanCapture *capture,   /*!<INOUT - The pin's capture state     */
+    ScanResult *result,     /*!<INOUT - The pin's result            */
+    const unsigned int now  /*!<IN    - When the edge was seen, us  */
+)
+{
+    const unsigned int length = now - capture->last_edge;
+
+    ++capture->edges;
+    capture->last_edge = now;
+    switch (capture->edges)
+    {
+        case 1:
+            result->response_us = now - capture->release;
+            break;
+
+        case 2:
+            result->low_us = length;
+            break;
+
+        case 3:
+            result->high_us = length;
+            result->responded = preamble_ok(result->low_us) && preamble_ok(length);
+            capture->done = !result->responded;
+            break;
+
+        default:
+            /* The data bits, the high level's length tells a 0 from a 1 */
+            if (0 == (capture->edges % 2) || result->bits >= FRAME_BITS)
+            {
+                break;
+            }
+            result->data[result->bits / 8] <<= 1;
+            if (length > SCAN_ONE_US)
+            {
+                result->data[result->bits / 8] |= 1;
+            }
+            if (++result->bits >= FRAME_BITS)
+            {
+                capture->done = 1;
+            }
+            break;
+    }
+}
+
+/*******************************************************************************
+ *  \brief  Probes every pin in the settings at once for a sensor. Pins in use
+ *          by another kdht are marked as locked and not probed.
+ *  \return The number of pins that responded.
+ */
+int scan_sensors
+(
+    const Settings *settings,   /*!<IN  - The pins to probe                 */
+    ScanResult *results         /*!<OUT - A result per pin, in order        */
+)
+{
+    ScanCapture captures[MAX_PINS];
+    char lockfile[SCAN_LOCK_LENGTH];
+    struct sched_param param;
+    unsigned int start;
+    unsigned int now;
+    int remaining = 0;
+    int found = 0;
+    int i;
+
+    /* The edges are timed by polling, so don't be put aside while capturing */
+    param.sched_priority = sched_get_priority_max(SCHED_FIFO);
+    sched_setscheduler(0, SCHED_FIFO, &param);
+
+    memset(results, 0, settings->count * sizeof(*results));
+    for (i = 0; i < settings->count; ++i)
+    {
+        memset(&captures[i], 0, sizeof(captures[i]));
+        results[i].pin = settings->pins[i].pin;
+        get_lockfile_name(results[i].pin, lockfile, SCAN_LOCK_LENGTH);
+        captures[i].lockfd = try_lockfile(lockfile);
+        results[i].locked = captures[i].lockfd < 0;
+        captures[i].done = results[i].locked;
+        if (!results[i].locked)
+        {
+            pinMode(results[i].pin, OUTPUT);
+            digitalWrite(results[i].pin, HIGH);
+            ++remaining;
+        }
+    }
+
+    /* The start sequence of read_dht22_data, on all the pins together */
+    delayMicroseconds(10000);
+    for (i = 0; i < settings->count; ++i)
+    {
+        if (!captures[i].done)
+        {
+            digitalWrite(results[i].pin, LOW);
+        }
+    }
+    delayMicroseconds(18000);
+    for (i = 0; i < settings->count; ++i)
+    {
+        if (!captures[i].done)
+        {
+            digitalWrite(results[i].pin, HIGH);
+        }
+    }
+    delayMicroseconds(40);
+    for (i = 0; i < settings->count; ++i)
+    {
+        if (!captures[i].done)
+        {
+            pinMode(results[i].pin, INPUT);
+            captures[i].release = micros();
+            captures[i].last_edge = captures[i].release;
+            captures[i].level = HIGH;
+        }
+    }
+
+    /* Poll the pins in turn until each has a frame or has gone quiet */
+    start = micros();
+    while (remaining > 0)
+    {
+        for (i = 0; i < settings->count; ++i)
+        {
+            int level;
+            if (captures[i].done)
+            {
+                continue;
+            }
+            level = digitalRead(results[i].pin);
+            now = micros();
+            if (level != captures[i].level)
+            {
+                captures[i].level = level;
+                take_edge(&captures[i], &results[i], now);
+            }
+            else if (0 == captures[i].edges && now - captures[i].release > SCAN_RESPONSE_US)
+            {
+                captures[i].done = 1;
+            }
+            if (captures[i].done)
+            {
+                --remaining;
+            }
+        }
+        if (micros() - start > SCAN_CAPTURE_US)
+        {
+            break;
+        }
+    }
+
+    param.sched_priority = 0;
+    sched_setscheduler(0, SCHED_OTHER, &param);
+
+    for (i = 0; i < settings->count; ++i)
+    {
+        ScanResult *result = &results[i];
+        if (captures[i].lockfd >= 0)
+        {
+            close_lockfile(captures[i].lockfd);
+        }
+        if (!result->responded)
+        {
+            continue;
+        }
+        ++found;
+        result->valid = (result->bits >= FRAME_BITS) && frame_checksum_ok(result->data);
+        if (result->valid)
+        {
+            result->model = frame_classify(result->data);
+            frame_decode(result->data, result->model, &result->values);
+            result->values.result = RESULT_OK;
+        }
+        else
+        {
+            result->values.result = RESULT_BAD_DATA;
+        }
+    }
+    return found;
+}
+
+/*******************************************************************************
+ *  \brief  Prints what was found on a pin in the given format.
+ */
+void print_scan_result
+(
+    FILE *fp,                   /*!<IN - The stream to print to     */
+    const OutputFormat format,  /*!<IN - The format to print in     */
+    const ScanResult *result    /*!<IN - The pin's result           */
+)
+{
+    const char *status = result->locked ? "in_use" :
+        !result->responded ? "none" : result->valid ? "found" : "bad_data";
+    const char *model = !result->valid ? "" :
+        (MODEL_AUTO == result->model) ? "unknown" : get_model_name(result->model);
+
+    switch (format)
+    {
+        case FORMAT_HUMAN:
+            if (result->locked)
+            {
+                fprintf(fp, "Pin %d: in use\n", result->pin);
+            }
+            else if (!result->responded)
+            {
+                fprintf(fp, "Pin %d: no response\n", result->pin);
+            }
+            else if (!result->valid)
+            {
+                fprintf(fp, "Pin %d: sensor responded, %d bits, bad data "
+                    "(preamble %u/%uus)\n", result->pin, result->bits,
+                    result->low_us, result->high_us);
+            }
+            else
+            {
+                fprintf(fp, "Pin %d: %s, %.1f%% %.1f*C (preamble %u/%uus)\n",
+                    result->pin, model, result->values.humidity,
+                    result->values.temperature, result->low_us, result->high_us);
+            }
+            break;
+
+        case FORMAT_JSON:
+            fprintf(fp, "{\"pin\":%d,\"status\":\"%s\"", result->pin, status);
+            if (result->responded)
+            {
+                fprintf(fp, ",\"response_us\":%u,\"low_us\":%u,\"high_us\":%u,"
+                    "\"bits\":%d", result->response_us, result->low_us,
+                    result->high_us, result->bits);
+            }
+            if (result->valid)
+            {
+                fprintf(fp, ",\"model\":\"%s\",\"humidity\":%.1f,\"temperature\":%.1f",
+                    model, result->values.humidity, result->values.temperature);
+            }
+            fprintf(fp, "}\n");
+            break;
+
+        case FORMAT_CSV:
+            fprintf(fp, "%d,%s,%s,%u,%u,%u,%d", result->pin, status, model,
+                result->response_us, result->low_us, result->high_us, result->bits);
+            if (result->valid)
+            {
+                fprintf(fp, ",%.1f,%.1f\n", result->values.humidity,
+                    result->values.temperature);
+            }
+            else
+            {
+                fprintf(fp, ",,\n");
+            }
+            break;
+
+        case FORMAT_INFLUX:
+            fprintf(fp, "dht_scan,pin=%d status=\"%s\",bits=%di", result->pin,
+                status, result->bits);
+            if (result->responded)
+            {
+                fprintf(fp, ",response_us=%ui,low_us=%ui,high_us=%ui",
+                    result->response_us, result->low_us, result->high_us);
+            }
+            if (result->valid)
+            {
+                fprintf(fp, ",model=\"%s\",humidity=%.1f,temperature=%.1f",
+                    model, result->values.humidity, result->values.temperature);
+            }
+            fprintf(fp, "\n");
+            break;
+    }
+}
@@ -0,0 +1,37 @@
+/*------------------------------------------------------------------------------
+ *! \file   scan.h
+ *! \brief  Sensor discovery, every candidate pin probed at once for a
+ *          DHT style response.
+ *------------------------------------------------------------------------------
+ *                   Kris Dunning ippie52@gmail.com 2016.
+ *------------------------------------------------------------------------------
+ */
+#pragma once
+
+#include "output.h"
+#include "settings.h"
+
+/* The general purpose pins of the 40 pin header, in wiringPi numbers */
+#define SCAN_DEFAULT_PINS   "0,1,2,3,4,5,6,7,21,22,23,24,25,26,27,28,29"
+
+/******************************************************************************/
+/** What was found on a pin
+ */
+typedef struct ScanResults
+{
+    int pin;                    /*!< The pin probed                         */
+    int locked;                 /*!< Non zero if in use, so not probed      */
+    int responded;              /*!< Non zero if the preamble was seen      */
+    unsigned int response_us;   /*!< Start released to the sensor answering */
+    unsigned int low_us;        /*!< The preamble's low time                */
+    unsigned int high_us;       /*!< The preamble's high time               */
+    int bits;                   /*!< The data bits captured                 */
+    int data[5];                /*!< The bytes captured                     */
+    int valid;                  /*!< Non zero if the checksum matched       */
+    SensorModel model;          /*!< The model, if valid                    */
+    SensorValues values;        /*!< The values decoded, if valid           */
+} ScanResult;
+
+int scan_sensors(const Settings *settings, ScanResult *results);
+void print_scan_result(FILE *fp, const OutputFormat format,
+    const ScanResult *result);
@@ -0,0 +1,426 @@
+/*------------------------------------------------------------------------------
+ *! \file   schedule.c
+ *! \brief  The read schedule, a hierarchical timing wheel of periodic reads.
+ *
+ *  Time is counted in 10ms ticks. The lowest level has a slot for each of the
+ *  next 64 ticks, and each level above has a slot for each of the next 64
+ *  spans of the level below. A read goes in the lowest level that reaches its
+ *  due tick, and is moved down again when its slot comes around, so adding,
+ *  removing and expiring a read are all constant time however many pins are
+ *  scheduled. A bitmap of the non empty slots of each level finds the next
+ *  tick with anything to do, so idle ticks are never visited.
+ *
+ *  The schedule also keeps to the sensor limits: a pin is never read again
+ *  sooner than the minimum gap (less a tick) after its last read, and no more
+ *  than the given number of reads are handed out until they are done.
+ *------------------------------------------------------------------------------
+ *                   Kris Dunning ippie52@gmail.com 2016.
+ *------------------------------------------------------------------------------
+ */
+
+#include <string.h>
+
+#include "schedule.h"
+
+#define SLOT_MASK       (SCHEDULE_SLOTS - 1)
+#define DUE_LIST        (SCHEDULE_LEVELS * SCHEDULE_SLOTS)
+#define NO_EVENT        INT64_MAX
+
+/*******************************************************************************
+ *  \brief  Converts a time to a tick, rounding up so nothing is early.
+ *  \return The tick, counted from the schedule's origin.
+ */
+static int64_t to_tick
+(
+    const Schedule *schedule,       /*!< - The schedule             */
+    const struct timespec *time,    /*!< - The time to convert      */
+    const int round_up              /*!< - Non zero to round up     */
+)
+{
+    const int64_t ns = (int64_t)(time->tv_sec - schedule->origin.tv_sec) * 1000000000LL +
+        (time->tv_nsec - schedule->origin.tv_nsec);
+    int64_t tick = ns / SCHEDULE_TICK_NS;
+    if (round_up && ns > tick * SCHEDULE_TICK_NS)
+    {
+        ++tick;
+    }
+    return tick;
+}
+
+/*******************************************************************************
+ *  \brief  Converts a tick back to a time.
+ */
+static void to_time
+(
+    const Schedule *schedule,   /*!< - The schedule             */
+    const int64_t tick,         /*!< - The tick to convert      */
+    struct timespec *time       /*!< - The time of the tick     */
+)
+{
+    const int64_t ns = schedule->origin.tv_nsec + tick * SCHEDULE_TICK_NS;
+    time->tv_sec = schedule->origin.tv_sec + (time_t)(ns / 1000000000LL);
+    time->tv_nsec = (long)(ns % 1000000000LL);
+}
+
+/*******************************************************************************
+ *  \brief  Adds a timer to the end of a list.
+ */
+static void list_append
+(
+    Schedule *schedule,     /*!< - The schedule                 */
+    const int list,         /*!< - The slot or the due list     */
+    const int index         /*!< - The timer to add             */
+)
+{
+    ScheduleTimer *timer = &schedule->timers[index];
+    timer->list = list;
+    timer->next = -1;
+    timer->prev = schedule->tails[list];
+    if (timer->prev < 0)
+    {
+        schedule->heads[list] = index;
+    }
+    else
+    {
+        schedule->timers[timer->prev].next = index;
+    }
+    schedule->tails[list] = index;
+    if (list < DUE_LIST)
+    {
+        schedule->occupied[list / SCHEDULE_SLOTS] |= 1ULL << (list & SLOT_MASK);
+    }
+}
+
+/*******************************************************************************
+ *  \brief  Takes a timer out of its list.
+ */
+static void list_unlink
+(
+    Schedule *schedule,     /*!< - The schedule                 */
+    const int index         /*!< - The timer to remove          */
+)
+{
+    ScheduleTimer *timer = &schedule->timers[index];
+    const int list = timer->list;
+    if (timer->prev < 0)
+    {
+        schedule->heads[list] = timer->next;
+    }
+    else
+    {
+        schedule->timers[timer->prev].next = timer->next;
+    }
+    if (timer->next < 0)
+    {
+        schedule->tails[list] = timer->prev;
+    }
+    else
+    {
+        schedule->timers[timer->next].prev = timer->prev;
+    }
+    if (list < DUE_LIST && schedule->heads[list] < 0)
+    {
+        schedule->occupied[list / SCHEDULE_SLOTS] &= ~(1ULL << (list & SLOT_MASK));
+    }
+    timer->list = -1;
+}
+
+/*******************************************************************************
+ *  \brief  Puts a timer in the lowest level that reaches its tick, or in the
+ *          due list if the tick has passed. Reads further away than the top
+ *          level reaches wait in its furthest slot and are placed again.
+ */
+static void place
+(
+    Schedule *schedule,     /*!< - The schedule                 */
+    const int index         /*!< - The timer to place           */
+)
+{
+    const int64_t expires = schedule->timers[index].expires;
+    int level;
+    int64_t span = 0;
+
+    if (expires <= schedule->current)
+    {
+        list_append(schedule, DUE_LIST, index);
+        return;
+    }
+    for (level = 0; level < SCHEDULE_LEVELS; ++level)
+    {
+        const int shift = level * SCHEDULE_LEVEL_BITS;
+        span = (expires >> shift) - (schedule->current >> shift);
+        if (span < SCHEDULE_SLOTS)
+        {
+            list_append(schedule, level * SCHEDULE_SLOTS +
+                (int)((expires >> shift) & SLOT_MASK), index);
+            return;
+        }
+    }
+    level = SCHEDULE_LEVELS - 1;
+    list_append(schedule, level * SCHEDULE_SLOTS + (int)(((schedule->current >>
+        (level * SCHEDULE_LEVEL_BITS)) + SLOT_MASK) & SLOT_MASK), index);
+}
+
+/*******************************************************************************
+ *  \brief  Finds the next tick on which a slot comes around with anything in.
+ *  \return The tick, NO_EVENT if the wheel is empty.
+ */
+static int64_t next_event
+(
+    const Schedule *schedule    /*!< - The schedule     */
+)
+{
+    int64_t next = NO_EVENT;
+    int level;
+    for (level = 0; level < SCHEDULE_LEVELS; ++level)
+    {
+        const int shift = level * SCHEDULE_LEVEL_BITS;
+        const int64_t base = schedule->current >> shift;
+        const int start = (int)((base + 1) & SLOT_MASK);
+        uint64_t occupied = schedule->occupied[level];
+        int64_t tick;
+        if (0 == occupied)
+        {
+            continue;
+        }
+        /* Rotate so that bit 0 is the slot after the current one */
+        if (0 != start)
+        {
+            occupied = (occupied >> start) | (occupied << (SCHEDULE_SLOTS - start));
+        }
+        tick = (base + 1 + __builtin_ctzll(occupied)) << shift;
+        if (tick < next)
+        {
+            next = tick;
+        }
+    }
+    return next;
+}
+
+/*******************************************************************************
+ *  \brief  Moves the wheel on to the given tick, placing again every timer in
+ *          the slots that come around on it.
+ */
+static void process
+(
+    Schedule *schedule,     /*!< - The schedule         */
+    const int64_t tick      /*!< - The tick to move to  */
+)
+{
+    int level;
+    schedule->current = tick;
+    for (level = SCHEDULE_LEVELS - 1; level >= 0; --level)
+    {
+        const int shift = level * SCHEDULE_LEVEL_BITS;
+        int list;
+        int index;
+        if (0 != (tick & ((1LL << shift) - 1)))
+        {
+            continue;
+        }
+        list = level * SCHEDULE_SLOTS + (int)((tick >> shift) & SLOT_MASK);
+        index = schedule->heads[list];
+        schedule->heads[list] = -1;
+        schedule->tails[list] = -1;
+        schedule->occupied[level] &= ~(1ULL << (list & SLOT_MASK));
+        while (index >= 0)
+        {
+            const int next = schedule->timers[index].next;
+            place(schedule, index);
+            index = next;
+        }
+    }
+}
+
+/*******************************************************************************
+ *  \brief  Sets up an empty schedule.
+ */
+void schedule_init
+(
+    Schedule *schedule,             /*!<OUT - The schedule                      */
+    ScheduleTimer *timers,          /*!<IN  - A timer for each pin index        */
+    const int capacity,             /*!<IN  - The number of timers              */
+    const int max_active,           /*!<IN  - The most reads at once            */
+    const int min_gap_ms,           /*!<IN  - The least time between reads      */
+    const struct timespec *now      /*!<IN  - The current time                  */
+)
+{
+    int i;
+    memset(schedule, 0, sizeof(*schedule));
+    schedule->timers = timers;
+    schedule->capacity = capacity;
+    schedule->max_active = max_active;
+    schedule->min_gap_ns = (int64_t)min_gap_ms * 1000000LL;
+    schedule->origin = *now;
+    for (i = 0; i <= DUE_LIST; ++i)
+    {
+        schedule->heads[i] = -1;
+        schedule->tails[i] = -1;
+    }
+    for (i = 0; i < capacity; ++i)
+    {
+        memset(&timers[i], 0, sizeof(timers[i]));
+        timers[i].list = -1;
+    }
+}
+
+/*******************************************************************************
+ *  \brief  Schedules a read, moving it if the pin already has one. The read
+ *          is put back to the minimum gap after the pin's last read.
+ *  \return Zero if the pin index is not valid, otherwise 1.
+ */
+int schedule_add
+(
+    Schedule *schedule,             /*!<INOUT - The schedule                */
+    const ScheduleEntry *entry      /*!<IN    - The read and its pin index  */
+)
+{
+    ScheduleTimer *timer;
+    if (entry->index < 0 || entry->index >= schedule->capacity)
+    {
+        return 0;
+    }
+    timer = &schedule->timers[entry->index];
+    if (timer->list >= 0)
+    {
+        list_unlink(schedule, entry->index);
+    }
+    else
+    {
+        ++schedule->count;
+    }
+
+    timer->entry = *entry;
+    if (0 != entry->last.tv_sec || 0 != entry->last.tv_nsec)
+    {
+        /* The gap protects the sensor, so it is never shortened: the due
+         * time is rounded up to the next tick, a read can be up to a tick
+         * late but never early
+         */
+        const int64_t gap = schedule->min_gap_ns;
+        struct timespec earliest = entry->last;
+        earliest.tv_sec += (time_t)(gap / 1000000000LL);
+        earliest.tv_nsec += (long)(gap % 1000000000LL);
+        if (earliest.tv_nsec >= 1000000000L)
+        {
+            earliest.tv_nsec -= 1000000000L;
+            ++earliest.tv_sec;
+        }
+        if (earliest.tv_sec > entry->due.tv_sec ||
+            (earliest.tv_sec == entry->due.tv_sec && earliest.tv_nsec > entry->due.tv_nsec))
+        {
+            timer->entry.due = earliest;
+        }
+    }
+    timer->expires = to_tick(schedule, &timer->entry.due, 1);
+    place(schedule, entry->index);
+    return 1;
+}
+
+/*******************************************************************************
+ *  \brief  Removes a pin's read.
+ *  \return Zero if the pin has no read scheduled, otherwise 1.
+ */
+int schedule_remove
+(
+    Schedule *schedule,     /*!<INOUT - The schedule                    */
+    const int index,        /*!<IN    - The pin index                   */
+    ScheduleEntry *entry    /*!<OUT   - The read removed, may be NULL   */
+)
+{
+    if (index < 0 || index >= schedule->capacity || schedule->timers[index].list < 0)
+    {
+        return 0;
+    }
+    list_unlink(schedule, index);
+    --schedule->count;
+    if (NULL != entry)
+    {
+        *entry = schedule->timers[index].entry;
+    }
+    return 1;
+}
+
+/*******************************************************************************
+ *  \brief  Takes the next read that is due, unless as many reads as allowed
+ *          are already in progress. The entry's last read time is set to now,
+ *          ready to be scheduled again, and schedule_done() must be called
+ *          once the read is over.
+ *  \return Zero if nothing can be read now, otherwise 1.
+ */
+int schedule_expire
+(
+    Schedule *schedule,             /*!<INOUT - The schedule            */
+    const struct timespec *now,     /*!<IN    - The current time        */
+    ScheduleEntry *entry            /*!<OUT   - The read to make        */
+)
+{
+    const int64_t tick = to_tick(schedule, now, 0);
+    int64_t event;
+    int index;
+
+    if (schedule->active >= schedule->max_active)
+    {
+        return 0;
+    }
+    while (schedule->heads[DUE_LIST] < 0)
+    {
+        event = next_event(schedule);
+        if (event > tick)
+        {
+            /* Nothing comes around before now, so the idle ticks are skipped */
+            if (tick > schedule->current)
+            {
+                schedule->current = tick;
+            }
+            break;
+        }
+        process(schedule, event);
+    }
+
+    index = schedule->heads[DUE_LIST];
+    if (index < 0)
+    {
+        return 0;
+    }
+    list_unlink(schedule, index);
+    --schedule->count;
+    ++schedule->active;
+    *entry = schedule->timers[index].entry;
+    entry->last = *now;
+    return 1;
+}
+
+/*******************************************************************************
+ *  \brief  Marks a read handed out by schedule_expire() as over.
+ */
+void schedule_done
+(
+    Schedule *schedule  /*!<INOUT - The schedule    */
+)
+{
+    if (schedule->active > 0)
+    {
+        --schedule->active;
+    }
+}
+
+/*******************************************************************************
+ *  \brief  Gets the time to wait until. This may be before the next read, as
+ *          a higher level slot comes around, but is never after it.
+ *  \return Zero if nothing is scheduled, otherwise 1.
+ */
+int schedule_next_due
+(
+    const Schedule *schedule,   /*!<IN  - The schedule          */
+    struct timespec *due        /*!<OUT - When to wake up       */
+)
+{
+    if (0 == schedule->count)
+    {
+        return 0;
+    }
+    to_time(schedule, (schedule->heads[DUE_LIST] >= 0) ? schedule->current :
+        next_event(schedule), due);
+    return 1;
+}
@@ -0,0 +1,68 @@
+/*------------------------------------------------------------------------------
+ *! \file   schedule.h
+ *! \brief  The read schedule, a hierarchical timing wheel of periodic reads.
+ *------------------------------------------------------------------------------
+ *                   Kris Dunning ippie52@gmail.com 2016.
+ *------------------------------------------------------------------------------
+ */
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+
+#define SCHEDULE_TICK_NS        10000000LL  /* 10ms per tick                */
+#define SCHEDULE_LEVEL_BITS     6
+#define SCHEDULE_SLOTS          (1 << SCHEDULE_LEVEL_BITS)
+#define SCHEDULE_LEVELS         4           /* 64^4 ticks, about 46 hours   */
+
+/******************************************************************************/
+/** A scheduled read
+ */
+typedef struct ScheduleEntries
+{
+    struct timespec due;    /*!< When the read is due (CLOCK_MONOTONIC)     */
+    struct timespec last;   /*!< When the pin was last read, zero if never  */
+    int index;              /*!< The pin's index in the pin table           */
+} ScheduleEntry;
+
+/******************************************************************************/
+/** A pin's place in the wheel, one per pin table index
+ */
+typedef struct ScheduleTimers
+{
+    ScheduleEntry entry;    /*!< The read                                   */
+    int64_t expires;        /*!< The tick the read is due on                */
+    int list;               /*!< The list holding the timer, -1 if none     */
+    int prev;               /*!< The previous timer in the list, or -1      */
+    int next;               /*!< The next timer in the list, or -1          */
+} ScheduleTimer;
+
+/******************************************************************************/
+/** The schedule. Each level's slots cover 64 times the span of the level
+ *  below, timers move down a level as their slot comes around, and a timer
+ *  in the lowest level is due on its slot's tick.
+ */
+typedef struct Schedules
+{
+    ScheduleTimer *timers;      /*!< The timers, indexed by pin index       */
+    int capacity;               /*!< The number of timers                   */
+    int count;                  /*!< The number of reads scheduled          */
+    int active;                 /*!< Reads handed out and not yet done      */
+    int max_active;             /*!< The most reads in progress at once     */
+    int64_t min_gap_ns;         /*!< The least time between a pin's reads   */
+    int64_t current;            /*!< The last tick processed                */
+    struct timespec origin;     /*!< The time of tick zero                  */
+    uint64_t occupied[SCHEDULE_LEVELS]; /*!< Non empty slots of each level  */
+    int heads[SCHEDULE_LEVELS * SCHEDULE_SLOTS + 1]; /*!< Slot lists, then
+                                                      *   the due list      */
+    int tails[SCHEDULE_LEVELS * SCHEDULE_SLOTS + 1]; /*!< Their last timers */
+} Schedule;
+
+void schedule_init(Schedule *schedule, ScheduleTimer *timers, const int capacity,
+    const int max_active, const int min_gap_ms, const struct timespec *now);
+int schedule_add(Schedule *schedule, const ScheduleEntry *entry);
+int schedule_remove(Schedule *schedule, const int index, ScheduleEntry *entry);
+int schedule_expire(Schedule *schedule, const struct timespec *now,
+    ScheduleEntry *entry);
+void schedule_done(Schedule *schedule);
+int schedule_next_due(const Schedule *schedule, struct timespec *due);
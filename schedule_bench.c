@@ -0,0 +1,191 @@
+/*------------------------------------------------------------------------------
+ *! \file   schedule_bench.c
+ *! \brief  Measures the read schedule with many simulated pins.
+ *
+ *  Every pin gets an interval between the 2s minimum and an hour, and the
+ *  simulated clock jumps from one wake up to the next, so the time measured is
+ *  the scheduling overhead alone. Each read is checked to be neither early nor
+ *  more than a tick late, and to keep the pin's minimum gap.
+ *
+ *  Usage: schedule-bench [<pins> [<hours> [<reads at once>]]]
+ *------------------------------------------------------------------------------
+ *                   Kris Dunning ippie52@gmail.com 2016.
+ *------------------------------------------------------------------------------
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "schedule.h"
+
+#define DEFAULT_BENCH_PINS      10000
+#define DEFAULT_BENCH_HOURS     24
+#define MIN_GAP_MS              2000
+#define MAX_INTERVAL_MS         3600000L
+
+/*******************************************************************************
+ *  \brief  Gets the nanoseconds from a to b.
+ *  \return The difference, b - a.
+ */
+static long long diff_ns
+(
+    const struct timespec *a,   /*!< - The earlier time */
+    const struct timespec *b    /*!< - The later time   */
+)
+{
+    return (long long)(b->tv_sec - a->tv_sec) * 1000000000LL +
+        (b->tv_nsec - a->tv_nsec);
+}
+
+/*******************************************************************************
+ *  \brief  Adds milliseconds to a time.
+ */
+static void add_ms
+(
+    struct timespec *time,  /*!< - The time to move on  */
+    const long ms           /*!< - The milliseconds     */
+)
+{
+    time->tv_sec += ms / 1000;
+    time->tv_nsec += (ms % 1000) * 1000000L;
+    if (time->tv_nsec >= 1000000000L)
+    {
+        time->tv_nsec -= 1000000000L;
+        ++time->tv_sec;
+    }
+}
+
+/*******************************************************************************
+ *  \brief  Main function.
+ *  \return EXIT_SUCCESS if every read kept to the schedule.
+ */
+int main
+(
+    int argc,       /*!< - The number of arguments              */
+    char *argv[]    /*!< - The collection of argument strings   */
+)
+{
+    const int pins = (argc > 1) ? atoi(argv[1]) : DEFAULT_BENCH_PINS;
+    const int hours = (argc > 2) ? atoi(argv[2]) : DEFAULT_BENCH_HOURS;
+    const int max_active = (argc > 3) ? atoi(argv[3]) : 1;
+    static Schedule schedule;
+    ScheduleTimer *timers;
+    long *intervals;
+    struct timespec *last;
+    ScheduleEntry *active;
+    ScheduleEntry entry;
+    struct timespec now = { 1000, 0 };
+    struct timespec end;
+    struct timespec started;
+    struct timespec finished;
+    long long elapsed;
+    long long late;
+    long long worst_late = 0;
+    long reads = 0;
+    long wakeups = 0;
+    long errors = 0;
+    int active_count;
+    int i;
+
+    if (pins < 1 || hours < 1 || max_active < 1)
+    {
+        fprintf(stderr, "Usage: %s [<pins> [<hours> [<reads at once>]]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    timers = calloc((size_t)pins, sizeof(*timers));
+    intervals = calloc((size_t)pins, sizeof(*intervals));
+    last = calloc((size_t)pins, sizeof(*last));
+    active = calloc((size_t)max_active, sizeof(*active));
+    if (NULL == timers || NULL == intervals || NULL == last || NULL == active)
+    {
+        fprintf(stderr, "Out of memory\n");
+        return EXIT_FAILURE;
+    }
+
+    srand(1);
+    end = now;
+    end.tv_sec += (time_t)hours * 3600;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    schedule_init(&schedule, timers, pins, max_active, MIN_GAP_MS, &now);
+    for (i = 0; i < pins; ++i)
+    {
+        intervals[i] = MIN_GAP_MS + rand() % (MAX_INTERVAL_MS - MIN_GAP_MS);
+        memset(&entry, 0, sizeof(entry));
+        entry.due = now;
+        add_ms(&entry.due, rand() % intervals[i]);
+        entry.index = i;
+        schedule_add(&schedule, &entry);
+    }
+
+    while (schedule_next_due(&schedule, &now) && diff_ns(&now, &end) > 0)
+    {
+        ++wakeups;
+        /* Take as many reads as allowed, then finish them together */
+        do
+        {
+            active_count = 0;
+            while (active_count < max_active &&
+                   schedule_expire(&schedule, &now, &active[active_count]))
+            {
+                ++active_count;
+            }
+            if (0 == active_count)
+            {
+                break;
+            }
+            if (schedule_expire(&schedule, &now, &entry))
+            {
+                fprintf(stderr, "More than %d reads at once\n", max_active);
+                ++errors;
+            }
+
+            for (i = 0; i < active_count; ++i)
+            {
+                ScheduleEntry *read = &active[i];
+                const int pin = read->index;
+                late = diff_ns(&read->due, &now);
+                if (late < 0 || late > SCHEDULE_TICK_NS)
+                {
+                    ++errors;
+                }
+                if (late > worst_late)
+                {
+                    worst_late = late;
+                }
+                if ((0 != last[pin].tv_sec) && diff_ns(&last[pin], &now) <
+                    (long long)MIN_GAP_MS * 1000000LL)
+                {
+                    ++errors;
+                }
+                last[pin] = now;
+                ++reads;
+
+                schedule_done(&schedule);
+                add_ms(&read->due, intervals[pin]);
+                schedule_add(&schedule, read);
+            }
+        } while (active_count == max_active);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+    elapsed = diff_ns(&started, &finished);
+
+    printf("pins:              %d\n", pins);
+    printf("simulated hours:   %d\n", hours);
+    printf("reads at once:     %d\n", max_active);
+    printf("reads:             %ld\n", reads);
+    printf("wake ups:          %ld\n", wakeups);
+    printf("total time:        %.3f ms\n", (double)elapsed / 1e6);
+    printf("per read:          %.1f ns (expire and reschedule)\n",
+        reads > 0 ? (double)elapsed / (double)reads : 0.0);
+    printf("per simulated hour: %.3f ms\n", (double)elapsed / 1e6 / hours);
+    printf("worst lateness:    %.3f ms\n", (double)worst_late / 1e6);
+    printf("errors:            %ld\n", errors);
+
+    free(active);
+    free(last);
+    free(intervals);
+    free(timers);
+    return (0 == errors) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,61 @@
+/*------------------------------------------------------------------------------
+ *! \file   sensor.h
+ *! \brief  Sensor reading types shared between the reader and its outputs.
+ *------------------------------------------------------------------------------
+ *                   Kris Dunning ippie52@gmail.com 2016.
+ *------------------------------------------------------------------------------
+ */
+#pragma once
+
+/******************************************************************************/
+/**The result enumeration of the sensor readings
+ */
+typedef enum Results
+{
+    RESULT_OK,          /*!< Valid values appear to have been found   */
+    RESULT_BAD_DATA,    /*!< Bad data                                 */
+    RESULT_ALL_ZERO,    /*!< All values are zero - suspicious         */
+    RESULT_INCONSISTENT,/*!< Data inconsistent from last reading      */
+    RESULT_INVALID      /*!< Data appears to be invalid               */
+} SensorReadingResults;
+
+#define RESULT_COUNT    (RESULT_INVALID + 1)
+
+/******************************************************************************/
+/**The phases of a read, as timed for the statistics
+ */
+typedef enum Phases
+{
+    PHASE_HANDSHAKE,    /*!< Start signal sent to the sensor          */
+    PHASE_CAPTURE,      /*!< Response and data bits captured          */
+    PHASE_RETRY_WAIT,   /*!< Waiting for the sensor before a retry    */
+    PHASE_TOTAL         /*!< The whole read, all attempts             */
+} ReadPhase;
+
+#define PHASE_COUNT     (PHASE_TOTAL + 1)
+
+/******************************************************************************/
+/** The supported sensor models
+ */
+typedef enum Models
+{
+    MODEL_AUTO,         /*!< Detected from the frames read            */
+    MODEL_DHT11,        /*!< DHT11, whole numbers and a tenths byte   */
+    MODEL_DHT22         /*!< DHT22 / AM2302, also the DHT21           */
+} SensorModel;
+
+/******************************************************************************/
+/** Sensor value struct, storing temperature, humidity and the processing result
+ */
+typedef struct Values
+{
+    SensorReadingResults result;    /*!< The sensor reading results         */
+    float humidity;                 /*!< The humidity reading (in %)        */
+    float temperature;              /*!< The temperature reading (in *C)    */
+
+} SensorValues;
+
+#define INVALID_VALUES  { RESULT_INVALID, 0.0f, 0.0f }
+#define MAX_GROUP_NAME_LENGTH   16U
+#define MAX_DEVICE_PATH_LENGTH  96U
+#define C_TO_F(c)       (((float)c * 1.8f) + 32.0f)
@@ -0,0 +1,362 @@
+/*------------------------------------------------------------------------------
+ *! \file   settings.c
+ *! \brief  The per pin settings table and the configuration file it is read
+ *          from.
+ *
+ *  The file has one setting per line, "<key> <value>", '#' starts a comment.
+ *  Settings before the first section are the long command line options
+ *  without their dashes, and are handed back to the caller. Each "[<pin>]"
+ *  section then lists the settings of one pin:
+ *
+ *      model auto|dht11|dht22
+ *      gpio auto|wiringpi|chardev
+ *      interval <seconds>
+ *      max-interval <seconds>
+ *      adapt-band <temperature>[:<humidity>]
+ *      tries <count>
+ *      retry-delay <ms>
+ *      deadband <temperature>[:<humidity>]
+ *      offset <temperature>[:<humidity>]
+ *      filter <readings>
+ *      sinks <name> [<name> ...]
+ *      group <name>
+ *      iio <device directory>
+ *      i2c <bus>[:<address>]
+ *
+ *  Anything a section leaves out is taken from the defaults given.
+ *------------------------------------------------------------------------------
+ *                   Kris Dunning ippie52@gmail.com 2016.
+ *------------------------------------------------------------------------------
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "settings.h"
+#include "filter.h"
+#include "i2c.h"
+
+#define MAX_SETTINGS_LINE_LENGTH    256U
+#define GROUP_NAME_CHARACTERS       "abcdefghijklmnopqrstuvwxyz" \
+                                    "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_-"
+
+/*******************************************************************************
+ *  \brief  Converts a sensor model name.
+ *  \return Zero if the model is not supported, otherwise 1.
+ */
+int parse_model
+(
+    const char *name,       /*!<IN  - The model name, i.e. "dht22"  */
+    SensorModel *model      /*!<OUT - The model identified         */
+)
+{
+    if (0 == strcmp(name, "auto"))
+    {
+        *model = MODEL_AUTO;
+        return 1;
+    }
+    if (0 == strcmp(name, "dht11"))
+    {
+        *model = MODEL_DHT11;
+        return 1;
+    }
+    if (0 == strcmp(name, "dht22") || 0 == strcmp(name, "am2302") ||
+        0 == strcmp(name, "dht21"))
+    {
+        *model = MODEL_DHT22;
+        return 1;
+    }
+    return 0;
+}
+
+/*******************************************************************************
+ *  \brief  Parses an I2C sensor, "<bus>[:<address>]". The bus is a number,
+ *          i.e. 1 for /dev/i2c-1, or a device path, and the address is
+ *          0x5C if not given.
+ *  \return Zero if the sensor is not valid, otherwise 1.
+ */
+int parse_i2c_device
+(
+    const char *spec,       /*!<IN  - The sensor to parse               */
+    PinConfig *config       /*!<OUT - The pin's bus and address         */
+)
+{
+    const char *colon = strrchr(spec, ':');
+    const size_t length = (NULL != colon) ? (size_t)(colon - spec) : strlen(spec);
+    char *end = NULL;
+    long address = I2C_DEFAULT_ADDRESS;
+
+    if (NULL != colon)
+    {
+        address = strtol(colon + 1, &end, 0);
+        if (end == colon + 1 || '\0' != *end || address < 0x03 || address > 0x77)
+        {
+            return 0;
+        }
+    }
+    if (0 == length || length + sizeof("/dev/i2c-") > sizeof(config->i2c))
+    {
+        return 0;
+    }
+    if (strspn(spec, "0123456789") == length)
+    {
+        snprintf(config->i2c, sizeof(config->i2c), "/dev/i2c-%.*s", (int)length, spec);
+    }
+    else
+    {
+        snprintf(config->i2c, sizeof(config->i2c), "%.*s", (int)length, spec);
+    }
+    config->i2c_address = (int)address;
+    return 1;
+}
+
+/*******************************************************************************
+ *  \brief  Parses "<first>[:<second>]", the second value is the same as the
+ *          first if not given.
+ *  \return Zero if the pair is not valid, otherwise 1.
+ */
+int parse_value_pair
+(
+    const char *spec,   /*!<IN  - The pair to parse     */
+    float *first,       /*!<OUT - The first value       */
+    float *second       /*!<OUT - The second value      */
+)
+{
+    char *end = NULL;
+    *first = strtof(spec, &end);
+    if (end == spec)
+    {
+        return 0;
+    }
+    *second = *first;
+    if (':' == *end)
+    {
+        spec = end + 1;
+        *second = strtof(spec, &end);
+        if (end == spec)
+        {
+            return 0;
+        }
+    }
+    return ('\0' == *end);
+}
+
+/*******************************************************************************
+ *  \brief  Parses a whole number setting.
+ *  \return Zero if the value is not a number of at least the minimum given,
+ *          otherwise 1.
+ */
+static int parse_count
+(
+    const char *value,  /*!<IN  - The value to parse    */
+    const int minimum,  /*!<IN  - The lowest allowed    */
+    int *count          /*!<OUT - The value parsed      */
+)
+{
+    char *end = NULL;
+    long parsed = strtol(value, &end, 10);
+    if (end == value || '\0' != *end || parsed < minimum || parsed > 1000000L)
+    {
+        return 0;
+    }
+    *count = (int)parsed;
+    return 1;
+}
+
+/*******************************************************************************
+ *  \brief  Applies a setting from a pin section.
+ *  \return Zero if the key or value is not valid, otherwise 1.
+ */
+static int apply_pin_setting
+(
+    PinConfig *config,      /*!<INOUT - The pin's settings      */
+    const char *key,        /*!<IN    - The setting name        */
+    const char *value       /*!<IN    - The setting value       */
+)
+{
+    if (0 == strcmp(key, "model"))
+    {
+        return parse_model(value, &config->model);
+    }
+    if (0 == strcmp(key, "gpio"))
+    {
+        return parse_gpio_backend(value, &config->gpio);
+    }
+    if (0 == strcmp(key, "interval"))
+    {
+        return parse_count(value, 0, &config->interval);
+    }
+    if (0 == strcmp(key, "max-interval"))
+    {
+        return parse_count(value, 0, &config->max_interval);
+    }
+    if (0 == strcmp(key, "adapt-band"))
+    {
+        return parse_value_pair(value, &config->adapt_temperature, &config->adapt_humidity) &&
+            config->adapt_temperature > 0.0f && config->adapt_humidity > 0.0f;
+    }
+    if (0 == strcmp(key, "tries"))
+    {
+        return parse_count(value, 1, &config->tries);
+    }
+    if (0 == strcmp(key, "retry-delay"))
+    {
+        return parse_count(value, 0, &config->retry_delay_ms);
+    }
+    if (0 == strcmp(key, "deadband"))
+    {
+        config->deadband_set = 1;
+        return parse_value_pair(value, &config->temperature_band, &config->humidity_band) &&
+            config->temperature_band >= 0.0f && config->humidity_band >= 0.0f;
+    }
+    if (0 == strcmp(key, "offset"))
+    {
+        return parse_value_pair(value, &config->temperature_offset,
+            &config->humidity_offset);
+    }
+    if (0 == strcmp(key, "filter"))
+    {
+        return parse_count(value, 0, &config->filter_window) &&
+            1 != config->filter_window && config->filter_window <= MAX_FILTER_WINDOW;
+    }
+    if (0 == strcmp(key, "sinks"))
+    {
+        if (strlen(value) >= sizeof(config->sinks))
+        {
+            return 0;
+        }
+        snprintf(config->sinks, sizeof(config->sinks), "%s", value);
+        return 1;
+    }
+    if (0 == strcmp(key, "group"))
+    {
+        /* The name is used as an InfluxDB tag and in CSV, so is kept plain */
+        if ('\0' == *value || strlen(value) >= sizeof(config->group) ||
+            strspn(value, GROUP_NAME_CHARACTERS) != strlen(value))
+        {
+            return 0;
+        }
+        snprintf(config->group, sizeof(config->group), "%s", value);
+        return 1;
+    }
+    if (0 == strcmp(key, "i2c"))
+    {
+        return parse_i2c_device(value, config);
+    }
+    if (0 == strcmp(key, "iio"))
+    {
+        if (strlen(value) >= sizeof(config->iio))
+        {
+            return 0;
+        }
+        snprintf(config->iio, sizeof(config->iio), "%s", value);
+        return 1;
+    }
+    return 0;
+}
+
+/*******************************************************************************
+ *  \brief  Reads the configuration file into the settings table. Settings
+ *          outside of a pin section are passed to the handler, or ignored if
+ *          it is NULL.
+ *  \return Zero if the file cannot be read or a setting is not valid,
+ *          otherwise 1.
+ */
+int settings_load
+(
+    const char *path,                   /*!<IN  - The configuration file        */
+    const PinConfig *defaults,          /*!<IN  - The settings of a new section */
+    Settings *settings,                 /*!<OUT - The pin settings read         */
+    GlobalSettingHandler handler,       /*!<IN  - Handles global settings       */
+    void *arg                           /*!<IN  - Passed to the handler         */
+)
+{
+    char line[MAX_SETTINGS_LINE_LENGTH];
+    PinConfig *section = NULL;
+    int line_number = 0;
+    int result = 1;
+    FILE *fp = fopen(path, "r");
+
+    memset(settings, 0, sizeof(*settings));
+    if (NULL == fp)
+    {
+        fprintf(stderr, "Failed to open the configuration file %s\n", path);
+        return 0;
+    }
+
+    while (result && NULL != fgets(line, sizeof(line), fp))
+    {
+        char *comment = strchr(line, '#');
+        char *key = line;
+        char *value;
+        char *end;
+
+        ++line_number;
+        if (NULL != comment)
+        {
+            *comment = '\0';
+        }
+        key += strspn(key, " \t");
+        end = key + strlen(key);
+        while (end > key && strchr(" \t\r\n", end[-1]))
+        {
+            *--end = '\0';
+        }
+        if ('\0' == *key)
+        {
+            continue;
+        }
+
+        if ('[' == *key)
+        {
+            int pin;
+            int i;
+            if (']' != end[-1])
+            {
+                result = 0;
+                break;
+            }
+            end[-1] = '\0';
+            if (!parse_count(key + 1, 0, &pin) || settings->count >= MAX_PINS)
+            {
+                result = 0;
+                break;
+            }
+            for (i = 0; i < settings->count; ++i)
+            {
+                if (settings->pins[i].pin == pin)
+                {
+                    result = 0;
+                }
+            }
+            section = &settings->pins[settings->count++];
+            *section = *defaults;
+            section->pin = pin;
+            continue;
+        }
+
+        value = key + strcspn(key, " \t");
+        if ('\0' != *value)
+        {
+            *value++ = '\0';
+            value += strspn(value, " \t");
+        }
+
+        if (NULL != section)
+        {
+            result = apply_pin_setting(section, key, value);
+        }
+        else if (NULL != handler)
+        {
+            result = handler(key, value, arg);
+        }
+    }
+    fclose(fp);
+
+    if (!result)
+    {
+        fprintf(stderr, "%s:%d: Invalid setting\n", path, line_number);
+    }
+    return result;
+}
@@ -0,0 +1,64 @@
+/*------------------------------------------------------------------------------
+ *! \file   settings.h
+ *! \brief  The per pin settings table and the configuration file it is read
+ *          from.
+ *------------------------------------------------------------------------------
+ *                   Kris Dunning ippie52@gmail.com 2016.
+ *------------------------------------------------------------------------------
+ */
+#pragma once
+
+#include "sensor.h"
+#include "gpio.h"
+
+#define MAX_PINS                128
+#define MAX_SINK_NAMES_LENGTH   96U
+#define DEFAULT_INTERVAL        30
+#define DEFAULT_TRIES           100
+#define DEFAULT_RETRY_DELAY     200
+
+/******************************************************************************/
+/** The settings of a single pin, as read from the configuration file
+ */
+typedef struct PinConfigs
+{
+    int pin;                    /*!< The sensor pin                         */
+    SensorModel model;          /*!< The sensor model                       */
+    GpioBackend gpio;           /*!< How the pin is accessed                */
+    int interval;               /*!< Seconds between reads, 0 to read once  */
+    int max_interval;           /*!< Longest adaptive interval, 0 if fixed  */
+    float adapt_temperature;    /*!< Change per read to read sooner, *C     */
+    float adapt_humidity;       /*!< Change per read to read sooner, %      */
+    int tries;                  /*!< The maximum number of attempts         */
+    int retry_delay_ms;         /*!< The wait between attempts              */
+    int deadband_set;           /*!< Non zero if the deadband was given     */
+    float temperature_band;     /*!< On change band, *C, negative if off    */
+    float humidity_band;        /*!< On change band, %, negative if off     */
+    float temperature_offset;   /*!< Added to each temperature read         */
+    float humidity_offset;      /*!< Added to each humidity read            */
+    int filter_window;          /*!< Readings in the median filter, 0 off   */
+    char sinks[MAX_SINK_NAMES_LENGTH]; /*!< Sink names, empty for all       */
+    char group[MAX_GROUP_NAME_LENGTH]; /*!< Sensor group, empty for none    */
+    char iio[MAX_DEVICE_PATH_LENGTH]; /*!< IIO device to read, empty for none */
+    char i2c[MAX_DEVICE_PATH_LENGTH]; /*!< I2C bus to read, empty for none  */
+    int i2c_address;            /*!< The sensor's address on the bus        */
+} PinConfig;
+
+/******************************************************************************/
+/** The settings of every pin
+ */
+typedef struct Settings
+{
+    PinConfig pins[MAX_PINS];   /*!< The pins, in the order given           */
+    int count;                  /*!< The number of pins                     */
+} Settings;
+
+/* Called for each setting outside of a [pin] section */
+typedef int (*GlobalSettingHandler)(const char *key, const char *value,
+    void *arg);
+
+int parse_model(const char *name, SensorModel *model);
+int parse_i2c_device(const char *spec, PinConfig *config);
+int parse_value_pair(const char *spec, float *first, float *second);
+int settings_load(const char *path, const PinConfig *defaults,
+    Settings *settings, GlobalSettingHandler handler, void *arg);
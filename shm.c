@@ -0,0 +1,340 @@
+/*------------------------------------------------------------------------------
+ *! \file   shm.c
+ *! \brief  Shared memory slots holding each pin's latest reading, and the
+ *          client call used to wait for the next one.
+ *
+ *  Each pin has a POSIX shared memory object, /kdht.<pin>, written only by the
+ *  kdht holding the pin's lock. The reading is guarded by a sequence lock, so
+ *  readers never block the writer, and the same counter is the futex the
+ *  consumers sleep on: a new reading wakes every waiter exactly once, with no
+ *  polling and no socket per consumer. Consumers map the slot read only.
+ *------------------------------------------------------------------------------
+ *                   Kris Dunning ippie52@gmail.com 2016.
+ *------------------------------------------------------------------------------
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "shm.h"
+
+#define SHM_MAPPED_LENGTH   256U
+#define SHM_NAME_LENGTH     32U
+
+/******************************************************************************/
+/** A slot mapped by this process, found by open addressing on the pin. Pins
+ *  are any non negative ID (GPIO, IIO or I2C), so they are not an index.
+ */
+typedef struct MappedSlots
+{
+    unsigned int key;           /*!< The pin + 1, zero while unused         */
+    SharedSlot *slot;           /*!< The mapping, NULL until published      */
+} MappedSlot;
+
+/* Slots mapped by this process for kdht_wait_newer() */
+static MappedSlot mapped[SHM_MAPPED_LENGTH];
+
+/*******************************************************************************
+ *  \brief  Gets the shared memory object name for a pin.
+ */
+static void get_shm_name
+(
+    const int pin,      /*!<IN  - The sensor pin            */
+    char *name          /*!<OUT - SHM_NAME_LENGTH bytes     */
+)
+{
+    snprintf(name, SHM_NAME_LENGTH, "/kdht.%d", pin);
+}
+
+/*******************************************************************************
+ *  \brief  Calls the futex system call, which has no glibc wrapper.
+ *  \return The system call result.
+ */
+static long futex
+(
+    volatile uint32_t *word,            /*!< - The futex word               */
+    const int op,                       /*!< - FUTEX_WAIT or FUTEX_WAKE     */
+    const uint32_t value,               /*!< - Expected value or wake count */
+    const struct timespec *timeout      /*!< - Relative timeout, or NULL    */
+)
+{
+    return syscall(SYS_futex, word, op, value, timeout, NULL, 0);
+}
+
+/*******************************************************************************
+ *  \brief  Creates (or reopens) the slot for a pin. An existing slot keeps its
+ *          sequence number, so consumers carry on across a restart.
+ *  \return The mapped slot, NULL on failure.
+ */
+SharedSlot *shm_create
+(
+    const int pin   /*!< - The sensor pin   */
+)
+{
+    char name[SHM_NAME_LENGTH];
+    SharedSlot *slot;
+    int fd;
+
+    get_shm_name(pin, name);
+    fd = shm_open(name, O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Failed to open shared memory %s: %s\n", name, strerror(errno));
+        return NULL;
+    }
+    if (ftruncate(fd, sizeof(SharedSlot)) < 0)
+    {
+        fprintf(stderr, "Failed to size shared memory %s: %s\n", name, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+    slot = mmap(NULL, sizeof(SharedSlot), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == slot)
+    {
+        return NULL;
+    }
+
+    if (SHM_MAGIC != slot->magic || SHM_VERSION != slot->version)
+    {
+        memset(slot, 0, sizeof(*slot));
+        slot->version = SHM_VERSION;
+        __atomic_store_n(&slot->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+    }
+    else if (slot->counter & 1U)
+    {
+        /* A previous writer stopped part way through */
+        __atomic_store_n(&slot->counter, slot->counter + 1U, __ATOMIC_RELEASE);
+    }
+    slot->reading.pin = pin;
+    return slot;
+}
+
+/*******************************************************************************
+ *  \brief  Publishes a new reading and wakes everyone waiting for it. The
+ *          sequence number is set here.
+ */
+void shm_publish
+(
+    SharedSlot *slot,               /*!<INOUT - The pin's slot          */
+    const KdhtReading *reading      /*!<IN    - The reading to publish  */
+)
+{
+    const uint32_t counter = slot->counter;
+
+    __atomic_store_n(&slot->counter, counter + 1U, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    slot->reading = *reading;
+    slot->reading.seq = (counter + 2U) / 2U;
+    __atomic_store_n(&slot->counter, counter + 2U, __ATOMIC_RELEASE);
+
+    (void)futex(&slot->counter, FUTEX_WAKE, INT_MAX, NULL);
+}
+
+/*******************************************************************************
+ *  \brief  Unmaps the slot. The object itself is left for the consumers.
+ */
+void shm_destroy
+(
+    SharedSlot *slot    /*!< - The slot to unmap, may be NULL    */
+)
+{
+    if (NULL != slot)
+    {
+        munmap(slot, sizeof(*slot));
+    }
+}
+
+/*******************************************************************************
+ *  \brief  Finds the entry of a pin in the mapped slots, claiming a free one
+ *          if the pin has none yet.
+ *  \return The entry, NULL if the table is full.
+ */
+static MappedSlot *find_mapped
+(
+    const int pin,      /*!< - The sensor pin, not negative                 */
+    const int claim     /*!< - Non zero to claim an entry if there is none  */
+)
+{
+    const unsigned int key = (unsigned int)pin + 1U;
+    unsigned int index = (unsigned int)pin % SHM_MAPPED_LENGTH;
+    unsigned int probes;
+
+    for (probes = 0; probes < SHM_MAPPED_LENGTH;
+         ++probes, index = (index + 1) % SHM_MAPPED_LENGTH)
+    {
+        MappedSlot *entry = &mapped[index];
+        unsigned int current = __atomic_load_n(&entry->key, __ATOMIC_ACQUIRE);
+        if (0 == current && claim &&
+            __atomic_compare_exchange_n(&entry->key, &current, key, 0,
+                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        {
+            return entry;
+        }
+        if (key == current)
+        {
+            return entry;
+        }
+        if (0 == current)
+        {
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
+/*******************************************************************************
+ *  \brief  Maps a pin's slot read only, once per process.
+ *  \return The slot, NULL if kdht has not created it.
+ */
+static SharedSlot *map_slot
+(
+    const int pin   /*!< - The sensor pin   */
+)
+{
+    char name[SHM_NAME_LENGTH];
+    MappedSlot *entry;
+    SharedSlot *slot;
+    SharedSlot *expected = NULL;
+    struct stat info;
+    int fd;
+
+    if (pin < 0)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    entry = find_mapped(pin, 0);
+    slot = (NULL != entry) ? __atomic_load_n(&entry->slot, __ATOMIC_ACQUIRE) : NULL;
+    if (NULL != slot)
+    {
+        return slot;
+    }
+
+    get_shm_name(pin, name);
+    fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+    {
+        return NULL;
+    }
+    if (fstat(fd, &info) < 0 || info.st_size < (off_t)sizeof(SharedSlot))
+    {
+        close(fd);
+        errno = ENOENT;
+        return NULL;
+    }
+    slot = mmap(NULL, sizeof(SharedSlot), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == slot)
+    {
+        return NULL;
+    }
+    if (SHM_MAGIC != __atomic_load_n(&slot->magic, __ATOMIC_ACQUIRE) ||
+        SHM_VERSION != slot->version)
+    {
+        munmap(slot, sizeof(*slot));
+        errno = EPROTO;
+        return NULL;
+    }
+
+    entry = find_mapped(pin, 1);
+    if (NULL == entry)
+    {
+        munmap(slot, sizeof(*slot));
+        errno = ENOSPC;
+        return NULL;
+    }
+    /* Another thread may have got there first */
+    if (!__atomic_compare_exchange_n(&entry->slot, &expected, slot, 0,
+            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    {
+        munmap(slot, sizeof(*slot));
+        slot = expected;
+    }
+    return slot;
+}
+
+/*******************************************************************************
+ *  \brief  Waits until a reading newer than the given sequence number has
+ *          been published for the pin. Pass a sequence number of zero to get
+ *          the latest reading straight away, if there is one.
+ *  \return 1 with the reading filled in, 0 on timeout, -1 on error (errno is
+ *          ENOENT if kdht has not published anything for the pin yet, or
+ *          ENOSPC if this process has mapped SHM_MAPPED_LENGTH pins already).
+ */
+int kdht_wait_newer
+(
+    const int pin,              /*!<IN  - The sensor pin                        */
+    const unsigned int seq,     /*!<IN  - The last sequence number seen         */
+    const int timeout_ms,       /*!<IN  - Longest to wait, negative for ever    */
+    KdhtReading *reading        /*!<OUT - The newer reading                     */
+)
+{
+    SharedSlot *slot = map_slot(pin);
+    struct timespec deadline;
+    struct timespec now;
+    struct timespec remaining;
+
+    if (NULL == slot)
+    {
+        return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+        ++deadline.tv_sec;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    for (;;)
+    {
+        const uint32_t counter = __atomic_load_n(&slot->counter, __ATOMIC_ACQUIRE);
+        long long wait_ns;
+
+        if (0 == (counter & 1U) && counter / 2U > seq)
+        {
+            *reading = slot->reading;
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&slot->counter, __ATOMIC_RELAXED) == counter)
+            {
+                return 1;
+            }
+            /* Overwritten while copying, try again */
+            continue;
+        }
+        if (counter & 1U)
+        {
+            /* Mid write, it only takes a moment */
+            sched_yield();
+            continue;
+        }
+
+        if (timeout_ms < 0)
+        {
+            (void)futex(&slot->counter, FUTEX_WAIT, counter, NULL);
+            continue;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        wait_ns = (long long)(deadline.tv_sec - now.tv_sec) * 1000000000LL +
+            (deadline.tv_nsec - now.tv_nsec);
+        if (wait_ns <= 0)
+        {
+            return 0;
+        }
+        remaining.tv_sec = (time_t)(wait_ns / 1000000000LL);
+        remaining.tv_nsec = (long)(wait_ns % 1000000000LL);
+        /* Returns at once if the counter has already moved on */
+        (void)futex(&slot->counter, FUTEX_WAIT, counter, &remaining);
+    }
+}
@@ -0,0 +1,59 @@
+/*------------------------------------------------------------------------------
+ *! \file   shm.h
+ *! \brief  Shared memory slots holding each pin's latest reading, and the
+ *          client call used to wait for the next one.
+ *
+ *  A consumer only needs this header and shm.c:
+ *
+ *      KdhtReading reading;
+ *      unsigned int seq = 0;
+ *      while (kdht_wait_newer(7, seq, 60000, &reading) > 0)
+ *      {
+ *          seq = reading.seq;
+ *          ...
+ *      }
+ *------------------------------------------------------------------------------
+ *                   Kris Dunning ippie52@gmail.com 2016.
+ *------------------------------------------------------------------------------
+ */
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+
+#include "sensor.h"
+
+#define SHM_MAGIC       0x5448444BU     /* "KDHT" */
+#define SHM_VERSION     1U
+
+/******************************************************************************/
+/** A reading as published to the consumers
+ */
+typedef struct KdhtReadings
+{
+    unsigned int seq;           /*!< Sequence number, 1 for the first reading */
+    int pin;                    /*!< The sensor pin                         */
+    SensorValues values;        /*!< The values and the result of the read  */
+    int attempts;               /*!< The number of attempts made            */
+    struct timespec timestamp;  /*!< Wall clock time of the reading         */
+} KdhtReading;
+
+/******************************************************************************/
+/** The shared memory slot of a pin. The counter is even while the reading is
+ *  stable and odd while it is being written, and is also the futex waited on.
+ */
+typedef struct SharedSlots
+{
+    uint32_t magic;             /*!< SHM_MAGIC                              */
+    uint32_t version;           /*!< SHM_VERSION                            */
+    volatile uint32_t counter;  /*!< Twice the sequence number, +1 writing  */
+    uint32_t reserved;          /*!< Keeps the reading aligned              */
+    KdhtReading reading;        /*!< The latest reading                     */
+} SharedSlot;
+
+SharedSlot *shm_create(const int pin);
+void shm_publish(SharedSlot *slot, const KdhtReading *reading);
+void shm_destroy(SharedSlot *slot);
+
+int kdht_wait_newer(const int pin, const unsigned int seq, const int timeout_ms,
+    KdhtReading *reading);
@@ -0,0 +1,469 @@
+/*------------------------------------------------------------------------------
+ *! \file   sink.c
+ *! \brief  Output sinks, each run on its own worker thread and fed through a
+ *          bounded queue so that no output can hold up the next read.
+ *
+ *  Each sink has a single producer (the read loop) and a single consumer (its
+ *  worker), so the queue is a ring indexed by two atomic counters. Two
+ *  semaphores count the queued events and the free slots, which lets the
+ *  worker sleep while idle and lets a blocking sink hold up the producer.
+ *------------------------------------------------------------------------------
+ *                   Kris Dunning ippie52@gmail.com 2016.
+ *------------------------------------------------------------------------------
+ */
+
+#include <dlfcn.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sink.h"
+
+#define MAX_SINKS           8
+#define SINK_QUEUE_LENGTH   64U
+#define MAX_SINK_PATH       160U
+
+/******************************************************************************/
+/** A running sink and its queue
+ */
+typedef struct Sinks
+{
+    const SinkOps *ops;                 /*!< The sink callbacks                 */
+    void *context;                      /*!< The sink's own state               */
+    void *handle;                       /*!< dlopen() handle, NULL if built in  */
+    SinkPolicy policy;                  /*!< Full queue policy                  */
+    SinkEvent queue[SINK_QUEUE_LENGTH]; /*!< The queued events                  */
+    atomic_uint head;                   /*!< Next slot to write (producer)      */
+    atomic_uint tail;                   /*!< Next slot to read (worker)         */
+    sem_t items;                        /*!< Events waiting                     */
+    sem_t slots;                        /*!< Free slots                         */
+    pthread_t worker;                   /*!< The worker thread                  */
+    atomic_ulong delivered;             /*!< Events handled by the sink         */
+    atomic_ulong dropped;               /*!< Events dropped on a full queue     */
+    atomic_uint high_water;             /*!< Deepest queue seen                 */
+} Sink;
+
+static Sink *sinks[MAX_SINKS];
+static int sink_count = 0;
+
+/*******************************************************************************
+ *  \brief  The worker thread, handing queued events to the sink until stopped.
+ *  \return Always NULL.
+ */
+static void *sink_worker
+(
+    void *arg   /*!<IN - The Sink to run  */
+)
+{
+    Sink *sink = (Sink *)arg;
+    int running = 1;
+    while (running)
+    {
+        unsigned int tail;
+        const SinkEvent *event;
+        while (sem_wait(&sink->items) != 0)
+        {
+        }
+        tail = atomic_load_explicit(&sink->tail, memory_order_relaxed);
+        event = &sink->queue[tail % SINK_QUEUE_LENGTH];
+        switch (event->type)
+        {
+            case SINK_EVENT_REPORT:
+            case SINK_EVENT_ALERT:
+                sink->ops->write(sink->context, event);
+                break;
+
+            case SINK_EVENT_CYCLE_END:
+                if (NULL != sink->ops->flush)
+                {
+                    sink->ops->flush(sink->context);
+                }
+                break;
+
+            case SINK_EVENT_STOP:
+                running = 0;
+                break;
+        }
+        atomic_store_explicit(&sink->tail, tail + 1, memory_order_release);
+        atomic_fetch_add_explicit(&sink->delivered, 1, memory_order_relaxed);
+        sem_post(&sink->slots);
+    }
+    return NULL;
+}
+
+/*******************************************************************************
+ *  \brief  Queues an event for a sink, applying its policy if full.
+ */
+static void sink_push
+(
+    Sink *sink,                 /*!<INOUT - The sink to queue for       */
+    const SinkEventType type,   /*!<IN    - The event type              */
+    const SensorReport *report, /*!<IN    - The report, may be NULL     */
+    const PinStats *stats,      /*!<IN    - The statistics, may be NULL */
+    const Alert *alert,         /*!<IN    - The alert, may be NULL      */
+    const int force_block       /*!<IN    - Wait even if policy is drop */
+)
+{
+    unsigned int head;
+    unsigned int depth;
+    SinkEvent *event;
+
+    if (SINK_POLICY_BLOCK == sink->policy || force_block)
+    {
+        while (sem_wait(&sink->slots) != 0)
+        {
+        }
+    }
+    else if (sem_trywait(&sink->slots) != 0)
+    {
+        atomic_fetch_add_explicit(&sink->dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    head = atomic_load_explicit(&sink->head, memory_order_relaxed);
+    event = &sink->queue[head % SINK_QUEUE_LENGTH];
+    event->type = type;
+    if (NULL != report)
+    {
+        event->report = *report;
+    }
+    if (NULL != stats)
+    {
+        event->stats = *stats;
+    }
+    if (NULL != alert)
+    {
+        event->alert = *alert;
+    }
+    atomic_store_explicit(&sink->head, head + 1, memory_order_release);
+
+    depth = head + 1 - atomic_load_explicit(&sink->tail, memory_order_acquire);
+    if (depth > atomic_load_explicit(&sink->high_water, memory_order_relaxed))
+    {
+        atomic_store_explicit(&sink->high_water, depth, memory_order_relaxed);
+    }
+    sem_post(&sink->items);
+}
+
+/*******************************************************************************
+ *  \brief  Starts a sink on its own worker thread. The worker always runs at
+ *          normal priority, whatever the read loop has been given.
+ *  \return Zero on failure, otherwise 1.
+ */
+int sink_add
+(
+    const SinkOps *ops,         /*!<IN - The sink callbacks             */
+    void *context,              /*!<IN - The sink's own state           */
+    const SinkPolicy policy     /*!<IN - What to do when the queue is full */
+)
+{
+    pthread_attr_t attr;
+    struct sched_param param;
+    Sink *sink;
+    int result;
+
+    if (sink_count >= MAX_SINKS)
+    {
+        fprintf(stderr, "Too many sinks, at most %d\n", MAX_SINKS);
+        return 0;
+    }
+    sink = calloc(1, sizeof(*sink));
+    if (NULL == sink)
+    {
+        return 0;
+    }
+    sink->ops = ops;
+    sink->context = context;
+    sink->policy = policy;
+    atomic_init(&sink->head, 0);
+    atomic_init(&sink->tail, 0);
+    atomic_init(&sink->delivered, 0);
+    atomic_init(&sink->dropped, 0);
+    atomic_init(&sink->high_water, 0);
+    sem_init(&sink->items, 0, 0);
+    sem_init(&sink->slots, 0, SINK_QUEUE_LENGTH);
+
+    memset(&param, 0, sizeof(param));
+    pthread_attr_init(&attr);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+    pthread_attr_setschedparam(&attr, &param);
+    result = pthread_create(&sink->worker, &attr, sink_worker, sink);
+    pthread_attr_destroy(&attr);
+    if (0 != result)
+    {
+        fprintf(stderr, "Failed to start the %s sink\n", ops->name);
+        free(sink);
+        return 0;
+    }
+    sinks[sink_count++] = sink;
+    return 1;
+}
+
+/*******************************************************************************
+ *  \brief  Loads a sink plugin and starts it. The spec is the path to the
+ *          shared object, optionally followed by ":" and the plugin arguments.
+ *  \return Zero on failure, otherwise 1.
+ */
+int sink_load
+(
+    const char *spec,           /*!<IN - The plugin path[:args]             */
+    const SinkPolicy policy     /*!<IN - What to do when the queue is full  */
+)
+{
+    char path[MAX_SINK_PATH];
+    const char *colon = strchr(spec, ':');
+    const char *args = colon ? colon + 1 : "";
+    size_t length = colon ? (size_t)(colon - spec) : strlen(spec);
+    const SinkOps *ops;
+    void *handle;
+    void *context;
+
+    if (length >= sizeof(path))
+    {
+        fprintf(stderr, "Sink path too long: %s\n", spec);
+        return 0;
+    }
+    memcpy(path, spec, length);
+    path[length] = '\0';
+
+    handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (NULL == handle)
+    {
+        fprintf(stderr, "Failed to load sink: %s\n", dlerror());
+        return 0;
+    }
+    ops = (const SinkOps *)dlsym(handle, SINK_SYMBOL);
+    if (NULL == ops || NULL == ops->open || NULL == ops->write)
+    {
+        fprintf(stderr, "%s is not a kdht sink\n", path);
+        dlclose(handle);
+        return 0;
+    }
+    if (SINK_API_VERSION != ops->version)
+    {
+        fprintf(stderr, "%s was built for sink API %d, this is %d, rebuild it\n",
+            path, ops->version, SINK_API_VERSION);
+        dlclose(handle);
+        return 0;
+    }
+    context = ops->open(args);
+    if (NULL == context)
+    {
+        fprintf(stderr, "The %s sink failed to open\n", ops->name);
+        dlclose(handle);
+        return 0;
+    }
+    if (!sink_add(ops, context, policy))
+    {
+        if (NULL != ops->close)
+        {
+            ops->close(context);
+        }
+        dlclose(handle);
+        return 0;
+    }
+    sinks[sink_count - 1]->handle = handle;
+    return 1;
+}
+
+/*******************************************************************************
+ *  \brief  Converts a sink policy name given on the command line.
+ *  \return Zero if the name is not recognised, otherwise 1.
+ */
+int parse_sink_policy
+(
+    const char *name,       /*!<IN  - The policy name, "drop" or "block" */
+    SinkPolicy *policy      /*!<OUT - The policy identified             */
+)
+{
+    int result = 1;
+    if (0 == strcmp(name, "drop"))
+    {
+        *policy = SINK_POLICY_DROP;
+    }
+    else if (0 == strcmp(name, "block"))
+    {
+        *policy = SINK_POLICY_BLOCK;
+    }
+    else
+    {
+        result = 0;
+    }
+    return result;
+}
+
+/*******************************************************************************
+ *  \brief  Finds a sink by name, for use in a sink mask.
+ *  \return The bit of the sink in a mask, -1 if there is no such sink.
+ */
+int sink_find
+(
+    const char *name    /*!<IN - The sink name, i.e. "mqtt" */
+)
+{
+    int i;
+    for (i = 0; i < sink_count; ++i)
+    {
+        if (0 == strcmp(sinks[i]->ops->name, name))
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*******************************************************************************
+ *  \brief  Passes a report to every sink in the mask.
+ */
+void sink_publish_report
+(
+    const SensorReport *report,     /*!<IN - The report to pass on          */
+    const PinStats *stats,          /*!<IN - The pin statistics to pass on  */
+    const unsigned int mask         /*!<IN - The sinks, SINK_MASK_ALL for all */
+)
+{
+    int i;
+    for (i = 0; i < sink_count; ++i)
+    {
+        if (0 == (mask & (1U << i)))
+        {
+            continue;
+        }
+        sink_push(sinks[i], SINK_EVENT_REPORT, report, stats, NULL, 0);
+    }
+}
+
+/*******************************************************************************
+ *  \brief  Passes an alert to every sink in the mask.
+ */
+void sink_publish_alert
+(
+    const Alert *alert,             /*!<IN - The alert to pass on           */
+    const unsigned int mask         /*!<IN - The sinks, SINK_MASK_ALL for all */
+)
+{
+    int i;
+    for (i = 0; i < sink_count; ++i)
+    {
+        if (mask & (1U << i))
+        {
+            sink_push(sinks[i], SINK_EVENT_ALERT, NULL, NULL, alert, 0);
+        }
+    }
+}
+
+/*******************************************************************************
+ *  \brief  Tells every sink that the cycle is complete.
+ */
+void sink_publish_cycle_end(void)
+{
+    int i;
+    for (i = 0; i < sink_count; ++i)
+    {
+        sink_push(sinks[i], SINK_EVENT_CYCLE_END, NULL, NULL, NULL, 0);
+    }
+}
+
+/*******************************************************************************
+ *  \brief  Lets every sink finish its queue, then stops and closes them.
+ */
+void sink_shutdown(void)
+{
+    int i;
+    for (i = 0; i < sink_count; ++i)
+    {
+        sink_push(sinks[i], SINK_EVENT_STOP, NULL, NULL, NULL, 1);
+    }
+    /* Sinks may look at each other's metrics, so all must stop before any go */
+    for (i = 0; i < sink_count; ++i)
+    {
+        pthread_join(sinks[i]->worker, NULL);
+    }
+    for (i = 0; i < sink_count; ++i)
+    {
+        Sink *sink = sinks[i];
+        if (NULL != sink->ops->close)
+        {
+            sink->ops->close(sink->context);
+        }
+        if (atomic_load(&sink->dropped) > 0)
+        {
+            fprintf(stderr, "The %s sink dropped %lu events\n", sink->ops->name,
+                (unsigned long)atomic_load(&sink->dropped));
+        }
+        if (NULL != sink->handle)
+        {
+            dlclose(sink->handle);
+        }
+        sem_destroy(&sink->items);
+        sem_destroy(&sink->slots);
+        free(sink);
+        sinks[i] = NULL;
+    }
+    sink_count = 0;
+}
+
+/*******************************************************************************
+ *  \brief  Writes the queue metrics of every sink as a node-exporter textfile,
+ *          kdht_sinks.prom in the given directory. The file is replaced
+ *          atomically.
+ *  \return Zero if writing fails, otherwise 1.
+ */
+int sink_write_prometheus
+(
+    const char *directory   /*!<IN - The textfile collector directory  */
+)
+{
+    char filename[MAX_SINK_PATH];
+    char temp[MAX_SINK_PATH + 4];
+    int i;
+    FILE *fp;
+
+    snprintf(filename, sizeof(filename), "%s/kdht_sinks.prom", directory);
+    snprintf(temp, sizeof(temp), "%s.tmp", filename);
+    fp = fopen(temp, "w");
+    if (NULL == fp)
+    {
+        fprintf(stderr, "Failed to open file %s in mode \"w\".\n", temp);
+        return 0;
+    }
+    fprintf(fp, "# HELP kdht_sink_queue_depth Events waiting for the sink.\n");
+    fprintf(fp, "# TYPE kdht_sink_queue_depth gauge\n");
+    for (i = 0; i < sink_count; ++i)
+    {
+        fprintf(fp, "kdht_sink_queue_depth{sink=\"%s\"} %u\n", sinks[i]->ops->name,
+            atomic_load(&sinks[i]->head) - atomic_load(&sinks[i]->tail));
+    }
+    fprintf(fp, "# HELP kdht_sink_queue_high_water Deepest the queue has been.\n");
+    fprintf(fp, "# TYPE kdht_sink_queue_high_water gauge\n");
+    for (i = 0; i < sink_count; ++i)
+    {
+        fprintf(fp, "kdht_sink_queue_high_water{sink=\"%s\"} %u\n",
+            sinks[i]->ops->name, atomic_load(&sinks[i]->high_water));
+    }
+    fprintf(fp, "# HELP kdht_sink_events_total Events handled by the sink.\n");
+    fprintf(fp, "# TYPE kdht_sink_events_total counter\n");
+    for (i = 0; i < sink_count; ++i)
+    {
+        fprintf(fp, "kdht_sink_events_total{sink=\"%s\"} %lu\n", sinks[i]->ops->name,
+            (unsigned long)atomic_load(&sinks[i]->delivered));
+    }
+    fprintf(fp, "# HELP kdht_sink_dropped_total Events dropped on a full queue.\n");
+    fprintf(fp, "# TYPE kdht_sink_dropped_total counter\n");
+    for (i = 0; i < sink_count; ++i)
+    {
+        fprintf(fp, "kdht_sink_dropped_total{sink=\"%s\"} %lu\n", sinks[i]->ops->name,
+            (unsigned long)atomic_load(&sinks[i]->dropped));
+    }
+    if (0 != fclose(fp) || 0 != rename(temp, filename))
+    {
+        fprintf(stderr, "Failed to replace %s\n", filename);
+        return 0;
+    }
+    return 1;
+}
@@ -0,0 +1,95 @@
+/*------------------------------------------------------------------------------
+ *! \file   sink.h
+ *! \brief  Output sinks, each run on its own worker thread and fed through a
+ *          bounded queue so that no output can hold up the next read.
+ *
+ *  This is also the interface for sink plugins. A plugin is a shared object
+ *  exporting a SinkOps structure named "kdht_sink":
+ *
+ *      const SinkOps kdht_sink = { SINK_API_VERSION, "mine", open, write,
+ *                                  flush, close };
+ *
+ *  write() is given every report and every alert raised or cleared by the
+ *  rules (see rules.h), so it should check the event type.
+ *
+ *  SinkEvent holds SensorReport, PinStats and Alert by value, so a plugin is
+ *  only compatible with the layout it was built against. SINK_API_VERSION is
+ *  bumped whenever any of those structures change, and plugins built for an
+ *  older version are refused rather than handed misaligned fields:
+ *
+ *      2   alerts
+ *      3   pin health in the report and the statistics
+ *      4   the sensor group, fused values and confidence in the report
+ *      5   the Kalman estimate and forecast in the report, the filters in the
+ *          statistics
+ *      6   the detected sensor model in the statistics
+ *      7   perf event counts in the report and the statistics
+ *      8   the GPIO backend in the statistics
+ *
+ *  All callbacks of a sink are called from that sink's worker thread only.
+ *------------------------------------------------------------------------------
+ *                   Kris Dunning ippie52@gmail.com 2016.
+ *------------------------------------------------------------------------------
+ */
+#pragma once
+
+#include <stdio.h>
+
+#include "output.h"
+#include "stats.h"
+
+#define SINK_API_VERSION    8
+#define SINK_SYMBOL         "kdht_sink"
+#define SINK_MASK_ALL       (~0U)
+
+/******************************************************************************/
+/** What to do when a sink's queue is full
+ */
+typedef enum SinkPolicies
+{
+    SINK_POLICY_DROP,   /*!< Drop the event and count it              */
+    SINK_POLICY_BLOCK   /*!< Wait for the sink to catch up            */
+} SinkPolicy;
+
+/******************************************************************************/
+/** The events passed to a sink
+ */
+typedef enum SinkEventTypes
+{
+    SINK_EVENT_REPORT,      /*!< A pin has been read                  */
+    SINK_EVENT_CYCLE_END,   /*!< All pins in the cycle have been read */
+    SINK_EVENT_ALERT,       /*!< A rule has been raised or cleared    */
+    SINK_EVENT_STOP         /*!< Internal, stops the worker           */
+} SinkEventType;
+
+typedef struct SinkEvents
+{
+    SinkEventType type;     /*!< The event type                         */
+    SensorReport report;    /*!< The report, for SINK_EVENT_REPORT      */
+    PinStats stats;         /*!< The pin statistics after the report    */
+    Alert alert;            /*!< The alert, for SINK_EVENT_ALERT        */
+} SinkEvent;
+
+/******************************************************************************/
+/** The sink callbacks, as implemented by built in sinks and plugins
+ */
+typedef struct SinkOperations
+{
+    int version;                                    /*!< SINK_API_VERSION       */
+    const char *name;                               /*!< Used in metrics        */
+    void *(*open)(const char *args);                /*!< Plugins only, NULL on failure */
+    void (*write)(void *context, const SinkEvent *event); /*!< Report or alert  */
+    void (*flush)(void *context);                   /*!< End of cycle, optional */
+    void (*close)(void *context);                   /*!< Shut down, optional    */
+} SinkOps;
+
+int sink_add(const SinkOps *ops, void *context, const SinkPolicy policy);
+int sink_load(const char *spec, const SinkPolicy policy);
+int parse_sink_policy(const char *name, SinkPolicy *policy);
+int sink_find(const char *name);
+void sink_publish_report(const SensorReport *report, const PinStats *stats,
+    const unsigned int mask);
+void sink_publish_alert(const Alert *alert, const unsigned int mask);
+void sink_publish_cycle_end(void);
+void sink_shutdown(void);
+int sink_write_prometheus(const char *directory);
@@ -0,0 +1,638 @@
+/*------------------------------------------------------------------------------
+ *! \file   stats.c
+ *! \brief  Persistent per pin read statistics and the Prometheus textfile
+ *          export of them.
+ *
+ *  The statistics are kept in /tmp/dhtstats.<pin> next to the stored reading,
+ *  so the counters carry on across separate runs. The textfile is written
+ *  atomically after each read, scrapes never touch the sensor.
+ *------------------------------------------------------------------------------
+ *                   Kris Dunning ippie52@gmail.com 2016.
+ *------------------------------------------------------------------------------
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glob.h>
+
+#include "stats.h"
+#include "locking.h"
+#include "settings.h"
+
+#define MAX_STATS_PATH_LENGTH   160U
+#define MAX_STATS_LINE_LENGTH   512U
+#define STATS_FILE_PREFIX       "/tmp/dhtstats."
+
+/* Upper bounds of the latency buckets, in microseconds */
+static const long LATENCY_BOUNDS[HISTOGRAM_BUCKETS] =
+{
+    1000L, 5000L, 10000L, 25000L, 50000L, 100000L,
+    250000L, 500000L, 1000000L, 2500000L, 5000000L, 10000000L
+};
+
+/* Upper bounds of the attempts per successful read buckets */
+static const long ATTEMPT_BOUNDS[HISTOGRAM_BUCKETS] =
+{
+    1L, 2L, 3L, 4L, 5L, 10L, 15L, 20L, 30L, 50L, 75L, 100L
+};
+
+static const char *PHASE_NAMES[PHASE_COUNT] =
+{
+    "handshake", "capture", "retry_wait", "total"
+};
+
+/*******************************************************************************
+ *  \brief  Adds an observation to the histogram.
+ */
+static void observe
+(
+    Histogram *histogram,   /*!<INOUT - The histogram to add to     */
+    const long *bounds,     /*!<IN    - The bucket upper bounds     */
+    const long value        /*!<IN    - The value observed          */
+)
+{
+    int bucket = 0;
+    while (bucket < HISTOGRAM_BUCKETS && value > bounds[bucket])
+    {
+        ++bucket;
+    }
+    ++histogram->counts[bucket];
+    histogram->sum += (double)value;
+}
+
+/*******************************************************************************
+ *  \brief  Writes a histogram to the statistics file.
+ */
+static void save_histogram
+(
+    FILE *fp,                       /*!<IN - The file to write to       */
+    const char *name,               /*!<IN - The histogram name         */
+    const Histogram *histogram      /*!<IN - The histogram to write     */
+)
+{
+    int i;
+    fprintf(fp, "%s %.0f", name, histogram->sum);
+    for (i = 0; i <= HISTOGRAM_BUCKETS; ++i)
+    {
+        fprintf(fp, " %lu", histogram->counts[i]);
+    }
+    fprintf(fp, "\n");
+}
+
+/*******************************************************************************
+ *  \brief  Reads a histogram from a line of the statistics file.
+ */
+static void load_histogram
+(
+    const char *line,       /*!<IN  - The values following the name */
+    Histogram *histogram    /*!<OUT - The histogram to fill         */
+)
+{
+    char *end;
+    int i;
+    histogram->sum = strtod(line, &end);
+    for (i = 0; i <= HISTOGRAM_BUCKETS; ++i)
+    {
+        line = end;
+        histogram->counts[i] = strtoul(line, &end, 10);
+    }
+}
+
+/*******************************************************************************
+ *  \brief  Reads a list of counters from a line of the statistics file.
+ */
+static void load_counters
+(
+    const char *line,           /*!<IN  - The values following the name */
+    unsigned long *counters,    /*!<OUT - The counters to fill          */
+    const int count             /*!<IN  - The number of counters        */
+)
+{
+    char *end;
+    int i;
+    for (i = 0; i < count; ++i)
+    {
+        counters[i] = strtoul(line, &end, 10);
+        line = end;
+    }
+}
+
+/*******************************************************************************
+ *  \brief  Reads a result's capture event counts from a line of the
+ *          statistics file.
+ */
+static void load_perf
+(
+    const char *line,       /*!<IN  - The values following the name */
+    uint64_t *counts        /*!<OUT - The counts to fill            */
+)
+{
+    char *end;
+    int i;
+    for (i = 0; i < PERF_EVENT_COUNT; ++i)
+    {
+        counts[i] = (uint64_t)strtoull(line, &end, 10);
+        line = end;
+    }
+}
+
+/*******************************************************************************
+ *  \brief  Writes a Kalman filter to the statistics file, if it has readings.
+ */
+static void save_filter
+(
+    FILE *fp,                       /*!<IN - The file to write to       */
+    const char *name,               /*!<IN - The filter name            */
+    const KalmanFilter *filter      /*!<IN - The filter to write        */
+)
+{
+    if (filter->ready)
+    {
+        fprintf(fp, "%s %.3f %.4f %.9g %.9g %.9g %.9g %.9g %.4f\n", name, filter->time,
+            filter->level, filter->rate, filter->p[0], filter->p[1], filter->p[2],
+            filter->q, filter->nis);
+    }
+}
+
+/*******************************************************************************
+ *  \brief  Reads a Kalman filter from a line of the statistics file, leaving
+ *          it without readings if the line is not valid.
+ */
+static void load_filter
+(
+    const char *line,       /*!<IN    - The values following the name */
+    KalmanFilter *filter    /*!<INOUT - The filter to fill            */
+)
+{
+    KalmanFilter loaded = *filter;
+    if (8 == sscanf(line, "%lf %f %f %f %f %f %f %f", &loaded.time, &loaded.level,
+        &loaded.rate, &loaded.p[0], &loaded.p[1], &loaded.p[2], &loaded.q, &loaded.nis))
+    {
+        loaded.ready = 1;
+        *filter = loaded;
+    }
+}
+
+/*******************************************************************************
+ *  \brief  Gets the statistics file name for the pin.
+ */
+static void get_stats_file_name
+(
+    const int pin,          /*!<IN  - The sensor pin                */
+    char *buffer,           /*!<OUT - The buffer to write to        */
+    const size_t size       /*!<IN  - The size of the buffer        */
+)
+{
+    snprintf(buffer, size, STATS_FILE_PREFIX "%d", pin);
+}
+
+/*******************************************************************************
+ *  \brief  Loads the statistics for the pin, starting from zero if none have
+ *          been saved.
+ */
+void stats_load
+(
+    const int pin,          /*!<IN  - The sensor pin                */
+    PinStats *stats         /*!<OUT - The statistics to fill        */
+)
+{
+    char filename[MAX_STATS_PATH_LENGTH];
+    char line[MAX_STATS_LINE_LENGTH];
+    char name[32];
+    int offset;
+    int phase;
+    int i;
+    FILE *fp;
+
+    memset(stats, 0, sizeof(*stats));
+    stats->pin = pin;
+    stats->last.result = RESULT_INVALID;
+    stats->model = MODEL_AUTO;
+    stats->backend = GPIO_AUTO;
+    health_init(&stats->health);
+    tracker_init(&stats->tracker);
+
+    get_stats_file_name(pin, filename, sizeof(filename));
+    fp = fopen(filename, "r");
+    if (NULL == fp)
+    {
+        return;
+    }
+    while (NULL != fgets(line, sizeof(line), fp))
+    {
+        if (1 != sscanf(line, "%31s %n", name, &offset))
+        {
+            continue;
+        }
+        if (0 == strcmp(name, "reads"))
+        {
+            load_counters(line + offset, stats->reads, RESULT_COUNT);
+        }
+        else if (0 == strcmp(name, "attempts"))
+        {
+            load_counters(line + offset, stats->attempts, RESULT_COUNT);
+        }
+        else if (0 == strcmp(name, "consecutive_failures"))
+        {
+            load_counters(line + offset, &stats->consecutive_failures, 1);
+        }
+        else if (0 == strcmp(name, "attempts_per_success"))
+        {
+            load_histogram(line + offset, &stats->attempts_per_success);
+        }
+        else if (0 == strcmp(name, "health"))
+        {
+            PinHealth *health = &stats->health;
+            if (7 != sscanf(line + offset, "%lu %f %f %f %f %f %f", &health->samples,
+                &health->rates[HEALTH_BAD_DATA], &health->rates[HEALTH_ALL_ZERO],
+                &health->rates[HEALTH_INCONSISTENT], &health->rates[HEALTH_TIMEOUT],
+                &health->attempts, &health->margin))
+            {
+                health_init(health);
+            }
+        }
+        else if (0 == strcmp(name, "perf_events"))
+        {
+            stats->perf_mask = (unsigned int)strtoul(line + offset, NULL, 10);
+        }
+        else if (0 == strncmp(name, "perf_", 5))
+        {
+            for (i = 0; i < RESULT_COUNT; ++i)
+            {
+                if (0 == strcmp(name + 5, get_result_name((SensorReadingResults)i)))
+                {
+                    load_perf(line + offset, stats->perf[i]);
+                }
+            }
+        }
+        else if (0 == strcmp(name, "model"))
+        {
+            char model[16];
+            if (1 != sscanf(line + offset, "%15s", model) ||
+                !parse_model(model, &stats->model))
+            {
+                stats->model = MODEL_AUTO;
+            }
+        }
+        else if (0 == strcmp(name, "backend"))
+        {
+            char backend[16];
+            if (1 != sscanf(line + offset, "%15s", backend) ||
+                !parse_gpio_backend(backend, &stats->backend))
+            {
+                stats->backend = GPIO_AUTO;
+            }
+        }
+        else if (0 == strcmp(name, "kalman_temperature"))
+        {
+            load_filter(line + offset, &stats->tracker.temperature);
+        }
+        else if (0 == strcmp(name, "kalman_humidity"))
+        {
+            load_filter(line + offset, &stats->tracker.humidity);
+        }
+        else if (0 == strcmp(name, "last"))
+        {
+            long when = 0;
+            if (3 == sscanf(line + offset, "%ld %f %f", &when,
+                &stats->last.temperature, &stats->last.humidity))
+            {
+                stats->last.result = RESULT_OK;
+                stats->last_time = (time_t)when;
+            }
+        }
+        else
+        {
+            for (phase = 0; phase < PHASE_COUNT; ++phase)
+            {
+                if (0 == strncmp(name, "phase_", 6) &&
+                    0 == strcmp(name + 6, PHASE_NAMES[phase]))
+                {
+                    load_histogram(line + offset, &stats->phases[phase]);
+                }
+            }
+        }
+    }
+    fclose(fp);
+}
+
+/*******************************************************************************
+ *  \brief  Saves the statistics for the pin. The file is written beside the
+ *          old one and renamed over it, so other processes reading it, and
+ *          the next run after a crash, never see it half written.
+ *  \return Zero if saving fails, otherwise 1.
+ */
+int stats_save
+(
+    const PinStats *stats   /*!<IN - The statistics to save */
+)
+{
+    char filename[MAX_STATS_PATH_LENGTH];
+    char temp[MAX_STATS_PATH_LENGTH + 4];
+    char name[32];
+    int i;
+    int j;
+    FILE *fp;
+
+    get_stats_file_name(stats->pin, filename, sizeof(filename));
+    snprintf(temp, sizeof(temp), "%s.tmp", filename);
+    fp = fopen(temp, "w");
+    if (NULL == fp)
+    {
+        fprintf(stderr, "Failed to open file %s in mode \"w\".\n", temp);
+        return 0;
+    }
+    fprintf(fp, "reads");
+    for (i = 0; i < RESULT_COUNT; ++i)
+    {
+        fprintf(fp, " %lu", stats->reads[i]);
+    }
+    fprintf(fp, "\nattempts");
+    for (i = 0; i < RESULT_COUNT; ++i)
+    {
+        fprintf(fp, " %lu", stats->attempts[i]);
+    }
+    fprintf(fp, "\nconsecutive_failures %lu\n", stats->consecutive_failures);
+    save_histogram(fp, "attempts_per_success", &stats->attempts_per_success);
+    for (i = 0; i < PHASE_COUNT; ++i)
+    {
+        snprintf(name, sizeof(name), "phase_%s", PHASE_NAMES[i]);
+        save_histogram(fp, name, &stats->phases[i]);
+    }
+    fprintf(fp, "health %lu %.5f %.5f %.5f %.5f %.3f %.4f\n", stats->health.samples,
+        stats->health.rates[HEALTH_BAD_DATA], stats->health.rates[HEALTH_ALL_ZERO],
+        stats->health.rates[HEALTH_INCONSISTENT], stats->health.rates[HEALTH_TIMEOUT],
+        stats->health.attempts, stats->health.margin);
+    if (0 != stats->perf_mask)
+    {
+        fprintf(fp, "perf_events %u\n", stats->perf_mask);
+        for (i = 0; i < RESULT_COUNT; ++i)
+        {
+            fprintf(fp, "perf_%s", get_result_name((SensorReadingResults)i));
+            for (j = 0; j < PERF_EVENT_COUNT; ++j)
+            {
+                fprintf(fp, " %llu", (unsigned long long)stats->perf[i][j]);
+            }
+            fprintf(fp, "\n");
+        }
+    }
+    if (MODEL_AUTO != stats->model)
+    {
+        fprintf(fp, "model %s\n", get_model_name(stats->model));
+    }
+    if (GPIO_AUTO != stats->backend)
+    {
+        fprintf(fp, "backend %s\n", get_gpio_backend_name(stats->backend));
+    }
+    save_filter(fp, "kalman_temperature", &stats->tracker.temperature);
+    save_filter(fp, "kalman_humidity", &stats->tracker.humidity);
+    if (RESULT_OK == stats->last.result)
+    {
+        fprintf(fp, "last %ld %.1f %.1f\n", (long)stats->last_time,
+            stats->last.temperature, stats->last.humidity);
+    }
+    if (0 != fclose(fp) || 0 != rename(temp, filename))
+    {
+        fprintf(stderr, "Failed to replace %s\n", filename);
+        return 0;
+    }
+    return 1;
+}
+
+/*******************************************************************************
+ *  \brief  Adds the outcome of a read to the statistics.
+ */
+void stats_update
+(
+    PinStats *stats,            /*!<INOUT - The statistics to update    */
+    const SensorReport *report  /*!<IN    - The outcome of the read     */
+)
+{
+    int i;
+    ++stats->reads[report->values.result];
+    for (i = 0; i < RESULT_COUNT; ++i)
+    {
+        stats->attempts[i] += (unsigned long)report->outcomes[i];
+    }
+    for (i = 0; i < PHASE_COUNT; ++i)
+    {
+        observe(&stats->phases[i], LATENCY_BOUNDS, report->phase_us[i]);
+    }
+    health_update(&stats->health, report);
+    stats->perf_mask |= report->perf_mask;
+    for (i = 0; i < RESULT_COUNT; ++i)
+    {
+        int j;
+        for (j = 0; j < PERF_EVENT_COUNT; ++j)
+        {
+            stats->perf[i][j] += report->perf[i][j];
+        }
+    }
+
+    if (RESULT_OK == report->values.result)
+    {
+        observe(&stats->attempts_per_success, ATTEMPT_BOUNDS, report->attempts);
+        stats->consecutive_failures = 0;
+        stats->last = report->values;
+        stats->last_time = report->timestamp.tv_sec;
+    }
+    else
+    {
+        ++stats->consecutive_failures;
+    }
+}
+
+/*******************************************************************************
+ *  \brief  Writes a Prometheus histogram, with the bounds scaled to the unit
+ *          exported.
+ */
+static void write_histogram
+(
+    FILE *fp,                       /*!<IN - The file to write to               */
+    const char *name,               /*!<IN - The metric name                    */
+    const char *labels,             /*!<IN - The labels, without braces         */
+    const Histogram *histogram,     /*!<IN - The histogram to write             */
+    const long *bounds,             /*!<IN - The bucket upper bounds            */
+    const double scale              /*!<IN - The scale from bounds to the unit  */
+)
+{
+    unsigned long cumulative = 0;
+    int i;
+    for (i = 0; i < HISTOGRAM_BUCKETS; ++i)
+    {
+        cumulative += histogram->counts[i];
+        fprintf(fp, "%s_bucket{%s,le=\"%g\"} %lu\n", name, labels,
+            (double)bounds[i] * scale, cumulative);
+    }
+    cumulative += histogram->counts[HISTOGRAM_BUCKETS];
+    fprintf(fp, "%s_bucket{%s,le=\"+Inf\"} %lu\n", name, labels, cumulative);
+    fprintf(fp, "%s_sum{%s} %g\n", name, labels, histogram->sum * scale);
+    fprintf(fp, "%s_count{%s} %lu\n", name, labels, cumulative);
+}
+
+/*******************************************************************************
+ *  \brief  Writes the statistics as a node-exporter textfile, kdht_<pin>.prom
+ *          in the given directory. The file is replaced atomically.
+ *  \return Zero if writing fails, otherwise 1.
+ */
+int stats_write_prometheus
+(
+    const char *directory,  /*!<IN - The textfile collector directory  */
+    const PinStats *stats   /*!<IN - The statistics to write            */
+)
+{
+    char filename[MAX_STATS_PATH_LENGTH];
+    char temp[MAX_STATS_PATH_LENGTH + 4];
+    char labels[64];
+    int i;
+    FILE *fp;
+
+    snprintf(filename, sizeof(filename), "%s/kdht_%d.prom", directory, stats->pin);
+    snprintf(temp, sizeof(temp), "%s.tmp", filename);
+    fp = fopen(temp, "w");
+    if (NULL == fp)
+    {
+        fprintf(stderr, "Failed to open file %s in mode \"w\".\n", temp);
+        return 0;
+    }
+
+    if (RESULT_OK == stats->last.result)
+    {
+        fprintf(fp, "# HELP kdht_temperature_celsius Last valid temperature read.\n");
+        fprintf(fp, "# TYPE kdht_temperature_celsius gauge\n");
+        fprintf(fp, "kdht_temperature_celsius{pin=\"%d\"} %.1f\n",
+            stats->pin, stats->last.temperature);
+        fprintf(fp, "# HELP kdht_humidity_percent Last valid relative humidity read.\n");
+        fprintf(fp, "# TYPE kdht_humidity_percent gauge\n");
+        fprintf(fp, "kdht_humidity_percent{pin=\"%d\"} %.1f\n",
+            stats->pin, stats->last.humidity);
+        fprintf(fp, "# HELP kdht_last_valid_read_timestamp_seconds Time of the last valid read.\n");
+        fprintf(fp, "# TYPE kdht_last_valid_read_timestamp_seconds gauge\n");
+        fprintf(fp, "kdht_last_valid_read_timestamp_seconds{pin=\"%d\"} %ld\n",
+            stats->pin, (long)stats->last_time);
+    }
+
+    fprintf(fp, "# HELP kdht_reads_total Reads by final result.\n");
+    fprintf(fp, "# TYPE kdht_reads_total counter\n");
+    for (i = 0; i < RESULT_COUNT; ++i)
+    {
+        fprintf(fp, "kdht_reads_total{pin=\"%d\",result=\"%s\"} %lu\n", stats->pin,
+            get_result_name((SensorReadingResults)i), stats->reads[i]);
+    }
+    fprintf(fp, "# HELP kdht_attempts_total Read attempts by result.\n");
+    fprintf(fp, "# TYPE kdht_attempts_total counter\n");
+    for (i = 0; i < RESULT_COUNT; ++i)
+    {
+        fprintf(fp, "kdht_attempts_total{pin=\"%d\",result=\"%s\"} %lu\n", stats->pin,
+            get_result_name((SensorReadingResults)i), stats->attempts[i]);
+    }
+    fprintf(fp, "# HELP kdht_consecutive_failures Reads in a row without valid values.\n");
+    fprintf(fp, "# TYPE kdht_consecutive_failures gauge\n");
+    fprintf(fp, "kdht_consecutive_failures{pin=\"%d\"} %lu\n",
+        stats->pin, stats->consecutive_failures);
+    fprintf(fp, "# HELP kdht_lock_contention_total Runs turned away by the pin lock.\n");
+    fprintf(fp, "# TYPE kdht_lock_contention_total counter\n");
+    fprintf(fp, "kdht_lock_contention_total{pin=\"%d\"} %ld\n",
+        stats->pin, get_lock_contention_count(stats->pin));
+
+    if (stats->health.samples > 0)
+    {
+        fprintf(fp, "# HELP kdht_health_score Sensor health, 0 failing to 100 healthy.\n");
+        fprintf(fp, "# TYPE kdht_health_score gauge\n");
+        fprintf(fp, "kdht_health_score{pin=\"%d\"} %d\n",
+            stats->pin, health_score(&stats->health));
+        fprintf(fp, "# HELP kdht_health_failure_ratio Recent failed attempts by kind, per attempt.\n");
+        fprintf(fp, "# TYPE kdht_health_failure_ratio gauge\n");
+        fprintf(fp, "kdht_health_failure_ratio{pin=\"%d\",kind=\"bad_data\"} %g\n",
+            stats->pin, stats->health.rates[HEALTH_BAD_DATA]);
+        fprintf(fp, "kdht_health_failure_ratio{pin=\"%d\",kind=\"all_zero\"} %g\n",
+            stats->pin, stats->health.rates[HEALTH_ALL_ZERO]);
+        fprintf(fp, "kdht_health_failure_ratio{pin=\"%d\",kind=\"inconsistent\"} %g\n",
+            stats->pin, stats->health.rates[HEALTH_INCONSISTENT]);
+        fprintf(fp, "kdht_health_failure_ratio{pin=\"%d\",kind=\"timeout\"} %g\n",
+            stats->pin, stats->health.rates[HEALTH_TIMEOUT]);
+        if (stats->health.margin >= 0.0f)
+        {
+            fprintf(fp, "# HELP kdht_health_bit_margin Recent data bit timing margin, of the threshold.\n");
+            fprintf(fp, "# TYPE kdht_health_bit_margin gauge\n");
+            fprintf(fp, "kdht_health_bit_margin{pin=\"%d\"} %g\n",
+                stats->pin, stats->health.margin);
+        }
+    }
+
+    if (0 != stats->perf_mask)
+    {
+        fprintf(fp, "# HELP kdht_capture_events_total Events counted over the captures, by attempt result.\n");
+        fprintf(fp, "# TYPE kdht_capture_events_total counter\n");
+        for (i = 0; i < PERF_EVENT_COUNT; ++i)
+        {
+            int j;
+            if (0 == (stats->perf_mask & (1U << i)))
+            {
+                continue;
+            }
+            for (j = 0; j < RESULT_COUNT; ++j)
+            {
+                fprintf(fp, "kdht_capture_events_total{pin=\"%d\",result=\"%s\",event=\"%s\"} %llu\n",
+                    stats->pin, get_result_name((SensorReadingResults)j),
+                    perf_event_name((PerfEvent)i), (unsigned long long)stats->perf[j][i]);
+            }
+        }
+    }
+
+    fprintf(fp, "# HELP kdht_attempts_per_success Attempts needed for each valid read.\n");
+    fprintf(fp, "# TYPE kdht_attempts_per_success histogram\n");
+    snprintf(labels, sizeof(labels), "pin=\"%d\"", stats->pin);
+    write_histogram(fp, "kdht_attempts_per_success", labels,
+        &stats->attempts_per_success, ATTEMPT_BOUNDS, 1.0);
+
+    fprintf(fp, "# HELP kdht_read_phase_seconds Time spent in each phase of a read.\n");
+    fprintf(fp, "# TYPE kdht_read_phase_seconds histogram\n");
+    for (i = 0; i < PHASE_COUNT; ++i)
+    {
+        snprintf(labels, sizeof(labels), "pin=\"%d\",phase=\"%s\"",
+            stats->pin, PHASE_NAMES[i]);
+        write_histogram(fp, "kdht_read_phase_seconds", labels,
+            &stats->phases[i], LATENCY_BOUNDS, 1e-6);
+    }
+
+    if (0 != fclose(fp) || 0 != rename(temp, filename))
+    {
+        fprintf(stderr, "Failed to replace %s\n", filename);
+        return 0;
+    }
+    return 1;
+}
+
+/*******************************************************************************
+ *  \brief  Finds the pins that have saved statistics.
+ *  \return The number of pins found, at most the size given.
+ */
+int stats_find_pins
+(
+    int *pins,          /*!<OUT - The pins found                */
+    const int size      /*!<IN  - The number of pins to find    */
+)
+{
+    const size_t prefix = strlen(STATS_FILE_PREFIX);
+    glob_t found;
+    char *end;
+    size_t i;
+    int count = 0;
+
+    if (0 != glob(STATS_FILE_PREFIX "*", 0, NULL, &found))
+    {
+        return 0;
+    }
+    for (i = 0; i < found.gl_pathc && count < size; ++i)
+    {
+        const long pin = strtol(found.gl_pathv[i] + prefix, &end, 10);
+        if ('\0' == *end && end != found.gl_pathv[i] + prefix)
+        {
+            pins[count++] = (int)pin;
+        }
+    }
+    globfree(&found);
+    return count;
+}
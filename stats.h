@@ -0,0 +1,55 @@
+/*------------------------------------------------------------------------------
+ *! \file   stats.h
+ *! \brief  Persistent per pin read statistics and the Prometheus textfile
+ *          export of them.
+ *------------------------------------------------------------------------------
+ *                   Kris Dunning ippie52@gmail.com 2016.
+ *------------------------------------------------------------------------------
+ */
+#pragma once
+
+#include <time.h>
+
+#include "sensor.h"
+#include "output.h"
+#include "health.h"
+#include "kalman.h"
+#include "gpio.h"
+
+#define HISTOGRAM_BUCKETS   12
+
+/******************************************************************************/
+/** A cumulative histogram with fixed bucket bounds
+ */
+typedef struct Histograms
+{
+    unsigned long counts[HISTOGRAM_BUCKETS + 1];    /*!< Per bucket, last is +Inf */
+    double sum;                                     /*!< Sum of observations      */
+} Histogram;
+
+/******************************************************************************/
+/** Statistics gathered for a single pin, kept across runs
+ */
+typedef struct PinStatistics
+{
+    int pin;                                    /*!< The sensor pin             */
+    unsigned long reads[RESULT_COUNT];          /*!< Final result of each read  */
+    unsigned long attempts[RESULT_COUNT];       /*!< Result of each attempt     */
+    unsigned long consecutive_failures;         /*!< Failed reads in a row      */
+    Histogram phases[PHASE_COUNT];              /*!< Time spent in each phase   */
+    Histogram attempts_per_success;             /*!< Attempts for OK reads      */
+    PinHealth health;                           /*!< Recent failures and margin */
+    PinTracker tracker;                         /*!< Filters of the raw values  */
+    SensorModel model;                          /*!< Detected model, if known   */
+    GpioBackend backend;                        /*!< Backend chosen, if auto    */
+    unsigned int perf_mask;                     /*!< Events ever counted        */
+    uint64_t perf[RESULT_COUNT][PERF_EVENT_COUNT]; /*!< Capture events by result */
+    SensorValues last;                          /*!< The last valid values      */
+    time_t last_time;                           /*!< When last was read         */
+} PinStats;
+
+void stats_load(const int pin, PinStats *stats);
+int stats_save(const PinStats *stats);
+void stats_update(PinStats *stats, const SensorReport *report);
+int stats_write_prometheus(const char *directory, const PinStats *stats);
+int stats_find_pins(int *pins, const int size);
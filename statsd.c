@@ -0,0 +1,251 @@
+/*------------------------------------------------------------------------------
+ *! \file   statsd.c
+ *! \brief  Non-blocking StatsD metrics emitter over UDP.
+ *
+ *  Metrics are coalesced into as few datagrams as possible and sent with a
+ *  single sendmmsg() call on a non-blocking socket. If the socket buffer is
+ *  full the packets are dropped rather than waited on, the sensor timing
+ *  always comes first.
+ *------------------------------------------------------------------------------
+ *                   Kris Dunning ippie52@gmail.com 2016.
+ *------------------------------------------------------------------------------
+ */
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "statsd.h"
+
+#define STATSD_DEFAULT_PORT "8125"
+#define STATSD_MAX_LINE     128U
+
+/*******************************************************************************
+ *  \brief  Sends all pending packets without blocking. Anything the socket
+ *          will not take straight away is dropped.
+ */
+void statsd_flush
+(
+    StatsdClient *client    /*!<INOUT - The client to flush */
+)
+{
+    struct mmsghdr messages[STATSD_MAX_PACKETS];
+    struct iovec vectors[STATSD_MAX_PACKETS];
+    unsigned int i;
+    int sent;
+
+    if (client->fd < 0 || 0 == client->count)
+    {
+        return;
+    }
+    memset(messages, 0, sizeof(messages));
+    for (i = 0; i < client->count; ++i)
+    {
+        vectors[i].iov_base = client->packets[i];
+        vectors[i].iov_len = client->lengths[i];
+        messages[i].msg_hdr.msg_iov = &vectors[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+    }
+    sent = sendmmsg(client->fd, messages, client->count, MSG_DONTWAIT);
+    if (sent < 0)
+    {
+        /* EAGAIN, or ECONNREFUSED from a previous packet; nothing to wait for */
+        sent = 0;
+    }
+    client->dropped += client->count - (unsigned int)sent;
+    client->count = 0;
+}
+
+/*******************************************************************************
+ *  \brief  Adds a single metric line, starting a new packet when the current
+ *          one is full.
+ */
+static void add_metric
+(
+    StatsdClient *client,   /*!<INOUT - The client to add to        */
+    const char *fmt,        /*!<IN    - The printf style metric     */
+    ...
+)
+{
+    char line[STATSD_MAX_LINE];
+    va_list args;
+    size_t length;
+    int written;
+
+    va_start(args, fmt);
+    written = vsnprintf(line, sizeof(line), fmt, args);
+    va_end(args);
+    if (written <= 0 || (size_t)written >= sizeof(line))
+    {
+        return;
+    }
+    length = (size_t)written;
+
+    if (0 == client->count ||
+        client->lengths[client->count - 1] + length + 1 > STATSD_PACKET_LENGTH)
+    {
+        if (STATSD_MAX_PACKETS == client->count)
+        {
+            statsd_flush(client);
+        }
+        client->lengths[client->count++] = 0;
+    }
+    else
+    {
+        client->packets[client->count - 1][client->lengths[client->count - 1]++] = '\n';
+    }
+    memcpy(client->packets[client->count - 1] + client->lengths[client->count - 1],
+        line, length);
+    client->lengths[client->count - 1] += length;
+}
+
+/*******************************************************************************
+ *  \brief  Opens the non-blocking UDP socket to the StatsD server.
+ *  \return Zero if the server is not valid, otherwise 1.
+ */
+int statsd_init
+(
+    StatsdClient *client,   /*!<OUT - The client to initialise          */
+    const char *server,     /*!<IN  - The StatsD server as host[:port]  */
+    const char *prefix      /*!<IN  - The metric name prefix            */
+)
+{
+    char host[64];
+    const char *colon = strrchr(server, ':');
+    size_t host_length = colon ? (size_t)(colon - server) : strlen(server);
+    struct addrinfo hints;
+    struct addrinfo *address = NULL;
+
+    memset(client, 0, sizeof(*client));
+    client->fd = -1;
+    snprintf(client->prefix, sizeof(client->prefix), "%s", prefix);
+    if (0 == host_length || host_length >= sizeof(host))
+    {
+        return 0;
+    }
+    memcpy(host, server, host_length);
+    host[host_length] = '\0';
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    if (0 != getaddrinfo(host, colon ? colon + 1 : STATSD_DEFAULT_PORT, &hints, &address))
+    {
+        fprintf(stderr, "StatsD: Could not resolve %s\n", host);
+        return 0;
+    }
+    client->fd = socket(address->ai_family, address->ai_socktype | SOCK_NONBLOCK,
+        address->ai_protocol);
+    if (client->fd >= 0 && connect(client->fd, address->ai_addr, address->ai_addrlen) < 0)
+    {
+        close(client->fd);
+        client->fd = -1;
+    }
+    freeaddrinfo(address);
+    return client->fd >= 0;
+}
+
+/*******************************************************************************
+ *  \brief  Queues the metrics for a single report: gauges for the values,
+ *          counters for the attempts and each attempt outcome, and a timer
+ *          for the read latency.
+ */
+void statsd_report
+(
+    StatsdClient *client,           /*!<INOUT - The client to queue on  */
+    const SensorReport *report      /*!<IN    - The report to send      */
+)
+{
+    int result;
+    if (client->fd < 0)
+    {
+        return;
+    }
+    if (RESULT_OK == report->values.result)
+    {
+        add_metric(client, "%s.%d.temperature:%.1f|g", client->prefix,
+            report->pin, report->values.temperature);
+        add_metric(client, "%s.%d.humidity:%.1f|g", client->prefix,
+            report->pin, report->values.humidity);
+    }
+    add_metric(client, "%s.%d.attempts:%d|c", client->prefix, report->pin,
+        report->attempts);
+    for (result = RESULT_OK; result < RESULT_COUNT; ++result)
+    {
+        if (report->outcomes[result] > 0)
+        {
+            add_metric(client, "%s.%d.result.%s:%d|c", client->prefix,
+                report->pin, get_result_name((SensorReadingResults)result),
+                report->outcomes[result]);
+        }
+    }
+    add_metric(client, "%s.%d.latency:%.3f|ms", client->prefix, report->pin,
+        (double)report->latency_us / 1000.0);
+}
+
+/*******************************************************************************
+ *  \brief  Sends anything pending and closes the socket.
+ */
+void statsd_close
+(
+    StatsdClient *client    /*!<INOUT - The client to close */
+)
+{
+    statsd_flush(client);
+    if (client->fd >= 0)
+    {
+        close(client->fd);
+        client->fd = -1;
+    }
+}
+
+/*******************************************************************************
+ *  \brief  Sink callback, queues the metrics for a report. Alerts are left to
+ *          the other sinks.
+ */
+static void statsd_sink_write
+(
+    void *context,              /*!<INOUT - The StatsdClient        */
+    const SinkEvent *event      /*!<IN    - The report to send      */
+)
+{
+    if (SINK_EVENT_REPORT == event->type)
+    {
+        statsd_report((StatsdClient *)context, &event->report);
+    }
+}
+
+/*******************************************************************************
+ *  \brief  Sink callback, sends the metrics for the cycle.
+ */
+static void statsd_sink_flush
+(
+    void *context   /*!<INOUT - The StatsdClient    */
+)
+{
+    statsd_flush((StatsdClient *)context);
+}
+
+/*******************************************************************************
+ *  \brief  Sink callback, sends anything pending and closes the socket.
+ */
+static void statsd_sink_close
+(
+    void *context   /*!<INOUT - The StatsdClient    */
+)
+{
+    statsd_close((StatsdClient *)context);
+}
+
+const SinkOps statsd_sink =
+{
+    SINK_API_VERSION, "statsd", NULL, statsd_sink_write, statsd_sink_flush,
+    statsd_sink_close
+};
@@ -0,0 +1,38 @@
+/*------------------------------------------------------------------------------
+ *! \file   statsd.h
+ *! \brief  Non-blocking StatsD metrics emitter over UDP.
+ *------------------------------------------------------------------------------
+ *                   Kris Dunning ippie52@gmail.com 2016.
+ *------------------------------------------------------------------------------
+ */
+#pragma once
+
+#include <stddef.h>
+
+#include "output.h"
+#include "sink.h"
+
+#define STATSD_MAX_PREFIX_LENGTH    32U
+#define STATSD_PACKET_LENGTH        1432U
+#define STATSD_MAX_PACKETS          16U
+
+/******************************************************************************/
+/** StatsD socket and the packets waiting to be sent
+ */
+typedef struct StatsdClients
+{
+    int fd;                                     /*!< The UDP socket, -1 if none */
+    char prefix[STATSD_MAX_PREFIX_LENGTH];      /*!< The metric name prefix     */
+    char packets[STATSD_MAX_PACKETS][STATSD_PACKET_LENGTH]; /*!< Pending packets */
+    size_t lengths[STATSD_MAX_PACKETS];         /*!< Length of each packet      */
+    unsigned int count;                         /*!< Packets in use             */
+    unsigned long dropped;                      /*!< Packets dropped so far     */
+} StatsdClient;
+
+int statsd_init(StatsdClient *client, const char *server, const char *prefix);
+void statsd_report(StatsdClient *client, const SensorReport *report);
+void statsd_flush(StatsdClient *client);
+void statsd_close(StatsdClient *client);
+
+/* The StatsD sink, its context is an initialised StatsdClient */
+extern const SinkOps statsd_sink;
@@ -0,0 +1,139 @@
+/*------------------------------------------------------------------------------
+ *! \file   statsd_check.c
+ *! \brief  Checks the StatsD emitter against a UDP listener on loopback.
+ *
+ *  A report with known values is queued and flushed to a socket bound to
+ *  127.0.0.1, and each gauge, counter and timer line expected of it is
+ *  looked for in the datagrams received. Run by "make check".
+ *------------------------------------------------------------------------------
+ *                   Kris Dunning ippie52@gmail.com 2016.
+ *------------------------------------------------------------------------------
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "statsd.h"
+
+#define CHECK_WAIT_MS       500
+#define CHECK_MAX_RECEIVED  (STATSD_PACKET_LENGTH * STATSD_MAX_PACKETS)
+
+/* The lines the report below must produce */
+static const char *EXPECTED[] =
+{
+    "kdht.7.temperature:23.8|g",
+    "kdht.7.humidity:62.1|g",
+    "kdht.7.attempts:2|c",
+    "kdht.7.result.ok:1|c",
+    "kdht.7.result.bad_data:1|c",
+    "kdht.7.latency:12.345|ms",
+    NULL
+};
+
+/*******************************************************************************
+ *  \brief  Checks whether a whole line is in the text received.
+ *  \return Non zero if it is.
+ */
+static int has_line
+(
+    const char *received,   /*!< - The datagrams, newline separated */
+    const char *line        /*!< - The line to find                 */
+)
+{
+    const size_t length = strlen(line);
+    const char *found = received;
+
+    while (NULL != (found = strstr(found, line)))
+    {
+        if ((found == received || '\n' == found[-1]) &&
+            ('\0' == found[length] || '\n' == found[length]))
+        {
+            return 1;
+        }
+        ++found;
+    }
+    return 0;
+}
+
+/*******************************************************************************
+ *  \brief  Main function.
+ *  \return EXIT_SUCCESS if every line expected arrived.
+ */
+int main(void)
+{
+    static char received[CHECK_MAX_RECEIVED];
+    static StatsdClient client;
+    SensorReport report;
+    struct sockaddr_in address;
+    socklen_t address_length = sizeof(address);
+    struct pollfd listener;
+    char server[32];
+    size_t used = 0;
+    int failures = 0;
+    int i;
+
+    listener.fd = socket(AF_INET, SOCK_DGRAM, 0);
+    listener.events = POLLIN;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (listener.fd < 0 ||
+        bind(listener.fd, (struct sockaddr *)&address, sizeof(address)) < 0 ||
+        getsockname(listener.fd, (struct sockaddr *)&address, &address_length) < 0)
+    {
+        perror("Failed to set up the listener");
+        return EXIT_FAILURE;
+    }
+    snprintf(server, sizeof(server), "127.0.0.1:%d", ntohs(address.sin_port));
+    if (!statsd_init(&client, server, "kdht"))
+    {
+        fprintf(stderr, "Failed to set up the StatsD client for %s\n", server);
+        return EXIT_FAILURE;
+    }
+
+    memset(&report, 0, sizeof(report));
+    report.pin = 7;
+    report.values.result = RESULT_OK;
+    report.values.temperature = 23.8f;
+    report.values.humidity = 62.1f;
+    report.attempts = 2;
+    report.outcomes[RESULT_OK] = 1;
+    report.outcomes[RESULT_BAD_DATA] = 1;
+    report.latency_us = 12345;
+    statsd_report(&client, &report);
+    statsd_flush(&client);
+
+    while (poll(&listener, 1, CHECK_WAIT_MS) > 0 && used + 1 < sizeof(received))
+    {
+        const ssize_t length = recv(listener.fd, received + used,
+            sizeof(received) - used - 1, 0);
+        if (length <= 0)
+        {
+            break;
+        }
+        used += (size_t)length;
+        received[used++] = '\n';
+    }
+    received[(used < sizeof(received)) ? used : sizeof(received) - 1] = '\0';
+
+    for (i = 0; NULL != EXPECTED[i]; ++i)
+    {
+        const int found = has_line(received, EXPECTED[i]);
+        printf("%s: %s\n", found ? "PASS" : "FAIL", EXPECTED[i]);
+        failures += !found;
+    }
+    if (0 != failures)
+    {
+        printf("Received:\n%s", received);
+    }
+    statsd_close(&client);
+    close(listener.fd);
+    return (0 == failures) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,330 @@
+/*------------------------------------------------------------------------------
+ *! \file   stream.c
+ *! \brief  Streams readings to a kdht-aggregator over TCP or a Unix socket.
+ *
+ *  Each reading is sent as one line, the node name followed by the CSV report:
+ *
+ *      node,timestamp_ms,pin,result,attempts,latency_us,humidity,temperature
+ *
+ *  A send that succeeded is no proof the aggregator got it, so the last few
+ *  lines are sent again after every reconnect. The aggregator drops anything
+ *  it has already seen for that node and pin.
+ *------------------------------------------------------------------------------
+ *                   Kris Dunning ippie52@gmail.com 2016.
+ *------------------------------------------------------------------------------
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netdb.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "stream.h"
+
+#define STREAM_UNIX_PREFIX      "unix:"
+#define STREAM_MAX_ADDRESS      108U
+#define STREAM_MAX_NODE         32U
+#define STREAM_MAX_LINE         (STREAM_MAX_NODE + MAX_REPORT_LENGTH)
+#define STREAM_RESEND_LINES     16U
+
+/******************************************************************************/
+/** The stream sink state
+ */
+struct StreamSinks
+{
+    char address[STREAM_MAX_ADDRESS];                       /*!< Where to send  */
+    char node[STREAM_MAX_NODE];                             /*!< This node name */
+    int fd;                                                 /*!< -1 if closed   */
+    char lines[STREAM_RESEND_LINES][STREAM_MAX_LINE];       /*!< Recent lines   */
+    unsigned int next;                                      /*!< Lines written  */
+};
+
+/*******************************************************************************
+ *  \brief  Splits a host:port address. IPv6 hosts may be given in brackets.
+ *  \return Zero if the address is not valid, otherwise 1.
+ */
+static int split_address
+(
+    const char *address,    /*!<IN  - The host:port address     */
+    char *host,             /*!<OUT - STREAM_MAX_ADDRESS bytes  */
+    const char **port       /*!<OUT - Points into address       */
+)
+{
+    const char *colon = strrchr(address, ':');
+    size_t length;
+    if (NULL == colon)
+    {
+        return 0;
+    }
+    length = (size_t)(colon - address);
+    if ('[' == address[0] && length > 1 && ']' == address[length - 1])
+    {
+        ++address;
+        length -= 2;
+    }
+    if (length >= STREAM_MAX_ADDRESS)
+    {
+        return 0;
+    }
+    memcpy(host, address, length);
+    host[length] = '\0';
+    *port = colon + 1;
+    return 1;
+}
+
+/*******************************************************************************
+ *  \brief  Opens a socket for the address, "unix:<path>" or "host:port", and
+ *          either connects or binds and listens.
+ *  \return The socket, -1 on failure.
+ */
+static int open_socket
+(
+    const char *address,    /*!<IN - The address to use             */
+    const int listening     /*!<IN - Non zero to bind and listen    */
+)
+{
+    struct sockaddr_un local;
+    struct addrinfo hints;
+    struct addrinfo *addresses = NULL;
+    struct addrinfo *entry;
+    char host[STREAM_MAX_ADDRESS];
+    const char *port;
+    const int on = 1;
+    int fd = -1;
+
+    if (0 == strncmp(address, STREAM_UNIX_PREFIX, strlen(STREAM_UNIX_PREFIX)))
+    {
+        memset(&local, 0, sizeof(local));
+        local.sun_family = AF_UNIX;
+        snprintf(local.sun_path, sizeof(local.sun_path), "%s",
+            address + strlen(STREAM_UNIX_PREFIX));
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0)
+        {
+            return -1;
+        }
+        if (listening)
+        {
+            unlink(local.sun_path);
+            if (bind(fd, (struct sockaddr *)&local, sizeof(local)) < 0 ||
+                listen(fd, SOMAXCONN) < 0)
+            {
+                close(fd);
+                return -1;
+            }
+        }
+        else if (connect(fd, (struct sockaddr *)&local, sizeof(local)) < 0)
+        {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    if (!split_address(address, host, &port))
+    {
+        return -1;
+    }
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = listening ? AI_PASSIVE : 0;
+    if (0 != getaddrinfo(host[0] ? host : NULL, port, &hints, &addresses))
+    {
+        return -1;
+    }
+    for (entry = addresses; NULL != entry && fd < 0; entry = entry->ai_next)
+    {
+        fd = socket(entry->ai_family, entry->ai_socktype, entry->ai_protocol);
+        if (fd < 0)
+        {
+            continue;
+        }
+        if (listening)
+        {
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+            if (bind(fd, entry->ai_addr, entry->ai_addrlen) < 0 ||
+                listen(fd, SOMAXCONN) < 0)
+            {
+                close(fd);
+                fd = -1;
+            }
+        }
+        else if (connect(fd, entry->ai_addr, entry->ai_addrlen) < 0)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+    return fd;
+}
+
+/*******************************************************************************
+ *  \brief  Connects to a stream address, "unix:<path>" or "host:port".
+ *  \return The connected socket, -1 on failure.
+ */
+int stream_connect
+(
+    const char *address     /*!<IN - The address to connect to  */
+)
+{
+    return open_socket(address, 0);
+}
+
+/*******************************************************************************
+ *  \brief  Listens on a stream address, "unix:<path>" or "[host]:port".
+ *  \return The listening socket, -1 on failure.
+ */
+int stream_listen
+(
+    const char *address     /*!<IN - The address to listen on   */
+)
+{
+    return open_socket(address, 1);
+}
+
+/*******************************************************************************
+ *  \brief  Sends a whole line, dropping the connection on failure.
+ *  \return Zero on failure, otherwise 1.
+ */
+static int send_line
+(
+    StreamSink *sink,       /*!<INOUT - The sink to send with   */
+    const char *line        /*!<IN    - The line to send        */
+)
+{
+    size_t length = strlen(line);
+    while (length > 0)
+    {
+        ssize_t sent = send(sink->fd, line, length, MSG_NOSIGNAL);
+        if (sent < 0)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            close(sink->fd);
+            sink->fd = -1;
+            return 0;
+        }
+        line += sent;
+        length -= (size_t)sent;
+    }
+    return 1;
+}
+
+/*******************************************************************************
+ *  \brief  Connects if required, resending the recent lines on a new
+ *          connection.
+ *  \return Zero if not connected, otherwise 1.
+ */
+static int ensure_connected
+(
+    StreamSink *sink        /*!<INOUT - The sink to connect     */
+)
+{
+    unsigned int first;
+    unsigned int i;
+    if (sink->fd >= 0)
+    {
+        return 1;
+    }
+    sink->fd = stream_connect(sink->address);
+    if (sink->fd < 0)
+    {
+        return 0;
+    }
+    first = sink->next > STREAM_RESEND_LINES ? sink->next - STREAM_RESEND_LINES : 0;
+    for (i = first; i < sink->next && sink->fd >= 0; ++i)
+    {
+        send_line(sink, sink->lines[i % STREAM_RESEND_LINES]);
+    }
+    return sink->fd >= 0;
+}
+
+/*******************************************************************************
+ *  \brief  Sink callback, sends the report as a stream line. Alerts are not
+ *          streamed, the aggregator only takes readings.
+ */
+static void stream_sink_write
+(
+    void *context,              /*!<INOUT - The StreamSink      */
+    const SinkEvent *event      /*!<IN    - The report to send  */
+)
+{
+    StreamSink *sink = (StreamSink *)context;
+    char *line = sink->lines[sink->next % STREAM_RESEND_LINES];
+    int length;
+
+    if (SINK_EVENT_REPORT != event->type)
+    {
+        return;
+    }
+    length = snprintf(line, STREAM_MAX_LINE, "%s,", sink->node);
+
+    format_report(line + length, STREAM_MAX_LINE - (size_t)length, FORMAT_CSV,
+        &event->report);
+    ++sink->next;
+    /* A new connection sends the line with the others it resends */
+    if (sink->fd >= 0)
+    {
+        send_line(sink, line);
+    }
+    else
+    {
+        (void)ensure_connected(sink);
+    }
+}
+
+/*******************************************************************************
+ *  \brief  Sink callback, closes the connection.
+ */
+static void stream_sink_close
+(
+    void *context   /*!<INOUT - The StreamSink  */
+)
+{
+    StreamSink *sink = (StreamSink *)context;
+    if (sink->fd >= 0)
+    {
+        close(sink->fd);
+    }
+    free(sink);
+}
+
+const SinkOps stream_sink =
+{
+    SINK_API_VERSION, "stream", NULL, stream_sink_write, NULL, stream_sink_close
+};
+
+/*******************************************************************************
+ *  \brief  Creates the context for the stream sink. The first connection is
+ *          made with the first report.
+ *  \return The sink context, NULL if the node name is not valid.
+ */
+StreamSink *stream_sink_create
+(
+    const char *address,    /*!<IN - The aggregator address         */
+    const char *node        /*!<IN - This node's name               */
+)
+{
+    StreamSink *sink;
+    if (0 == node[0] || strlen(node) >= STREAM_MAX_NODE || NULL != strchr(node, ','))
+    {
+        return NULL;
+    }
+    sink = calloc(1, sizeof(*sink));
+    if (NULL != sink)
+    {
+        snprintf(sink->address, sizeof(sink->address), "%s", address);
+        snprintf(sink->node, sizeof(sink->node), "%s", node);
+        sink->fd = -1;
+    }
+    return sink;
+}
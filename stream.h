@@ -0,0 +1,18 @@
+/*------------------------------------------------------------------------------
+ *! \file   stream.h
+ *! \brief  Streams readings to a kdht-aggregator over TCP or a Unix socket.
+ *------------------------------------------------------------------------------
+ *                   Kris Dunning ippie52@gmail.com 2016.
+ *------------------------------------------------------------------------------
+ */
+#pragma once
+
+#include "sink.h"
+
+/* The stream sink, its context is a StreamSink from stream_sink_create() */
+typedef struct StreamSinks StreamSink;
+extern const SinkOps stream_sink;
+StreamSink *stream_sink_create(const char *address, const char *node);
+
+int stream_connect(const char *address);
+int stream_listen(const char *address);
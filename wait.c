@@ -0,0 +1,148 @@
+/*------------------------------------------------------------------------------
+ *! \file   wait.c
+ *! \brief  kdht-wait, prints a pin's next reading as soon as kdht publishes it.
+ *
+ *  A thin wrapper around kdht_wait_newer() for scripts, taking the place of
+ *  polling /tmp/dhtsensor.<pin> in a sleep loop.
+ *------------------------------------------------------------------------------
+ *                   Kris Dunning ippie52@gmail.com 2016.
+ *------------------------------------------------------------------------------
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "output.h"
+#include "shm.h"
+#include "config.h"
+
+/*******************************************************************************
+ *  \brief  Prints the usage information.
+ */
+static void print_usage
+(
+    const char *name    /*!< - The application name */
+)
+{
+    fprintf(stderr, "kdht-wait version %s\n\n", VERSION);
+    fprintf(stderr, "Usage: %s [options] <pin>\n\n", name);
+    fprintf(stderr, "Waits for kdht to publish a new reading for the pin and prints it.\n\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "\t--latest              Print the latest reading without waiting\n");
+    fprintf(stderr, "\t--follow              Keep printing every new reading\n");
+    fprintf(stderr, "\t--timeout <ms>        Give up after this long (default wait for ever)\n");
+    fprintf(stderr, "\t--format <fmt>        human, json, csv or influx (default human)\n");
+}
+
+/*******************************************************************************
+ *  \brief  Main function.
+ *  \return EXIT_SUCCESS once a reading is printed, EXIT_FAILURE on a timeout
+ *          or error.
+ */
+int main
+(
+    int argc,       /*!< - The number of arguments              */
+    char *argv[]    /*!< - The collection of argument strings   */
+)
+{
+    static const struct option long_options[] =
+    {
+        { "latest",     no_argument,        NULL, 'l' },
+        { "follow",     no_argument,        NULL, 'F' },
+        { "timeout",    required_argument,  NULL, 't' },
+        { "format",     required_argument,  NULL, 'f' },
+        { "help",       no_argument,        NULL, 'h' },
+        { NULL,         0,                  NULL, 0   }
+    };
+    OutputFormat format = FORMAT_HUMAN;
+    KdhtReading reading;
+    SensorReport report;
+    unsigned int seq = 0;
+    int latest = 0;
+    int follow = 0;
+    int timeout_ms = -1;
+    int pin;
+    int result;
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "lFt:f:h", long_options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+            case 'l':
+                latest = 1;
+                break;
+
+            case 'F':
+                follow = 1;
+                break;
+
+            case 't':
+                timeout_ms = atoi(optarg);
+                break;
+
+            case 'f':
+                if (!parse_output_format(optarg, &format))
+                {
+                    fprintf(stderr, "Invalid format supplied: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            case 'h':
+                print_usage(argv[0]);
+                exit(EXIT_SUCCESS);
+
+            default:
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+    if (optind + 1 != argc)
+    {
+        print_usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    pin = atoi(argv[optind]);
+
+    /* Start from the reading already there, unless that is what is wanted */
+    if (!latest)
+    {
+        result = kdht_wait_newer(pin, 0, 0, &reading);
+        if (result < 0 && ENOENT != errno)
+        {
+            fprintf(stderr, "No readings for pin %d: %s\n", pin, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        seq = (result > 0) ? reading.seq : 0;
+    }
+
+    do
+    {
+        result = kdht_wait_newer(pin, seq, timeout_ms, &reading);
+        if (result <= 0)
+        {
+            if (result < 0)
+            {
+                fprintf(stderr, "No readings for pin %d: %s\n", pin,
+                    (ENOENT == errno) ? "kdht is not publishing it" : strerror(errno));
+            }
+            exit(EXIT_FAILURE);
+        }
+        seq = reading.seq;
+
+        memset(&report, 0, sizeof(report));
+        report.smoothed.result = RESULT_INVALID;
+        report.pin = reading.pin;
+        report.values = reading.values;
+        report.attempts = reading.attempts;
+        report.timestamp = reading.timestamp;
+        print_report(stdout, format, &report);
+        fflush(stdout);
+    } while (follow);
+
+    return EXIT_SUCCESS;
+}